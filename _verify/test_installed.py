@@ -1,6 +1,6 @@
 """Verifica del wheel INSTALLATO (self-contained): nessun add_dll_directory,
 nessun python/ in sys.path -> importa dal site-packages."""
-import os, sys
+import ctypes, importlib, os, struct, sys, tempfile
 import numpy as np
 
 DATA = sys.argv[1] if len(sys.argv) > 1 else "data"
@@ -25,6 +25,30 @@ def aligned(a, alignment=64):
     return out
 
 
+def clib(QP, *names):
+    """Estensione C del modulo di QP via ctypes, per i controlli sulle funzioni
+    del motore; None se i simboli non sono esportati (es. MSVC)."""
+    mod = QP.__module__
+    ext = importlib.import_module(f"{mod}._{mod.rsplit('.', 1)[1]}")
+    lib = ctypes.CDLL(ext.__file__)
+    return lib if all(hasattr(lib, n) for n in names) else None
+
+
+# Neighbor / Neighbor64 (query.h, query64.h) come dtype NumPy
+NEIGHBOR = {"32": np.dtype([("id", "<i4"), ("approx", "<f4"), ("real", "<f4")], align=True),
+            "64": np.dtype([("id", "<i4"), ("approx", "<f8"), ("real", "<f8")], align=True)}
+
+
+# MatrixF32 / MatrixF64 (matrix.h): vista su un array NumPy contiguo
+class CMatrix(ctypes.Structure):
+    _fields_ = [("n", ctypes.c_uint32), ("d", ctypes.c_uint32),
+                ("data", ctypes.c_void_p), ("map", ctypes.c_void_p)]
+
+
+def cmatrix(a):
+    return CMatrix(a.shape[0], a.shape[1], a.ctypes.data, None)
+
+
 def check(tag, QP, dt, prec):
     DS = aligned(load(os.path.join(DATA, f"dataset_2000x256_{prec}.ds2"), dt))
     Q = aligned(load(os.path.join(DATA, f"query_2000x256_{prec}.ds2"), dt))
@@ -38,9 +62,1199 @@ def check(tag, QP, dt, prec):
     return full == len(gids)
 
 
+def check_exact(tag, QP, dt, prec, nq=200, k=8):
+    """predict_exact() vs forza bruta NumPy (distanze ordinate, float64)."""
+    DS = load(os.path.join(DATA, f"dataset_2000x256_{prec}.ds2"), dt)
+    Q = load(os.path.join(DATA, f"query_2000x256_{prec}.ds2"), dt)[:nq]
+    ids, dst = QP().fit(DS, n_pivots=16, quant_level=64, silent=1).predict_exact(Q, k=k)
+    A, B = Q.astype(np.float64), DS.astype(np.float64)
+    d2 = (A * A).sum(1)[:, None] + (B * B).sum(1)[None, :] - 2.0 * A @ B.T
+    ref = np.sqrt(np.sort(np.maximum(d2, 0.0), axis=1)[:, :k])
+    atol = 1e-3 if prec == "32" else 1e-9
+    ok = bool(np.allclose(np.asarray(dst, np.float64), ref, atol=atol, rtol=0))
+    print(f"[{tag}] predict_exact vs NumPy: {'OK' if ok else 'MISMATCH'}")
+    return ok
+
+
+def check_autotune(tag, QP, dt, prec, n=1000, nq=50, k=8, target=0.5):
+    """autotune(build=True): il predict con (h, x, rerank) scelti raggiunge la recall."""
+    DS = np.ascontiguousarray(load(os.path.join(DATA, f"dataset_2000x256_{prec}.ds2"), dt)[:n])
+    Q = np.ascontiguousarray(load(os.path.join(DATA, f"query_2000x256_{prec}.ds2"), dt)[:nq])
+    qp = QP()
+    cfg = qp.autotune(DS, k=k, recall=target, query=Q, sample_q=nq)
+    ids, _ = qp.predict(Q, k=k)
+    ref, _ = qp.predict_exact(Q, k=k)
+    rec = np.mean([len(set(a) & set(b)) / k for a, b in zip(np.asarray(ids), np.asarray(ref))])
+    ok = bool(cfg["met"] and cfg["built"] and rec >= target)
+    print(f"[{tag}] autotune h={cfg['h']} x={cfg['x']} rerank={cfg['rerank']} "
+          f"recall={rec:.3f}: {'OK' if ok else 'MISMATCH'}")
+    return ok
+
+
+def check_shards(tag, QP, dt, prec, S=4, nq=100, k=8):
+    """fit(shards=S): ogni vicino viene dal top-k del proprio shard (id globali)."""
+    DS = load(os.path.join(DATA, f"dataset_2000x256_{prec}.ds2"), dt)
+    Q = np.ascontiguousarray(load(os.path.join(DATA, f"query_2000x256_{prec}.ds2"), dt)[:nq])
+    ids, dst = QP().fit(DS, n_pivots=16, quant_level=64, silent=1, shards=S).predict(Q, k=k)
+    ids = np.asarray(ids)
+    step = len(DS) // S
+    cand = []
+    for s in range(S):
+        part = np.ascontiguousarray(DS[s * step:(s + 1) * step])
+        sid, _ = QP().fit(part, n_pivots=16, quant_level=64, silent=1).predict(Q, k=k)
+        cand.append(np.asarray(sid) + s * step)
+    cand = np.concatenate(cand, axis=1)
+    real = np.linalg.norm(DS[ids].astype(np.float64) - Q[:, None, :].astype(np.float64), axis=2)
+    atol = 1e-3 if prec == "32" else 1e-9
+    ok = all(len(set(a)) == k and set(a) <= set(c) for a, c in zip(ids, cand))
+    ok = ok and bool(np.allclose(np.asarray(dst, np.float64), real, atol=atol, rtol=0))
+    print(f"[{tag}] shards={S} vs indici per shard: {'OK' if ok else 'MISMATCH'}")
+    return ok
+
+
+def check_threads(tag, QP, dt, prec, nq=300, k=8):
+    """predict(num_threads=...) sul pool persistente: stessi risultati con 1 o 4 thread."""
+    mod = sys.modules[QP.__module__]
+    DS = load(os.path.join(DATA, f"dataset_2000x256_{prec}.ds2"), dt)
+    Q = np.ascontiguousarray(load(os.path.join(DATA, f"query_2000x256_{prec}.ds2"), dt)[:nq])
+    mod.configure_pool(4, spin=True)
+    qp = QP().fit(DS, n_pivots=16, quant_level=64, silent=1, num_threads=4)
+    ids4, d4 = qp.predict(Q, k=k)
+    ids1, d1 = qp.predict(Q, k=k, num_threads=1)
+    mod.configure_pool(0)
+    ok = bool(np.array_equal(ids4, ids1) and np.array_equal(d4, d1))
+    print(f"[{tag}] pool num_threads 4 vs 1: {'OK' if ok else 'MISMATCH'}")
+    return ok
+
+
+def check_async(tag, QP, dt, prec, nq=200, k=8, step=7):
+    """submit(): Future concorrenti da più thread, stessi risultati di predict."""
+    from concurrent.futures import ThreadPoolExecutor
+    DS = load(os.path.join(DATA, f"dataset_2000x256_{prec}.ds2"), dt)
+    Q = np.ascontiguousarray(load(os.path.join(DATA, f"query_2000x256_{prec}.ds2"), dt)[:nq])
+    qp = QP().fit(DS, n_pivots=16, quant_level=64, silent=1)
+    ids, d = qp.predict(Q, k=k)
+    with ThreadPoolExecutor(4) as ex:
+        futs = list(ex.map(lambda s: qp.submit(Q[s:s + step], k=k), range(0, nq, step)))
+    got = [f.result(timeout=60) for f in futs]
+    ok = bool(np.array_equal(np.vstack([g[0] for g in got]), ids) and
+              np.array_equal(np.vstack([g[1] for g in got]), d))
+    print(f"[{tag}] submit {len(futs)} future vs predict: {'OK' if ok else 'MISMATCH'}")
+    return ok
+
+def check_range(tag, QP, dt, prec, nq=50):
+    """range_query(): con r illimitato e filtro r_real coincide con la forza bruta."""
+    DS = load(os.path.join(DATA, f"dataset_2000x256_{prec}.ds2"), dt)
+    Q = np.ascontiguousarray(load(os.path.join(DATA, f"query_2000x256_{prec}.ds2"), dt)[:nq])
+    D2 = np.sqrt(((Q[:, None, :].astype(np.float64) - DS[None, :, :]) ** 2).sum(-1))
+    r_real = float(np.median(np.sort(D2, axis=1)[:, 20]))
+    ok = True
+    for S in (1, 4):
+        qp = QP().fit(DS, n_pivots=16, quant_level=64, silent=1, shards=S)
+        off, ids, d = qp.range_query(Q, 1e9, r_real=r_real)
+        ok &= len(off) == nq + 1 and off[0] == 0 and off[-1] == len(ids)
+        for i in range(nq):
+            got = ids[off[i]:off[i + 1]]
+            # punti a distanza ~r_real: ammessi in entrambi i sensi (arrotondamento)
+            inner = set(np.nonzero(D2[i] <= r_real * (1 - 1e-5))[0])
+            outer = set(np.nonzero(D2[i] <= r_real * (1 + 1e-5))[0])
+            ok &= inner <= set(got) <= outer and bool(np.all(np.diff(got) > 0))
+            ok &= bool(np.allclose(d[off[i]:off[i + 1]], D2[i][got], rtol=1e-4))
+        # raggio approssimato: CSR valido, id crescenti
+        off, ids, _ = qp.range_query(Q, 0.0)
+        ok &= bool(np.all(np.diff(off) >= 0)) and off[-1] == len(ids)
+        ok &= all(bool(np.all(np.diff(ids[off[i]:off[i + 1]]) > 0)) for i in range(nq))
+    print(f"[{tag}] range_query CSR vs forza bruta: {'OK' if ok else 'MISMATCH'}")
+    return ok
+
+
+def check_filtered(tag, QP, dt, prec, nq=100, k=8):
+    """predict_filtered(): k righe ammesse, allow/deny e (N,)/(nq, N) equivalenti."""
+    DS = load(os.path.join(DATA, f"dataset_2000x256_{prec}.ds2"), dt)
+    Q = np.ascontiguousarray(load(os.path.join(DATA, f"query_2000x256_{prec}.ds2"), dt)[:nq])
+    rng = np.random.default_rng(0)
+    ok = True
+    for S in (1, 4):
+        qp = QP().fit(DS, n_pivots=16, quant_level=64, silent=1, shards=S)
+        ids, d = qp.predict(Q, k=k)
+        full = qp.predict_filtered(Q, k, allow=np.ones(len(DS), bool))
+        ok &= bool(np.array_equal(np.sort(full[0], 1), np.sort(ids, 1)))
+        # denso (metà delle righe) e selettivo (< N/16): elenco degli id ammessi
+        for frac in (0.5, 0.02):
+            mask = rng.random(len(DS)) < frac
+            a = qp.predict_filtered(Q, k, allow=mask)
+            b = qp.predict_filtered(Q, k, deny=~mask)
+            c = qp.predict_filtered(Q, k, allow=np.repeat(mask[None], nq, 0))
+            ok &= bool(np.all(mask[a[0]]) and np.all(a[0] >= 0))
+            ok &= bool(np.array_equal(a[0], b[0]) and np.array_equal(a[0], c[0]))
+        # meno di k righe ammesse: slot in eccesso con id -1
+        few = np.zeros(len(DS), bool); few[[3, 500, 1999]] = True
+        e = qp.predict_filtered(Q[:5], k, allow=few)[0]
+        ok &= bool(np.all(np.sort(e, 1)[:, -3:] == [3, 500, 1999]) and np.all((e == -1).sum(1) == k - 3))
+    ok &= check_filter_no_bits(tag, QP, DS, Q, prec, k)
+    print(f"[{tag}] predict_filtered: {'OK' if ok else 'MISMATCH'}")
+    return ok
+
+
+# RowFilter (filter.h)
+class CRowFilter(ctypes.Structure):
+    _fields_ = [("bits", ctypes.c_void_p), ("base", ctypes.c_size_t), ("deny", ctypes.c_int)]
+
+
+def check_filter_no_bits(tag, QP, DS, Q, prec, k, S=4):
+    """knn_query_(sharded_)all_filtered con un filtro condiviso senza bitmap
+    (bits == NULL): nessun filtro, come knn_query_(sharded_)all."""
+    sfx = "_f64" if prec == "64" else ""
+    names = [f + sfx for f in ("knn_query_all_filtered", "knn_query_sharded_all_filtered",
+                               "knn_query_all", "knn_query_sharded_all")]
+    lib = clib(QP, *names)
+    if lib is None:
+        return True
+    filt, sfilt, plain, splain = (getattr(lib, n) for n in names)
+    build, sbuild = getattr(lib, "build_index" + sfx), getattr(lib, "build_sharded_index" + sfx)
+    build.restype = sbuild.restype = ctypes.c_void_p
+    build.argtypes = [ctypes.POINTER(CMatrix), ctypes.c_int, ctypes.c_int]
+    sbuild.argtypes = [ctypes.POINTER(CMatrix), ctypes.c_int, ctypes.c_int, ctypes.c_int]
+    lib.free_index.argtypes = lib.free_sharded_index.argtypes = [ctypes.c_void_p]
+    common = [ctypes.POINTER(CMatrix), ctypes.c_void_p, ctypes.POINTER(CMatrix), ctypes.c_int, ctypes.c_int]
+    plain.argtypes = splain.argtypes = common + [ctypes.c_void_p]
+    filt.argtypes = sfilt.argtypes = common + [ctypes.POINTER(CRowFilter), ctypes.c_size_t, ctypes.c_void_p]
+
+    A, B = np.ascontiguousarray(DS), np.ascontiguousarray(Q)
+    ma, mb, f = cmatrix(A), cmatrix(B), CRowFilter(None, 0, 0)
+    ok = True
+    for make, free, ref_fn, fn in ((lambda: build(ctypes.byref(ma), 16, 64), lib.free_index, plain, filt),
+                                   (lambda: sbuild(ctypes.byref(ma), S, 16, 64), lib.free_sharded_index,
+                                    splain, sfilt)):
+        idx = make()
+        ref = np.zeros((len(B), k), dtype=NEIGHBOR[prec])
+        got = np.zeros_like(ref)
+        ref_fn(ctypes.byref(ma), idx, ctypes.byref(mb), k, 64, ref.ctypes.data)
+        fn(ctypes.byref(ma), idx, ctypes.byref(mb), k, 64, ctypes.byref(f), 1, got.ctypes.data)
+        ok &= bool(np.array_equal(ref, got))
+        free(idx)
+    return ok
+
+
+def check_sorted(tag, QP, dt, prec, nq=200, k=8):
+    """sorted_pivots: range_query identico alla scansione completa, predict valido."""
+    DS = load(os.path.join(DATA, f"dataset_2000x256_{prec}.ds2"), dt)
+    Q = np.ascontiguousarray(load(os.path.join(DATA, f"query_2000x256_{prec}.ds2"), dt)[:nq])
+    base = QP().fit(DS, n_pivots=16, quant_level=64, silent=1)
+    ok = True
+    for cols in (1, 2):
+        qp = QP().fit(DS, n_pivots=16, quant_level=64, silent=1, sorted_pivots=cols)
+        for r in (0.0, 10.0, 20.0):
+            a, b = base.range_query(Q, r), qp.range_query(Q, r)
+            ok &= all(bool(np.array_equal(x, y)) for x, y in zip(a, b))
+        # K-NN: a parità di distanza approssimata l'ordine di visita può cambiare i vicini
+        ids, d = qp.predict(Q, k=k)
+        ok &= bool(np.all((ids >= 0) & (ids < len(DS))))
+        ok &= all(len(set(row)) == k for row in ids)
+    print(f"[{tag}] sorted_pivots: {'OK' if ok else 'MISMATCH'}")
+    return ok
+
+def check_cascade(tag, QP, dt, prec, nq=200, k=8):
+    """pivot_cascade: predict e range_query identici a d* su tutti i pivot."""
+    DS = load(os.path.join(DATA, f"dataset_2000x256_{prec}.ds2"), dt)
+    Q = np.ascontiguousarray(load(os.path.join(DATA, f"query_2000x256_{prec}.ds2"), dt)[:nq])
+    ok = True
+    # h = 80: ordine dei pivot oltre il buffer sullo stack (INDEX_ORDER_STACK)
+    for shards, h in ((1, 32), (4, 32), (1, 80)):
+        base = QP().fit(DS, n_pivots=h, quant_level=64, silent=1, shards=shards)
+        ib, db = base.predict(Q, k=k)
+        for hot in (1, 4, 16):
+            qp = QP().fit(DS, n_pivots=h, quant_level=64, silent=1, shards=shards, pivot_cascade=hot)
+            ids, d = qp.predict(Q, k=k)
+            ok &= bool(np.array_equal(ib, ids)) and bool(np.array_equal(db, d))
+            for r in (0.0, 20.0):
+                a, b = base.range_query(Q, r), qp.range_query(Q, r)
+                ok &= all(bool(np.array_equal(x, y)) for x, y in zip(a, b))
+    try:
+        QP().fit(DS, n_pivots=8, quant_level=64, silent=1, pivot_cascade=9)
+        ok = False
+    except ValueError:
+        pass
+    print(f"[{tag}] pivot_cascade: {'OK' if ok else 'MISMATCH'}")
+    return ok
+
+def check_anytime(tag, QP, dt, prec, nq=200, k=8):
+    """alpha = 1 senza budget identico a predict; max_evals piccolo segnala
+    le query parziali con k vicini validi; alpha > 1 valuta meno righe."""
+    DS = load(os.path.join(DATA, f"dataset_2000x256_{prec}.ds2"), dt)
+    Q = np.ascontiguousarray(load(os.path.join(DATA, f"query_2000x256_{prec}.ds2"), dt)[:nq])
+    qp = QP().fit(DS, n_pivots=16, quant_level=64, silent=1)
+    ib, db = qp.predict(Q, k=k)
+    ia, da, part = qp.predict(Q, k=k, alpha=1.0, return_partial=True)
+    ok = bool(np.array_equal(ia, ib)) and bool(np.array_equal(da, db)) and not part.any()
+    ia, da, part = qp.predict(Q, k=k, max_evals=2 * k, return_partial=True)
+    ok &= part.dtype == np.bool_ and bool(part.all())
+    ok &= bool(np.all((ia >= 0) & (ia < len(DS))))
+    ok &= bool(np.allclose(da, np.linalg.norm(DS[ia] - Q[:, None, :], axis=2), rtol=1e-4))
+    # scadenza già passata: ferma al secondo blocco di righe, k vicini validi
+    ia, da, part = qp.predict(Q, k=k, deadline_ms=1e-6, return_partial=True)
+    ok &= bool(part.all()) and bool(np.all((ia >= 0) & (ia < len(DS))))
+    ia, da = qp.predict(Q, k=k, alpha=2.0, deadline_ms=1000.0)
+    ok &= bool(np.all((ia >= 0) & (ia < len(DS))))
+    try:
+        qp.predict(Q, k=k, alpha=-1.0)
+        ok = False
+    except ValueError:
+        pass
+    print(f"[{tag}] anytime: {'OK' if ok else 'MISMATCH'}")
+    return ok
+
+def check_graph(tag, QP, dt, prec, n=600, k=8):
+    """query_by_id identico a predict sulle stesse righe; knn_graph in CSR
+    con k vicini per riga, senza la riga stessa, per distanza reale crescente."""
+    DS = np.ascontiguousarray(load(os.path.join(DATA, f"dataset_2000x256_{prec}.ds2"), dt)[:n])
+    ok = True
+    for rerank in (1, 3):
+        qp = QP().fit(DS, n_pivots=16, quant_level=64, silent=1, rerank=rerank)
+        rows = np.arange(0, n, 7)
+        ia, da = qp.query_by_id(rows, k=k)
+        ib, db = qp.predict(np.ascontiguousarray(DS[rows]), k=k)
+        ok &= bool(np.array_equal(ia, ib)) and bool(np.array_equal(da, db))
+    off, ids, d = qp.knn_graph(k=k)
+    ok &= len(off) == n + 1 and bool(np.all(np.diff(off) == k))
+    for i in range(n):
+        row, di = ids[off[i]:off[i + 1]], d[off[i]:off[i + 1]]
+        ok &= i not in row and len(set(row)) == k and bool(np.all(np.diff(di) >= 0))
+        ok &= bool(np.allclose(di, np.linalg.norm(DS[row] - DS[i], axis=1), rtol=1e-4))
+    try:
+        QP().fit(DS, n_pivots=16, quant_level=64, silent=1, shards=2).knn_graph(k=k)
+        ok = False
+    except ValueError:
+        pass
+    print(f"[{tag}] query_by_id / knn_graph: {'OK' if ok else 'MISMATCH'}")
+    return ok
+
+def check_ivf(tag, QP, dt, prec, C=16, nq=200, k=8):
+    """ivf_lists: id originali con distanza reale corretta, nprobe = C come nprobe > C."""
+    DS = load(os.path.join(DATA, f"dataset_2000x256_{prec}.ds2"), dt)
+    Q = np.ascontiguousarray(load(os.path.join(DATA, f"query_2000x256_{prec}.ds2"), dt)[:nq])
+    ok = True
+    for nprobe in (1, 4, C):
+        qp = QP().fit(DS, n_pivots=16, quant_level=64, silent=1, ivf_lists=C, nprobe=nprobe)
+        ids, d = qp.predict(Q, k=k)
+        ok &= bool(np.all((ids >= 0) & (ids < len(DS)))) and all(len(set(row)) == k for row in ids)
+        real = np.linalg.norm(DS[ids].astype(np.float64) - Q[:, None, :], axis=2)
+        ok &= bool(np.allclose(real, d, atol=1e-3 if prec == "32" else 1e-9, rtol=0))
+        s = qp.submit(Q, k=k).result(timeout=60)
+        ok &= bool(np.array_equal(s[0], ids) and np.array_equal(s[1], d))
+    full = QP().fit(DS, n_pivots=16, quant_level=64, silent=1, ivf_lists=C, nprobe=10 * C)
+    ok &= bool(np.array_equal(full.predict(Q, k=k)[0], ids))
+    try:
+        qp.range_query(Q, 0.0)
+        ok = False
+    except ValueError:
+        pass
+    print(f"[{tag}] ivf_lists: {'OK' if ok else 'MISMATCH'}")
+    return ok
+
+def check_hnsw(tag, QP, dt, prec, nq=200, k=8):
+    """hnsw_m: candidati ordinati per distanza reale; ef >= N equivale al K-NN esatto."""
+    DS = load(os.path.join(DATA, f"dataset_2000x256_{prec}.ds2"), dt)
+    Q = np.ascontiguousarray(load(os.path.join(DATA, f"query_2000x256_{prec}.ds2"), dt)[:nq])
+    qp = QP().fit(DS, n_pivots=16, quant_level=64, silent=1, hnsw_m=16)
+    ok = True
+    first = qp.predict(Q, k=k, ef=k, num_threads=1)[0]
+    for ef in (k, 64):
+        ids, d = qp.predict(Q, k=k, ef=ef)
+        ok &= bool(np.all((ids >= 0) & (ids < len(DS)))) and all(len(set(row)) == k for row in ids)
+        real = np.linalg.norm(DS[ids].astype(np.float64) - Q[:, None, :], axis=2)
+        ok &= bool(np.allclose(real, d, atol=1e-3 if prec == "32" else 1e-9, rtol=0))
+        ok &= bool(np.all(np.diff(d, axis=1) >= 0))
+    s = qp.submit(Q, k=k).result(timeout=60)
+    ok &= bool(np.array_equal(s[0], qp.predict(Q, k=k)[0]))
+    # fascio ampio quanto il dataset: tutto il grafo (connesso) viene visitato
+    e, _ = qp.predict_exact(Q, k=k)
+    ok &= bool(np.array_equal(qp.predict(Q, k=k, ef=len(DS))[0], e))
+    # slot di ricerca riusati: dopo la visita di tutto il grafo le stesse
+    # query danno lo stesso risultato, con 1 o più thread
+    a = qp.predict(Q, k=k, ef=k, num_threads=1)[0]
+    ok &= bool(np.array_equal(a, first))
+    ok &= all(bool(np.array_equal(a, qp.predict(Q, k=k, ef=k, num_threads=t)[0])) for t in (1, 4))
+    print(f"[{tag}] hnsw_m: {'OK' if ok else 'MISMATCH'}")
+    return ok
+
+
+def check_pq(tag, QP, dt, prec, nq=200, k=8):
+    """pq_m: vicini per distanza reale; re-rank di tutte le righe = K-NN esatto."""
+    DS = load(os.path.join(DATA, f"dataset_2000x256_{prec}.ds2"), dt)
+    Q = np.ascontiguousarray(load(os.path.join(DATA, f"query_2000x256_{prec}.ds2"), dt)[:nq])
+    e, _ = QP().fit(DS, n_pivots=16, quant_level=64, silent=1).predict_exact(Q, k=k)
+    ok = True
+    for bits, opq in ((8, 0), (4, 0), (4, 1)):
+        qp = QP().fit(DS, n_pivots=16, quant_level=64, silent=1, pq_m=32, pq_bits=bits, opq=opq)
+        ids, d = qp.predict(Q, k=k)
+        ok &= bool(np.all((ids >= 0) & (ids < len(DS)))) and all(len(set(row)) == k for row in ids)
+        real = np.linalg.norm(DS[ids].astype(np.float64) - Q[:, None, :], axis=2)
+        ok &= bool(np.allclose(real, d, atol=1e-3 if prec == "32" else 1e-9, rtol=0))
+        ok &= bool(np.all(np.diff(d, axis=1) >= 0))
+        s = qp.submit(Q, k=k).result(timeout=60)
+        ok &= bool(np.array_equal(s[0], ids))
+        full = QP().fit(DS, n_pivots=16, quant_level=64, silent=1, rerank=len(DS) // k,
+                        pq_m=32, pq_bits=bits, opq=opq)
+        ok &= bool(np.array_equal(full.predict(Q, k=k)[0], e))
+    try:
+        qp.range_query(Q, 0.0)
+        ok = False
+    except ValueError:
+        pass
+    print(f"[{tag}] pq_m: {'OK' if ok else 'MISMATCH'}")
+    return ok
+
+
+def check_result_writer(tag, QP, dt, prec):
+    """result_writer_write_blocks + close: rilettura di .npy e .ds2, anche con
+    nq non multiplo del blocco e righe oltre il buffer da 1 MB; scrittura
+    incompleta -> errore e file rimossi."""
+    lib = clib(QP, "result_writer_open", "result_writer_write_blocks")
+    if lib is None:
+        print(f"[{tag}] result_writer: SKIP (simboli C non esportati)")
+        return True
+    BlockFn = ctypes.CFUNCTYPE(None, ctypes.c_void_p, ctypes.c_size_t, ctypes.c_size_t, ctypes.c_void_p)
+    lib.result_writer_open.restype = ctypes.c_void_p
+    lib.result_writer_open.argtypes = [ctypes.c_char_p, ctypes.c_uint32, ctypes.c_uint32, ctypes.c_int]
+    lib.result_writer_write_blocks.argtypes = [ctypes.c_void_p, ctypes.c_size_t, BlockFn, ctypes.c_void_p]
+    lib.result_writer_put.argtypes = [ctypes.c_void_p, ctypes.c_void_p, ctypes.c_size_t]
+    lib.result_writer_put_f64.argtypes = [ctypes.c_void_p, ctypes.c_void_p, ctypes.c_size_t]
+    lib.result_writer_close.argtypes = [ctypes.c_void_p]
+    nb, f64 = NEIGHBOR[prec], int(prec == "64")
+    rng = np.random.default_rng(49)
+    ok = True
+    with tempfile.TemporaryDirectory() as tmp:
+        # (nq, k, blocco): 8192 = RESULT_WRITER_BLOCK dei main
+        for nq, k, block in ((8192 + 37, 50, 8192), (1037, 3, 100), (5, 8, 8192)):
+            ids = rng.integers(0, 1 << 30, size=(nq, k), dtype=np.int32)
+            dst = rng.random((nq, k)).astype(dt)
+
+            def fill(ctx, q0, cnt, res):
+                buf = (ctypes.c_char * (cnt * k * nb.itemsize)).from_address(res)
+                a = np.frombuffer(buf, dtype=nb).reshape(cnt, k)
+                a["id"], a["real"] = ids[q0:q0 + cnt], dst[q0:q0 + cnt]
+
+            for ext in (".npy", ".ds2"):
+                base = os.path.join(tmp, f"knn_{nq}{ext}")
+                w = lib.result_writer_open(base.encode(), nq, k, f64)
+                ok &= w is not None
+                ok &= lib.result_writer_write_blocks(w, block, BlockFn(fill), None) == 0
+                ok &= lib.result_writer_close(w) == 0
+                stem = base[:-len(ext)]
+                if ext == ".npy":
+                    rid, rdst = np.load(stem + "_ids.npy"), np.load(stem + "_dst.npy")
+                else:
+                    rid, rdst = load(stem + "_ids.ds2", np.int32), load(stem + "_dst.ds2", dt)
+                ok &= rid.dtype == np.int32 and rdst.dtype == dt
+                ok &= bool(np.array_equal(rid, ids) and np.array_equal(rdst, dst))
+
+        base = os.path.join(tmp, "short.ds2")
+        w = lib.result_writer_open(base.encode(), 10, 4, f64)
+        rows = np.zeros(5 * 4, dtype=nb)
+        put = lib.result_writer_put_f64 if f64 else lib.result_writer_put
+        ok &= put(w, rows.ctypes.data, 5) == 0
+        ok &= lib.result_writer_close(w) == -1
+        ok &= not os.path.exists(os.path.join(tmp, "short_ids.ds2"))
+        ok &= not os.path.exists(os.path.join(tmp, "short_dst.ds2"))
+    print(f"[{tag}] result_writer: {'OK' if ok else 'MISMATCH'}")
+    return bool(ok)
+
+
+class CacheStats(ctypes.Structure):
+    _fields_ = [("hits", ctypes.c_uint64), ("misses", ctypes.c_uint64),
+                ("evictions", ctypes.c_uint64), ("invalidations", ctypes.c_uint64),
+                ("entries", ctypes.c_size_t), ("capacity", ctypes.c_size_t)]
+
+
+def check_query_cache(tag, QP, dt, prec, n=1000, nq=50, k=8, h=16, x=64):
+    """knn_query_single_cached: le query ripetute sono hit con risultati
+    identici al percorso senza cache; dopo la ricostruzione dell'indice (nuova
+    versione) la stessa cache non restituisce i candidati del vecchio."""
+    sfx = "_f64" if prec == "64" else ""
+    lib = clib(QP, "query_cache_create", "knn_query_single_cached" + sfx)
+    if lib is None:
+        print(f"[{tag}] query_cache: SKIP (simboli C non esportati)")
+        return True
+    build, free_index = getattr(lib, "build_index" + sfx), lib.free_index
+    single, cached = getattr(lib, "knn_query_single" + sfx), getattr(lib, "knn_query_single_cached" + sfx)
+    build.restype = ctypes.c_void_p
+    build.argtypes = [ctypes.POINTER(CMatrix), ctypes.c_int, ctypes.c_int]
+    free_index.argtypes = [ctypes.c_void_p]
+    single.argtypes = [ctypes.POINTER(CMatrix), ctypes.c_void_p, ctypes.c_void_p, ctypes.c_int, ctypes.c_int,
+                       ctypes.c_void_p]
+    cached.argtypes = single.argtypes[:5] + [ctypes.c_void_p, ctypes.c_void_p]
+    lib.query_cache_create.restype = ctypes.c_void_p
+    lib.query_cache_create.argtypes = [ctypes.c_size_t]
+    lib.query_cache_stats.argtypes = [ctypes.c_void_p, ctypes.POINTER(CacheStats)]
+    lib.query_cache_free.argtypes = [ctypes.c_void_p]
+
+    DS = load(os.path.join(DATA, f"dataset_2000x256_{prec}.ds2"), dt)
+    Q = load(os.path.join(DATA, f"query_2000x256_{prec}.ds2"), dt)[:nq]
+    Q2 = np.ascontiguousarray(np.concatenate([Q, Q]))  # seconda passata: tutte hit
+
+    def run(A, idx, cache):
+        m = cmatrix(A)
+        out = np.zeros((len(Q2), k), dtype=NEIGHBOR[prec])
+        for i in range(len(Q2)):
+            if cache:
+                cached(ctypes.byref(m), idx, Q2[i].ctypes.data, k, x, cache, out[i].ctypes.data)
+            else:
+                single(ctypes.byref(m), idx, Q2[i].ctypes.data, k, x, out[i].ctypes.data)
+        return out
+
+    cache = lib.query_cache_create(1024)
+    st = CacheStats()
+    A = np.ascontiguousarray(DS[:n])
+    idx = build(ctypes.byref(cmatrix(A)), h, x)
+    ref, got = run(A, idx, None), run(A, idx, cache)
+    lib.query_cache_stats(cache, ctypes.byref(st))
+    ok = bool(np.array_equal(ref, got)) and st.hits >= nq and st.hits + st.misses == 2 * nq
+    hits = st.hits
+
+    # Nuovo indice su altre righe: codici delle query uguali, versione diversa
+    free_index(idx)
+    B = np.ascontiguousarray(DS[n:2 * n])
+    idx = build(ctypes.byref(cmatrix(B)), h, x)
+    ref2, got2 = run(B, idx, None), run(B, idx, cache)
+    lib.query_cache_stats(cache, ctypes.byref(st))
+    ok &= bool(np.array_equal(ref2, got2)) and not np.array_equal(ref2["id"], ref["id"])
+    ok &= st.invalidations > 0 and st.hits - hits >= nq
+    free_index(idx)
+    lib.query_cache_free(cache)
+    print(f"[{tag}] query_cache: {'OK' if ok else 'MISMATCH'}")
+    return bool(ok)
+
+
+# Index (index.h)
+class CIndex(ctypes.Structure):
+    _fields_ = [("n", ctypes.c_size_t), ("h", ctypes.c_size_t), ("D", ctypes.c_size_t), ("Dp", ctypes.c_size_t),
+                ("bits", ctypes.c_int), ("pivot_ids", ctypes.POINTER(ctypes.c_size_t)),
+                ("vp_all", ctypes.c_void_p), ("vn_all", ctypes.c_void_p),
+                ("vp_piv", ctypes.c_void_p), ("vn_piv", ctypes.c_void_p),
+                ("dist", ctypes.POINTER(ctypes.c_int)),
+                ("arena", ctypes.c_void_p), ("arena_bytes", ctypes.c_size_t), ("arena_kind", ctypes.c_int),
+                ("n_sorted", ctypes.c_int), ("sorted_piv", ctypes.c_int * 2),
+                ("sorted_id", ctypes.POINTER(ctypes.c_uint32)), ("sorted_key", ctypes.POINTER(ctypes.c_int)),
+                ("n_hot", ctypes.c_int), ("hot_piv", ctypes.c_int * 16),
+                ("hot_dist", ctypes.POINTER(ctypes.c_int)), ("piv_center", ctypes.POINTER(ctypes.c_int)),
+                ("version", ctypes.c_uint64)]
+
+
+# IndexReplicas (affinity.h)
+class CIndexReplicas(ctypes.Structure):
+    _fields_ = [("nodes", ctypes.c_int), ("idx", ctypes.POINTER(ctypes.POINTER(CIndex)))]
+
+
+def graded_codes_ref(V, x, bits):
+    """quantize_vector_graded in NumPy: le x componenti di modulo maggiore,
+    per rango, valgono L - j*L//x (L = 2^bits - 1), in v+ o v- per segno."""
+    L = (1 << bits) - 1
+    vp = np.zeros(V.shape, np.uint8)
+    vn = np.zeros(V.shape, np.uint8)
+    for i, v in enumerate(V):
+        for j, c in enumerate(np.argsort(-np.abs(v), kind="stable")[:x]):
+            (vp if v[c] >= 0 else vn)[i, c] = L - j * L // x
+    return vp, vn
+
+
+def check_graded(tag, QP, dt, prec, n=40, h=4, x=30):
+    """Codici a livelli: quantize_vector_graded, graded_distance (kernel SSE2
+    nel modulo a 32 bit, AVX2 in quello a 64) e la tabella dei pivot di
+    build_index_graded uguali al riferimento scalare NumPy."""
+    sfx = "_f64" if prec == "64" else ""
+    lib = clib(QP, "graded_distance", "quantize_vector_graded" + sfx, "build_index_graded" + sfx)
+    if lib is None:
+        print(f"[{tag}] graded: SKIP (simboli C non esportati)")
+        return True
+    gd, ad = lib.graded_distance, lib.approximate_distance
+    gd.argtypes = ad.argtypes = [ctypes.c_void_p] * 4 + [ctypes.c_size_t]
+    quant = getattr(lib, "quantize_vector_graded" + sfx)
+    quant.argtypes = [ctypes.c_void_p, ctypes.c_void_p, ctypes.c_void_p, ctypes.c_size_t, ctypes.c_int, ctypes.c_int]
+    build = getattr(lib, "build_index_graded" + sfx)
+    build.restype = ctypes.POINTER(CIndex)
+    build.argtypes = [ctypes.POINTER(CMatrix), ctypes.c_int, ctypes.c_int, ctypes.c_int]
+    lib.free_index.argtypes = [ctypes.POINTER(CIndex)]
+    rng = np.random.default_rng(44)
+    ok = True
+
+    def dist(a, b):
+        return int(gd(a[0].ctypes.data, a[1].ctypes.data, b[0].ctypes.data, b[1].ctypes.data, a[0].size))
+
+    # Kernel su codici casuali: lunghezze attorno ai passi SIMD (16 / 32 byte)
+    for D in (1, 15, 16, 31, 32, 33, 75, 256):
+        lv = rng.integers(-7, 8, size=(2, D))
+        a = (np.maximum(lv[0], 0).astype(np.uint8), np.maximum(-lv[0], 0).astype(np.uint8))
+        b = (np.maximum(lv[1], 0).astype(np.uint8), np.maximum(-lv[1], 0).astype(np.uint8))
+        ok &= dist(a, b) == int(lv[0] @ lv[1])
+
+    V = np.ascontiguousarray(rng.standard_normal((n, 75)).astype(dt))
+    for bits in (1, 2, 3):
+        rp, rn = graded_codes_ref(V, x, bits)
+        vp, vn = np.empty_like(rp), np.empty_like(rn)
+        for i in range(n):
+            quant(V[i].ctypes.data, vp[i].ctypes.data, vn[i].ctypes.data, V.shape[1], x, bits)
+        ok &= bool(np.array_equal(vp, rp) and np.array_equal(vn, rn))
+        lv = rp.astype(np.int64) - rn.astype(np.int64)
+        ref = lv @ lv.T
+        got = np.array([[dist((vp[i], vn[i]), (vp[j], vn[j])) for j in range(n)] for i in range(n)])
+        ok &= bool(np.array_equal(got, ref))
+        if bits == 1:  # livelli 0/1: coincide con approximate_distance
+            ok &= all(int(ad(vp[i].ctypes.data, vn[i].ctypes.data, vp[j].ctypes.data, vn[j].ctypes.data,
+                             V.shape[1])) == ref[i, j] for i in range(n) for j in range(n))
+
+        idx = build(ctypes.byref(cmatrix(V)), h, x, bits)
+        ix = idx.contents
+        piv = [ix.pivot_ids[c] for c in range(h)]
+        table = np.ctypeslib.as_array(ix.dist, shape=(n * h,)).reshape(n, h)
+        ok &= ix.bits == bits and bool(np.array_equal(table, ref[:, piv]))
+        lib.free_index(idx)
+    print(f"[{tag}] graded: {'OK' if ok else 'MISMATCH'}")
+    return bool(ok)
+
+
+class CQueryCodes(ctypes.Structure):
+    _fields_ = [("nq", ctypes.c_size_t), ("D", ctypes.c_size_t), ("h", ctypes.c_size_t),
+                ("vp", ctypes.c_void_p), ("vn", ctypes.c_void_p), ("dq", ctypes.POINTER(ctypes.c_int))]
+
+
+def check_prepared(tag, QP, dt, prec, n=300, nq=37, D=75, h=12, x=20, k=8):
+    """prepare_queries: codici delle query (coda a zero fino a Dp) e matrice
+    nq x h di index_pivot_distances a blocchi uguali al riferimento scalare
+    NumPy; knn_query_single_prepared identico a knn_query_single.
+    nq = 37 lascia un blocco incompleto (INDEX_PIVOT_BLOCK = 16)."""
+    sfx = "_f64" if prec == "64" else ""
+    lib = clib(QP, "prepare_queries" + sfx, "knn_query_single_prepared" + sfx, "build_index_graded" + sfx)
+    if lib is None:
+        print(f"[{tag}] prepare_queries: SKIP (simboli C non esportati)")
+        return True
+    build = getattr(lib, "build_index_graded" + sfx)
+    build.restype = ctypes.POINTER(CIndex)
+    build.argtypes = [ctypes.POINTER(CMatrix), ctypes.c_int, ctypes.c_int, ctypes.c_int]
+    prep = getattr(lib, "prepare_queries" + sfx)
+    prep.restype = ctypes.POINTER(CQueryCodes)
+    prep.argtypes = [ctypes.POINTER(CIndex), ctypes.POINTER(CMatrix), ctypes.c_int]
+    single = getattr(lib, "knn_query_single" + sfx)
+    single.argtypes = [ctypes.POINTER(CMatrix), ctypes.POINTER(CIndex), ctypes.c_void_p, ctypes.c_int,
+                       ctypes.c_int, ctypes.c_void_p]
+    prepared = getattr(lib, "knn_query_single_prepared" + sfx)
+    prepared.argtypes = [ctypes.POINTER(CMatrix), ctypes.POINTER(CIndex), ctypes.c_void_p,
+                         ctypes.POINTER(CQueryCodes), ctypes.c_size_t, ctypes.c_int, ctypes.c_void_p]
+    lib.free_index.argtypes = [ctypes.POINTER(CIndex)]
+    libc = ctypes.CDLL(None)   # free_query_codes è inline: si liberano i tre array e la struttura
+    libc.free.argtypes = [ctypes.c_void_p]
+    rng = np.random.default_rng(40)
+    DS = np.ascontiguousarray(rng.standard_normal((n, D)).astype(dt))
+    Q = np.ascontiguousarray(rng.standard_normal((nq, D)).astype(dt))
+    ok = True
+    for bits in (1, 2, 3):
+        idx = build(ctypes.byref(cmatrix(DS)), h, x, bits)
+        ix = idx.contents
+        Dp = ix.Dp
+        qcp = prep(idx, ctypes.byref(cmatrix(Q)), x)
+        qc = qcp.contents
+        ok &= qc.nq == nq and qc.D == Dp and qc.h == h
+        vp = np.ctypeslib.as_array((ctypes.c_uint8 * (nq * Dp)).from_address(qc.vp)).reshape(nq, Dp)
+        vn = np.ctypeslib.as_array((ctypes.c_uint8 * (nq * Dp)).from_address(qc.vn)).reshape(nq, Dp)
+        dq = np.ctypeslib.as_array(qc.dq, shape=(nq * h,)).reshape(nq, h)
+        rp, rn = graded_codes_ref(Q, x, bits)
+        ok &= bool(np.array_equal(vp[:, :D], rp) and np.array_equal(vn[:, :D], rn))
+        ok &= not vp[:, D:].any() and not vn[:, D:].any()
+        dp, dn = graded_codes_ref(DS, x, bits)
+        piv = [ix.pivot_ids[c] for c in range(h)]
+        lq = rp.astype(np.int64) - rn.astype(np.int64)
+        ld = dp.astype(np.int64) - dn.astype(np.int64)
+        ok &= bool(np.array_equal(dq, lq @ ld[piv].T))
+
+        for i in range(nq):
+            a, b = np.empty(k, NEIGHBOR[prec]), np.empty(k, NEIGHBOR[prec])
+            single(ctypes.byref(cmatrix(DS)), idx, Q[i].ctypes.data, k, x, a.ctypes.data)
+            prepared(ctypes.byref(cmatrix(DS)), idx, Q[i].ctypes.data, qcp, i, k, b.ctypes.data)
+            ok &= all(bool(np.array_equal(a[f], b[f])) for f in NEIGHBOR[prec].names)
+
+        for ptr in (qc.vp, qc.vn, ctypes.cast(qc.dq, ctypes.c_void_p).value, ctypes.addressof(qc)):
+            libc.free(ptr)
+        lib.free_index(idx)
+    print(f"[{tag}] prepare_queries: {'OK' if ok else 'MISMATCH'}")
+    return bool(ok)
+
+def scan_ref(dist, dq, dapprox, k):
+    """Scansione punto per punto di block_scan: vicino peggiore (il primo a
+    parità), d* = max_j |d(v,p_j) - d(q,p_j)|, pruning se d* >= peggiore.
+    Ritorna id, distanze approssimate e righe scartate."""
+    ids, ap, pruned = [-1] * k, [np.inf] * k, 0
+    for i, d_star in enumerate(np.abs(dist - dq).max(axis=1)):
+        w = int(np.argmax(ap))
+        if d_star >= ap[w]:
+            pruned += 1
+        elif dapprox[i] < ap[w]:
+            ids[w], ap[w] = i, float(dapprox[i])
+    return ids, ap, pruned
+
+
+def check_survivors(tag, QP, dt, prec, n=1000, nq=30, D=75, h=8, x=20, k=8):
+    """block_scan in due passate (sopravvissuti, poi distanze con prefetch):
+    vicini di knn_query_single e righe scartate (perf_scan_read) identici
+    alla scansione punto per punto. n = 1000: l'ultimo blocco di SCAN_BLOCK
+    righe è incompleto."""
+    sfx = "_f64" if prec == "64" else ""
+    lib = clib(QP, "knn_query_single" + sfx, "build_index_graded" + sfx, "perf_scan_read")
+    if lib is None:
+        print(f"[{tag}] survivor pass: SKIP (simboli C non esportati)")
+        return True
+    build = getattr(lib, "build_index_graded" + sfx)
+    build.restype = ctypes.POINTER(CIndex)
+    build.argtypes = [ctypes.POINTER(CMatrix), ctypes.c_int, ctypes.c_int, ctypes.c_int]
+    single = getattr(lib, "knn_query_single" + sfx)
+    single.argtypes = [ctypes.POINTER(CMatrix), ctypes.POINTER(CIndex), ctypes.c_void_p, ctypes.c_int,
+                       ctypes.c_int, ctypes.c_void_p]
+    lib.perf_scan_read.argtypes = [ctypes.POINTER(ctypes.c_uint64)] * 2
+    lib.free_index.argtypes = [ctypes.POINTER(CIndex)]
+    rng = np.random.default_rng(42)
+    DS = np.ascontiguousarray(rng.standard_normal((n, D)).astype(dt))
+    Q = np.ascontiguousarray(rng.standard_normal((nq, D)).astype(dt))
+    ok = True
+    for bits in (1, 3):
+        idx = build(ctypes.byref(cmatrix(DS)), h, x, bits)
+        ix = idx.contents
+        dist = np.ctypeslib.as_array(ix.dist, shape=(n * h,)).reshape(n, h).astype(np.int64)
+        piv = [ix.pivot_ids[c] for c in range(h)]
+        qp, qn = graded_codes_ref(Q, x, bits)
+        dp, dn = graded_codes_ref(DS, x, bits)
+        lq = qp.astype(np.int64) - qn.astype(np.int64)
+        ld = dp.astype(np.int64) - dn.astype(np.int64)
+        dapprox = lq @ ld.T
+        dq = lq @ ld[piv].T
+        s0, p0, s1, p1 = (ctypes.c_uint64() for _ in range(4))
+        for i in range(nq):
+            out = np.empty(k, NEIGHBOR[prec])
+            lib.perf_scan_read(ctypes.byref(s0), ctypes.byref(p0))
+            single(ctypes.byref(cmatrix(DS)), idx, Q[i].ctypes.data, k, x, out.ctypes.data)
+            lib.perf_scan_read(ctypes.byref(s1), ctypes.byref(p1))
+            ids, ap, pruned = scan_ref(dist, dq[i], dapprox[i], k)
+            ok &= list(out["id"]) == ids and list(out["approx"]) == ap
+            ok &= s1.value - s0.value == n and p1.value - p0.value == pruned
+        lib.free_index(idx)
+    print(f"[{tag}] survivor pass: {'OK' if ok else 'MISMATCH'}")
+    return bool(ok)
+
+def check_arena(tag, QP, dt, prec, h=12, D=200, x=20, k=8):
+    """Arena dell'indice con INDEX_PAGES_SMALL e INDEX_PAGES_THP: sei array
+    contigui nell'ordine di index_alloc_arena, ognuno allineato a 64 byte e
+    di dimensione arrotondata, righe di Dp byte con coda a zero; con THP e
+    almeno 2 MB un mmap allineato a 2 MB, sotto i 2 MB l'allocatore di
+    sistema. Codici, distanze e vicini non dipendono dalle pagine."""
+    sfx = "_f64" if prec == "64" else ""
+    lib = clib(QP, "build_index" + sfx, "knn_query_all" + sfx, "index_set_pages", "index_memory_estimate")
+    if lib is None:
+        print(f"[{tag}] arena: SKIP (simboli C non esportati)")
+        return True
+    build, qall = getattr(lib, "build_index" + sfx), getattr(lib, "knn_query_all" + sfx)
+    build.restype = ctypes.POINTER(CIndex)
+    build.argtypes = [ctypes.POINTER(CMatrix), ctypes.c_int, ctypes.c_int]
+    qall.argtypes = [ctypes.POINTER(CMatrix), ctypes.POINTER(CIndex), ctypes.POINTER(CMatrix),
+                     ctypes.c_int, ctypes.c_int, ctypes.c_void_p]
+    lib.index_set_pages.argtypes = [ctypes.c_int]
+    lib.index_memory_bytes.argtypes = [ctypes.POINTER(CIndex)]
+    lib.index_memory_bytes.restype = lib.index_memory_estimate.restype = ctypes.c_size_t
+    lib.index_memory_estimate.argtypes = [ctypes.c_size_t] * 3
+    lib.free_index.argtypes = [ctypes.POINTER(CIndex)]
+    SMALL, THP, HUGE, ALIGN = 0, 1, 2 << 20, 64
+    rnd = lambda b: (b + ALIGN - 1) // ALIGN * ALIGN
+    rng = np.random.default_rng(45)
+    Q = np.ascontiguousarray(rng.standard_normal((50, D)).astype(dt))
+    ok = True
+    # n = 5000: arena oltre i 2 MB; n = 500: sotto, anche con THP
+    for n in (5000, 500):
+        DS = np.ascontiguousarray(rng.standard_normal((n, D)).astype(dt))
+        Dp = (D + 31) // 32 * 32
+        sizes = [rnd(h * 8), rnd(n * Dp), rnd(n * Dp), rnd(h * Dp), rnd(h * Dp), rnd(n * h * 4)]
+        used = sum(sizes)
+        runs = []
+        for pages in (SMALL, THP):
+            lib.index_set_pages(pages)
+            idx = build(ctypes.byref(cmatrix(DS)), h, x)
+            ix = idx.contents
+            base = ix.arena
+            ptrs = [ctypes.addressof(ix.pivot_ids.contents), ix.vp_all, ix.vn_all, ix.vp_piv, ix.vn_piv,
+                    ctypes.addressof(ix.dist.contents)]
+            ok &= ix.Dp == Dp and ptrs[0] == base
+            ok &= [b - a for a, b in zip(ptrs, ptrs[1:])] == sizes[:-1]
+            ok &= all(p % ALIGN == 0 for p in ptrs) and ix.arena_bytes >= used
+            if pages == THP and used >= HUGE:
+                ok &= ix.arena_kind == 1 and base % HUGE == 0
+                ok &= ix.arena_bytes == (used + HUGE - 1) // HUGE * HUGE
+            else:
+                ok &= ix.arena_kind == 0 and ix.arena_bytes == used
+                ok &= lib.index_memory_bytes(idx) == lib.index_memory_estimate(n, h, D)
+            codes = [np.ctypeslib.as_array((ctypes.c_uint8 * (rows * Dp)).from_address(a)).reshape(rows, Dp).copy()
+                     for a, rows in zip(ptrs[1:5], (n, n, h, h))]
+            ok &= all(not c[:, D:].any() for c in codes)
+            piv = [ix.pivot_ids[c] for c in range(h)]
+            ok &= np.array_equal(codes[2], codes[0][piv]) and np.array_equal(codes[3], codes[1][piv])
+            dist = np.ctypeslib.as_array(ix.dist, shape=(n * h,)).copy()
+            out = np.empty((Q.shape[0], k), NEIGHBOR[prec])
+            qall(ctypes.byref(cmatrix(DS)), idx, ctypes.byref(cmatrix(Q)), k, x, out.ctypes.data)
+            runs.append((piv, codes, dist, out))
+            lib.free_index(idx)
+        (p0, c0, d0, o0), (p1, c1, d1, o1) = runs
+        ok &= p0 == p1 and all(np.array_equal(a, b) for a, b in zip(c0, c1)) and np.array_equal(d0, d1)
+        ok &= all(np.array_equal(o0[f], o1[f]) for f in NEIGHBOR[prec].names)
+    lib.index_set_pages(THP)
+    print(f"[{tag}] arena: {'OK' if ok else 'MISMATCH'}")
+    return bool(ok)
+
+def check_replicas(tag, QP, dt, prec, n=3000, h=12, D=200, x=20, k=8):
+    """Repliche NUMA (index_replicate) di un indice con colonne ordinate e
+    cascata: per ogni nodo stessi campi e versione, stessa disposizione
+    dell'arena, parte usata identica byte per byte, stesse colonne ordinate
+    e calde; knn_query_all_replicated uguale a knn_query_all."""
+    sfx = "_f64" if prec == "64" else ""
+    lib = clib(QP, "build_index" + sfx, "knn_query_all" + sfx, "knn_query_all_replicated" + sfx,
+               "index_replicate", "index_sort_pivots", "index_build_cascade")
+    if lib is None:
+        print(f"[{tag}] NUMA replicas: SKIP (simboli C non esportati)")
+        return True
+    build, qall = getattr(lib, "build_index" + sfx), getattr(lib, "knn_query_all" + sfx)
+    qrep = getattr(lib, "knn_query_all_replicated" + sfx)
+    build.restype = ctypes.POINTER(CIndex)
+    build.argtypes = [ctypes.POINTER(CMatrix), ctypes.c_int, ctypes.c_int]
+    qall.argtypes = [ctypes.POINTER(CMatrix), ctypes.POINTER(CIndex), ctypes.POINTER(CMatrix),
+                     ctypes.c_int, ctypes.c_int, ctypes.c_void_p]
+    qrep.argtypes = [ctypes.POINTER(CMatrix), ctypes.POINTER(CIndexReplicas), ctypes.POINTER(CMatrix),
+                     ctypes.c_int, ctypes.c_int, ctypes.c_int, ctypes.c_void_p]
+    lib.index_sort_pivots.argtypes = lib.index_build_cascade.argtypes = [ctypes.POINTER(CIndex), ctypes.c_int]
+    lib.index_replicate.restype = ctypes.POINTER(CIndexReplicas)
+    lib.index_replicate.argtypes = [ctypes.POINTER(CIndex)]
+    lib.free_index_replicas.argtypes = [ctypes.POINTER(CIndexReplicas)]
+    lib.free_index.argtypes = [ctypes.POINTER(CIndex)]
+    rng = np.random.default_rng(46)
+    DS = np.ascontiguousarray(rng.standard_normal((n, D)).astype(dt))
+    Q = np.ascontiguousarray(rng.standard_normal((60, D)).astype(dt))
+    idx = build(ctypes.byref(cmatrix(DS)), h, x)
+    ok = lib.index_sort_pivots(idx, 2) == 0 and lib.index_build_cascade(idx, 4) == 0
+    src = idx.contents
+
+    def raw(addr, size):
+        return ctypes.string_at(addr, size)
+
+    def offsets(ix):
+        return [ctypes.addressof(ix.pivot_ids.contents) - ix.arena, ix.vp_all - ix.arena, ix.vn_all - ix.arena,
+                ix.vp_piv - ix.arena, ix.vn_piv - ix.arena, ctypes.addressof(ix.dist.contents) - ix.arena]
+
+    used = offsets(src)[-1] + n * h * 4
+    ns, nh = src.n_sorted * n, src.n_hot
+    ok &= src.n_sorted == 2 and nh == 4
+    rep = lib.index_replicate(idx)
+    ok &= bool(rep) and rep.contents.nodes >= 1
+    for r in range(rep.contents.nodes if rep else 0):
+        ix = rep.contents.idx[r].contents
+        ok &= ix.arena != src.arena
+        ok &= [getattr(ix, f) for f in ("n", "h", "D", "Dp", "bits", "version", "arena_bytes", "n_sorted", "n_hot")] \
+            == [getattr(src, f) for f in ("n", "h", "D", "Dp", "bits", "version", "arena_bytes", "n_sorted", "n_hot")]
+        ok &= offsets(ix) == offsets(src) and raw(ix.arena, used) == raw(src.arena, used)
+        ok &= list(ix.sorted_piv) == list(src.sorted_piv) and list(ix.hot_piv) == list(src.hot_piv)
+        ok &= raw(ctypes.addressof(ix.sorted_id.contents), ns * 4) == raw(ctypes.addressof(src.sorted_id.contents), ns * 4)
+        ok &= raw(ctypes.addressof(ix.sorted_key.contents), ns * 4) == raw(ctypes.addressof(src.sorted_key.contents), ns * 4)
+        ok &= raw(ctypes.addressof(ix.hot_dist.contents), n * nh * 4) == raw(ctypes.addressof(src.hot_dist.contents), n * nh * 4)
+        ok &= raw(ctypes.addressof(ix.piv_center.contents), h * 4) == raw(ctypes.addressof(src.piv_center.contents), h * 4)
+    ref = np.empty((Q.shape[0], k), NEIGHBOR[prec])
+    got = np.empty_like(ref)
+    qall(ctypes.byref(cmatrix(DS)), idx, ctypes.byref(cmatrix(Q)), k, x, ref.ctypes.data)
+    if rep:
+        qrep(ctypes.byref(cmatrix(DS)), rep, ctypes.byref(cmatrix(Q)), k, x, 1, got.ctypes.data)
+        ok &= all(np.array_equal(ref[f], got[f]) for f in NEIGHBOR[prec].names)
+        lib.free_index_replicas(rep)
+    lib.free_index(idx)
+    print(f"[{tag}] NUMA replicas: {'OK' if ok else 'MISMATCH'}")
+    return bool(ok)
+
+def write_vecs(path, A):
+    """.fvecs/.ivecs/.bvecs: ogni riga preceduta dalla dimensione int32."""
+    n, d = A.shape
+    rows = np.empty((n, 4 + A.itemsize * d), np.uint8)
+    rows[:, :4] = np.frombuffer(np.int32(d).tobytes(), np.uint8)
+    rows[:, 4:] = np.ascontiguousarray(A).view(np.uint8).reshape(n, -1)
+    rows.tofile(path)
+
+
+class quiet_stderr:
+    """Silenzia i messaggi C (fd 2) dei file rifiutati volutamente."""
+    def __enter__(self):
+        sys.stderr.flush()
+        self.fd = os.dup(2)
+        nul = os.open(os.devnull, os.O_WRONLY)
+        os.dup2(nul, 2)
+        os.close(nul)
+
+    def __exit__(self, *exc):
+        os.dup2(self.fd, 2)
+        os.close(self.fd)
+
+
+def check_matrix_formats(tag, QP, dt, prec):
+    """matrix_load_file: .fvecs/.ivecs/.bvecs/.npy/.npz riletti uguali alla
+    sorgente (zero copie per il .npy del tipo della matrice), rilascio con
+    matrix_unmap / free_matrix_*; file troncati o incoerenti rifiutati."""
+    lib = clib(QP, "matrix_load_file", "matrix_format", "matrix_unmap")
+    if lib is None:
+        print(f"[{tag}] matrix_formats: SKIP (simboli C non esportati)")
+        return True
+    lib.matrix_format.argtypes = [ctypes.c_char_p]
+    lib.matrix_load_file.argtypes = [ctypes.c_char_p, ctypes.c_int, ctypes.c_int,
+                                     ctypes.POINTER(ctypes.c_uint32), ctypes.POINTER(ctypes.c_uint32),
+                                     ctypes.POINTER(ctypes.c_void_p), ctypes.POINTER(ctypes.c_void_p)]
+    lib.matrix_unmap.argtypes = [ctypes.c_void_p]
+    T_F32, T_F64, T_I32 = 0, 1, 2  # MatrixType (matrix_formats.h)
+    T = T_F32 if prec == "32" else T_F64
+    frees = {T_F32: lib.free_matrix_f32, T_F64: lib.free_matrix_f64, T_I32: lib.free_matrix_i32}
+    for f in frees.values():
+        f.argtypes = [ctypes.POINTER(CMatrix)]
+    ctype = {T_F32: np.float32, T_F64: np.float64, T_I32: np.int32}
+
+    def load_file(path, t):
+        n, d = ctypes.c_uint32(), ctypes.c_uint32()
+        data, mp = ctypes.c_void_p(), ctypes.c_void_p()
+        p = path.encode()
+        if lib.matrix_load_file(p, lib.matrix_format(p), t, ctypes.byref(n), ctypes.byref(d),
+                                ctypes.byref(data), ctypes.byref(mp)) != 0:
+            return None, None
+        cnt = n.value * d.value
+        buf = (ctypes.c_char * (cnt * np.dtype(ctype[t]).itemsize)).from_address(data.value)
+        out = np.frombuffer(buf, dtype=ctype[t]).reshape(n.value, d.value).copy()
+        if mp.value:
+            lib.matrix_unmap(mp)
+        else:
+            frees[t](ctypes.byref(CMatrix(n.value, d.value, data.value, None)))
+        return out, bool(mp.value)
+
+    rng = np.random.default_rng(50)
+    A = rng.standard_normal((37, 19)).astype(np.float32)
+    I = rng.integers(-1000, 1000, size=(37, 19), dtype=np.int32)
+    U = rng.integers(0, 256, size=(37, 19), dtype=np.uint8)
+    other = np.float64 if dt == np.float32 else np.float32
+    ok = True
+    with tempfile.TemporaryDirectory() as tmp:
+        P = lambda name: os.path.join(tmp, name)
+        write_vecs(P("a.fvecs"), A)
+        write_vecs(P("a.ivecs"), I)
+        write_vecs(P("a.bvecs"), U)
+        np.save(P("a.npy"), A.astype(dt))
+        np.save(P("b.npy"), A.astype(other))
+        np.save(P("u.npy"), U)
+        np.save(P("l.npy"), I.astype(np.int64))
+        np.savez(P("a.npz"), base=A.astype(dt), query=U)
+        # (file, tipo richiesto, atteso, zero copie?)
+        cases = ((P("a.fvecs"), T, A.astype(dt), False),
+                 (P("a.ivecs"), T_I32, I, False),
+                 (P("a.bvecs"), T, U.astype(dt), False),
+                 (P("a.npy"), T, A.astype(dt), True),
+                 (P("b.npy"), T, A.astype(other).astype(dt), False),
+                 (P("u.npy"), T, U.astype(dt), False),
+                 (P("l.npy"), T_I32, I, False),
+                 (P("a.npz"), T, A.astype(dt), None),
+                 (P("a.npz") + ":query", T, U.astype(dt), None))
+        for path, t, want, mapped in cases:
+            got, was_mapped = load_file(path, t)
+            ok &= got is not None and got.dtype == want.dtype and bool(np.array_equal(got, want))
+            ok &= mapped is None or was_mapped == mapped
+
+        # Rifiutati: .fvecs troncato, dimensione di una riga diversa, .npy
+        # troncato, Fortran order, archivio compresso, array assente
+        raw = open(P("a.fvecs"), "rb").read()
+        open(P("trunc.fvecs"), "wb").write(raw[:-3])
+        bad = bytearray(raw)
+        bad[2 * (4 + 4 * 19)] = 18
+        open(P("dim.fvecs"), "wb").write(bytes(bad))
+        raw = open(P("a.npy"), "rb").read()
+        open(P("trunc.npy"), "wb").write(raw[:-5])
+        np.save(P("fort.npy"), np.asfortranarray(A.astype(dt)))
+        np.savez_compressed(P("z.npz"), base=A.astype(dt))
+        with quiet_stderr():
+            for path in ("trunc.fvecs", "dim.fvecs", "trunc.npy", "fort.npy", "z.npz", "a.npz:missing"):
+                ok &= load_file(P(path), T)[0] is None
+    print(f"[{tag}] matrix_formats: {'OK' if ok else 'MISMATCH'}")
+    return bool(ok)
+
+
+
+# ServerRequest / ServerResponse / ServerStats (server.h)
+SERVER_MAGIC = 0x4B505153
+SERVER_HDR = struct.Struct("<IHHIIII")
+
+
+class CServerStats(ctypes.Structure):
+    _fields_ = [("elem_size", ctypes.c_uint32), ("d", ctypes.c_uint32), ("n", ctypes.c_uint64),
+                ("generation", ctypes.c_uint64), ("uptime_s", ctypes.c_double), ("qps", ctypes.c_double),
+                ("qps_recent", ctypes.c_double)] + \
+               [(f, ctypes.c_uint64) for f in ("connections", "requests", "queries", "errors", "tiles",
+                                               "rejected", "scanned", "pruned")] + \
+               [(f, ctypes.c_double) for f in ("prune_rate", "lat_p50_us", "lat_p95_us", "lat_p99_us")] + \
+               [("lat_hist", ctypes.c_uint64 * 32), ("cache_hits", ctypes.c_uint64),
+                ("cache_misses", ctypes.c_uint64)]
+
+
+SERVE_QP = {"quantpivot32": QP32, "quantpivot64": QP64, "quantpivot64omp": QP64OMP}
+
+
+def serve_child(path, tag, prec, h=16, x=64):
+    """Processo figlio di check_server: server_run sul dataset di prova (il
+    loader ricostruisce l'indice a ogni ricarica) fino a SIGTERM."""
+    sfx = "_f64" if prec == "64" else ""
+    lib = clib(SERVE_QP[tag], "server_run")
+    load_m = getattr(lib, "load_matrix_f64" if prec == "64" else "load_matrix_f32")
+    build, create = getattr(lib, "build_index" + sfx), getattr(lib, "async_engine_create" + sfx)
+    backend = getattr(lib, "async_server_backend" + sfx)
+    build.restype = create.restype = ctypes.c_void_p
+    build.argtypes = [ctypes.POINTER(CMatrix), ctypes.c_int, ctypes.c_int]
+    create.argtypes = [ctypes.POINTER(CMatrix), ctypes.c_void_p, ctypes.c_int, ctypes.c_void_p]
+    backend.argtypes = [ctypes.c_void_p, ctypes.POINTER(CMatrix), ctypes.c_void_p, ctypes.c_void_p]
+
+    # AsyncOptions (async_opts.h): coda 1024, tile da 64, 200 us, non bloccante
+    opts = (ctypes.c_int * 6)(1024, 64, 200, 0, 1, 0)
+
+    @ctypes.CFUNCTYPE(ctypes.c_int, ctypes.c_void_p, ctypes.c_void_p)
+    def loader(user, out):
+        m = CMatrix()
+        if load_m(os.path.join(DATA, f"dataset_2000x256_{prec}.ds2").encode(), ctypes.byref(m)) != 0:
+            return -1
+        idx = build(ctypes.byref(m), h, x)
+        eng = create(ctypes.byref(m), idx, x, opts)
+        return backend(eng, ctypes.byref(m), idx, out)
+
+    lib.server_run.argtypes = [ctypes.c_char_p, ctypes.c_void_p, ctypes.c_void_p, ctypes.c_void_p]
+    return lib.server_run(path.encode(), loader, None, None)
+
+
+def check_server(tag, QP, dt, prec, h=16, x=64):
+    """Modalità server (-L) sul protocollo binario: handshake (stats con
+    dimensioni del dataset), query identiche a knn_query_all anche in
+    pipeline, ricarica, risposte di errore, statistiche e un client che non
+    legge le risposte senza bloccare gli altri."""
+    import socket, subprocess, time
+    sfx = "_f64" if prec == "64" else ""
+    lib = clib(QP, "server_run", "async_server_backend" + sfx, "knn_query_all" + sfx)
+    if lib is None or not hasattr(socket, "AF_UNIX") or os.name == "nt":
+        print(f"[{tag}] server: SKIP (socket Unix o simboli C non disponibili)")
+        return True
+    build, qall = getattr(lib, "build_index" + sfx), getattr(lib, "knn_query_all" + sfx)
+    build.restype = ctypes.c_void_p
+    build.argtypes = [ctypes.POINTER(CMatrix), ctypes.c_int, ctypes.c_int]
+    qall.argtypes = [ctypes.POINTER(CMatrix), ctypes.c_void_p, ctypes.POINTER(CMatrix), ctypes.c_int,
+                     ctypes.c_int, ctypes.c_void_p]
+    lib.free_index.argtypes = [ctypes.c_void_p]
+
+    DS = aligned(load(os.path.join(DATA, f"dataset_2000x256_{prec}.ds2"), dt))
+    Q = aligned(load(os.path.join(DATA, f"query_2000x256_{prec}.ds2"), dt))
+    n, d = DS.shape
+    elem = DS.itemsize
+    idx = build(ctypes.byref(cmatrix(DS)), h, x)
+
+    def reference(A, k):
+        out = np.zeros((len(A), k), dtype=NEIGHBOR[prec])
+        qall(ctypes.byref(cmatrix(DS)), idx, ctypes.byref(cmatrix(A)), k, x, out.ctypes.data)
+        return out["id"], out["real"].astype(dt)
+
+    def request(sock, op, rid, nq=0, k=0, dd=0, payload=b"", flags=0, magic=SERVER_MAGIC):
+        sock.sendall(SERVER_HDR.pack(magic, op, flags, rid, nq, k, dd) + payload)
+
+    def recv_all(sock, size):
+        buf = b""
+        while len(buf) < size:
+            part = sock.recv(size - len(buf))
+            if not part:
+                raise EOFError
+            buf += part
+        return buf
+
+    def response(sock):
+        magic, op, status, rid, nq, k, size = SERVER_HDR.unpack(recv_all(sock, SERVER_HDR.size))
+        return (magic, op, status, rid, nq, k), recv_all(sock, size)
+
+    def knn_reply(body, nq, k):
+        ids = np.frombuffer(body[:nq * k * 4], np.int32).reshape(nq, k)
+        return ids, np.frombuffer(body[nq * k * 4:], dt).reshape(nq, k)
+
+    def stats(sock, rid=0):
+        request(sock, 2, rid)
+        hdr, body = response(sock)
+        return CServerStats.from_buffer_copy(body) if hdr[2] == 0 else None
+
+    tmp = tempfile.mkdtemp()
+    path = os.path.join(tmp, "knn.sock")
+    child = subprocess.Popen([sys.executable, os.path.abspath(__file__), DATA, "--serve", path, tag, prec],
+                             stdout=subprocess.DEVNULL)
+    ok = True
+    try:
+        for _ in range(300):
+            if os.path.exists(path) or child.poll() is not None:
+                break
+            time.sleep(0.1)
+        a = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        a.settimeout(30)
+        a.connect(path)
+
+        # Handshake: il server descrive il dataset servito
+        st = stats(a)
+        ok &= st is not None and (st.elem_size, st.d, st.n, st.generation) == (elem, d, n, 0)
+
+        # Query in pipeline: le risposte si abbinano per id
+        blocks = {10 + i: (Q[i * 25:(i + 1) * 25], 8) for i in range(4)}
+        blocks[20] = (Q[100:105], 200)
+        for rid, (A, k) in blocks.items():
+            request(a, 1, rid, len(A), k, d, A.tobytes())
+        for _ in blocks:
+            (magic, op, status, rid, nq, k), body = response(a)
+            A, kk = blocks[rid]
+            ref_ids, ref_d = reference(A, kk)
+            ids, dist = knn_reply(body, nq, k)
+            ok &= magic == SERVER_MAGIC and op == 1 and status == 0 and (nq, k) == (len(A), kk)
+            ok &= bool(np.array_equal(ids, ref_ids) and np.array_equal(dist, ref_d))
+
+        # Errori: la connessione resta utilizzabile
+        one = Q[:1].tobytes()
+        bad = [dict(op=1, nq=1, k=8, dd=d + 1, payload=np.zeros(d + 1, dt).tobytes()),   # d diverso
+               dict(op=1, nq=1, k=0, dd=d, payload=one),                                  # k = 0
+               dict(op=1, nq=1, k=n + 1, dd=d, payload=one),                              # k > n
+               dict(op=1, nq=1, k=8, dd=d, payload=one, flags=1),                         # bit riservati
+               dict(op=2, flags=0x8000),
+               dict(op=9),                                                                # op ignota
+               dict(op=1, nq=4200, k=n, dd=d, payload=np.resize(Q, (4200, d)).tobytes())]  # risposta > 64 MB
+        for i, kw in enumerate(bad):
+            request(a, rid=100 + i, **kw)
+            hdr, body = response(a)
+            ok &= hdr[2] == 1 and hdr[3] == 100 + i and body == b""
+        request(a, 1, 200, 2, 8, d, Q[:2].tobytes())
+        hdr, body = response(a)
+        ok &= hdr[2] == 0 and bool(np.array_equal(knn_reply(body, 2, 8)[0], reference(Q[:2], 8)[0]))
+
+        # Magic errato: risposta di errore, poi il server chiude la connessione
+        c = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        c.settimeout(30)
+        c.connect(path)
+        request(c, 1, 7, magic=0x12345678)
+        hdr, _ = response(c)
+        try:
+            closed = c.recv(1) == b""
+        except OSError:
+            closed = True
+        ok &= hdr[2] == 1 and closed
+        c.close()
+
+        # Client lento: risposte per alcuni MB lasciate nel socket; un altro
+        # client deve comunque ricevere subito le proprie
+        slow = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        slow.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 4096)
+        slow.settimeout(30)
+        slow.connect(path)
+        S = Q[:10]
+        for i in range(150):
+            request(slow, 1, 1000 + i, len(S), 200, d, S.tobytes())
+        time.sleep(0.5)
+        t0 = time.time()
+        request(a, 1, 300, 2, 8, d, Q[:2].tobytes())
+        hdr, body = response(a)
+        fast = time.time() - t0
+        ok &= hdr[2] == 0 and hdr[3] == 300 and fast < 2.0
+        ref_ids, ref_d = reference(S, 200)
+        seen = set()
+        for _ in range(150):
+            hdr, body = response(slow)
+            ids, dist = knn_reply(body, hdr[4], hdr[5])
+            seen.add(hdr[3])
+            ok &= hdr[2] == 0 and bool(np.array_equal(ids, ref_ids) and np.array_equal(dist, ref_d))
+        ok &= seen == set(range(1000, 1150))
+        slow.close()
+
+        # Ricarica: nuova generazione, stesse risposte
+        request(a, 3, 400)
+        hdr, _ = response(a)
+        ok &= hdr[2] == 0
+        for _ in range(300):
+            st = stats(a)
+            if st.generation >= 1:
+                break
+            time.sleep(0.1)
+        ok &= st.generation == 1
+        request(a, 1, 401, 25, 8, d, Q[:25].tobytes())
+        hdr, body = response(a)
+        ids, dist = knn_reply(body, 25, 8)
+        ref_ids, ref_d = reference(Q[:25], 8)
+        ok &= hdr[2] == 0 and bool(np.array_equal(ids, ref_ids) and np.array_equal(dist, ref_d))
+
+        # Statistiche: richieste riuscite e risposte di errore contate
+        st = stats(a)
+        ok &= st.requests >= len(blocks) + 153 and st.queries >= 1500 + 127 and st.errors >= len(bad) + 1
+        ok &= st.connections >= 1 and st.lat_p50_us > 0 and st.qps > 0
+        a.close()
+
+        # Arresto: SIGTERM completa le richieste, rimuove il socket ed esce con 0
+        child.terminate()
+        ok &= child.wait(timeout=60) == 0 and not os.path.exists(path)
+    except (OSError, EOFError, struct.error) as e:
+        print(f"[{tag}] server: errore {e!r}")
+        ok = False
+    finally:
+        if child.poll() is None:
+            child.kill()
+            child.wait()
+        lib.free_index(idx)
+    print(f"[{tag}] server: {'OK' if ok else 'MISMATCH'}")
+    return bool(ok)
+
+
+if sys.argv[2:3] == ["--serve"]:
+    sys.exit(serve_child(*sys.argv[3:6]))
+
 print("import OK da:", QP32.__module__)
 ok = check("quantpivot32", QP32, np.float32, "32")
 ok &= check("quantpivot64", QP64, np.float64, "64")
 ok &= check("quantpivot64omp", QP64OMP, np.float64, "64")
+ok &= check_exact("quantpivot32", QP32, np.float32, "32")
+ok &= check_exact("quantpivot64omp", QP64OMP, np.float64, "64")
+ok &= check_autotune("quantpivot32", QP32, np.float32, "32")
+ok &= check_autotune("quantpivot64omp", QP64OMP, np.float64, "64")
+ok &= check_shards("quantpivot32", QP32, np.float32, "32")
+ok &= check_shards("quantpivot64omp", QP64OMP, np.float64, "64")
+ok &= check_threads("quantpivot32", QP32, np.float32, "32")
+ok &= check_threads("quantpivot64omp", QP64OMP, np.float64, "64")
+ok &= check_async("quantpivot32", QP32, np.float32, "32")
+ok &= check_async("quantpivot64omp", QP64OMP, np.float64, "64")
+ok &= check_range("quantpivot32", QP32, np.float32, "32")
+ok &= check_range("quantpivot64omp", QP64OMP, np.float64, "64")
+ok &= check_filtered("quantpivot32", QP32, np.float32, "32")
+ok &= check_filtered("quantpivot64omp", QP64OMP, np.float64, "64")
+ok &= check_sorted("quantpivot32", QP32, np.float32, "32")
+ok &= check_sorted("quantpivot64omp", QP64OMP, np.float64, "64")
+ok &= check_cascade("quantpivot32", QP32, np.float32, "32")
+ok &= check_cascade("quantpivot64omp", QP64OMP, np.float64, "64")
+ok &= check_graph("quantpivot32", QP32, np.float32, "32")
+ok &= check_graph("quantpivot64omp", QP64OMP, np.float64, "64")
+ok &= check_anytime("quantpivot32", QP32, np.float32, "32")
+ok &= check_anytime("quantpivot64omp", QP64OMP, np.float64, "64")
+ok &= check_ivf("quantpivot32", QP32, np.float32, "32")
+ok &= check_ivf("quantpivot64omp", QP64OMP, np.float64, "64")
+ok &= check_hnsw("quantpivot32", QP32, np.float32, "32")
+ok &= check_hnsw("quantpivot64omp", QP64OMP, np.float64, "64")
+ok &= check_pq("quantpivot32", QP32, np.float32, "32")
+ok &= check_pq("quantpivot64omp", QP64OMP, np.float64, "64")
+ok &= check_graded("quantpivot32", QP32, np.float32, "32")
+ok &= check_graded("quantpivot64", QP64, np.float64, "64")
+ok &= check_prepared("quantpivot32", QP32, np.float32, "32")
+ok &= check_prepared("quantpivot64omp", QP64OMP, np.float64, "64")
+ok &= check_survivors("quantpivot32", QP32, np.float32, "32")
+ok &= check_survivors("quantpivot64omp", QP64OMP, np.float64, "64")
+ok &= check_arena("quantpivot32", QP32, np.float32, "32")
+ok &= check_arena("quantpivot64omp", QP64OMP, np.float64, "64")
+ok &= check_replicas("quantpivot32", QP32, np.float32, "32")
+ok &= check_replicas("quantpivot64omp", QP64OMP, np.float64, "64")
+ok &= check_query_cache("quantpivot32", QP32, np.float32, "32")
+ok &= check_query_cache("quantpivot64", QP64, np.float64, "64")
+ok &= check_result_writer("quantpivot32", QP32, np.float32, "32")
+ok &= check_result_writer("quantpivot64", QP64, np.float64, "64")
+ok &= check_matrix_formats("quantpivot32", QP32, np.float32, "32")
+ok &= check_matrix_formats("quantpivot64", QP64, np.float64, "64")
+ok &= check_server("quantpivot32", QP32, np.float32, "32")
+ok &= check_server("quantpivot64omp", QP64OMP, np.float64, "64")
 print("\nWHEEL INSTALLATO:", "TUTTO CORRETTO" if ok else "MISMATCH")
 sys.exit(0 if ok else 1)
@@ -0,0 +1,52 @@
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+#include <stddef.h>
+#include "index.h"
+
+// Pinning dei thread di query (vedi affinity_pin_threads)
+typedef enum {
+    PIN_NONE = 0,   // nessun vincolo: decide lo scheduler
+    PIN_COMPACT,    // thread t -> t-esima CPU, riempiendo un nodo NUMA alla volta
+    PIN_SCATTER     // thread t -> nodo t % nodi, a rotazione fra i socket
+} PinPolicy;
+
+// Collocazione in memoria dell'indice
+typedef enum {
+    PLACE_DEFAULT = 0,  // first-touch (il thread di build_index)
+    PLACE_INTERLEAVE,   // pagine distribuite a rotazione su tutti i nodi
+    PLACE_REPLICA       // una copia per nodo, ogni thread legge la sua
+} PlacePolicy;
+
+// Una replica dell'indice per nodo NUMA (idx[nodo]); le query la scelgono
+// con index_replica_local() in base alla CPU su cui gira il thread.
+typedef struct {
+    int     nodes;
+    Index **idx;
+} IndexReplicas;
+
+// Topologia (da /sys/devices/system/node, 1 nodo fuori da Linux).
+// La prima chiamata legge la topologia: va fatta fuori dalle regioni parallele
+// (lo fanno già affinity_pin_threads e index_replicate).
+int affinity_nodes(void);
+int affinity_current_node(void);
+
+// Fissa i primi `threads` thread OpenMP secondo la politica; i team
+// successivi con lo stesso numero di thread riusano gli stessi thread.
+// Ritorna i thread fissati (0 se non supportato).
+int affinity_pin_threads(int threads, PinPolicy policy);
+
+// Sposta le pagine già scritte dell'indice in interleave su tutti i nodi.
+// Ritorna 0, -1 se mbind non è disponibile (l'indice resta valido).
+int index_interleave(Index *idx);
+
+// Copia profonda dell'indice su ogni nodo (memoria: nodi x index_memory_bytes)
+IndexReplicas *index_replicate(const Index *idx);
+const Index *index_replica_local(const IndexReplicas *rep);
+void free_index_replicas(IndexReplicas *rep);
+
+// Politica dai nomi usati nei parametri CLI; -1 se il nome non è valido
+int pin_policy_from_name(const char *name);    // "none", "compact", "scatter"
+int place_policy_from_name(const char *name);  // "default", "interleave", "replica"
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef ASYNC_H
+#define ASYNC_H
+
+#include <stddef.h>
+#include "matrix.h"
+#include "index.h"
+#include "query.h"
+#include "async_opts.h"
+#include "server.h"
+
+// Sottomissione asincrona di query (32 bit; 64 bit in async64.h).
+//
+// async_submit copia le query in una coda limitata e ritorna subito un
+// handle. Un thread del motore raccoglie le richieste arrivate insieme in
+// un tile di al più max_batch query (aspettando al massimo max_wait_us che
+// il tile si riempia) e lo esegue sul pool condiviso (pool.h). Il
+// completamento si osserva con la callback o con async_poll/async_wait.
+// Su Windows il motore è sincrono: async_submit esegue la richiesta subito.
+
+typedef struct AsyncEngine  AsyncEngine;
+typedef struct AsyncRequest AsyncRequest;
+
+// Chiamata dal thread del motore a richiesta completata. Può chiamare
+// async_release sulla richiesta, ma non deve sottomettere e attendere
+// altre richieste sullo stesso motore.
+typedef void (*AsyncCallback)(AsyncRequest *req, void *user);
+
+// ds e idx devono restare validi fino a async_engine_destroy
+AsyncEngine *async_engine_create(const MatrixF32 *ds, const Index *idx, int x, const AsyncOptions *opt);
+// Esegue le richieste ancora in coda, poi ferma il thread del motore
+void async_engine_destroy(AsyncEngine *eng);
+void async_engine_stats(AsyncEngine *eng, AsyncStats *out);
+
+// queries: nq x D (copiate). Ritorna 0 e *out (se out != NULL), ASYNC_FULL
+// con coda piena in modalità nonblocking, -1 su errore
+int async_submit(AsyncEngine *eng, const float *queries, size_t nq, int k,
+                 AsyncCallback cb, void *user, AsyncRequest **out);
+
+int  async_poll(const AsyncRequest *req);          // 1 completata, 0 in corso
+void async_wait(AsyncRequest *req);
+// nq x k vicini (come knn_query_all), valido dopo il completamento
+const Neighbor *async_results(const AsyncRequest *req, size_t *nq, int *k);
+// Rilascia l'handle del chiamante (la memoria è liberata a richiesta completata)
+void async_release(AsyncRequest *req);
+
+// Motore per server_run (server.h) sopra eng. Prende possesso di eng, idx e
+// dei dati di ds (liberati dalla close del backend). 0, -1 su errore.
+int async_server_backend(AsyncEngine *eng, MatrixF32 *ds, Index *idx, ServerBackend *out);
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef ASYNC64_H
+#define ASYNC64_H
+
+#include <stddef.h>
+#include "matrix.h"
+#include "index.h"
+#include "query64.h"
+#include "async_opts.h"
+#include "server.h"
+
+// Sottomissione asincrona di query, versione 64 bit di async.h.
+//
+// async_submit_f64 copia le query in una coda limitata e ritorna subito un
+// handle. Un thread del motore raccoglie le richieste arrivate insieme in
+// un tile di al più max_batch query (aspettando al massimo max_wait_us che
+// il tile si riempia) e lo esegue sul pool condiviso (pool.h). Il
+// completamento si osserva con la callback o con
+// async_poll_f64/async_wait_f64.
+// Su Windows il motore è sincrono: async_submit_f64 esegue la richiesta subito.
+
+typedef struct AsyncEngine64  AsyncEngine64;
+typedef struct AsyncRequest64 AsyncRequest64;
+
+// Chiamata dal thread del motore a richiesta completata. Può chiamare
+// async_release_f64 sulla richiesta, ma non deve sottomettere e attendere
+// altre richieste sullo stesso motore.
+typedef void (*AsyncCallback64)(AsyncRequest64 *req, void *user);
+
+// ds e idx devono restare validi fino a async_engine_destroy_f64
+AsyncEngine64 *async_engine_create_f64(const MatrixF64 *ds, const Index *idx, int x, const AsyncOptions *opt);
+// Esegue le richieste ancora in coda, poi ferma il thread del motore
+void async_engine_destroy_f64(AsyncEngine64 *eng);
+void async_engine_stats_f64(AsyncEngine64 *eng, AsyncStats *out);
+
+// queries: nq x D (copiate). Ritorna 0 e *out (se out != NULL), ASYNC_FULL
+// con coda piena in modalità nonblocking, -1 su errore
+int async_submit_f64(AsyncEngine64 *eng, const double *queries, size_t nq, int k,
+                     AsyncCallback64 cb, void *user, AsyncRequest64 **out);
+
+int  async_poll_f64(const AsyncRequest64 *req);    // 1 completata, 0 in corso
+void async_wait_f64(AsyncRequest64 *req);
+// nq x k vicini (come knn_query_all_f64), valido dopo il completamento
+const Neighbor64 *async_results_f64(const AsyncRequest64 *req, size_t *nq, int *k);
+// Rilascia l'handle del chiamante (la memoria è liberata a richiesta completata)
+void async_release_f64(AsyncRequest64 *req);
+
+// Motore per server_run (server.h) sopra eng. Prende possesso di eng, idx e
+// dei dati di ds (liberati dalla close del backend). 0, -1 su errore.
+int async_server_backend_f64(AsyncEngine64 *eng, MatrixF64 *ds, Index *idx, ServerBackend *out);
+
+#endif
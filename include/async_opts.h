@@ -0,0 +1,39 @@
+#ifndef ASYNC_OPTS_H
+#define ASYNC_OPTS_H
+
+#include <stdint.h>
+#include <string.h>
+
+// Opzioni e contatori del motore asincrono.
+// Comune a 32 e 64 bit: async.h e async64.h la includono entrambi.
+typedef struct {
+    int queue_cap;     // richieste in coda al massimo (default 1024)
+    int max_batch;     // query per tile (default 64)
+    int max_wait_us;   // attesa per completare un tile (default 200, 0 = nessuna)
+    int num_threads;   // thread del pool per tile (0 = tutti)
+    int nonblocking;   // coda piena: 1 -> ASYNC_FULL subito, 0 -> attende
+    int cache_entries; // cache dei candidati per codice di query (0 = nessuna)
+} AsyncOptions;
+
+// Contatori cumulativi del motore
+typedef struct {
+    uint64_t submitted;    // richieste accettate
+    uint64_t completed;    // richieste completate
+    uint64_t queries;      // query eseguite
+    uint64_t tiles;        // tile eseguiti
+    uint64_t rejected;     // richieste respinte a coda piena
+    uint64_t cache_hits;   // query servite dalla cache (cache_entries > 0)
+    uint64_t cache_misses;
+} AsyncStats;
+
+#define ASYNC_FULL 1       // valore di ritorno di async_submit a coda piena
+
+static inline void async_default_options(AsyncOptions *opt)
+{
+    memset(opt, 0, sizeof(*opt));
+    opt->queue_cap   = 1024;
+    opt->max_batch   = 64;
+    opt->max_wait_us = 200;
+}
+
+#endif
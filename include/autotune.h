@@ -0,0 +1,54 @@
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+
+#include <stddef.h>
+#include <string.h>
+#include "matrix.h"
+#include "index.h"
+
+// Opzioni della ricerca automatica di (h, x, r).
+// Le griglie NULL usano i valori di default (vedi autotune.c).
+typedef struct {
+    int        k;              // vicini richiesti
+    double     target_recall;  // recall@k richiesta sul campione (0..1)
+    size_t     mem_budget;     // byte massimi dell'indice sul dataset COMPLETO (0 = nessun limite)
+    int        sample_n;       // righe del dataset nel campione (0 = tutte)
+    int        sample_q;       // query nel campione (0 = default)
+    unsigned   seed;           // seme del campionamento
+    const int *h_grid; int nh; // pivot candidati
+    const int *x_grid; int nx; // livelli di quantizzazione candidati
+    const int *r_grid; int nr; // fattori di re-rank (k*r candidati), crescenti
+    int        bits;           // livelli dei codici (build_index_graded), 0/1 = ternari
+    int        verbose;        // stampa ogni configurazione provata
+} TuneOptions;
+
+// Configurazione scelta (o la migliore trovata se la recall non è raggiunta)
+typedef struct {
+    int    h, x, r;
+    double recall;             // recall@k sul campione
+    double query_us;           // tempo medio per query sul campione (microsecondi)
+    size_t index_bytes;        // stima sul dataset completo
+    int    met;                // 1 se recall e memoria sono rispettate
+    int    evaluated;          // configurazioni (h, x, r) misurate
+} TuneResult;
+
+// Valori di default (k = 8, recall 0.9, campione 5000 x 200).
+// Inline: serve sia ai target 32 bit sia a quelli 64 bit (autotune64.h).
+static inline void tune_default_options(TuneOptions *opt)
+{
+    memset(opt, 0, sizeof(*opt));
+    opt->k             = 8;
+    opt->target_recall = 0.9;
+    opt->sample_n      = 5000;
+    opt->sample_q      = 200;
+    opt->seed          = 12345u;
+}
+
+// queries == NULL: le query del campione sono estratte dal dataset (righe
+// escluse dal campione, quando possibile). Se out_index != NULL e la ricerca
+// ha successo, costruisce l'indice finale sul dataset completo.
+// Ritorna 0 se il target è raggiunto, 1 se non è raggiungibile, -1 su errore.
+int autotune(const MatrixF32 *ds, const MatrixF32 *queries,
+             const TuneOptions *opt, TuneResult *best, Index **out_index);
+
+#endif
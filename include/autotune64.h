@@ -0,0 +1,10 @@
+#ifndef AUTOTUNE64_H
+#define AUTOTUNE64_H
+
+#include "autotune.h"
+
+// Versione float64 di autotune() (stesse opzioni e stesso risultato)
+int autotune_f64(const MatrixF64 *ds, const MatrixF64 *queries,
+                 const TuneOptions *opt, TuneResult *best, Index **out_index);
+
+#endif
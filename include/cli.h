@@ -0,0 +1,27 @@
+#ifndef CLI_H
+#define CLI_H
+
+#include "config.h"
+#include "matrix.h"
+#include "query.h"
+
+// Modalità della riga di comando condivise dagli eseguibili a 32 bit
+// (main.c, main32ASSEMBLY.c); cli64.h è la versione a 64 bit. Il main
+// resta responsabile di banner, parsing, caricamento e confronto con i
+// golden. Tutti i tempi sono misurati con query_now_s (orologio monotono).
+
+// Server su socket Unix (-L): il dataset è riletto a ogni ricarica
+int cli_run_server(const Config *cfg);
+
+// Modalità senza indice a pivot unico: -e, -A, -S, -I, -p, -G.
+// Ritorna l'exit code della modalità eseguita, -1 se cfg non ne chiede una.
+int cli_run_mode(const MatrixF32 *ds, const MatrixF32 *qs, const Config *cfg);
+
+// Indice a pivot con le opzioni di cfg (-P, -C, -c, -N, -B, -t, -Q, -a, -m,
+// -T, -r): build e query su tutte le query. Con -o i risultati vanno su file
+// e *results resta NULL, altrimenti *results (nq x k) è da liberare con free.
+// cfg->threads torna 0 se il pool non si crea. Ritorna 0 o 1 su errore.
+int cli_run_index(const MatrixF32 *ds, const MatrixF32 *qs, Config *cfg,
+                  Neighbor **results, double *build_ms, double *query_ms);
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef CLI64_H
+#define CLI64_H
+
+#include "config.h"
+#include "matrix.h"
+#include "query64.h"
+
+// Modalità della riga di comando, versione 64 bit di cli.h (main64.c,
+// main64ASSEMBLY.c). Stessa implementazione di cli.c, compilata in cli64.c.
+
+int cli_run_server_f64(const Config *cfg);
+
+// -1 se cfg non chiede -e, -A, -S, -I, -p o -G
+int cli_run_mode_f64(const MatrixF64 *ds, const MatrixF64 *qs, const Config *cfg);
+
+int cli_run_index_f64(const MatrixF64 *ds, const MatrixF64 *qs, Config *cfg,
+                      Neighbor64 **results, double *build_ms, double *query_ms);
+
+#endif
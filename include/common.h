@@ -31,12 +31,31 @@ typedef struct {
     int     x;         // parametro di quantizzazione
     int     N;         // righe del dataset
     int     D;         // colonne/feature
-    void   *index;     // indice costruito (Index*)
+    void   *index;     // indice costruito (Index*, ShardedIndex* se S > 1, IvfIndex* se C > 0, PqIndex* se pq_m > 0)
     type   *Q;         // query (nq x D), gestito da NumPy
     int     nq;        // numero di query
     int    *id_nn;     // identificativi dei vicini (nq x k)
     type   *dist_nn;   // distanze reali dai vicini (nq x k)
     int     silent;    // modalità silenziosa
+    int     r;         // re-rank: k*r candidati approssimati (1 = disattivato)
+    int     S;         // shard dell'indice (1 = indice unico)
+    int     num_threads; // thread del pool per predict (0 = tutti)
+    int     cols;      // colonne ordinate per pivot nell'indice (0 = scansione completa)
+    int     cascade;   // pivot caldi della cascata di d* (0 = d* su tutti i pivot)
+    float   alpha;     // pruning rilassato di predict: alpha * d* >= peggiore (0/1 = esatto)
+    size_t  max_evals; // distanze approssimate per query in predict (0 = illimitate)
+    double  deadline_ms; // tempo per query in predict, in ms (0 = illimitato)
+    uint8_t *partial;  // flag delle query parziali di predict (nq), NULL = non richiesti
+    int     C;         // liste dell'indice IVF (0 = nessuna; index è allora IvfIndex*)
+    int     nprobe;    // liste sondate per query con indice IVF
+    void   *graph;     // grafo HNSW sull'indice (HnswIndex*), NULL se assente
+    int     M;         // archi per nodo del grafo (0 = nessun grafo)
+    int     ef_c;      // ampiezza del fascio in costruzione del grafo
+    int     ef;        // ampiezza del fascio di ricerca sul grafo
+    int     pq_m;      // sotto-quantizzatori PQ (0 = nessuno; index è allora PqIndex*)
+    int     pq_bits;   // bit per codice PQ: 8 (ADC) o 4 (fast-scan)
+    int     opq;       // rotazione OPQ prima della quantizzazione prodotto
+    void   *async;     // motore di submit_query (AsyncEngine*), creato al primo uso
 } params;
 
 #endif
@@ -7,8 +7,38 @@ typedef struct {
     int h;
     int k;
     int x;
+    int exact;   // -e: K-NN esatto (forza bruta), h e x non servono
+    int perf;    // -P: contatori hardware per fase (perf_event_open, Linux)
+    int r;       // -r: re-rank dei k*r candidati approssimati (0/1 = disattivato)
+    double tune; // -A: autotune di h, x, r per la recall@k indicata (0 = disattivato)
+    int mem_mb;  // -M: budget di memoria dell'indice per l'autotune (MB, 0 = illimitato)
+    int shards;  // -S: indice partizionato in S shard (0/1 = indice unico)
+    const char *numa; // -N: collocazione dell'indice (default | interleave | replica)
+    const char *pin;  // -B: pinning dei thread di query (none | compact | scatter)
+    int threads; // -t: query sul pool di thread persistente con t thread (0 = OpenMP)
+    int cache;   // -Q: cache LRU dei candidati per codice di query con Q voci (0 = nessuna)
+    int cols;    // -C: colonne ordinate per pivot nell'indice (0 = scansione completa)
+    int cascade; // -c: cascata del limite inferiore con c pivot caldi (0 = d* su tutti i pivot)
+    double alpha;     // -a: pruning rilassato alpha * d* >= peggiore (0/1 = esatto)
+    long long evals;  // -m: distanze approssimate al pi per query (0 = illimitate)
+    double deadline;  // -T: tempo per query in ms, poi risultato parziale (0 = illimitato)
+    int ivf;     // -I: indice IVF con I liste k-means (0 = disattivato)
+    int nprobe;  // -n: liste sondate per query con -I (default 8)
+    int graph;   // -G: grafo HNSW con G archi per nodo sull'indice (0 = disattivato)
+    int ef;      // -E: ampiezza del fascio di ricerca con -G (default 64)
+    const char *pages; // -H: pagine dell'arena dell'indice (small | thp | hugetlb)
+    int bits;    // -b: codici a livelli di ampiezza con b bit (0/1 = ternari)
+    int pq;      // -p: quantizzazione prodotto con p sotto-quantizzatori (0 = disattivata)
+    int pq4;     // -F: codici PQ a 4 bit con scansione fast-scan (default 8 bit)
+    int opq;     // -O: rotazione OPQ prima della quantizzazione prodotto
+    const char *out;    // -o: risultati in base_ids / base_dst (.ds2 o .npy), senza confronto con i golden
+    const char *listen; // -L: modalit server sul socket Unix indicato (-q non serve)
 } Config;
 
 int parse_args(int argc, char **argv, Config *cfg);
 
+// Controlla le opzioni lette da parse_args e applica quelle globali (-H).
+// Con -b assente imposta bits = 1. Ritorna -1 (con messaggio) se non valide.
+int config_validate(Config *cfg);
+
 #endif
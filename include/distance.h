@@ -18,6 +18,15 @@ int approximate_distance(
     size_t D
 );
 
+// Distanza per codici a livelli (quantize_vector_graded): prodotto
+// scalare intero fra (v+ - v-) e (w+ - w-). Con livelli 0/1 vale quanto
+// approximate_distance.
+int graded_distance(
+    const uint8_t *vp, const uint8_t *vn,
+    const uint8_t *wp, const uint8_t *wn,
+    size_t D
+);
+
 // Distanza euclidea reale float32
 float euclidean_distance(const float *a, const float *b, size_t D);
 
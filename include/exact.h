@@ -0,0 +1,17 @@
+#ifndef EXACT_H
+#define EXACT_H
+
+#include "matrix.h"
+#include "query.h"
+
+// K-NN ESATTO (forza bruta) float32.
+// Le distanze sono calcolate come ||q||^2 + ||v||^2 - 2 q.v a blocchi
+// (tile di query x tile di dataset) con le norme delle righe precalcolate.
+// Per ogni query i k vicini sono restituiti in ordine crescente di distanza
+// euclidea reale (dist_real == dist_approx). Gli slot oltre n hanno id = -1.
+void exact_knn(const MatrixF32 *ds,
+               const MatrixF32 *queries,
+               int k,
+               Neighbor *results);
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef EXACT64_H
+#define EXACT64_H
+
+#include "matrix.h"
+#include "query64.h"
+
+// K-NN ESATTO (forza bruta) float64, stesso schema a blocchi di exact_knn.
+void exact_knn_f64(const MatrixF64 *ds,
+                   const MatrixF64 *queries,
+                   int k,
+                   Neighbor64 *results);
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Filtro sulle righe del dataset per le query K-NN filtrate
+// (knn_query_*_filtered): bitmap con un bit per riga, letto dentro la
+// scansione prima del limite inferiore sui pivot.
+// Comune a 32 e 64 bit: query.h e query64.h lo includono entrambi.
+typedef struct {
+    const uint64_t *bits;   // bit (base + i) della bitmap = riga i del dataset scandito
+    size_t          base;   // primo bit usato (shard: riga globale del primo punto)
+    int             deny;   // 0: bit a 1 = riga ammessa; 1: bit a 1 = riga esclusa
+} RowFilter;
+
+// Se le righe ammesse sono al più n / ROW_FILTER_SPARSE la scansione passa
+// all'elenco degli id ammessi invece di testare il bit di ogni riga
+#define ROW_FILTER_SPARSE 16
+
+static inline int row_filter_allows(const RowFilter *f, size_t i)
+{
+    size_t b = f->base + i;
+    int set = (int)((f->bits[b >> 6] >> (b & 63)) & 1u);
+    return set != f->deny;
+}
+
+static inline size_t row_filter_popcount(uint64_t w)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return (size_t)__builtin_popcountll(w);
+#else
+    w = w - ((w >> 1) & 0x5555555555555555ull);
+    w = (w & 0x3333333333333333ull) + ((w >> 2) & 0x3333333333333333ull);
+    w = (w + (w >> 4)) & 0x0F0F0F0F0F0F0F0Full;
+    return (size_t)((w * 0x0101010101010101ull) >> 56);
+#endif
+}
+
+// Righe ammesse fra le prime n: popcount a parole intere di 64 bit,
+// mascherando la prima e l'ultima se [base, base + n) non è allineato
+static inline size_t row_filter_count(const RowFilter *f, size_t n)
+{
+    size_t set = 0, b = f->base, end = f->base + n;
+    while (b < end) {
+        size_t w  = b >> 6, lo = b & 63;
+        size_t hi = end - (w << 6) < 64 ? end - (w << 6) : 64;
+        uint64_t word = f->bits[w] >> lo;
+        if (hi - lo < 64) word &= ((uint64_t)1 << (hi - lo)) - 1;
+        set += row_filter_popcount(word);
+        b = (w << 6) + hi;
+    }
+    return f->deny ? n - set : set;
+}
+
+// Scrive in rows gli id ammessi fra le prime n righe (crescenti); ne ritorna il numero
+static inline size_t row_filter_rows(const RowFilter *f, size_t n, uint32_t *rows)
+{
+    size_t c = 0;
+    for (size_t i = 0; i < n; i++)
+        if (row_filter_allows(f, i)) rows[c++] = (uint32_t)i;
+    return c;
+}
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef HNSW_H
+#define HNSW_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "index.h"
+
+// Grafo di prossimità a livelli (stile HNSW) sui codici v+/v- di un Index:
+// archi e attraversamento usano approximate_distance, senza leggere il
+// dataset. Il grafo non possiede l'indice, che deve restare valido finché
+// il grafo è in uso (e va liberato dopo). Il re-rank euclideo sulle righe
+// originali è in knn_query_hnsw_* (query.c / query64.c).
+typedef struct {
+    const Index *idx;      // codici dei nodi (non posseduto)
+    size_t    n;           // nodi (= righe dell'indice)
+    int       M;           // archi per nodo ai livelli > 0 (livello 0: 2M)
+    int       max_level;   // livello del punto d'ingresso
+    uint32_t  entry;       // punto d'ingresso della ricerca
+    uint8_t  *level;       // n: livello più alto di ogni nodo
+    uint32_t *links0;      // n * (1 + 2M): [conteggio, archi...] al livello 0
+    uint32_t **upper;      // n: livelli 1..level[i], (1 + M) ciascuno (NULL se level[i] = 0)
+    struct HnswSlot *slots; // stato di ricerca riusato fra le query (hnsw.c)
+} HnswIndex;
+
+#define HNSW_DEFAULT_M      16
+#define HNSW_DEFAULT_EF_C   100   // ampiezza del fascio in costruzione
+#define HNSW_DEFAULT_EF     64    // ampiezza del fascio in ricerca
+#define HNSW_MAX_LEVEL      16
+
+// Inserimento parallelo (OpenMP) di tutte le righe di idx. M < 2 o
+// ef_construction < 1 prendono i valori di default. NULL su errore.
+HnswIndex *build_hnsw(const Index *idx, int M, int ef_construction);
+void free_hnsw(HnswIndex *g);
+
+// Byte occupati dal grafo (l'indice è escluso)
+size_t hnsw_memory_bytes(const HnswIndex *g);
+
+// Ricerca a fascio di ampiezza ef per la query quantizzata (vp_q, vn_q:
+// idx->Dp byte con coda a zero): scrive in ids / dist fino a ef candidati
+// in ordine di d~ crescente e ne ritorna il numero. In *evaluated (se non
+// NULL) le distanze calcolate. Chiamate concorrenti sullo stesso grafo sono
+// ammesse: ognuna prende uno slot di ricerca libero (bitset dei visitati
+// allocato una volta e azzerato solo sui nodi toccati).
+size_t hnsw_search(const HnswIndex *g,
+                   const uint8_t *vp_q,
+                   const uint8_t *vn_q,
+                   int ef,
+                   uint32_t *ids,
+                   int *dist,
+                   size_t *evaluated);
+
+#endif
@@ -4,29 +4,206 @@
 #include <stddef.h>
 #include <stdint.h>
 #include "matrix.h"
+#include "distance.h"
+
+// Colonne ordinate per pivot al massimo (index_sort_pivots)
+#define INDEX_MAX_SORTED 2
+
+// Pivot caldi al massimo (index_build_cascade) e righe campionate per la
+// mediana di d(v,p) con cui si ordinano gli altri pivot per query
+#define INDEX_MAX_HOT        16
+#define INDEX_CENTER_SAMPLE  4096
+
+// Righe dei codici allungate a un multiplo di INDEX_ROW_ALIGN byte (un
+// registro AVX2) con coda a zero: la coda non cambia d~ e i kernel non
+// hanno mai un resto scalare. Ogni array dell'arena parte allineato a
+// INDEX_ARENA_ALIGN (una linea di cache).
+#define INDEX_ROW_ALIGN    32
+#define INDEX_ARENA_ALIGN  64
+#define INDEX_HUGE_PAGE    (2u << 20)
+
+// Provenienza dell'arena (Index.arena_kind), per liberarla allo stesso modo
+enum { INDEX_ARENA_HEAP, INDEX_ARENA_MMAP, INDEX_ARENA_HUGETLB };
+
+// Pagine dell'arena per gli indici costruiti dopo la chiamata (index_set_pages)
+typedef enum {
+    INDEX_PAGES_SMALL,     // pagine normali, allocatore di sistema
+    INDEX_PAGES_THP,       // default: huge page trasparenti (madvise) oltre INDEX_HUGE_PAGE
+    INDEX_PAGES_HUGETLB    // huge page riservate (MAP_HUGETLB), altrimenti come THP
+} IndexPages;
 
 // Indice delle distanze approssimate
 typedef struct {
     size_t n;         // n punti nel dataset
     size_t h;         // n pivot
     size_t D;         // dimensione vettori
+    size_t Dp;        // passo delle righe dei codici (D allungato, coda a zero)
+    int    bits;      // livelli dei codici: 1 = ternari, 2..QUANT_MAX_BITS = a livelli
 
     size_t *pivot_ids;   // pivot scelti
 
-    uint8_t *vp_all;  // v+ dataset  (n * D)
+    uint8_t *vp_all;  // v+ dataset  (n * Dp)
     uint8_t *vn_all;  // v- dataset
 
-    uint8_t *vp_piv;  // v+ per i pivot (h * D)
+    uint8_t *vp_piv;  // v+ per i pivot (h * Dp)
     uint8_t *vn_piv;  // v- per i pivot
 
     int *dist;        // matrice distanze approssimate: dimensione = n * h
+
+    // Unica allocazione per i sei array sopra (index_alloc_arena)
+    void   *arena;
+    size_t  arena_bytes;
+    int     arena_kind;   // INDEX_ARENA_*
+
+    // Colonne ordinate (opzionali, index_sort_pivots): per la colonna c gli
+    // id delle righe in ordine crescente di d(v, p_sorted_piv[c])
+    int       n_sorted;                      // 0 = assenti (scansione completa)
+    int       sorted_piv[INDEX_MAX_SORTED];  // pivot di ogni colonna
+    uint32_t *sorted_id;                     // n_sorted * n
+    int      *sorted_key;                    // n_sorted * n, dist[sorted_id][piv]
+
+    // Cascata dei pivot (opzionale, index_build_cascade): le distanze dagli
+    // n_hot pivot con la varianza maggiore in un array compatto letto per
+    // primo; le altre colonne di dist solo per le righe non ancora scartate
+    int       n_hot;                   // 0 = assente (d* su tutti i pivot)
+    int       hot_piv[INDEX_MAX_HOT];  // pivot di ogni colonna calda
+    int      *hot_dist;                // n * n_hot: dist[i][hot_piv[c]]
+    int      *piv_center;              // h: mediana (campionata) di d(v,p)
+    // Cambia a ogni costruzione o modifica (index_sort_pivots): due indici
+    // con la stessa versione danno gli stessi candidati (query_cache.h)
+    uint64_t  version;
 } Index;
 
+// Nuovo valore per Index.version (unico nel processo)
+uint64_t index_next_version(void);
+
 // Funzioni
 Index *build_index(const MatrixF32 *ds, int h, int x);     // 32 bit
 Index *build_index_f64(const MatrixF64 *ds, int h, int x); // 64 bit
 void free_index(Index *idx);
 
+// Codici a livelli di ampiezza (quantize_vector_graded, bits = 1..QUANT_MAX_BITS):
+// d~ pi fine, quindi meno parit fra i candidati a parit di x. Le query
+// sull'indice sono quantizzate con gli stessi bits. bits = 1 = build_index.
+Index *build_index_graded(const MatrixF32 *ds, int h, int x, int bits);
+Index *build_index_graded_f64(const MatrixF64 *ds, int h, int x, int bits);
+
+// d~ fra due righe di codici con il passo dell'indice: kernel ternario
+// (approximate_distance) o a livelli (graded_distance)
+static inline int index_code_distance(const Index *idx,
+                                      const uint8_t *vp, const uint8_t *vn,
+                                      const uint8_t *wp, const uint8_t *wn)
+{
+    return idx->bits > 1 ? graded_distance(vp, vn, wp, wn, idx->Dp)
+                         : approximate_distance(vp, vn, wp, wn, idx->Dp);
+}
+
+// Passo delle righe dei codici per vettori di dimensione D
+static inline size_t index_row_stride(size_t D)
+{
+    return (D + INDEX_ROW_ALIGN - 1) / INDEX_ROW_ALIGN * INDEX_ROW_ALIGN;
+}
+
+// Arena azzerata per un indice con n, h, D gi impostati: imposta Dp e i
+// puntatori dei sei array. Ritorna 0, -1 su errore.
+int index_alloc_arena(Index *idx);
+void index_set_pages(IndexPages pages);
+// "small" | "thp" | "hugetlb" -> IndexPages, -1 se sconosciuto
+int index_pages_from_name(const char *name);
+
+// Costruisce m colonne ordinate (1 o INDEX_MAX_SORTED) sui pivot con la
+// maggiore varianza di d(v,p): le query K-NN e per raggio partono dalla
+// posizione di d(q,p) ed espandono verso l'esterno invece di scandire tutte
+// le n righe (stile iDistance/LAESA). m = 0 le rimuove. Ritorna 0, -1 su errore.
+int index_sort_pivots(Index *idx, int m);
+
+// Prima posizione della colonna c con chiave >= key (n se nessuna)
+size_t index_sorted_lower_bound(const Index *idx, int c, int key);
+// Colonna da usare per una query K-NN: quella con le chiavi pi distanziate
+// attorno a d(q,p) sui k vicini di posizione (meno righe per finestra)
+int index_sorted_column(const Index *idx, const int *dq_pivot, int k);
+
+// Cascata del limite inferiore su m pivot caldi (1..INDEX_MAX_HOT, <= h)
+// scelti per varianza di d(v,p): d* si calcola prima sulle colonne calde e,
+// solo per le righe non ancora scartate, sui pivot restanti fermandosi
+// appena raggiunge la soglia. I risultati non cambiano. m = 0 la rimuove.
+// Ritorna 0, -1 su errore.
+int index_build_cascade(Index *idx, int m);
+
+// Per una query: d(q,p) dei pivot caldi in dq_hot (n_hot) e i pivot freddi
+// (h - n_hot) in order per |d(q,p) - mediana di d(v,p)| decrescente: una
+// query all'estremo di un pivot  lontana dalla maggior parte delle
+// righe, quindi quel pivot scarta prima
+void index_cascade_order(const Index *idx, const int *dq_pivot, int *dq_hot, int *order);
+
+// index_cascade_order una volta per query, in buf (INDEX_ORDER_STACK interi
+// sullo stack del chiamante) se h ci sta, altrimenti in un buffer allocato.
+// NULL senza cascata o se l'allocazione fallisce: d* su tutti i pivot.
+// Da rilasciare con index_cascade_end(order, buf).
+#define INDEX_ORDER_STACK 64
+int *index_cascade_begin(const Index *idx, const int *dq_pivot, int *dq_hot, int *buf);
+void index_cascade_end(int *order, int *buf);
+
+// d* della riga i con la cascata: esatto se minore di limit, altrimenti un
+// valore >= limit (la riga  comunque scartata)
+static inline int index_cascade_bound(const Index *idx, size_t i, const int *dq_hot,
+                                      const int *dq_pivot, const int *order, int limit)
+{
+    const int *hv = &idx->hot_dist[i * (size_t)idx->n_hot];
+    int best = 0;
+    for (int c = 0; c < idx->n_hot; c++) {
+        int diff = hv[c] - dq_hot[c];
+        if (diff < 0) diff = -diff;
+        if (diff > best) best = diff;
+    }
+    if (best >= limit) return best;
+
+    const int *dv = &idx->dist[i * idx->h];
+    int cold = (int)idx->h - idx->n_hot;
+    for (int c = 0; c < cold; c++) {
+        int diff = dv[order[c]] - dq_pivot[order[c]];
+        if (diff < 0) diff = -diff;
+        if (diff > best) {
+            best = diff;
+            if (best >= limit) break;
+        }
+    }
+    return best;
+}
+
+// Prefetch in L1 dei codici v+/v- della riga i (una richiesta per linea da
+// 64 byte), per le scansioni che ne conoscono in anticipo le righe
+#if defined(__GNUC__) || defined(__clang__)
+#define INDEX_PREFETCH(p) __builtin_prefetch((p), 0, 3)
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <xmmintrin.h>
+#define INDEX_PREFETCH(p) _mm_prefetch((const char *)(p), _MM_HINT_T0)
+#else
+#define INDEX_PREFETCH(p) ((void)(p))
+#endif
+
+static inline void index_prefetch_codes(const Index *idx, size_t i)
+{
+    const uint8_t *vp = &idx->vp_all[i * idx->Dp];
+    const uint8_t *vn = &idx->vn_all[i * idx->Dp];
+    for (size_t o = 0; o < idx->Dp; o += 64) {
+        INDEX_PREFETCH(vp + o);
+        INDEX_PREFETCH(vn + o);
+    }
+}
+
+// Distanze approssimate di nq righe di codici (vp, vn: nq x Dp, coda a
+// zero) da tutti gli h pivot, in dq (nq x h). A blocchi di INDEX_PIVOT_BLOCK
+// righe: i codici di un pivot restano in cache mentre servono tutte le
+// righe del blocco.
+#define INDEX_PIVOT_BLOCK 16
+void index_pivot_distances(const Index *idx, const uint8_t *vp, const uint8_t *vn, size_t nq, int *dq);
+
+// Byte occupati dall'indice (strutture + arena)
+size_t index_memory_bytes(const Index *idx);
+// Stima degli stessi byte per un indice n x h in dimensione D (senza costruirlo)
+size_t index_memory_estimate(size_t n, size_t h, size_t D);
+
 
 
 
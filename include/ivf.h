@@ -0,0 +1,42 @@
+#ifndef IVF_H
+#define IVF_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "matrix.h"
+#include "index.h"
+
+// Indice a file invertiti (IVF): k-means euclideo divide il dataset in C
+// liste; le righe sono riordinate per lista e l'indice a pivot è costruito
+// su quest'ordine, così codici v+/v- e righe di dist di una lista sono
+// contigui. Una query scandisce (pruning + d~) solo le nprobe liste con il
+// centroide più vicino: con nprobe = C il risultato equivale a una
+// scansione completa dello stesso indice.
+typedef struct {
+    size_t    C;          // liste
+    size_t    n;          // righe totali
+    size_t    D;          // dimensione vettori
+    double   *centroids;  // C x D, anche per dataset float32
+    size_t   *offset;     // C + 1: la lista c occupa le posizioni [offset[c], offset[c+1])
+    uint32_t *ids;        // n: riga originale del dataset in ogni posizione
+    Index    *idx;        // indice sulle righe in ordine di lista (id = posizione)
+} IvfIndex;
+
+// Iterazioni di Lloyd e righe di addestramento per lista (campione del dataset)
+#define IVF_ITERS          10
+#define IVF_TRAIN_PER_LIST 64
+
+// C viene ridotto a n se necessario. NULL su errore.
+IvfIndex *build_ivf_index(const MatrixF32 *ds, int C, int h, int x);     // 32 bit
+IvfIndex *build_ivf_index_f64(const MatrixF64 *ds, int C, int h, int x); // 64 bit
+void free_ivf_index(IvfIndex *ivf);
+
+// Byte occupati (indice a pivot + centroidi + permutazione)
+size_t ivf_memory_bytes(const IvfIndex *ivf);
+
+// Scrive in lists le min(nprobe, C) liste con il centroide più vicino a q,
+// in ordine di distanza crescente; ne ritorna il numero
+size_t ivf_probe(const IvfIndex *ivf, const float *q, int nprobe, uint32_t *lists);
+size_t ivf_probe_f64(const IvfIndex *ivf, const double *q, int nprobe, uint32_t *lists);
+
+#endif
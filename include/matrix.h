@@ -8,6 +8,7 @@ typedef struct {
     uint32_t n;
     uint32_t d;
     float   *data;
+    struct MatrixMap *map;  // file mappato in cui punta data (matrix_formats.h), NULL: malloc
 } MatrixF32;
 
 // Matrice float64 (double)
@@ -15,6 +16,7 @@ typedef struct {
     uint32_t n;
     uint32_t d;
     double  *data;
+    struct MatrixMap *map;  // file mappato in cui punta data (matrix_formats.h), NULL: malloc
 } MatrixF64;
 
 // Matrice risultati indice int32
@@ -22,8 +24,12 @@ typedef struct {
     uint32_t n;
     uint32_t d;
     int32_t *data;
+    struct MatrixMap *map;  // file mappato in cui punta data (matrix_formats.h), NULL: malloc
 } MatrixI32;
 
+// Caricamento/svuotamento: .ds2, oppure .fvecs/.ivecs/.bvecs/.npy/.npz in
+// base all'estensione (matrix_formats.h, convertiti nel tipo della matrice)
+
 // Caricamento/svuotamento float32
 int  load_matrix_f32(const char *path, MatrixF32 *m);
 void free_matrix_f32(MatrixF32 *m);
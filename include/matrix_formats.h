@@ -0,0 +1,56 @@
+#ifndef MATRIX_FORMATS_H
+#define MATRIX_FORMATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Formati di input letti da load_matrix_* oltre al .ds2, scelti in base
+// all'estensione del percorso:
+//   .fvecs / .ivecs / .bvecs  corpora ANN (SIFT, GIST, slice di Deep1B): ogni
+//                             riga è preceduta dalla sua dimensione (int32)
+//                             ed è float32, int32 o uint8
+//   .npy                      array NumPy 2-D in ordine C, tipi '<f4' '<f8'
+//                             '<i4' '<i8' '|u1'
+//   .npz[:nome]               archivio np.savez (entry non compresse):
+//                             l'array "nome", senza ":nome" il primo
+//
+// Il file è mappato in memoria (mmap copy-on-write; su Windows letto in un
+// buffer). Se le righe sono contigue e del tipo richiesto (.npy/.npz dello
+// stesso tipo della matrice) i dati restano nella mappatura, senza copie.
+// Altrimenti (prefisso per riga dei .*vecs, conversione uint8/int/float) le
+// righe sono convertite a blocchi di MATRIX_CHUNK byte del file, rilasciando
+// le pagine già lette: in memoria non restano mai due copie del dataset.
+typedef enum {
+    MATRIX_FMT_DS2 = 0,
+    MATRIX_FMT_FVECS,
+    MATRIX_FMT_IVECS,
+    MATRIX_FMT_BVECS,
+    MATRIX_FMT_NPY,
+    MATRIX_FMT_NPZ
+} MatrixFormat;
+
+// Tipo degli elementi (della matrice richiesta o del file)
+typedef enum {
+    MATRIX_T_F32,
+    MATRIX_T_F64,
+    MATRIX_T_I32,
+    MATRIX_T_I64,
+    MATRIX_T_U8
+} MatrixType;
+
+typedef struct MatrixMap MatrixMap;
+
+#define MATRIX_CHUNK (4u << 20)   // byte del file convertiti per blocco
+
+// Formato dal percorso (".npz:" seguito dal nome dell'array vale .npz)
+MatrixFormat matrix_format(const char *path);
+
+// Carica path (fmt != MATRIX_FMT_DS2) come matrice n x d di tipo t: *data
+// punta nella mappatura (*map != NULL, da rilasciare con matrix_unmap) o in
+// un buffer malloc (*map == NULL). 0 se ok, -1 su errore (motivo su stderr).
+int matrix_load_file(const char *path, MatrixFormat fmt, MatrixType t,
+                     uint32_t *n, uint32_t *d, void **data, MatrixMap **map);
+
+void matrix_unmap(MatrixMap *map);
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef PERFCOUNT_H
+#define PERFCOUNT_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+// Contatori hardware (perf_event_open, solo Linux) per fase del motore.
+//
+// La raccolta è disattivata finché non si chiama perf_init(): a runtime
+// PERF_BEGIN/PERF_END costano un solo test su una variabile globale.
+// Compilando con -DQP_NO_PERF (o fuori da Linux) le macro spariscono.
+// Con la raccolta attiva i confini di fase non fanno syscall: i contatori
+// hardware si leggono con rdpmc dalla pagina mmap dell'evento (x86) e il
+// tempo dall'orologio monotono (vDSO). Solo se rdpmc non è consentito
+// (o fuori da x86) i contatori hardware passano da read() sul gruppo.
+
+typedef enum {
+    PERF_PHASE_QUANT = 0,   // quantizzazione (dataset o query)
+    PERF_PHASE_PIVOT,       // tabella distanze pivot (d(v,p) o d(q,p))
+    PERF_PHASE_LB,          // limite inferiore d* sui pivot
+    PERF_PHASE_APPROX,      // pruning + distanza approssimata
+    PERF_PHASE_RERANK,      // distanza reale dei k candidati
+    PERF_PHASES
+} PerfPhase;
+
+typedef enum {
+    PERF_EV_TIME = 0,       // tempo nella fase (ns, clock monotono); il gruppo ha sempre il task-clock
+    PERF_EV_CYCLES,
+    PERF_EV_INSTR,
+    PERF_EV_LLC_MISS,
+    PERF_EV_BRANCH_MISS,
+    PERF_EVENTS
+} PerfEvent;
+
+#define PERF_MAX_THREADS 256
+
+// Valori accumulati da un thread
+typedef struct {
+    uint64_t v[PERF_PHASES][PERF_EVENTS];
+    uint64_t calls[PERF_PHASES];
+} PerfThreadStats;
+
+// Attiva la raccolta. Restituisce la maschera degli eventi disponibili
+// (bit PERF_EV_*), 0 se perf_event_open non è utilizzabile.
+unsigned perf_init(void);
+void     perf_reset(void);
+
+// 1 dopo un perf_init riuscito (letto inline da PERF_BEGIN/PERF_END)
+extern int perf_enabled;
+static inline int perf_active(void) { return perf_enabled; }
+
+void perf_phase_begin(PerfPhase p);
+void perf_phase_end(PerfPhase p);
+
+// Copia le statistiche per thread; restituisce il numero di thread
+int  perf_snapshot(PerfThreadStats *out, int max_threads);
+// Somma di tutti i thread
+void perf_total(PerfThreadStats *out);
+// Tabella per fase (totale) e, se per_thread, per ogni thread
+void perf_print(FILE *f, int per_thread);
+
+// Punti esaminati dalla scansione delle query e scartati dal pruning sul
+// limite inferiore d*. Sempre attivi (indipendenti da perf_init): ogni
+// knn_query_single* aggiunge i propri totali a fine query nello slot del
+// suo thread (una riga di cache, nessun atomico condiviso); perf_scan_read
+// somma gli slot.
+void perf_scan_add(uint64_t scanned, uint64_t pruned);
+void perf_scan_read(uint64_t *scanned, uint64_t *pruned);
+
+const char *perf_phase_name(int p);
+const char *perf_event_name(int e);
+unsigned    perf_events_mask(void);
+
+#if defined(__linux__) && !defined(QP_NO_PERF)
+    #define PERF_BEGIN(p) do { if (perf_active()) perf_phase_begin(p); } while (0)
+    #define PERF_END(p)   do { if (perf_active()) perf_phase_end(p); } while (0)
+#else
+    #define PERF_BEGIN(p) ((void)0)
+    #define PERF_END(p)   ((void)0)
+#endif
+
+#endif
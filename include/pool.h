@@ -0,0 +1,45 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+// Pool di thread persistente del motore (pthreads su Linux/macOS).
+//
+// I worker restano vivi fra una chiamata e l'altra: un dispatch costa un
+// incremento atomico (più un broadcast se qualche worker dorme) invece di
+// aprire una regione parallela. Il chiamante lavora come thread 0.
+// Su Windows le chiamate passano per "omp parallel for num_threads(n)"
+// (sequenziale senza OpenMP).
+
+typedef enum {
+    POOL_PARK = 0,   // i worker liberi dormono subito su una condition variable
+    POOL_SPIN        // attesa attiva per spin_us, poi dormono (dispatch più rapido)
+} PoolWait;
+
+typedef struct ThreadPool ThreadPool;
+
+// Corpo di un parallel-for: elabora [begin, end); tid in [0, thread usati)
+typedef void (*PoolTask)(void *ctx, size_t begin, size_t end, int tid);
+
+// threads <= 0: CPU online. spin_us <= 0 con POOL_SPIN: 50 us.
+ThreadPool *pool_create(int threads, PoolWait wait, int spin_us);
+void        pool_destroy(ThreadPool *pool);
+int         pool_size(const ThreadPool *pool);
+
+// Esegue task su [0, n) a blocchi di `chunk` elementi, distribuiti
+// dinamicamente su min(num_threads, pool_size) thread (num_threads <= 0:
+// tutti). Ritorna a lavoro finito. Chiamate concorrenti sullo stesso pool
+// sono serializzate, quindi più indici nello stesso processo non
+// sovraccaricano la macchina.
+void pool_parallel_for(ThreadPool *pool, int num_threads, size_t n, size_t chunk,
+                       PoolTask task, void *ctx);
+
+// Pool condiviso da tutti gli indici, creato alla prima chiamata con una
+// dimensione pari alle CPU online (in modalità POOL_SPIN).
+ThreadPool *pool_default(void);
+
+// Ricrea il pool condiviso; da chiamare quando nessuna query è in corso.
+// Ritorna 0, -1 su errore (il pool precedente resta attivo).
+int pool_configure(int threads, PoolWait wait, int spin_us);
+
+#endif
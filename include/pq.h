@@ -0,0 +1,71 @@
+#ifndef PQ_H
+#define PQ_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "matrix.h"
+
+// Quantizzazione prodotto (PQ): il vettore (eventualmente ruotato, OPQ) è
+// diviso in M sottospazi di dsub componenti, ognuno codificato con l'indice
+// del più vicino fra ks centroidi k-means. Una riga occupa M byte (8 bit,
+// 256 centroidi) o M/2 byte (4 bit, 16 centroidi): niente codici v+/v- né
+// distanze dai pivot. La distanza approssimata è l'ADC (asymmetric distance
+// computation): per ogni query si calcola una tabella M x ks di distanze
+// euclidee al quadrato fra il sottovettore della query e i centroidi, e la
+// distanza da una riga è la somma di M letture di tabella.
+//
+// Con 4 bit i codici sono disposti in blocchi di PQ_BLOCK righe (fast-scan):
+// per sottospazio 16 byte, il byte t con il codice della riga t nei 4 bit
+// bassi e quello della riga t + 16 nei 4 alti. Le tabelle, quantizzate a
+// uint8, stanno in un registro e la scansione usa pshufb (SSSE3/AVX2) per
+// 16/32 letture alla volta, con somme a 16 bit.
+//
+// Il re-rank euclideo sulle righe originali è in knn_query_pq_* (query.c /
+// query64.c). Comune a 32 e 64 bit: centroidi, rotazione e tabelle sono
+// float anche per dataset float64.
+typedef struct {
+    size_t   n;          // righe codificate
+    size_t   D;          // dimensione vettori
+    int      M;          // sotto-quantizzatori
+    int      nbits;      // bit per codice: 8 (ADC) o 4 (fast-scan)
+    size_t   ks;         // centroidi per sotto-quantizzatore (2^nbits)
+    size_t   dsub;       // componenti per sottospazio: M * dsub >= D, coda a zero
+    float   *R;          // rotazione OPQ (M*dsub x D), NULL senza rotazione
+    float   *centroids;  // M x ks x dsub
+    uint8_t *codes;      // 8 bit: n x M; 4 bit: blocchi fast-scan (M pari)
+} PqIndex;
+
+#define PQ_MAX_M       256   // somme a 16 bit del fast-scan: 256 * 255 < 65536
+#define PQ_BLOCK       32    // righe per blocco fast-scan
+#define PQ_ITERS       10    // iterazioni di Lloyd per sottospazio
+#define PQ_TRAIN_PER_C 64    // righe di addestramento per centroide (campione)
+#define PQ_DEFAULT_RERANK 8  // candidati ADC per vicino se r non è indicato
+
+// M sotto-quantizzatori (1..min(D, PQ_MAX_M)) con nbits 8 o 4; opq != 0
+// ruota prima i vettori (PCA con i valori propri ripartiti fra i
+// sottospazi in modo da bilanciarne la varianza). NULL su errore.
+PqIndex *build_pq_index(const MatrixF32 *ds, int M, int nbits, int opq);     // 32 bit
+PqIndex *build_pq_index_f64(const MatrixF64 *ds, int M, int nbits, int opq); // 64 bit
+void free_pq_index(PqIndex *pq);
+
+// Byte occupati (codici + centroidi + rotazione)
+size_t pq_memory_bytes(const PqIndex *pq);
+
+// Componenti di un vettore ruotato / con coda a zero (M * dsub)
+static inline size_t pq_rotated_dim(const PqIndex *pq)
+{
+    return (size_t)pq->M * pq->dsub;
+}
+
+// Rotazione della query (y: pq_rotated_dim float)
+void pq_project(const PqIndex *pq, const float *q, float *y);
+void pq_project_f64(const PqIndex *pq, const double *q, float *y);
+
+// Tabella ADC (M x ks) della query ruotata y
+void pq_tables(const PqIndex *pq, const float *y, float *T);
+
+// I min(kk, n) codici con ADC minore per la tabella T: ids e dist (kk
+// elementi) in ordine di distanza crescente; ne ritorna il numero
+size_t pq_scan(const PqIndex *pq, const float *T, size_t kk, uint32_t *ids, float *dist);
+
+#endif
@@ -17,4 +17,13 @@ void quantize_vector(const float *v, uint8_t *vp, uint8_t *vn, size_t D, int x);
 // Versione float64
 void quantize_vector_f64(const double *v, uint8_t *vp, uint8_t *vn, size_t D, int x);
 
+// Quantizzazione a livelli di ampiezza: le x componenti scelte sono divise
+// per rango in 2^bits - 1 gruppi; quelle di modulo maggiore valgono
+// 2^bits - 1, l'ultimo gruppo 1. bits = 1 equivale a quantize_vector.
+// I codici vanno confrontati con graded_distance (distance.h).
+#define QUANT_MAX_BITS 3
+
+void quantize_vector_graded(const float *v, uint8_t *vp, uint8_t *vn, size_t D, int x, int bits);
+void quantize_vector_graded_f64(const double *v, uint8_t *vp, uint8_t *vn, size_t D, int x, int bits);
+
 #endif
@@ -5,6 +5,13 @@
 #include <float.h>
 #include "matrix.h"
 #include "index.h"
+#include "shard.h"
+#include "affinity.h"
+#include "query_opts.h"
+#include "filter.h"
+#include "ivf.h"
+#include "hnsw.h"
+#include "pq.h"
 
 // Vicini distanza approssimata & distanza reale
 typedef struct {
@@ -27,4 +34,242 @@ void knn_query_all(const MatrixF32 *ds,
                    int x,
                    Neighbor *results);
 
+// Come knn_query_single, con i candidati presi da cache (query_cache.h) se
+// il codice della query vi  gi presente: si calcola solo la distanza
+// reale. Risultato identico; cache NULL = knn_query_single.
+void knn_query_single_cached(const MatrixF32 *ds,
+                             const Index *idx,
+                             const float *q,
+                             int k,
+                             int x,
+                             QueryCache *cache,
+                             Neighbor *neighbors);
+
+// Re-ranking: cerca k*r candidati con la distanza approssimata e restituisce
+// i k con distanza reale minore (ordine crescente). r = 1 -> stessi k vicini
+// di knn_query_single, ma ordinati.
+void knn_query_single_rerank(const MatrixF32 *ds,
+                             const Index *idx,
+                             const float *q,
+                             int k,
+                             int x,
+                             int r,
+                             Neighbor *neighbors);
+
+void knn_query_all_rerank(const MatrixF32 *ds,
+                          const Index *idx,
+                          const MatrixF32 *queries,
+                          int k,
+                          int x,
+                          int r,
+                          Neighbor *results);
+
+// Query preparate in blocco: quantizzazione e distanze dai pivot di tutte
+// le query in parallelo (NULL su errore, liberare con free_query_codes).
+// knn_query_single_prepared scandisce la riga i di qc (vettore originale q)
+// con lo stesso risultato di knn_query_single.
+QueryCodes *prepare_queries(const Index *idx, const MatrixF32 *queries, int x);
+
+void knn_query_single_prepared(const MatrixF32 *ds,
+                               const Index *idx,
+                               const float *q,
+                               const QueryCodes *qc,
+                               size_t i,
+                               int k,
+                               Neighbor *neighbors);
+
+// KNN per tutte le query sul pool di thread persistente (pool.h), con
+// numero di thread e re-rank scelti per chiamata. Con alpha o un budget
+// (query_opts.h) opt->partial, se presente, riceve un flag per query.
+void knn_query_all_opt(const MatrixF32 *ds,
+                       const Index *idx,
+                       const MatrixF32 *queries,
+                       int k,
+                       int x,
+                       const QueryOptions *opt,
+                       Neighbor *results);
+
+// Una query con le stesse opzioni (opt->partial ignorato): 1 se il budget
+// si  esaurito e i vicini sono i migliori trovati fino a quel momento
+int knn_query_single_opt(const MatrixF32 *ds,
+                         const Index *idx,
+                         const float *q,
+                         int k,
+                         int x,
+                         const QueryOptions *opt,
+                         Neighbor *neighbors);
+
+// Replica per nodo NUMA (index_replicate): ogni thread usa quella locale;
+// r > 1 applica il re-rank come knn_query_all_rerank
+void knn_query_all_replicated(const MatrixF32 *ds,
+                              const IndexReplicas *rep,
+                              const MatrixF32 *queries,
+                              int k,
+                              int x,
+                              int r,
+                              Neighbor *results);
+
+// Indice partizionato: fan-out sugli shard e merge dei top-k con id globali,
+// ordinati per distanza approssimata crescente
+void knn_query_sharded_single(const MatrixF32 *ds,
+                              const ShardedIndex *sx,
+                              const float *q,
+                              int k,
+                              int x,
+                              Neighbor *neighbors);
+
+void knn_query_sharded_all(const MatrixF32 *ds,
+                           const ShardedIndex *sx,
+                           const MatrixF32 *queries,
+                           int k,
+                           int x,
+                           Neighbor *results);
+
+// Ricerca per raggio in formato CSR: i vicini della query i sono
+// items[offsets[i] .. offsets[i+1]), in ordine crescente di id
+typedef struct {
+    size_t    nq;
+    size_t   *offsets;   // nq + 1 confini
+    Neighbor *items;     // offsets[nq] vicini (dist_approx e dist_real)
+} RangeResult;
+
+// Tutti i punti con distanza approssimata <= r; con r_real >= 0 restano solo
+// quelli con distanza reale <= r_real (r_real < 0: nessun filtro). Il pruning
+// su d* usa r come soglia fissa. NULL se manca memoria.
+RangeResult *range_query_single(const MatrixF32 *ds,
+                                const Index *idx,
+                                const float *q,
+                                int x,
+                                float r,
+                                float r_real);
+
+RangeResult *range_query_all(const MatrixF32 *ds,
+                             const Index *idx,
+                             const MatrixF32 *queries,
+                             int x,
+                             float r,
+                             float r_real);
+
+// Indice partizionato: id globali, sempre in ordine crescente
+RangeResult *range_query_sharded_all(const MatrixF32 *ds,
+                                     const ShardedIndex *sx,
+                                     const MatrixF32 *queries,
+                                     int x,
+                                     float r,
+                                     float r_real);
+
+void free_range_result(RangeResult *res);
+
+// K-NN delle righe indicizzate: la query id  la riga id di ds, con il
+// codice e le distanze dai pivot gi nell'indice (niente quantizzazione n
+// confronto con i pivot). Stesso risultato di knn_query_single (r <= 1) o
+// knn_query_single_rerank sulla riga con lo x dell'indice; la riga stessa 
+// fra i vicini. ds  il dataset su cui  stato costruito idx.
+void knn_query_by_id(const MatrixF32 *ds,
+                     const Index *idx,
+                     size_t id,
+                     int k,
+                     int r,
+                     Neighbor *neighbors);
+
+void knn_query_by_id_all(const MatrixF32 *ds,
+                         const Index *idx,
+                         const uint32_t *ids,
+                         size_t n_ids,
+                         int k,
+                         int r,
+                         Neighbor *results);
+
+// Grafo dei k vicini di tutte le righe (self-join) in formato CSR: la riga i
+// ha in items[offsets[i] .. offsets[i+1]) i suoi min(k, n - 1) vicini, se
+// stessa esclusa, in ordine crescente di distanza reale. d* e d~ sono
+// simmetrici: ogni coppia  valutata una volta, a tessere in parallelo.
+// NULL se manca memoria.
+RangeResult *knn_graph(const MatrixF32 *ds, const Index *idx, int k);
+
+// K-NN filtrato: solo le righe ammesse dal RowFilter (filter.h); slot oltre
+// le righe ammesse con id = -1. f NULL o senza bitmap = knn_query_single.
+void knn_query_single_filtered(const MatrixF32 *ds,
+                               const Index *idx,
+                               const float *q,
+                               int k,
+                               int x,
+                               const RowFilter *f,
+                               Neighbor *neighbors);
+
+// n_filters = 1: filtro condiviso da tutte le query; n_filters = nq: un
+// filtro per query (filters[i] per la query i)
+void knn_query_all_filtered(const MatrixF32 *ds,
+                            const Index *idx,
+                            const MatrixF32 *queries,
+                            int k,
+                            int x,
+                            const RowFilter *filters,
+                            size_t n_filters,
+                            Neighbor *results);
+
+// Indice partizionato: i bit dei filtri sono riferiti agli id globali
+void knn_query_sharded_all_filtered(const MatrixF32 *ds,
+                                    const ShardedIndex *sx,
+                                    const MatrixF32 *queries,
+                                    int k,
+                                    int x,
+                                    const RowFilter *filters,
+                                    size_t n_filters,
+                                    Neighbor *results);
+
+// Indice IVF: scansione delle sole nprobe liste pi vicine alla query
+// (nprobe >= C equivale alla scansione completa di ivf->idx). Gli id
+// ritornati sono righe del dataset originale.
+void knn_query_ivf_single(const MatrixF32 *ds,
+                          const IvfIndex *ivf,
+                          const float *q,
+                          int k,
+                          int x,
+                          int nprobe,
+                          Neighbor *neighbors);
+
+void knn_query_ivf_all(const MatrixF32 *ds,
+                       const IvfIndex *ivf,
+                       const MatrixF32 *queries,
+                       int k,
+                       int x,
+                       int nprobe,
+                       Neighbor *results);
+
+// Grafo HNSW sui codici di un Index: ricerca a fascio max(ef, k) per d~,
+// poi i k candidati con distanza reale minore (ordinati). Gli id sono righe
+// del dataset su cui  stato costruito l'indice del grafo.
+void knn_query_hnsw_single(const MatrixF32 *ds,
+                           const HnswIndex *g,
+                           const float *q,
+                           int k,
+                           int x,
+                           int ef,
+                           Neighbor *neighbors);
+
+void knn_query_hnsw_all(const MatrixF32 *ds,
+                        const HnswIndex *g,
+                        const MatrixF32 *queries,
+                        int k,
+                        int x,
+                        int ef,
+                        Neighbor *results);
+
+// Quantizzazione prodotto: ADC sui codici PQ per i k*r candidati migliori,
+// poi i k con distanza reale minore (ordinati). Nessun pivot: x non serve.
+void knn_query_pq_single(const MatrixF32 *ds,
+                         const PqIndex *pq,
+                         const float *q,
+                         int k,
+                         int r,
+                         Neighbor *neighbors);
+
+void knn_query_pq_all(const MatrixF32 *ds,
+                      const PqIndex *pq,
+                      const MatrixF32 *queries,
+                      int k,
+                      int r,
+                      Neighbor *results);
+
 #endif
@@ -3,6 +3,13 @@
 
 #include "matrix.h"
 #include "index.h"
+#include "shard.h"
+#include "affinity.h"
+#include "query_opts.h"
+#include "filter.h"
+#include "ivf.h"
+#include "hnsw.h"
+#include "pq.h"
 
 typedef struct {
     int    id;
@@ -24,4 +31,200 @@ void knn_query_all_f64(const MatrixF64 *ds,
                        int x,
                        Neighbor64 *results);
 
+void knn_query_single_cached_f64(const MatrixF64 *ds,
+                                 const Index *idx,
+                                 const double *q,
+                                 int k,
+                                 int x,
+                                 QueryCache *cache,
+                                 Neighbor64 *neighbors);
+
+void knn_query_single_rerank_f64(const MatrixF64 *ds,
+                                 const Index *idx,
+                                 const double *q,
+                                 int k,
+                                 int x,
+                                 int r,
+                                 Neighbor64 *neighbors);
+
+void knn_query_all_rerank_f64(const MatrixF64 *ds,
+                              const Index *idx,
+                              const MatrixF64 *queries,
+                              int k,
+                              int x,
+                              int r,
+                              Neighbor64 *results);
+
+QueryCodes *prepare_queries_f64(const Index *idx, const MatrixF64 *queries, int x);
+
+void knn_query_single_prepared_f64(const MatrixF64 *ds,
+                                   const Index *idx,
+                                   const double *q,
+                                   const QueryCodes *qc,
+                                   size_t i,
+                                   int k,
+                                   Neighbor64 *neighbors);
+
+void knn_query_all_opt_f64(const MatrixF64 *ds,
+                           const Index *idx,
+                           const MatrixF64 *queries,
+                           int k,
+                           int x,
+                           const QueryOptions *opt,
+                           Neighbor64 *results);
+
+int knn_query_single_opt_f64(const MatrixF64 *ds,
+                             const Index *idx,
+                             const double *q,
+                             int k,
+                             int x,
+                             const QueryOptions *opt,
+                             Neighbor64 *neighbors);
+
+void knn_query_all_replicated_f64(const MatrixF64 *ds,
+                                  const IndexReplicas *rep,
+                                  const MatrixF64 *queries,
+                                  int k,
+                                  int x,
+                                  int r,
+                                  Neighbor64 *results);
+
+void knn_query_sharded_single_f64(const MatrixF64 *ds,
+                                  const ShardedIndex *sx,
+                                  const double *q,
+                                  int k,
+                                  int x,
+                                  Neighbor64 *neighbors);
+
+void knn_query_sharded_all_f64(const MatrixF64 *ds,
+                               const ShardedIndex *sx,
+                               const MatrixF64 *queries,
+                               int k,
+                               int x,
+                               Neighbor64 *results);
+
+// Ricerca per raggio (vedi range_query_all in query.h)
+typedef struct {
+    size_t      nq;
+    size_t     *offsets;
+    Neighbor64 *items;
+} RangeResult64;
+
+RangeResult64 *range_query_single_f64(const MatrixF64 *ds,
+                                      const Index *idx,
+                                      const double *q,
+                                      int x,
+                                      double r,
+                                      double r_real);
+
+RangeResult64 *range_query_all_f64(const MatrixF64 *ds,
+                                   const Index *idx,
+                                   const MatrixF64 *queries,
+                                   int x,
+                                   double r,
+                                   double r_real);
+
+RangeResult64 *range_query_sharded_all_f64(const MatrixF64 *ds,
+                                           const ShardedIndex *sx,
+                                           const MatrixF64 *queries,
+                                           int x,
+                                           double r,
+                                           double r_real);
+
+void free_range_result_f64(RangeResult64 *res);
+
+// K-NN per id e grafo K-NN (vedi knn_query_by_id e knn_graph in query.h)
+void knn_query_by_id_f64(const MatrixF64 *ds,
+                         const Index *idx,
+                         size_t id,
+                         int k,
+                         int r,
+                         Neighbor64 *neighbors);
+
+void knn_query_by_id_all_f64(const MatrixF64 *ds,
+                             const Index *idx,
+                             const uint32_t *ids,
+                             size_t n_ids,
+                             int k,
+                             int r,
+                             Neighbor64 *results);
+
+RangeResult64 *knn_graph_f64(const MatrixF64 *ds, const Index *idx, int k);
+
+// K-NN filtrato (vedi knn_query_all_filtered in query.h)
+void knn_query_single_filtered_f64(const MatrixF64 *ds,
+                                   const Index *idx,
+                                   const double *q,
+                                   int k,
+                                   int x,
+                                   const RowFilter *f,
+                                   Neighbor64 *neighbors);
+
+void knn_query_all_filtered_f64(const MatrixF64 *ds,
+                                const Index *idx,
+                                const MatrixF64 *queries,
+                                int k,
+                                int x,
+                                const RowFilter *filters,
+                                size_t n_filters,
+                                Neighbor64 *results);
+
+void knn_query_sharded_all_filtered_f64(const MatrixF64 *ds,
+                                        const ShardedIndex *sx,
+                                        const MatrixF64 *queries,
+                                        int k,
+                                        int x,
+                                        const RowFilter *filters,
+                                        size_t n_filters,
+                                        Neighbor64 *results);
+
+// IVF (vedi knn_query_ivf_all in query.h)
+void knn_query_ivf_single_f64(const MatrixF64 *ds,
+                              const IvfIndex *ivf,
+                              const double *q,
+                              int k,
+                              int x,
+                              int nprobe,
+                              Neighbor64 *neighbors);
+
+void knn_query_ivf_all_f64(const MatrixF64 *ds,
+                           const IvfIndex *ivf,
+                           const MatrixF64 *queries,
+                           int k,
+                           int x,
+                           int nprobe,
+                           Neighbor64 *results);
+
+// Grafo HNSW (vedi knn_query_hnsw_all in query.h)
+void knn_query_hnsw_single_f64(const MatrixF64 *ds,
+                               const HnswIndex *g,
+                               const double *q,
+                               int k,
+                               int x,
+                               int ef,
+                               Neighbor64 *neighbors);
+
+void knn_query_hnsw_all_f64(const MatrixF64 *ds,
+                            const HnswIndex *g,
+                            const MatrixF64 *queries,
+                            int k,
+                            int x,
+                            int ef,
+                            Neighbor64 *results);
+
+// Quantizzazione prodotto (vedi knn_query_pq_all in query.h)
+void knn_query_pq_single_f64(const MatrixF64 *ds,
+                             const PqIndex *pq,
+                             const double *q,
+                             int k,
+                             int r,
+                             Neighbor64 *neighbors);
+
+void knn_query_pq_all_f64(const MatrixF64 *ds,
+                          const PqIndex *pq,
+                          const MatrixF64 *queries,
+                          int k,
+                          int r,
+                          Neighbor64 *results);
+
 #endif
@@ -0,0 +1,55 @@
+#ifndef QUERY_CACHE_H
+#define QUERY_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "index.h"
+
+// Cache LRU dei candidati per codice di query: due query con gli stessi
+// v+/v- hanno la stessa scansione sull'indice e quindi gli stessi k
+// candidati (id e d~, nello stesso ordine degli slot); cambia solo la
+// distanza reale. Un hit salta la scansione e ricalcola solo quest'ultima
+// sulla query vera (knn_query_single_cached / QueryOptions.cache).
+//
+// La chiave è il codice impacchettato (2 * Index.bits bit per componente)
+// più k, con un hash a 64 bit per il bucket; il codice completo è
+// confrontato a ogni hit.
+// Le voci sono divise in QUERY_CACHE_SHARDS partizioni, ognuna con il
+// proprio lock e la propria lista LRU, così thread diversi si bloccano solo
+// sulla stessa partizione.
+//
+// Ogni voce ricorda Index.version: se l'indice cambia (nuova costruzione,
+// index_sort_pivots, rebuild_shard) la partizione viene svuotata al primo
+// accesso. Comune a 32 e 64 bit.
+typedef struct QueryCache QueryCache;
+
+#define QUERY_CACHE_SHARDS 16
+
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;      // voci scartate perché la cache era piena
+    uint64_t invalidations;  // partizioni svuotate per un indice cambiato
+    size_t   entries;        // voci presenti
+    size_t   capacity;
+} QueryCacheStats;
+
+// Al più capacity voci (arrotondato a un multiplo di QUERY_CACHE_SHARDS).
+// NULL su errore o capacity = 0.
+QueryCache *query_cache_create(size_t capacity);
+void query_cache_free(QueryCache *c);
+void query_cache_clear(QueryCache *c);
+
+// Candidati (ids, dist: k elementi) della query con codice (vp, vn) su idx.
+// 1 se presenti (la voce diventa la più recente), 0 altrimenti.
+int query_cache_get(QueryCache *c, const Index *idx, const uint8_t *vp, const uint8_t *vn,
+                    int k, int *ids, int *dist);
+
+// Inserisce (o aggiorna) i candidati, scartando la voce usata meno di recente
+// se la partizione è piena. Senza memoria la voce non viene inserita.
+void query_cache_put(QueryCache *c, const Index *idx, const uint8_t *vp, const uint8_t *vn,
+                     int k, const int *ids, const int *dist);
+
+void query_cache_stats(QueryCache *c, QueryCacheStats *out);
+
+#endif
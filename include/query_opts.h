@@ -0,0 +1,124 @@
+#ifndef QUERY_OPTS_H
+#define QUERY_OPTS_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "query_cache.h"
+
+// Opzioni di esecuzione di knn_query_all_opt / knn_query_all_opt_f64.
+// Una struttura azzerata equivale a knn_query_all sul pool condiviso.
+// Comune a 32 e 64 bit: query.h e query64.h la includono entrambi.
+//
+// Ricerca "anytime": max_evals e deadline_ms limitano ogni query (numero di
+// distanze approssimate calcolate, tempo dall'inizio della sua scansione);
+// esaurito il budget la query restituisce i k migliori trovati fin lì e,
+// se partial non è NULL, partial[i] = 1. alpha > 1 rilassa il pruning
+// (scarta se alpha * d* >= peggiore): meno righe valutate, recall minore.
+// Con alpha o un budget i risultati della scansione non entrano nella
+// cache (una hit resta quella esatta).
+typedef struct {
+    int r;             // re-rank: k*r candidati approssimati (<= 1 disattivato)
+    int num_threads;   // thread del pool condiviso (pool.h), 0 = tutti
+    QueryCache *cache; // candidati per codice di query (query_cache.h), NULL = nessuna
+    float    alpha;       // fattore di pruning (0 o 1 = esatto)
+    size_t   max_evals;   // distanze approssimate per query (0 = illimitate)
+    double   deadline_ms; // tempo per query in ms (0 = illimitato)
+    uint8_t *partial;     // nq flag in uscita (NULL = non richiesti)
+} QueryOptions;
+
+static inline void query_default_options(QueryOptions *opt)
+{
+    memset(opt, 0, sizeof(*opt));
+    opt->r = 1;
+}
+
+// Stato del budget di una query durante la scansione (query.c / query64.c)
+typedef struct {
+    float  alpha;
+    size_t evals;       // distanze approssimate calcolate
+    size_t max_evals;   // 0 = illimitate
+    double deadline;    // istante limite (query_now_s), 0 = nessuno
+    int    partial;     // 1 se la scansione si è fermata per il budget
+} ScanBudget;
+
+// Secondi da un istante fisso (orologio monotono: QueryPerformanceCounter su
+// Windows, CLOCK_MONOTONIC altrove; src/query_opts.c)
+double query_now_s(void);
+
+// 1 se opt chiede un budget o un pruning rilassato
+static inline int query_budget_active(const QueryOptions *opt)
+{
+    return opt && ((opt->alpha > 0.0f && opt->alpha != 1.0f) || opt->max_evals > 0 || opt->deadline_ms > 0.0);
+}
+
+// Budget di una query che inizia adesso
+static inline void scan_budget_init(ScanBudget *b, const QueryOptions *opt)
+{
+    b->alpha     = opt->alpha > 0.0f ? opt->alpha : 1.0f;
+    b->evals     = 0;
+    b->max_evals = opt->max_evals;
+    b->deadline  = opt->deadline_ms > 0.0 ? query_now_s() + opt->deadline_ms * 1e-3 : 0.0;
+    b->partial   = 0;
+}
+
+// Prenota una distanza approssimata: 0 (e partial = 1) se max_evals è finito
+static inline int scan_budget_spend(ScanBudget *b)
+{
+    if (b->max_evals && b->evals >= b->max_evals) {
+        b->partial = 1;
+        return 0;
+    }
+    b->evals++;
+    return 1;
+}
+
+// Scadenza: letta una volta per blocco di righe della scansione, prima del
+// limite inferiore, e solo dopo la prima distanza calcolata (anche con una
+// scadenza già passata la query ha dei vicini). 0 (e partial = 1) se passata.
+static inline int scan_budget_check(ScanBudget *b)
+{
+    if (b->deadline > 0.0 && b->evals && query_now_s() >= b->deadline) {
+        b->partial = 1;
+        return 0;
+    }
+    return 1;
+}
+
+// Query preparate (prepare_queries / prepare_queries_f64): codici v+/v-
+// delle nq query e matrice nq x h delle distanze approssimate dai pivot,
+// calcolate in parallelo prima della scansione. Non dipende dalla precisione.
+typedef struct {
+    size_t   nq, D, h;  // D: passo delle righe dei codici (Index.Dp)
+    uint8_t *vp;     // nq x D, coda a zero
+    uint8_t *vn;     // nq x D
+    int     *dq;     // nq x h: d~(q_i, p_j)
+} QueryCodes;
+
+static inline void free_query_codes(QueryCodes *qc)
+{
+    if (!qc) return;
+    free(qc->vp);
+    free(qc->vn);
+    free(qc->dq);
+    free(qc);
+}
+
+static inline QueryCodes *query_codes_alloc(size_t nq, size_t D, size_t h)
+{
+    QueryCodes *qc = calloc(1, sizeof(QueryCodes));
+    if (!qc) return NULL;
+    qc->nq = nq;
+    qc->D  = D;
+    qc->h  = h;
+    qc->vp = calloc(nq * D, sizeof(uint8_t));
+    qc->vn = calloc(nq * D, sizeof(uint8_t));
+    qc->dq = malloc(nq * h * sizeof(int));
+    if (!qc->vp || !qc->vn || !qc->dq) {
+        free_query_codes(qc);
+        return NULL;
+    }
+    return qc;
+}
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef RESULT_WRITER_H
+#define RESULT_WRITER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "query.h"
+#include "query64.h"
+
+// Scrittura dei risultati K-NN (-o dei main): due file, gli id (int32) e le
+// distanze reali (float32, float64 per i main a 64 bit), nq x k ciascuno.
+// Dal percorso "base.ext" si ottengono "base_ids.ext" e "base_dst.ext",
+// come i file dei golden in data/:
+//   .npy        formato NumPy 1.0 (np.load), header allineato a 64 byte
+//   altrimenti  .ds2 (uint32 n, uint32 d, poi le righe), letto da load_matrix_*
+//
+// Le righe arrivano a blocchi (result_writer_put) mentre le query vengono
+// elaborate: i vicini sono separati in due buffer di RESULT_WRITER_BUF byte
+// e scritti con fwrite grandi, senza tenere in memoria la matrice nq x k.
+typedef struct ResultWriter ResultWriter;
+
+#define RESULT_WRITER_BUF   (1u << 20)  // byte per buffer (id e distanze)
+#define RESULT_WRITER_BLOCK 8192        // query per blocco nei main con -o
+
+// Crea i due file con l'intestazione per nq x k (f64: distanze double).
+// NULL su errore (percorso non scrivibile, memoria).
+ResultWriter *result_writer_open(const char *path, uint32_t nq, uint32_t k, int f64);
+
+// Accoda rows righe di k vicini (id, dist_real). 0 se ok, -1 su errore di
+// scrittura o oltre nq righe.
+int result_writer_put(ResultWriter *w, const Neighbor *nb, size_t rows);       // 32 bit
+int result_writer_put_f64(ResultWriter *w, const Neighbor64 *nb, size_t rows); // 64 bit
+
+// Calcolo di un blocco di query [q0, q0 + cnt): cnt x k vicini in results
+// (Neighbor, o Neighbor64 se il writer è a 64 bit)
+typedef void (*ResultBlockFn)(void *ctx, size_t q0, size_t cnt, void *results);
+
+// Righe mancanti del writer a blocchi di block query: fn calcola ogni
+// blocco in un buffer di block x k vicini, accodato subito ai file. 0 se
+// ok, -1 su errore di memoria o di scrittura (result_writer_close lo riporta).
+int result_writer_write_blocks(ResultWriter *w, size_t block, ResultBlockFn fn, void *ctx);
+
+// Percorsi dei due file
+const char *result_writer_ids_path(const ResultWriter *w);
+const char *result_writer_dst_path(const ResultWriter *w);
+
+// Svuota i buffer e chiude: -1 se una scrittura è fallita o le righe
+// ricevute non sono nq, e in quel caso i due file incompleti sono rimossi
+int result_writer_close(ResultWriter *w);
+
+#endif
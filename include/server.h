@@ -0,0 +1,138 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "async_opts.h"
+
+// Modalità server: l'indice resta in memoria e le richieste K-NN arrivano su
+// un socket Unix locale con un protocollo binario (solo Linux/macOS).
+//
+// Il server è indipendente dalla precisione: il motore (32 o 64 bit) è un
+// ServerBackend costruito dal chiamante tramite un ServerLoader, di solito
+// con async_server_backend(_f64). Le richieste concorrenti finiscono nella
+// stessa coda del motore asincrono e sono eseguite a tile (micro-batching).
+//
+// Tutti i campi sono nell'ordine dei byte dell'host (il client è sulla
+// stessa macchina). Ogni messaggio è un header seguito da un payload.
+//
+//   richiesta: ServerRequest, poi per SERVER_OP_QUERY nq x d elementi
+//              (float o double secondo ServerStats.elem_size)
+//   risposta : ServerResponse, poi len byte:
+//              SERVER_OP_QUERY -> nq x k int32 (id), nq x k distanze reali
+//              SERVER_OP_STATS -> ServerStats
+//
+// Le risposte di richieste diverse sulla stessa connessione possono
+// arrivare in ordine diverso da quello di invio: il campo id le distingue.
+
+#define SERVER_MAGIC 0x4B505153u   // "SQPK" in little endian
+
+enum {
+    SERVER_OP_QUERY  = 1,          // K-NN di nq query
+    SERVER_OP_STATS  = 2,          // contatori del server
+    SERVER_OP_RELOAD = 3           // ricarica dataset e indice (come SIGHUP)
+};
+
+enum {
+    SERVER_OK       = 0,
+    SERVER_EINVAL   = 1,           // header, flags o dimensioni non valide
+    SERVER_EBUSY    = 2,           // coda del motore piena, riprovare
+    SERVER_ENOMEM   = 3,
+    SERVER_ERELOAD  = 4            // ricarica fallita o già in corso
+};
+
+typedef struct {
+    uint32_t magic;
+    uint16_t op;
+    uint16_t flags;    // riservato: deve essere 0 (altrimenti SERVER_EINVAL)
+    uint32_t id;       // scelto dal client, ripetuto nella risposta
+    uint32_t nq;       // query nel payload (solo SERVER_OP_QUERY)
+    uint32_t k;
+    uint32_t d;        // dimensione delle query, uguale a quella del dataset
+} ServerRequest;
+
+typedef struct {
+    uint32_t magic;
+    uint16_t op;
+    uint16_t status;   // SERVER_OK o SERVER_E*
+    uint32_t id;
+    uint32_t nq;
+    uint32_t k;
+    uint32_t len;      // byte di payload che seguono
+} ServerResponse;
+
+// Istogramma delle latenze: il bucket b conta le richieste con latenza
+// (arrivo della richiesta -> risposta pronta) in [2^b, 2^(b+1)) us
+#define SERVER_LAT_BUCKETS 32
+
+typedef struct {
+    uint32_t elem_size;         // 4 = float, 8 = double
+    uint32_t d;
+    uint64_t n;                 // righe del dataset servito
+    uint64_t generation;        // ricariche completate
+    double   uptime_s;
+    double   qps;               // query/s dall'avvio
+    double   qps_recent;        // query/s negli ultimi secondi (SERVER_QPS_WINDOW)
+    uint64_t connections;       // connessioni aperte ora
+    uint64_t requests;          // richieste di query completate
+    uint64_t queries;
+    uint64_t errors;            // risposte con status != SERVER_OK
+    uint64_t tiles;             // tile eseguiti dai motori (anche prima delle ricariche)
+    uint64_t rejected;          // richieste respinte a coda piena (SERVER_EBUSY)
+    uint64_t scanned;           // punti esaminati dalle query (perf_scan_read)
+    uint64_t pruned;            // di cui scartati dal limite inferiore
+    double   prune_rate;        // pruned / scanned
+    double   lat_p50_us, lat_p95_us, lat_p99_us;
+    uint64_t lat_hist[SERVER_LAT_BUCKETS];
+    uint64_t cache_hits;        // query servite dalla cache del motore corrente
+    uint64_t cache_misses;
+} ServerStats;
+
+#define SERVER_QPS_WINDOW 10
+
+// Completamento di una ricerca: ids/dist (nq x k) valgono solo durante la
+// chiamata, NULL se la ricerca è fallita
+typedef void (*ServerDone)(void *tag, const int32_t *ids, const void *dist, size_t nq, int k);
+
+// Motore servito: dataset, indice e coda asincrona di una precisione
+typedef struct {
+    void    *ctx;
+    uint32_t elem_size;
+    uint32_t d;
+    uint64_t n;
+    // Accoda nq query (copiate); 0, ASYNC_FULL o -1
+    int  (*submit)(void *ctx, const void *q, size_t nq, int k, ServerDone done, void *tag);
+    void (*stats)(void *ctx, AsyncStats *out);
+    // Completa le richieste in coda e libera tutto
+    void (*close)(void *ctx);
+} ServerBackend;
+
+// Costruisce il motore (all'avvio e a ogni ricarica); 0 se riuscito
+typedef int (*ServerLoader)(void *user, ServerBackend *out);
+
+typedef struct {
+    int max_conn;      // connessioni contemporanee (default 256)
+    int max_query_mb;  // payload massimo di una richiesta in MB (default 64)
+    int max_out_mb;    // risposte in attesa di invio per connessione in MB (default 64);
+                       // limita anche la risposta di una richiesta (nq x k x (4 + elem_size))
+    int verbose;       // una riga su stdout per avvio, ricarica e arresto
+} ServerOptions;
+
+static inline void server_default_options(ServerOptions *opt)
+{
+    memset(opt, 0, sizeof(*opt));
+    opt->max_conn     = 256;
+    opt->max_query_mb = 64;
+    opt->max_out_mb   = 64;
+    opt->verbose      = 1;
+}
+
+// Crea il socket in path, carica il motore e serve fino a SIGINT/SIGTERM.
+// SIGHUP o SERVER_OP_RELOAD ricaricano il motore in un thread separato:
+// le richieste continuano sul motore vecchio finché il nuovo non è pronto,
+// poi il vecchio completa la propria coda e viene liberato.
+// Ritorna 0 all'arresto, -1 se il socket o il primo caricamento falliscono.
+int server_run(const char *path, ServerLoader load, void *user, const ServerOptions *opt);
+
+#endif
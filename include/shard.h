@@ -0,0 +1,47 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <stddef.h>
+#include "matrix.h"
+#include "index.h"
+
+// Indice partizionato: S blocchi contigui di righe, ognuno con i propri
+// pivot, codici e tabella delle distanze (un Index per shard).
+// Lo shard s copre le righe globali [offset[s], offset[s+1]).
+typedef struct {
+    size_t  S;          // numero di shard
+    size_t  n;          // righe totali
+    size_t  D;          // dimensione vettori
+    int     h;          // pivot per shard
+    int     x;          // parametro di quantizzazione
+    size_t *offset;     // S + 1 confini di riga
+    Index **shards;     // S indici locali (id locali 0..n_s-1)
+} ShardedIndex;
+
+// Costruzione in parallelo (un task per shard sul pool condiviso). S viene
+// ridotto se le righe non bastano per h pivot in ogni shard.
+ShardedIndex *build_sharded_index(const MatrixF32 *ds, int S, int h, int x);     // 32 bit
+ShardedIndex *build_sharded_index_f64(const MatrixF64 *ds, int S, int h, int x); // 64 bit
+
+// Ricostruisce solo lo shard s dalle righe correnti di ds (stesse n, D).
+// Non va eseguita in concorrenza con query sullo stesso indice.
+// Ritorna 0, -1 su errore (lo shard precedente resta valido).
+int rebuild_shard(ShardedIndex *sx, const MatrixF32 *ds, size_t s);
+int rebuild_shard_f64(ShardedIndex *sx, const MatrixF64 *ds, size_t s);
+
+// index_sort_pivots su ogni shard. Ritorna 0, -1 su errore.
+int sharded_sort_pivots(ShardedIndex *sx, int m);
+
+// index_build_cascade su ogni shard. Ritorna 0, -1 su errore.
+int sharded_build_cascade(ShardedIndex *sx, int m);
+
+void free_sharded_index(ShardedIndex *sx);
+
+// Somma di index_memory_bytes sugli shard
+size_t sharded_memory_bytes(const ShardedIndex *sx);
+
+// Viste (senza copia) sulle righe dello shard s
+MatrixF32 shard_view(const MatrixF32 *ds, const ShardedIndex *sx, size_t s);
+MatrixF64 shard_view_f64(const MatrixF64 *ds, const ShardedIndex *sx, size_t s);
+
+#endif
@@ -2,6 +2,6 @@
 32-bit Quantized Pivot Indexing
 """
 
-from ._quantpivot32 import QuantPivot
+from ._quantpivot32 import QuantPivot, configure_pool
 
-__all__ = ['QuantPivot']
+__all__ = ['QuantPivot', 'configure_pool']
@@ -2,6 +2,6 @@
 64-bit Quantized Pivot Indexing
 """
 
-from ._quantpivot64 import QuantPivot
+from ._quantpivot64 import QuantPivot, configure_pool
 
-__all__ = ['QuantPivot']
+__all__ = ['QuantPivot', 'configure_pool']
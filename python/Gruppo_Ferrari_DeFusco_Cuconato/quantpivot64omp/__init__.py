@@ -2,6 +2,6 @@
 64-bit Quantized Pivot Indexing win OpenMP
 """
 
-from ._quantpivot64omp import QuantPivot
+from ._quantpivot64omp import QuantPivot, configure_pool
 
-__all__ = ['QuantPivot']
+__all__ = ['QuantPivot', 'configure_pool']
@@ -14,17 +14,20 @@ INCLUDE_DIRS = [np.get_include(), "include"]
 
 # Sorgenti C condivisi (il calcolo passa per gli INTRINSECI SIMD in distance.c,
 # portabili su Linux/gcc, Windows/MSVC e macOS/clang).
-CORE = ("index.c", "quantization.c", "matrix.c", "distance.c")
+CORE = ("index.c", "quantization.c", "matrix.c", "matrix_formats.c", "distance.c", "perfcount.c", "shard.c", "affinity.c", "pool.c", "ivf.c", "hnsw.c", "query_cache.c", "query_opts.c", "pq.c", "result_writer.c", "server.c")
+# Sorgenti specifici della precisione (query con pruning, K-NN esatto, autotune)
+SRC32 = ("query.c", "exact.c", "autotune.c", "async.c")
+SRC64 = ("query64.c", "exact64.c", "autotune64.c", "async64.c")
 
 
 def s(*names):
     return [os.path.join("src", n) for n in names]
 
 
-def make_ext(modname, wrapper, query_src, macros, simd, omp):
+def make_ext(modname, wrapper, prec_srcs, macros, simd, omp):
     ext = Extension(
         f"{PKG}.{modname}._{modname}",
-        sources=s(wrapper, query_src, *CORE),
+        sources=s(wrapper, *prec_srcs, *CORE),
         include_dirs=INCLUDE_DIRS,
         define_macros=macros,
     )
@@ -35,11 +38,11 @@ def make_ext(modname, wrapper, query_src, macros, simd, omp):
 
 
 # 32-bit SSE2 (float) | 64-bit AVX2 (double) | 64-bit AVX2 + OpenMP
-module32 = make_ext("quantpivot32", "quantpivot32_py.c", "query.c",
+module32 = make_ext("quantpivot32", "quantpivot32_py.c", SRC32,
                     [("USE_SSE2", None)], "sse2", False)
-module64 = make_ext("quantpivot64", "quantpivot64_py.c", "query64.c",
+module64 = make_ext("quantpivot64", "quantpivot64_py.c", SRC64,
                     [("USE_AVX", None), ("QP_DOUBLE", None)], "avx2", False)
-module64omp = make_ext("quantpivot64omp", "quantpivot64omp_py.c", "query64.c",
+module64omp = make_ext("quantpivot64omp", "quantpivot64omp_py.c", SRC64,
                        [("USE_AVX", None), ("QP_DOUBLE", None)], "avx2", True)
 
 
@@ -61,8 +64,9 @@ class build_ext_portable(build_ext):
                     ca.append("/openmp")
                 ext.extra_compile_args, ext.extra_link_args = ca, []
             else:  # gcc / clang / mingw32
-                ca = ["-O3", "-mavx2" if simd == "avx2" else "-msse2"]
-                la = []
+                # -pthread: pool di thread persistente (src/pool.c)
+                ca = ["-O3", "-mavx2" if simd == "avx2" else "-msse2", "-pthread"]
+                la = ["-pthread"]
                 if omp:
                     ca.append("-fopenmp")
                     la.append("-fopenmp")
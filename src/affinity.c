@@ -0,0 +1,313 @@
+#define _GNU_SOURCE
+#include "affinity.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+int pin_policy_from_name(const char *name)
+{
+    if (!name) return -1;
+    if (strcmp(name, "none") == 0)    return PIN_NONE;
+    if (strcmp(name, "compact") == 0) return PIN_COMPACT;
+    if (strcmp(name, "scatter") == 0) return PIN_SCATTER;
+    return -1;
+}
+
+int place_policy_from_name(const char *name)
+{
+    if (!name) return -1;
+    if (strcmp(name, "default") == 0)    return PLACE_DEFAULT;
+    if (strcmp(name, "interleave") == 0) return PLACE_INTERLEAVE;
+    if (strcmp(name, "replica") == 0)    return PLACE_REPLICA;
+    return -1;
+}
+
+#if defined(__linux__)
+
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+// Costanti di <numaif.h>: non serve libnuma, mbind è una system call
+#define QP_MPOL_BIND        2
+#define QP_MPOL_INTERLEAVE  3
+#define QP_MPOL_MF_MOVE     (1 << 1)
+
+#define MAX_CPUS  1024
+#define MAX_NODES 64
+
+// ------------------ TOPOLOGIA ----------------------
+//
+// Letta una sola volta da /sys/devices/system/node/node<N>/cpulist.
+// cpus[] elenca le CPU online nodo per nodo (prima tutte quelle del
+// nodo 0, poi del nodo 1, ...): è l'ordine usato da PIN_COMPACT.
+//
+// ---------------------------------------------------
+
+static int topo_ready = 0;
+static int topo_nodes = 1;
+static int cpu_node[MAX_CPUS];
+static int node_first[MAX_NODES + 1];  // cpus[node_first[n] .. node_first[n+1])
+static int cpus[MAX_CPUS];
+
+// Lista nel formato del kernel: "0-3,8-11"
+static int parse_cpulist(const char *s, int node, int pos)
+{
+    while (*s && pos < MAX_CPUS) {
+        char *end;
+        long a = strtol(s, &end, 10), b = a;
+        if (end == s) break;
+        if (*end == '-') b = strtol(end + 1, &end, 10);
+        for (long c = a; c <= b && pos < MAX_CPUS; c++)
+            if (c >= 0 && c < MAX_CPUS) {
+                cpu_node[c] = node;
+                cpus[pos++] = (int)c;
+            }
+        s = (*end == ',') ? end + 1 : end;
+        if (*s == '\n') break;
+    }
+    return pos;
+}
+
+static void topo_init(void)
+{
+    if (topo_ready) return;
+
+    int pos = 0, nodes = 0;
+    for (int n = 0; n < MAX_NODES; n++) {
+        char path[96], line[4096];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", n);
+        FILE *f = fopen(path, "r");
+        if (!f) break;
+        node_first[n] = pos;
+        if (fgets(line, sizeof(line), f)) pos = parse_cpulist(line, n, pos);
+        fclose(f);
+        nodes++;
+    }
+
+    // Nessuna informazione NUMA: un solo nodo con le CPU online
+    if (nodes == 0 || pos == 0) {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        if (ncpu < 1) ncpu = 1;
+        if (ncpu > MAX_CPUS) ncpu = MAX_CPUS;
+        for (pos = 0; pos < ncpu; pos++) { cpus[pos] = pos; cpu_node[pos] = 0; }
+        nodes = 1;
+        node_first[0] = 0;
+    }
+    node_first[nodes] = pos;
+
+    topo_nodes = nodes;
+    topo_ready = 1;
+}
+
+int affinity_nodes(void)
+{
+    topo_init();
+    return topo_nodes;
+}
+
+int affinity_current_node(void)
+{
+    if (!topo_ready || topo_nodes == 1) return 0;
+    int c = sched_getcpu();
+    return (c >= 0 && c < MAX_CPUS) ? cpu_node[c] : 0;
+}
+
+// CPU assegnata al thread t
+static int pick_cpu(int t, PinPolicy policy)
+{
+    int total = node_first[topo_nodes];
+    if (policy == PIN_SCATTER) {
+        int n   = t % topo_nodes;
+        int cnt = node_first[n + 1] - node_first[n];
+        if (cnt > 0) return cpus[node_first[n] + (t / topo_nodes) % cnt];
+    }
+    return cpus[t % total];
+}
+
+static int pin_self(int cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set) == 0;   // 0 = thread chiamante
+}
+
+int affinity_pin_threads(int threads, PinPolicy policy)
+{
+    topo_init();
+    if (policy == PIN_NONE || threads < 1) return 0;
+
+    int pinned = 0;
+#ifdef _OPENMP
+    #pragma omp parallel num_threads(threads) reduction(+:pinned)
+    pinned += pin_self(pick_cpu(omp_get_thread_num(), policy));
+#else
+    pinned = pin_self(pick_cpu(0, policy));
+#endif
+    return pinned;
+}
+
+// ------------------ COLLOCAZIONE DELLE PAGINE ----------------------
+
+static long mbind_range(void *p, size_t bytes, int mode, const unsigned long *mask, unsigned flags)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    uintptr_t a = ((uintptr_t)p + page - 1) & ~(uintptr_t)(page - 1);
+    uintptr_t b = ((uintptr_t)p + bytes) & ~(uintptr_t)(page - 1);
+
+    // Meno di una pagina intera: nulla da spostare
+    if (!p || b <= a) return 0;
+    return syscall(SYS_mbind, (void *)a, (unsigned long)(b - a), mode,
+                   mask, (unsigned long)MAX_NODES + 1, flags);
+}
+
+int index_interleave(Index *idx)
+{
+    if (!idx) return -1;
+    topo_init();
+
+    unsigned long mask = 0;
+    for (int n = 0; n < topo_nodes; n++) mask |= 1UL << n;
+
+    // Tutta l'arena: codici e tabella sono quasi tutto il suo contenuto
+    return mbind_range(idx->arena, idx->arena_bytes, QP_MPOL_INTERLEAVE, &mask, QP_MPOL_MF_MOVE) ? -1 : 0;
+}
+
+// Lega [p, p + bytes) al nodo (prima della prima scrittura, o spostando le
+// pagine già presenti)
+static void node_bind(void *p, size_t bytes, int node)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    if (topo_nodes > 1) {
+        unsigned long mask = 1UL << node;
+        mbind_range(p, (bytes + page - 1) & ~(page - 1), QP_MPOL_BIND, &mask, QP_MPOL_MF_MOVE);
+    }
+}
+
+// Buffer allineato alla pagina e legato al nodo prima della prima scrittura:
+// la copia che segue alloca le pagine direttamente sul nodo
+static void *node_alloc(size_t bytes, int node)
+{
+    void *p = NULL;
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    if (bytes == 0) bytes = 1;
+    if (posix_memalign(&p, page, bytes) != 0) return NULL;
+
+    node_bind(p, bytes, node);
+    return p;
+}
+
+#else   // ---- fuori da Linux: un solo nodo, nessun pinning ----
+
+int affinity_nodes(void) { return 1; }
+int affinity_current_node(void) { return 0; }
+int affinity_pin_threads(int threads, PinPolicy policy) { (void)threads; (void)policy; return 0; }
+int index_interleave(Index *idx) { (void)idx; return -1; }
+
+static void node_bind(void *p, size_t bytes, int node) { (void)p; (void)bytes; (void)node; }
+
+static void *node_alloc(size_t bytes, int node)
+{
+    (void)node;
+    return malloc(bytes ? bytes : 1);
+}
+
+#endif
+
+// ------------------ REPLICHE PER NODO ----------------------
+
+static void *node_copy(const void *src, size_t bytes, int node)
+{
+    void *p = node_alloc(bytes, node);
+    if (p && bytes) memcpy(p, src, bytes);
+    return p;
+}
+
+static Index *index_copy_to_node(const Index *src, int node)
+{
+    Index *idx = calloc(1, sizeof(Index));
+    if (!idx) return NULL;
+
+    idx->n = src->n;
+    idx->h = src->h;
+    idx->D = src->D;
+    idx->bits = src->bits;
+    idx->version = src->version;   // stesso contenuto: stessi candidati
+
+    // Stessa disposizione dell'arena di src: una sola copia
+    if (index_alloc_arena(idx) != 0) {
+        free(idx);
+        return NULL;
+    }
+    size_t used = (size_t)((const uint8_t *)(src->dist + src->n * src->h) - (const uint8_t *)src->arena);
+    node_bind(idx->arena, idx->arena_bytes, node);
+    memcpy(idx->arena, src->arena, used);
+
+    if (src->n_sorted > 0) {
+        size_t ns = (size_t)src->n_sorted * src->n;
+        idx->sorted_id  = node_copy(src->sorted_id, ns * sizeof(uint32_t), node);
+        idx->sorted_key = node_copy(src->sorted_key, ns * sizeof(int), node);
+        if (!idx->sorted_id || !idx->sorted_key) {
+            free_index(idx);
+            return NULL;
+        }
+        idx->n_sorted = src->n_sorted;
+        memcpy(idx->sorted_piv, src->sorted_piv, sizeof(idx->sorted_piv));
+    }
+    if (src->n_hot > 0) {
+        idx->hot_dist   = node_copy(src->hot_dist, src->n * (size_t)src->n_hot * sizeof(int), node);
+        idx->piv_center = node_copy(src->piv_center, src->h * sizeof(int), node);
+        if (!idx->hot_dist || !idx->piv_center) {
+            free_index(idx);
+            return NULL;
+        }
+        idx->n_hot = src->n_hot;
+        memcpy(idx->hot_piv, src->hot_piv, sizeof(idx->hot_piv));
+    }
+    return idx;
+}
+
+IndexReplicas *index_replicate(const Index *idx)
+{
+    if (!idx) return NULL;
+
+    IndexReplicas *rep = calloc(1, sizeof(IndexReplicas));
+    if (!rep) return NULL;
+
+    rep->nodes = affinity_nodes();
+    rep->idx   = calloc((size_t)rep->nodes, sizeof(Index *));
+    if (!rep->idx) {
+        free(rep);
+        return NULL;
+    }
+
+    for (int n = 0; n < rep->nodes; n++) {
+        rep->idx[n] = index_copy_to_node(idx, n);
+        if (!rep->idx[n]) {
+            free_index_replicas(rep);
+            return NULL;
+        }
+    }
+    return rep;
+}
+
+const Index *index_replica_local(const IndexReplicas *rep)
+{
+    int n = affinity_current_node();
+    return rep->idx[n < rep->nodes ? n : 0];
+}
+
+void free_index_replicas(IndexReplicas *rep)
+{
+    if (!rep) return;
+    if (rep->idx)
+        for (int n = 0; n < rep->nodes; n++) free_index(rep->idx[n]);
+    free(rep->idx);
+    free(rep);
+}
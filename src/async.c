@@ -0,0 +1,506 @@
+#include "async.h"
+#include "pool.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// ------------------ RICHIESTE E TILE ----------------------
+//
+// Una richiesta è referenziata dal motore (fino al completamento) e, se il
+// chiamante ha chiesto l'handle, dal chiamante (fino a async_release):
+// l'ultimo dei due la libera. Il tile è una lista di coppie (richiesta,
+// query) distribuite sul pool a blocchi di TILE_CHUNK.
+//
+// ----------------------------------------------------------
+
+#define TILE_CHUNK 4
+
+// refs e done sono condivisi fra il thread del motore e i chiamanti. Con
+// MSVC (solo motore sincrono, vedi in fondo) bastano accessi ordinari.
+#if defined(_MSC_VER)
+#define REF_DEC(p)      (--*(p))
+#define DONE_LOAD(p)    (*(p))
+#define DONE_STORE(p)   (*(p) = 1)
+#else
+#define REF_DEC(p)      __atomic_sub_fetch((p), 1, __ATOMIC_ACQ_REL)
+#define DONE_LOAD(p)    __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define DONE_STORE(p)   __atomic_store_n((p), 1, __ATOMIC_RELEASE)
+#endif
+
+struct AsyncRequest {
+    AsyncEngine   *eng;
+    size_t         nq;
+    int            k;
+    float         *q;        // copia delle query (nq x D)
+    Neighbor      *res;      // nq x k
+    AsyncCallback  cb;
+    void          *user;
+    int            refs;     // atomico
+    int            done;     // atomico
+    AsyncRequest  *next;
+};
+
+typedef struct {
+    AsyncRequest *req;
+    size_t        qi;
+} TileItem;
+
+typedef struct {
+    const AsyncEngine *eng;
+    const TileItem    *items;
+} TileTask;
+
+static AsyncRequest *request_new(AsyncEngine *eng, const float *queries, size_t nq, size_t D, int k,
+                                 AsyncCallback cb, void *user, int caller_ref)
+{
+    AsyncRequest *r = calloc(1, sizeof(AsyncRequest));
+    if (!r) return NULL;
+
+    r->q   = malloc(nq * D * sizeof(float));
+    r->res = malloc(nq * (size_t)k * sizeof(Neighbor));
+    if (!r->q || !r->res) {
+        free(r->q);
+        free(r->res);
+        free(r);
+        return NULL;
+    }
+    memcpy(r->q, queries, nq * D * sizeof(float));
+
+    r->eng  = eng;
+    r->nq   = nq;
+    r->k    = k;
+    r->cb   = cb;
+    r->user = user;
+    r->refs = 1 + (caller_ref ? 1 : 0);
+    return r;
+}
+
+static void request_unref(AsyncRequest *r)
+{
+    if (REF_DEC(&r->refs) == 0) {
+        free(r->q);
+        free(r->res);
+        free(r);
+    }
+}
+
+int async_poll(const AsyncRequest *req)
+{
+    return req ? DONE_LOAD(&req->done) : 1;
+}
+
+const Neighbor *async_results(const AsyncRequest *req, size_t *nq, int *k)
+{
+    if (!req || !async_poll(req)) return NULL;
+    if (nq) *nq = req->nq;
+    if (k)  *k  = req->k;
+    return req->res;
+}
+
+void async_release(AsyncRequest *req)
+{
+    if (req) request_unref(req);
+}
+
+// ------------------ BACKEND DEL SERVER ----------------------
+
+typedef struct {
+    AsyncEngine *eng;
+    MatrixF32    ds;
+    Index       *idx;
+} ServerCtx;
+
+typedef struct {
+    ServerDone done;
+    void      *tag;
+} ServerReq;
+
+// Vicini -> id int32 + distanze reali, poi risposta del server
+static void server_complete(AsyncRequest *req, void *user)
+{
+    ServerReq *sr = (ServerReq *)user;
+    size_t nq = 0;
+    int k = 0;
+    const Neighbor *res = async_results(req, &nq, &k);
+
+    size_t m = nq * (size_t)k;
+    int32_t *ids  = malloc(m * sizeof(int32_t));
+    float   *dist = malloc(m * sizeof(float));
+
+    if (res && ids && dist) {
+        for (size_t i = 0; i < m; i++) {
+            ids[i]  = res[i].id;
+            dist[i] = res[i].dist_real;
+        }
+        sr->done(sr->tag, ids, dist, nq, k);
+    } else
+        sr->done(sr->tag, NULL, NULL, nq, k);
+
+    free(ids);
+    free(dist);
+    free(sr);
+}
+
+static int server_submit(void *ctx, const void *q, size_t nq, int k, ServerDone done, void *tag)
+{
+    ServerReq *sr = malloc(sizeof(ServerReq));
+    if (!sr) return -1;
+    sr->done = done;
+    sr->tag  = tag;
+
+    int ret = async_submit(((ServerCtx *)ctx)->eng, (const float *)q, nq, k, server_complete, sr, NULL);
+    if (ret != 0) free(sr);
+    return ret;
+}
+
+static void server_stats(void *ctx, AsyncStats *out)
+{
+    async_engine_stats(((ServerCtx *)ctx)->eng, out);
+}
+
+static void server_close(void *ctx)
+{
+    ServerCtx *sc = (ServerCtx *)ctx;
+    async_engine_destroy(sc->eng);
+    free_index(sc->idx);
+    free_matrix_f32(&sc->ds);
+    free(sc);
+}
+
+int async_server_backend(AsyncEngine *eng, MatrixF32 *ds, Index *idx, ServerBackend *out)
+{
+    if (!eng || !ds || !idx || !out) return -1;
+
+    ServerCtx *sc = malloc(sizeof(ServerCtx));
+    if (!sc) return -1;
+    sc->eng = eng;
+    sc->ds  = *ds;
+    sc->idx = idx;
+
+    out->ctx       = sc;
+    out->elem_size = sizeof(float);
+    out->d         = ds->d;
+    out->n         = ds->n;
+    out->submit    = server_submit;
+    out->stats     = server_stats;
+    out->close     = server_close;
+    return 0;
+}
+
+// Contatori della cache (zero senza cache)
+static void cache_stats(QueryCache *c, AsyncStats *out)
+{
+    QueryCacheStats cs;
+    query_cache_stats(c, &cs);
+    out->cache_hits   = cs.hits;
+    out->cache_misses = cs.misses;
+}
+
+#if !defined(_WIN32)
+
+#include <pthread.h>
+#include <time.h>
+
+struct AsyncEngine {
+    MatrixF32     ds;
+    const Index  *idx;
+    int           x;
+    AsyncOptions  opt;
+    QueryCache   *cache;        // NULL se opt.cache_entries = 0
+
+    pthread_t       th;
+    pthread_mutex_t lock;
+    pthread_cond_t  nonempty;    // dispatcher <- nuove richieste
+    pthread_cond_t  nonfull;     // submit <- spazio in coda
+    pthread_cond_t  done;        // async_wait <- richieste completate
+    AsyncRequest   *head, *tail;
+    size_t          queued;      // richieste in coda
+    size_t          queued_q;    // query in coda
+    int             stop;
+
+    AsyncStats      stats;
+};
+
+static void tile_task(void *ctx, size_t begin, size_t end, int tid)
+{
+    const TileTask *t = (const TileTask *)ctx;
+    const AsyncEngine *e = t->eng;
+    (void)tid;
+
+    for (size_t i = begin; i < end; i++) {
+        AsyncRequest *r = t->items[i].req;
+        size_t qi = t->items[i].qi;
+        knn_query_single_cached(&e->ds, e->idx, &r->q[qi * e->ds.d], r->k, e->x, e->cache, &r->res[qi * r->k]);
+    }
+}
+
+static void deadline_after_us(struct timespec *ts, long us)
+{
+    clock_gettime(CLOCK_REALTIME, ts);
+    ts->tv_sec  += us / 1000000;
+    ts->tv_nsec += (us % 1000000) * 1000;
+    if (ts->tv_nsec >= 1000000000L) { ts->tv_sec++; ts->tv_nsec -= 1000000000L; }
+}
+
+static void *dispatcher_main(void *arg)
+{
+    AsyncEngine *e = (AsyncEngine *)arg;
+    size_t cap = (size_t)e->opt.max_batch;
+    TileItem *items = NULL;
+    size_t items_cap = 0;
+
+    pthread_mutex_lock(&e->lock);
+    for (;;) {
+        while (!e->head && !e->stop)
+            pthread_cond_wait(&e->nonempty, &e->lock);
+        if (!e->head) break;    // stop e coda vuota
+
+        // Micro-batching: si aspetta che il tile si riempia, al più max_wait_us
+        if (e->queued_q < cap && e->opt.max_wait_us > 0 && !e->stop) {
+            struct timespec dl;
+            deadline_after_us(&dl, e->opt.max_wait_us);
+            while (e->queued_q < cap && !e->stop)
+                if (pthread_cond_timedwait(&e->nonempty, &e->lock, &dl) != 0) break;
+        }
+
+        // Richieste intere fino a max_batch query (almeno una)
+        AsyncRequest *batch = e->head, *last = NULL;
+        size_t nq = 0, nreq = 0;
+        for (AsyncRequest *r = e->head; r; r = r->next) {
+            if (nreq > 0 && nq + r->nq > cap) break;
+            nq += r->nq;
+            nreq++;
+            last = r;
+        }
+        e->head = last->next;
+        if (!e->head) e->tail = NULL;
+        last->next = NULL;
+        e->queued   -= nreq;
+        e->queued_q -= nq;
+        pthread_cond_broadcast(&e->nonfull);
+        pthread_mutex_unlock(&e->lock);
+
+        if (nq > items_cap) {
+            TileItem *tmp = realloc(items, nq * sizeof(TileItem));
+            if (tmp) { items = tmp; items_cap = nq; }
+        }
+
+        if (nq <= items_cap) {
+            size_t n = 0;
+            for (AsyncRequest *r = batch; r; r = r->next)
+                for (size_t qi = 0; qi < r->nq; qi++) { items[n].req = r; items[n].qi = qi; n++; }
+            TileTask t = { e, items };
+            pool_parallel_for(pool_default(), e->opt.num_threads, n, TILE_CHUNK, tile_task, &t);
+        } else {
+            // Memoria insufficiente per il tile: una richiesta alla volta
+            for (AsyncRequest *r = batch; r; r = r->next) {
+                MatrixF32 qs = { .n = (uint32_t)r->nq, .d = e->ds.d, .data = r->q };
+                knn_query_all(&e->ds, e->idx, &qs, r->k, e->x, r->res);
+            }
+        }
+
+        pthread_mutex_lock(&e->lock);
+        e->stats.completed += nreq;
+        e->stats.queries   += nq;
+        e->stats.tiles++;
+        for (AsyncRequest *r = batch; r; r = r->next)
+            DONE_STORE(&r->done);
+        pthread_cond_broadcast(&e->done);
+        pthread_mutex_unlock(&e->lock);
+
+        // Callback fuori dal lock: possono rilasciare la richiesta
+        for (AsyncRequest *r = batch, *nx; r; r = nx) {
+            nx = r->next;
+            if (r->cb) r->cb(r, r->user);
+            request_unref(r);
+        }
+
+        pthread_mutex_lock(&e->lock);
+    }
+    pthread_mutex_unlock(&e->lock);
+
+    free(items);
+    return NULL;
+}
+
+AsyncEngine *async_engine_create(const MatrixF32 *ds, const Index *idx, int x, const AsyncOptions *opt)
+{
+    if (!ds || !idx) return NULL;
+
+    AsyncEngine *e = calloc(1, sizeof(AsyncEngine));
+    if (!e) return NULL;
+
+    e->ds  = *ds;
+    e->idx = idx;
+    e->x   = x;
+    if (opt) e->opt = *opt;
+    else     async_default_options(&e->opt);
+    if (e->opt.queue_cap < 1) e->opt.queue_cap = 1;
+    if (e->opt.max_batch < 1) e->opt.max_batch = 1;
+    if (e->opt.cache_entries > 0) e->cache = query_cache_create((size_t)e->opt.cache_entries);
+
+    pthread_mutex_init(&e->lock, NULL);
+    pthread_cond_init(&e->nonempty, NULL);
+    pthread_cond_init(&e->nonfull, NULL);
+    pthread_cond_init(&e->done, NULL);
+
+    if (pthread_create(&e->th, NULL, dispatcher_main, e) != 0) {
+        pthread_mutex_destroy(&e->lock);
+        pthread_cond_destroy(&e->nonempty);
+        pthread_cond_destroy(&e->nonfull);
+        pthread_cond_destroy(&e->done);
+        query_cache_free(e->cache);
+        free(e);
+        return NULL;
+    }
+    return e;
+}
+
+void async_engine_destroy(AsyncEngine *e)
+{
+    if (!e) return;
+
+    pthread_mutex_lock(&e->lock);
+    e->stop = 1;
+    pthread_cond_broadcast(&e->nonempty);
+    pthread_cond_broadcast(&e->nonfull);
+    pthread_mutex_unlock(&e->lock);
+
+    pthread_join(e->th, NULL);
+
+    pthread_mutex_destroy(&e->lock);
+    pthread_cond_destroy(&e->nonempty);
+    pthread_cond_destroy(&e->nonfull);
+    pthread_cond_destroy(&e->done);
+    query_cache_free(e->cache);
+    free(e);
+}
+
+void async_engine_stats(AsyncEngine *e, AsyncStats *out)
+{
+    if (!e || !out) return;
+    pthread_mutex_lock(&e->lock);
+    *out = e->stats;
+    pthread_mutex_unlock(&e->lock);
+    cache_stats(e->cache, out);
+}
+
+int async_submit(AsyncEngine *e, const float *queries, size_t nq, int k,
+                 AsyncCallback cb, void *user, AsyncRequest **out)
+{
+    if (out) *out = NULL;
+    if (!e || !queries || nq == 0 || k <= 0) return -1;
+
+    AsyncRequest *r = request_new(e, queries, nq, e->ds.d, k, cb, user, out != NULL);
+    if (!r) return -1;
+
+    pthread_mutex_lock(&e->lock);
+    while (e->queued >= (size_t)e->opt.queue_cap && !e->stop) {
+        if (e->opt.nonblocking) {
+            e->stats.rejected++;
+            pthread_mutex_unlock(&e->lock);
+            free(r->q); free(r->res); free(r);
+            return ASYNC_FULL;
+        }
+        pthread_cond_wait(&e->nonfull, &e->lock);
+    }
+    if (e->stop) {
+        pthread_mutex_unlock(&e->lock);
+        free(r->q); free(r->res); free(r);
+        return -1;
+    }
+
+    if (e->tail) e->tail->next = r;
+    else         e->head = r;
+    e->tail = r;
+    e->queued++;
+    e->queued_q += nq;
+    e->stats.submitted++;
+    pthread_cond_signal(&e->nonempty);
+    pthread_mutex_unlock(&e->lock);
+
+    if (out) *out = r;
+    return 0;
+}
+
+void async_wait(AsyncRequest *r)
+{
+    if (!r || async_poll(r)) return;
+
+    AsyncEngine *e = r->eng;
+    pthread_mutex_lock(&e->lock);
+    while (!async_poll(r))
+        pthread_cond_wait(&e->done, &e->lock);
+    pthread_mutex_unlock(&e->lock);
+}
+
+#else   // ---- Windows: esecuzione sincrona in async_submit ----
+
+struct AsyncEngine {
+    MatrixF32     ds;
+    const Index  *idx;
+    int           x;
+    AsyncOptions  opt;
+    QueryCache   *cache;        // NULL se opt.cache_entries = 0
+    AsyncStats    stats;
+};
+
+AsyncEngine *async_engine_create(const MatrixF32 *ds, const Index *idx, int x, const AsyncOptions *opt)
+{
+    if (!ds || !idx) return NULL;
+    AsyncEngine *e = calloc(1, sizeof(AsyncEngine));
+    if (!e) return NULL;
+    e->ds  = *ds;
+    e->idx = idx;
+    e->x   = x;
+    if (opt) e->opt = *opt;
+    else     async_default_options(&e->opt);
+    if (e->opt.cache_entries > 0) e->cache = query_cache_create((size_t)e->opt.cache_entries);
+    return e;
+}
+
+void async_engine_destroy(AsyncEngine *e)
+{
+    if (!e) return;
+    query_cache_free(e->cache);
+    free(e);
+}
+
+void async_engine_stats(AsyncEngine *e, AsyncStats *out)
+{
+    if (!e || !out) return;
+    *out = e->stats;
+    cache_stats(e->cache, out);
+}
+
+int async_submit(AsyncEngine *e, const float *queries, size_t nq, int k,
+                 AsyncCallback cb, void *user, AsyncRequest **out)
+{
+    if (out) *out = NULL;
+    if (!e || !queries || nq == 0 || k <= 0) return -1;
+
+    AsyncRequest *r = request_new(e, queries, nq, e->ds.d, k, cb, user, out != NULL);
+    if (!r) return -1;
+
+    MatrixF32 qs = { .n = (uint32_t)nq, .d = e->ds.d, .data = r->q };
+    QueryOptions qo;
+    query_default_options(&qo);
+    qo.num_threads = e->opt.num_threads;
+    qo.cache       = e->cache;
+    knn_query_all_opt(&e->ds, e->idx, &qs, k, e->x, &qo, r->res);
+
+    e->stats.submitted++;
+    e->stats.completed++;
+    e->stats.queries += nq;
+    e->stats.tiles++;
+    DONE_STORE(&r->done);
+
+    if (out) *out = r;
+    if (cb) cb(r, user);
+    request_unref(r);
+    return 0;
+}
+
+void async_wait(AsyncRequest *r) { (void)r; }
+
+#endif
@@ -0,0 +1,229 @@
+#include "autotune.h"
+#include "query.h"
+#include "exact.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// ------------------ RICERCA AUTOMATICA DI (h, x, r) ----------------------
+//
+// 1. campione casuale di sample_n righe del dataset e sample_q query;
+// 2. vicini esatti del campione (exact_knn) come riferimento;
+// 3. per ogni (h, x) che rispetta il budget di memoria (stimato sul dataset
+//    completo) si costruisce l'indice sul campione e si provano i fattori di
+//    re-rank r in ordine crescente: il primo che raggiunge la recall chiude
+//    la riga, perché r maggiori sono solo più lenti;
+// 4. vince la configurazione più veloce che rispetta entrambi i vincoli.
+//
+// --------------------------------------------------------------------------
+
+static const int DEFAULT_H[] = { 4, 8, 16, 32, 64 };
+static const int DEFAULT_R[] = { 1, 2, 4, 8, 16, 32, 64, 128, 256 };
+
+static int cmp_size(const void *a, const void *b)
+{
+    size_t A = *(const size_t *)a, B = *(const size_t *)b;
+    return (A > B) - (A < B);
+}
+
+static unsigned xorshift32(unsigned *s)
+{
+    unsigned x = *s;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *s = x;
+}
+
+// Copia le righe perm[0..m) di src in dst (m x D)
+static int gather_rows(const MatrixF32 *src, const size_t *perm, size_t m, MatrixF32 *dst)
+{
+    size_t D = src->d;
+    dst->n = (uint32_t)m;
+    dst->d = src->d;
+    dst->data = (float *)malloc(m * D * sizeof(float));
+    if (!dst->data) return -1;
+    for (size_t i = 0; i < m; i++)
+        memcpy(&dst->data[i * D], &src->data[perm[i] * D], D * sizeof(float));
+    return 0;
+}
+
+static double recall_at_k(const Neighbor *res, const Neighbor *truth, size_t nq, int k)
+{
+    size_t hit = 0;
+    for (size_t q = 0; q < nq; q++)
+        for (int a = 0; a < k; a++) {
+            int id = res[q * k + a].id;
+            if (id < 0) continue;
+            for (int b = 0; b < k; b++)
+                if (truth[q * k + b].id == id) { hit++; break; }
+        }
+    return nq ? (double)hit / (double)(nq * (size_t)k) : 0.0;
+}
+
+// Migliore fra due configurazioni: prima chi rispetta i vincoli, poi
+// (se nessuna li rispetta) la recall più alta, a parità il tempo minore
+static int better(const TuneResult *a, const TuneResult *b)
+{
+    if (a->met != b->met) return a->met;
+    if (!a->met && a->recall != b->recall) return a->recall > b->recall;
+    return a->query_us < b->query_us;
+}
+
+int autotune(const MatrixF32 *ds, const MatrixF32 *queries,
+             const TuneOptions *opt, TuneResult *best, Index **out_index)
+{
+    if (!ds || !opt || !best || opt->k <= 0 || ds->n == 0) return -1;
+    if (queries && queries->d != ds->d) return -1;
+    if (out_index) *out_index = NULL;
+
+    size_t n = ds->n;
+    size_t D = ds->d;
+    int    k = opt->k;
+    int    bits = opt->bits > 1 ? opt->bits : 1;
+
+    // ---- Campionamento (Fisher-Yates parziale) ----
+    size_t sn = (opt->sample_n > 0 && (size_t)opt->sample_n < n) ? (size_t)opt->sample_n : n;
+    size_t sq = opt->sample_q > 0 ? (size_t)opt->sample_q : 200;
+    size_t qsrc_n = queries ? queries->n : n;
+    if (sq > qsrc_n) sq = qsrc_n;
+    if ((size_t)k > sn) k = (int)sn;
+
+    size_t *perm = (size_t *)malloc(n * sizeof(size_t));
+    if (!perm) return -1;
+    for (size_t i = 0; i < n; i++) perm[i] = i;
+
+    unsigned seed = opt->seed ? opt->seed : 12345u;
+    size_t draw = sn + (queries ? 0 : sq);
+    if (draw > n) draw = n;
+    for (size_t i = 0; i < draw; i++) {
+        size_t j = i + xorshift32(&seed) % (n - i);
+        size_t t = perm[i]; perm[i] = perm[j]; perm[j] = t;
+    }
+
+    // Righe del campione nell'ordine del dataset: la selezione dei pivot
+    // (floor(n/h)*j) si comporta come sull'indice finale
+    qsort(perm, sn, sizeof(size_t), cmp_size);
+
+    MatrixF32 sds = {0}, sqs = {0};
+    int err = gather_rows(ds, perm, sn, &sds);
+
+    if (!err && queries) {
+        size_t *qperm = (size_t *)malloc(queries->n * sizeof(size_t));
+        if (!qperm) err = -1;
+        else {
+            for (size_t i = 0; i < queries->n; i++) qperm[i] = i;
+            for (size_t i = 0; i < sq; i++) {
+                size_t j = i + xorshift32(&seed) % (queries->n - i);
+                size_t t = qperm[i]; qperm[i] = qperm[j]; qperm[j] = t;
+            }
+            err = gather_rows(queries, qperm, sq, &sqs);
+            free(qperm);
+        }
+    } else if (!err) {
+        // Righe non campionate come query; se il dataset è tutto nel campione
+        // si riusano le sue prime righe
+        const size_t *src = (sn + sq <= n) ? &perm[sn] : perm;
+        err = gather_rows(ds, src, sq, &sqs);
+    }
+    free(perm);
+
+    Neighbor *truth = NULL, *res = NULL;
+    if (!err) {
+        truth = (Neighbor *)malloc(sq * (size_t)k * sizeof(Neighbor));
+        res   = (Neighbor *)malloc(sq * (size_t)k * sizeof(Neighbor));
+        if (!truth || !res) err = -1;
+    }
+    if (err) {
+        free(sds.data); free(sqs.data); free(truth); free(res);
+        return -1;
+    }
+
+    exact_knn(&sds, &sqs, k, truth);
+
+    // ---- Griglie ----
+    int xdef[5], nxdef = 0;
+    for (int div = 32; div >= 2; div /= 2) {
+        int x = (int)(D / div);
+        if (x >= 1 && (nxdef == 0 || xdef[nxdef - 1] != x)) xdef[nxdef++] = x;
+    }
+    if (nxdef == 0) xdef[nxdef++] = 1;
+
+    const int *hg = opt->h_grid ? opt->h_grid : DEFAULT_H;
+    int nh        = opt->h_grid ? opt->nh : (int)(sizeof(DEFAULT_H) / sizeof(int));
+    const int *xg = opt->x_grid ? opt->x_grid : xdef;
+    int nx        = opt->x_grid ? opt->nx : nxdef;
+    const int *rg = opt->r_grid ? opt->r_grid : DEFAULT_R;
+    int nr        = opt->r_grid ? opt->nr : (int)(sizeof(DEFAULT_R) / sizeof(int));
+
+    // ---- Ricerca ----
+    int found = 0;
+    memset(best, 0, sizeof(*best));
+
+    if (opt->verbose)
+        printf("%5s %5s %5s | %8s | %12s | %10s\n", "h", "x", "r", "recall", "us/query", "indice KB");
+
+    for (int ih = 0; ih < nh; ih++) {
+        int h = hg[ih];
+        if (h <= 0 || (size_t)h > sn) continue;
+
+        size_t bytes = index_memory_estimate(n, (size_t)h, D);
+        if (opt->mem_budget && bytes > opt->mem_budget) continue;
+
+        for (int ix = 0; ix < nx; ix++) {
+            int x = xg[ix];
+            if (x <= 0 || (size_t)x > D) continue;
+
+            Index *idx = build_index_graded(&sds, h, x, bits);
+            if (!idx) continue;
+
+            for (int ir = 0; ir < nr; ir++) {
+                int r = rg[ir];
+                if (r < 1) continue;
+
+                double t0 = query_now_s();
+                knn_query_all_rerank(&sds, idx, &sqs, k, x, r, res);
+                double t1 = query_now_s();
+
+                TuneResult cur;
+                cur.h = h; cur.x = x; cur.r = r;
+                cur.recall      = recall_at_k(res, truth, sq, k);
+                cur.query_us    = (t1 - t0) * 1e6 / (double)sq;
+                cur.index_bytes = bytes;
+                cur.met         = cur.recall >= opt->target_recall;
+                cur.evaluated   = 0;
+                best->evaluated++;
+
+                if (opt->verbose)
+                    printf("%5d %5d %5d | %8.4f | %12.2f | %10zu%s\n", h, x, r,
+                           cur.recall, cur.query_us, bytes / 1024, cur.met ? "  *" : "");
+
+                if (!found || better(&cur, best)) {
+                    int ev = best->evaluated;
+                    *best = cur;
+                    best->evaluated = ev;
+                    found = 1;
+                }
+
+                // k*r >= campione: la ricerca è già esaustiva
+                if (cur.met || (size_t)k * (size_t)r >= sn) break;
+            }
+            free_index(idx);
+        }
+    }
+
+    free(sds.data);
+    free(sqs.data);
+    free(truth);
+    free(res);
+
+    if (!found) return 1;         // nessuna configurazione entro il budget
+    if (!best->met) return 1;
+
+    if (out_index) {
+        *out_index = build_index_graded(ds, best->h, best->x, bits);
+        if (!*out_index) return -1;
+    }
+    return 0;
+}
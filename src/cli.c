@@ -0,0 +1,620 @@
+// Modalità della riga di comando (cli.h). Lo stesso sorgente è compilato
+// due volte: qui a 32 bit e in cli64.c con CLI_DOUBLE (cli64.h). Le macro
+// sotto scelgono tipi e funzioni della precisione.
+
+#ifdef CLI_DOUBLE
+#include "cli64.h"
+#include "exact64.h"
+#include "autotune64.h"
+#include "async64.h"
+
+typedef MatrixF64     CliMatrix;
+typedef Neighbor64    CliNeighbor;
+typedef AsyncEngine64 CliEngine;
+
+#define CLI_F(f)     f##_f64
+#define CLI_SFX      "_f64"
+#define CLI_DIST     "%.12lf"
+#define CLI_DOUBLES  1
+#define cli_load     load_matrix_f64
+#define cli_free     free_matrix_f64
+#else
+#include "cli.h"
+#include "exact.h"
+#include "autotune.h"
+#include "async.h"
+
+typedef MatrixF32     CliMatrix;
+typedef Neighbor      CliNeighbor;
+typedef AsyncEngine   CliEngine;
+
+#define CLI_F(f)     f
+#define CLI_SFX      ""
+#define CLI_DIST     "%.6f"
+#define CLI_DOUBLES  0
+#define cli_load     load_matrix_f32
+#define cli_free     free_matrix_f32
+#endif
+
+#include "perfcount.h"
+#include "pool.h"
+#include "result_writer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// ---------------------------------------------
+// Tempo trascorso da t0 (query_now_s), in ms
+// ---------------------------------------------
+static double ms_since(double t0)
+{
+    return (query_now_s() - t0) * 1000.0;
+}
+
+static void print_neighbors(const CliNeighbor *results, int k)
+{
+    for (int j = 0; j < k; j++)
+        printf("  k=%d -> id: %d   dist: " CLI_DIST "\n", j, results[j].id, results[j].dist_real);
+}
+
+// ---------------------------------------------
+// Scrittura dei risultati (-o): le query sono elaborate a blocchi di
+// RESULT_WRITER_BLOCK e ogni blocco è accodato ai file appena pronto, così
+// basta il buffer dei vicini di un blocco invece di nq x k
+// ---------------------------------------------
+typedef void (*QueryBlockFn)(void *ctx, const CliMatrix *qv, size_t q0, int k, CliNeighbor *results);
+
+// Vista sul blocco di query per fn (result_writer_write_blocks)
+typedef struct {
+    const CliMatrix *qs;
+    int              k;
+    QueryBlockFn     fn;
+    void            *ctx;
+} BlockViews;
+
+static void block_view(void *p, size_t q0, size_t cnt, void *results)
+{
+    const BlockViews *b = (const BlockViews *)p;
+    CliMatrix qv = { .n = (uint32_t)cnt, .d = b->qs->d, .data = &b->qs->data[q0 * b->qs->d] };
+    b->fn(b->ctx, &qv, q0, b->k, (CliNeighbor *)results);
+}
+
+static int write_results(const char *out, const CliMatrix *qs, int k, QueryBlockFn fn, void *ctx)
+{
+    ResultWriter *w = result_writer_open(out, qs->n, (uint32_t)k, CLI_DOUBLES);
+    if (!w) {
+        printf("ERRORE: impossibile creare i file dei risultati '%s'.\n", out);
+        return 1;
+    }
+    printf("Scrittura risultati: %s, %s\n", result_writer_ids_path(w), result_writer_dst_path(w));
+
+    BlockViews views = { qs, k, fn, ctx };
+    int err = result_writer_write_blocks(w, RESULT_WRITER_BLOCK, block_view, &views) != 0;
+    err |= result_writer_close(w) != 0;
+
+    if (err) printf("ERRORE: scrittura dei risultati in '%s' non riuscita.\n", out);
+    return err;
+}
+
+static void exact_block(void *ctx, const CliMatrix *qv, size_t q0, int k, CliNeighbor *results)
+{
+    (void)q0;
+    CLI_F(exact_knn)((const CliMatrix *)ctx, qv, k, results);
+}
+
+// Indice a pivot: repliche NUMA (-N replica), pool/cache/budget
+// (-t/-Q/-a/-m/-T), re-rank (-r); lo stesso percorso con e senza -o
+typedef struct {
+    const CliMatrix     *ds;
+    const Index         *idx;
+    const IndexReplicas *rep;
+    const Config        *cfg;
+    QueryCache          *cache;
+    uint8_t             *partial;  // flag per query (-a/-m/-T), NULL senza budget
+} IndexRun;
+
+static void query_block(void *ctx, const CliMatrix *qv, size_t q0, int k, CliNeighbor *results)
+{
+    const IndexRun *run = (const IndexRun *)ctx;
+    const Config *cfg = run->cfg;
+    int budget = cfg->alpha > 0.0 || cfg->evals > 0 || cfg->deadline > 0.0;
+
+    if (run->rep && !budget)
+        CLI_F(knn_query_all_replicated)(run->ds, run->rep, qv, k, cfg->x, cfg->r, results);
+    else if (cfg->threads > 0 || run->cache || budget) {
+        QueryOptions qo;
+        query_default_options(&qo);
+        qo.r           = cfg->r;
+        qo.num_threads = cfg->threads;
+        qo.cache       = run->cache;
+        qo.alpha       = (float)cfg->alpha;
+        qo.max_evals   = (size_t)cfg->evals;
+        qo.deadline_ms = cfg->deadline;
+        qo.partial     = run->partial ? &run->partial[q0] : NULL;
+        CLI_F(knn_query_all_opt)(run->ds, run->idx, qv, k, cfg->x, &qo, results);
+    }
+    else if (cfg->r > 1)
+        CLI_F(knn_query_all_rerank)(run->ds, run->idx, qv, k, cfg->x, cfg->r, results);
+    else
+        CLI_F(knn_query_all)(run->ds, run->idx, qv, k, cfg->x, results);
+}
+
+// ---------------------------------------------
+// K-NN esatto (-e): forza bruta, nessun indice
+// ---------------------------------------------
+static int run_exact(const CliMatrix *ds, const CliMatrix *qs, int k, const char *out)
+{
+    if (out) {
+        printf("Esecuzione K-NN ESATTO su %u query...\n", qs->n);
+        return write_results(out, qs, k, exact_block, (void *)ds);
+    }
+
+    CliNeighbor *results = malloc((size_t)qs->n * (size_t)k * sizeof(CliNeighbor));
+    if (!results) {
+        printf("ERRORE: impossibile allocare memoria risultati.\n");
+        return 1;
+    }
+
+    printf("Esecuzione K-NN ESATTO su %u query...\n", qs->n);
+
+    double t0 = query_now_s();
+    CLI_F(exact_knn)(ds, qs, k, results);
+    double t_query = ms_since(t0);
+
+    printf("Query #0 - %d vicini esatti (ordine crescente):\n", k);
+    print_neighbors(results, k);
+
+    printf("\nexact_knn" CLI_SFX "()   : %.2f ms\n\n", t_query);
+
+    free(results);
+    return 0;
+}
+
+// ---------------------------------------------
+// Autotune (-A): h, x, r per la recall richiesta
+// ---------------------------------------------
+static int run_autotune(const CliMatrix *ds, const CliMatrix *qs, const Config *cfg)
+{
+    TuneOptions opt;
+    tune_default_options(&opt);
+    opt.k             = cfg->k;
+    opt.target_recall = cfg->tune;
+    opt.mem_budget    = (size_t)cfg->mem_mb << 20;
+    opt.bits          = cfg->bits;
+    opt.verbose       = 1;
+
+    printf("Autotune: recall@%d >= %.3f, budget indice: ", cfg->k, cfg->tune);
+    if (cfg->mem_mb > 0) printf("%d MB\n\n", cfg->mem_mb);
+    else                 printf("illimitato\n\n");
+
+    TuneResult best;
+    int ret = CLI_F(autotune)(ds, qs, &opt, &best, NULL);
+    if (ret < 0) {
+        printf("ERRORE: autotune fallito (parametri o memoria).\n");
+        return 1;
+    }
+
+    printf("\n%s (%d configurazioni provate):\n",
+           ret == 0 ? "Configurazione scelta" : "Target NON raggiunto, migliore trovata",
+           best.evaluated);
+    printf("  -h %d -x %d -r %d   recall %.4f   %.2f us/query   indice %zu KB\n\n",
+           best.h, best.x, best.r, best.recall, best.query_us, best.index_bytes / 1024);
+
+    return ret == 0 ? 0 : 1;
+}
+
+// ---------------------------------------------
+// Colonne ordinate per pivot (-C) su un indice appena costruito
+// ---------------------------------------------
+static void sort_columns(Index *idx, int cols)
+{
+    if (cols <= 0) return;
+    if (index_sort_pivots(idx, cols) == 0)
+        printf("Colonne ordinate per pivot: %d\n\n", cols);
+    else
+        printf("[INDICE] -C %d non valido (1..%d): scansione completa.\n\n", cols, INDEX_MAX_SORTED);
+}
+
+// Cascata dei pivot (-c) su un indice appena costruito
+static void build_cascade(Index *idx, int hot)
+{
+    if (hot <= 0) return;
+    if (index_build_cascade(idx, hot) == 0)
+        printf("Cascata di pivot: %d caldi\n\n", hot);
+    else
+        printf("[INDICE] -c %d non valido (1..%d, <= h): d* su tutti i pivot.\n\n", hot, INDEX_MAX_HOT);
+}
+
+// ---------------------------------------------
+// Indice partizionato (-S): build e query per shard, merge dei top-k
+// ---------------------------------------------
+static int run_sharded(const CliMatrix *ds, const CliMatrix *qs, const Config *cfg)
+{
+    printf("Costruzione indice partizionato (%d shard)...\n", cfg->shards);
+
+    double t0 = query_now_s();
+    ShardedIndex *sx = CLI_F(build_sharded_index)(ds, cfg->shards, cfg->h, cfg->x);
+    double t_build = ms_since(t0);
+
+    if (!sx) {
+        printf("ERRORE: impossibile costruire indice partizionato.\n");
+        return 1;
+    }
+
+    printf("Shard: %zu   memoria indice: %zu KB\n", sx->S, sharded_memory_bytes(sx) / 1024);
+    printf("Tempo build_sharded_index" CLI_SFX "(): %.2f ms\n\n", t_build);
+
+    if (cfg->cols > 0 && sharded_sort_pivots(sx, cfg->cols) != 0)
+        printf("[INDICE] -C %d non valido (1..%d): scansione completa.\n\n", cfg->cols, INDEX_MAX_SORTED);
+    if (cfg->cascade > 0 && sharded_build_cascade(sx, cfg->cascade) != 0)
+        printf("[INDICE] -c %d non valido (1..%d, <= h): d* su tutti i pivot.\n\n", cfg->cascade, INDEX_MAX_HOT);
+
+    CliNeighbor *results = malloc((size_t)qs->n * (size_t)cfg->k * sizeof(CliNeighbor));
+    if (!results) {
+        printf("ERRORE: impossibile allocare memoria risultati.\n");
+        free_sharded_index(sx);
+        return 1;
+    }
+
+    double t1 = query_now_s();
+    CLI_F(knn_query_sharded_all)(ds, sx, qs, cfg->k, cfg->x, results);
+    double t_query = ms_since(t1);
+
+    printf("Query #0 - %d vicini (id globali):\n", cfg->k);
+    print_neighbors(results, cfg->k);
+
+    printf("\nknn_query_sharded_all" CLI_SFX "() : %.2f ms\n\n", t_query);
+
+    free(results);
+    free_sharded_index(sx);
+    return 0;
+}
+
+// ---------------------------------------------
+// Indice IVF (-I): k-means in liste, query sulle -n liste più vicine
+// ---------------------------------------------
+static int run_ivf(const CliMatrix *ds, const CliMatrix *qs, const Config *cfg)
+{
+    int nprobe = cfg->nprobe > 0 ? cfg->nprobe : 8;
+    if (nprobe > cfg->ivf) nprobe = cfg->ivf;
+
+    printf("Costruzione indice IVF (%d liste)...\n", cfg->ivf);
+
+    double t0 = query_now_s();
+    IvfIndex *ivf = CLI_F(build_ivf_index)(ds, cfg->ivf, cfg->h, cfg->x);
+    double t_build = ms_since(t0);
+
+    if (!ivf) {
+        printf("ERRORE: impossibile costruire indice IVF.\n");
+        return 1;
+    }
+
+    printf("Liste: %zu   nprobe: %d   memoria indice: %zu KB\n", ivf->C, nprobe, ivf_memory_bytes(ivf) / 1024);
+    printf("Tempo build_ivf_index" CLI_SFX "(): %.2f ms\n\n", t_build);
+
+    CliNeighbor *results = malloc((size_t)qs->n * (size_t)cfg->k * sizeof(CliNeighbor));
+    if (!results) {
+        printf("ERRORE: impossibile allocare memoria risultati.\n");
+        free_ivf_index(ivf);
+        return 1;
+    }
+
+    uint64_t s0, s1;
+    perf_scan_read(&s0, NULL);
+    double t1 = query_now_s();
+    CLI_F(knn_query_ivf_all)(ds, ivf, qs, cfg->k, cfg->x, nprobe, results);
+    double t_query = ms_since(t1);
+    perf_scan_read(&s1, NULL);
+
+    printf("Query #0 - %d vicini:\n", cfg->k);
+    print_neighbors(results, cfg->k);
+
+    printf("\nknn_query_ivf_all" CLI_SFX "() : %.2f ms\n", t_query);
+    printf("Righe scandite: %.1f%% del dataset\n\n",
+           100.0 * (double)(s1 - s0) / ((double)qs->n * (double)ds->n));
+
+    free(results);
+    free_ivf_index(ivf);
+    return 0;
+}
+
+// ---------------------------------------------
+// Grafo HNSW (-G): indice a pivot + grafo sui codici, ricerca a fascio (-E)
+// ---------------------------------------------
+static int run_hnsw(const CliMatrix *ds, const CliMatrix *qs, const Config *cfg)
+{
+    int ef = cfg->ef > 0 ? cfg->ef : HNSW_DEFAULT_EF;
+
+    printf("Costruzione grafo HNSW (M = %d)...\n", cfg->graph);
+
+    double t0 = query_now_s();
+    Index *idx = CLI_F(build_index_graded)(ds, cfg->h, cfg->x, cfg->bits);
+    HnswIndex *g = idx ? build_hnsw(idx, cfg->graph, HNSW_DEFAULT_EF_C) : NULL;
+    double t_build = ms_since(t0);
+
+    if (!g) {
+        printf("ERRORE: impossibile costruire il grafo HNSW.\n");
+        free_index(idx);
+        return 1;
+    }
+
+    printf("Livelli: %d   ef: %d   memoria grafo: %zu KB\n", g->max_level + 1, ef, hnsw_memory_bytes(g) / 1024);
+    printf("Tempo build_index" CLI_SFX "() + build_hnsw(): %.2f ms\n\n", t_build);
+
+    CliNeighbor *results = malloc((size_t)qs->n * (size_t)cfg->k * sizeof(CliNeighbor));
+    if (!results) {
+        printf("ERRORE: impossibile allocare memoria risultati.\n");
+        free_hnsw(g);
+        free_index(idx);
+        return 1;
+    }
+
+    uint64_t s0, s1;
+    perf_scan_read(&s0, NULL);
+    double t1 = query_now_s();
+    CLI_F(knn_query_hnsw_all)(ds, g, qs, cfg->k, cfg->x, ef, results);
+    double t_query = ms_since(t1);
+    perf_scan_read(&s1, NULL);
+
+    printf("Query #0 - %d vicini (ordinati per distanza reale):\n", cfg->k);
+    print_neighbors(results, cfg->k);
+
+    printf("\nknn_query_hnsw_all" CLI_SFX "() : %.2f ms\n", t_query);
+    printf("Distanze d~ per query: %.1f (%.1f%% del dataset)\n\n",
+           (double)(s1 - s0) / (double)qs->n,
+           100.0 * (double)(s1 - s0) / ((double)qs->n * (double)ds->n));
+
+    free(results);
+    free_hnsw(g);
+    free_index(idx);
+    return 0;
+}
+
+// ---------------------------------------------
+// Quantizzazione prodotto (-p [-F] [-O]): ADC sui codici, re-rank dei k*r
+// candidati sulle righe originali
+// ---------------------------------------------
+static int run_pq(const CliMatrix *ds, const CliMatrix *qs, const Config *cfg)
+{
+    int nbits = cfg->pq4 ? 4 : 8;
+    int r = cfg->r > 1 ? cfg->r : PQ_DEFAULT_RERANK;
+
+    printf("Costruzione indice PQ (M = %d, %d bit%s)...\n", cfg->pq, nbits, cfg->opq ? ", OPQ" : "");
+
+    double t0 = query_now_s();
+    PqIndex *pq = CLI_F(build_pq_index)(ds, cfg->pq, nbits, cfg->opq);
+    double t_build = ms_since(t0);
+
+    if (!pq) {
+        printf("ERRORE: impossibile costruire indice PQ (M <= D, M <= %d).\n", PQ_MAX_M);
+        return 1;
+    }
+
+    printf("Byte per riga: %.1f   r: %d   memoria indice: %zu KB\n",
+           (double)pq->M * nbits / 8.0, r, pq_memory_bytes(pq) / 1024);
+    printf("Tempo build_pq_index" CLI_SFX "(): %.2f ms\n\n", t_build);
+
+    CliNeighbor *results = malloc((size_t)qs->n * (size_t)cfg->k * sizeof(CliNeighbor));
+    if (!results) {
+        printf("ERRORE: impossibile allocare memoria risultati.\n");
+        free_pq_index(pq);
+        return 1;
+    }
+
+    double t1 = query_now_s();
+    CLI_F(knn_query_pq_all)(ds, pq, qs, cfg->k, r, results);
+    double t_query = ms_since(t1);
+
+    printf("Query #0 - %d vicini (ordinati per distanza reale):\n", cfg->k);
+    print_neighbors(results, cfg->k);
+
+    printf("\nknn_query_pq_all" CLI_SFX "() : %.2f ms\n\n", t_query);
+
+    free(results);
+    free_pq_index(pq);
+    return 0;
+}
+
+int CLI_F(cli_run_mode)(const CliMatrix *ds, const CliMatrix *qs, const Config *cfg)
+{
+    if (cfg->exact)     return run_exact(ds, qs, cfg->k, cfg->out);
+    if (cfg->tune > 0)  return run_autotune(ds, qs, cfg);
+    if (cfg->shards > 1) return run_sharded(ds, qs, cfg);
+    if (cfg->ivf > 0)   return run_ivf(ds, qs, cfg);
+    if (cfg->pq > 0)    return run_pq(ds, qs, cfg);
+    if (cfg->graph > 0) return run_hnsw(ds, qs, cfg);
+    return -1;
+}
+
+// ---------------------------------------------
+// NUMA (-N) e pinning dei thread di query (-B)
+// ---------------------------------------------
+static int setup_numa(const Config *cfg, Index *idx, IndexReplicas **rep)
+{
+    *rep = NULL;
+
+    int place = cfg->numa ? place_policy_from_name(cfg->numa) : PLACE_DEFAULT;
+    int pin   = cfg->pin  ? pin_policy_from_name(cfg->pin)    : PIN_NONE;
+    if (place < 0 || pin < 0) {
+        printf("ERRORE: -N accetta default|interleave|replica, -B none|compact|scatter.\n");
+        return -1;
+    }
+
+    int threads = 1;
+    #ifdef _OPENMP
+    threads = omp_get_max_threads();
+    #endif
+
+    if (pin != PIN_NONE)
+        printf("Thread di query fissati: %d/%d (%s, %d nodi NUMA)\n",
+               affinity_pin_threads(threads, (PinPolicy)pin), threads, cfg->pin, affinity_nodes());
+
+    if (place == PLACE_INTERLEAVE && index_interleave(idx) != 0)
+        printf("[NUMA] mbind non disponibile: indice lasciato in first-touch.\n");
+
+    if (place == PLACE_REPLICA) {
+        *rep = index_replicate(idx);
+        if (!*rep) {
+            printf("ERRORE: impossibile replicare l'indice.\n");
+            return -1;
+        }
+        printf("Repliche dell'indice: %d (una per nodo NUMA)\n", (*rep)->nodes);
+    }
+    return 0;
+}
+
+// ---------------------------------------------
+// Indice a pivot unico: build, opzioni dell'indice, query (o -o)
+// ---------------------------------------------
+int CLI_F(cli_run_index)(const CliMatrix *ds, const CliMatrix *qs, Config *cfg,
+                         CliNeighbor **results, double *build_ms, double *query_ms)
+{
+    *results  = NULL;
+    *build_ms = *query_ms = 0.0;
+
+    // Contatori hardware per fase (-P)
+    if (cfg->perf && perf_init() == 0)
+        printf("[PERF] perf_event_open non disponibile: contatori disattivati.\n\n");
+
+    printf("Costruzione indice...\n");
+
+    double t0 = query_now_s();
+    Index *idx = CLI_F(build_index_graded)(ds, cfg->h, cfg->x, cfg->bits);
+    *build_ms = ms_since(t0);
+
+    if (!idx) {
+        printf("ERRORE: impossibile costruire indice.\n");
+        return 1;
+    }
+
+    printf("Indice costruito.\n");
+    if (cfg->bits > 1) printf("Codici a livelli: %d bit\n", cfg->bits);
+    printf("Tempo build_index" CLI_SFX "(): %.2f ms\n\n", *build_ms);
+
+    sort_columns(idx, cfg->cols);
+    build_cascade(idx, cfg->cascade);
+
+    IndexReplicas *rep = NULL;
+    if (setup_numa(cfg, idx, &rep) != 0) {
+        free_index(idx);
+        return 1;
+    }
+
+    // Pool di thread persistente (-t), creato fuori dalla misura dei tempi
+    if (cfg->threads > 0 && pool_configure(cfg->threads, POOL_SPIN, 0) != 0) {
+        printf("[POOL] impossibile creare il pool: query con OpenMP.\n");
+        cfg->threads = 0;
+    }
+
+    int k = cfg->k;
+    CliNeighbor *res = cfg->out ? NULL : malloc((size_t)qs->n * (size_t)k * sizeof(CliNeighbor));
+    if (!cfg->out && !res) {
+        printf("ERRORE: impossibile allocare memoria risultati.\n");
+        free_index_replicas(rep);
+        free_index(idx);
+        return 1;
+    }
+
+    // Cache dei candidati (-Q), sul percorso di knn_query_all_opt
+    QueryCache *cache = cfg->cache > 0 ? query_cache_create((size_t)cfg->cache) : NULL;
+
+    // Ricerca con budget (-m, -T) o pruning rilassato (-a): flag delle query
+    // terminate prima della fine della scansione
+    int budget = cfg->alpha > 0.0 || cfg->evals > 0 || cfg->deadline > 0.0;
+    uint8_t *partial = budget ? (uint8_t *)calloc(qs->n, 1) : NULL;
+    IndexRun run = { ds, idx, rep, cfg, cache, partial };
+    int werr = 0;
+
+    printf("Esecuzione K-NN su %u query...\n", qs->n);
+
+    double t1 = query_now_s();
+    if (cfg->out)
+        werr = write_results(cfg->out, qs, k, query_block, &run);
+    else
+        query_block(&run, qs, 0, k, res);
+    *query_ms = ms_since(t1);
+
+    printf("K-NN completato.\n");
+    if (cache) {
+        QueryCacheStats cs;
+        query_cache_stats(cache, &cs);
+        printf("Cache query: %llu hit, %llu miss (%zu voci)\n",
+               (unsigned long long)cs.hits, (unsigned long long)cs.misses, cs.entries);
+        query_cache_free(cache);
+    }
+    if (partial) {
+        size_t np = 0;
+        for (size_t i = 0; i < qs->n; i++) np += partial[i];
+        printf("Query parziali (budget esaurito): %zu su %u\n", np, qs->n);
+        free(partial);
+    }
+    printf("Tempo knn_query_all" CLI_SFX "(): %.2f ms\n\n", *query_ms);
+
+    free_index_replicas(rep);
+    free_index(idx);
+
+    *results = res;
+    return werr;
+}
+
+// ---------------------------------------------
+// Modalità server (-L): dataset e indice restano in memoria, le richieste
+// arrivano sul socket Unix (server.h). Il loader è richiamato a ogni
+// ricarica (SIGHUP): rilegge il dataset e ricostruisce l'indice.
+// ---------------------------------------------
+static int load_backend(void *user, ServerBackend *out)
+{
+    const Config *cfg = (const Config *)user;
+
+    CliMatrix ds = {0};
+    if (cli_load(cfg->ds_path, &ds) != 0) {
+        printf("ERRORE: impossibile leggere dataset '%s'\n", cfg->ds_path);
+        return -1;
+    }
+
+    double t0 = query_now_s();
+    Index *idx = CLI_F(build_index_graded)(&ds, cfg->h, cfg->x, cfg->bits);
+    double t_build = ms_since(t0);
+    if (!idx) {
+        printf("ERRORE: impossibile costruire indice.\n");
+        cli_free(&ds);
+        return -1;
+    }
+
+    sort_columns(idx, cfg->cols);
+    build_cascade(idx, cfg->cascade);
+
+    // Coda non bloccante: a coda piena il client riceve SERVER_EBUSY
+    AsyncOptions ao;
+    async_default_options(&ao);
+    ao.num_threads = cfg->threads;
+    ao.nonblocking = 1;
+    ao.cache_entries = cfg->cache;
+
+    CliEngine *eng = CLI_F(async_engine_create)(&ds, idx, cfg->x, &ao);
+    if (!eng || CLI_F(async_server_backend)(eng, &ds, idx, out) != 0) {
+        printf("ERRORE: impossibile avviare il motore asincrono.\n");
+        CLI_F(async_engine_destroy)(eng);
+        free_index(idx);
+        cli_free(&ds);
+        return -1;
+    }
+
+    printf("Indice pronto: %u x %u, h=%d x=%d (%.2f ms)\n", ds.n, ds.d, cfg->h, cfg->x, t_build);
+    fflush(stdout);
+    return 0;
+}
+
+int CLI_F(cli_run_server)(const Config *cfg)
+{
+    if (cfg->threads > 0 && pool_configure(cfg->threads, POOL_SPIN, 0) != 0)
+        printf("[POOL] impossibile creare il pool con %d thread: uso quello di default.\n", cfg->threads);
+
+    ServerOptions opt;
+    server_default_options(&opt);
+    return server_run(cfg->listen, load_backend, (void *)cfg, &opt) == 0 ? 0 : 1;
+}
@@ -0,0 +1,3 @@
+// Modalità della riga di comando a 64 bit (cli64.h): cli.c con CLI_DOUBLE
+#define CLI_DOUBLE
+#include "cli.c"
@@ -1,4 +1,6 @@
 #include "config.h"
+#include "index.h"
+#include "quantization.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -22,14 +24,126 @@ int parse_args(int argc, char **argv, Config *cfg) {
         else if (strcmp(argv[i], "-x") == 0 && i + 1 < argc)
             cfg->x = atoi(argv[++i]);
 
+        else if (strcmp(argv[i], "-e") == 0)
+            cfg->exact = 1;
+
+        else if (strcmp(argv[i], "-P") == 0)
+            cfg->perf = 1;
+
+        else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+            cfg->r = atoi(argv[++i]);
+
+        else if (strcmp(argv[i], "-A") == 0 && i + 1 < argc)
+            cfg->tune = atof(argv[++i]);
+
+        else if (strcmp(argv[i], "-M") == 0 && i + 1 < argc)
+            cfg->mem_mb = atoi(argv[++i]);
+
+        else if (strcmp(argv[i], "-S") == 0 && i + 1 < argc)
+            cfg->shards = atoi(argv[++i]);
+
+        else if (strcmp(argv[i], "-N") == 0 && i + 1 < argc)
+            cfg->numa = argv[++i];
+
+        else if (strcmp(argv[i], "-B") == 0 && i + 1 < argc)
+            cfg->pin = argv[++i];
+
+        else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+            cfg->threads = atoi(argv[++i]);
+
+        else if (strcmp(argv[i], "-Q") == 0 && i + 1 < argc)
+            cfg->cache = atoi(argv[++i]);
+
+        else if (strcmp(argv[i], "-C") == 0 && i + 1 < argc)
+            cfg->cols = atoi(argv[++i]);
+
+        else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+            cfg->cascade = atoi(argv[++i]);
+
+        else if (strcmp(argv[i], "-a") == 0 && i + 1 < argc)
+            cfg->alpha = atof(argv[++i]);
+
+        else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc)
+            cfg->evals = atoll(argv[++i]);
+
+        else if (strcmp(argv[i], "-T") == 0 && i + 1 < argc)
+            cfg->deadline = atof(argv[++i]);
+
+        else if (strcmp(argv[i], "-I") == 0 && i + 1 < argc)
+            cfg->ivf = atoi(argv[++i]);
+
+        else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+            cfg->nprobe = atoi(argv[++i]);
+
+        else if (strcmp(argv[i], "-G") == 0 && i + 1 < argc)
+            cfg->graph = atoi(argv[++i]);
+
+        else if (strcmp(argv[i], "-E") == 0 && i + 1 < argc)
+            cfg->ef = atoi(argv[++i]);
+
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+            cfg->out = argv[++i];
+
+        else if (strcmp(argv[i], "-L") == 0 && i + 1 < argc)
+            cfg->listen = argv[++i];
+
+        else if (strcmp(argv[i], "-H") == 0 && i + 1 < argc)
+            cfg->pages = argv[++i];
+
+        else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc)
+            cfg->bits = atoi(argv[++i]);
+
+        else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc)
+            cfg->pq = atoi(argv[++i]);
+
+        else if (strcmp(argv[i], "-F") == 0)
+            cfg->pq4 = 1;
+
+        else if (strcmp(argv[i], "-O") == 0)
+            cfg->opq = 1;
+
         else {
             printf("Parametro non riconosciuto: %s\n", argv[i]);
             return -1;
         }
     }
 
-    if (!cfg->ds_path || !cfg->q_path)
+    if (!cfg->ds_path || (!cfg->q_path && !cfg->listen))
         return -1;
 
     return 0;
 }
+
+int config_validate(Config *cfg) {
+
+    // Pagine dell'arena dell'indice (-H), per tutti gli indici costruiti
+    if (cfg->pages) {
+        int pages = index_pages_from_name(cfg->pages);
+        if (pages < 0) {
+            printf("ERRORE: -H accetta small|thp|hugetlb.\n");
+            return -1;
+        }
+        index_set_pages((IndexPages)pages);
+    }
+
+    // Codici a livelli di ampiezza (-b)
+    if (cfg->bits <= 0) cfg->bits = 1;
+    if (cfg->bits > QUANT_MAX_BITS) {
+        printf("ERRORE: -b accetta 1..%d bit.\n", QUANT_MAX_BITS);
+        return -1;
+    }
+
+    // Budget per query (-m, -T) e fattore di pruning (-a)
+    if (cfg->alpha < 0.0 || cfg->evals < 0 || cfg->deadline < 0.0) {
+        printf("ERRORE: -a, -m e -T accettano valori >= 0.\n");
+        return -1;
+    }
+
+    // Scrittura dei risultati (-o): indice a pivot unico o -e
+    if (cfg->out && (cfg->tune > 0 || cfg->shards > 1 || cfg->ivf > 0 || cfg->pq > 0 || cfg->graph > 0 || cfg->listen)) {
+        printf("ERRORE: -o vale per l'indice a pivot e per -e (non con -A, -S, -I, -p, -G, -L).\n");
+        return -1;
+    }
+
+    return 0;
+}
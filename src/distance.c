@@ -196,6 +196,71 @@ int approximate_distance(
 #endif
 }
 
+// =====================================================================
+// Distanza per codici a livelli (quantize_vector_graded)
+//  ˜d = (v+ − v−)·(w+ − w−), livelli 0..7: le differenze stanno in un int8
+// =====================================================================
+
+int graded_distance(
+    const uint8_t *vp, const uint8_t *vn,
+    const uint8_t *wp, const uint8_t *wn,
+    size_t D
+) {
+    int sum = 0;
+    size_t offset = 0;
+
+#if defined(USE_AVX)
+    // ================== VERSIONE AVX2 (256 bit) ==================
+    // maddubs(|a|, sign(b, a)) = a·b a coppie in int16, poi madd a int32
+    __m256i ones = _mm256_set1_epi16(1);
+    __m256i acc  = _mm256_setzero_si256();
+
+    for (; offset + 32 <= D; offset += 32) {
+        __m256i a = _mm256_sub_epi8(_mm256_loadu_si256((const __m256i*)(vp + offset)),
+                                    _mm256_loadu_si256((const __m256i*)(vn + offset)));
+        __m256i b = _mm256_sub_epi8(_mm256_loadu_si256((const __m256i*)(wp + offset)),
+                                    _mm256_loadu_si256((const __m256i*)(wn + offset)));
+
+        __m256i p = _mm256_maddubs_epi16(_mm256_abs_epi8(a), _mm256_sign_epi8(b, a));
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(p, ones));
+    }
+
+    int32_t tmp32[8];
+    _mm256_storeu_si256((__m256i*)tmp32, acc);
+    for (int i = 0; i < 8; ++i) sum += tmp32[i];
+
+#elif defined(USE_SSE2)
+    // ================== VERSIONE SSE2 (128 bit) ==================
+    // Estensione con segno a int16 (unpack su sé stesso + shift), poi madd
+    __m128i acc = _mm_setzero_si128();
+
+    for (; offset + 16 <= D; offset += 16) {
+        __m128i a = _mm_sub_epi8(_mm_loadu_si128((const __m128i*)(vp + offset)),
+                                 _mm_loadu_si128((const __m128i*)(vn + offset)));
+        __m128i b = _mm_sub_epi8(_mm_loadu_si128((const __m128i*)(wp + offset)),
+                                 _mm_loadu_si128((const __m128i*)(wn + offset)));
+
+        __m128i alo = _mm_srai_epi16(_mm_unpacklo_epi8(a, a), 8);
+        __m128i ahi = _mm_srai_epi16(_mm_unpackhi_epi8(a, a), 8);
+        __m128i blo = _mm_srai_epi16(_mm_unpacklo_epi8(b, b), 8);
+        __m128i bhi = _mm_srai_epi16(_mm_unpackhi_epi8(b, b), 8);
+
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(alo, blo));
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(ahi, bhi));
+    }
+
+    int32_t tmp32[4];
+    _mm_storeu_si128((__m128i*)tmp32, acc);
+    for (int i = 0; i < 4; ++i) sum += tmp32[i];
+#endif
+
+    // Resto scalare (solo per D non multiplo del registro)
+    for (size_t i = offset; i < D; i++)
+        sum += ((int)vp[i] - (int)vn[i]) * ((int)wp[i] - (int)wn[i]);
+
+    return sum;
+}
+
 // =====================================================================
 // Distanza euclidea reale float32
 // =====================================================================
@@ -36,6 +36,18 @@ int approximate_distance(
 #endif
 }
 
+// Codici a livelli: nessuna routine assembly, ciclo C (vettorizzato a -O3)
+int graded_distance(
+    const uint8_t *vp, const uint8_t *vn,
+    const uint8_t *wp, const uint8_t *wn,
+    size_t D
+) {
+    int sum = 0;
+    for (size_t i = 0; i < D; i++)
+        sum += ((int)vp[i] - (int)vn[i]) * ((int)wp[i] - (int)wn[i]);
+    return sum;
+}
+
 float euclidean_distance(const float *a, const float *b, size_t D)
 {
     float sum = 0.0f;
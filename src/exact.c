@@ -0,0 +1,236 @@
+#include "exact.h"
+
+#include <stdlib.h>
+#include <math.h>
+#include <float.h>
+
+#if defined(USE_AVX) || defined(USE_AVX_ASM)
+    #include <immintrin.h>
+#elif defined(USE_SSE2) || defined(USE_SSE2_ASM)
+    #include <emmintrin.h>
+#endif
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// ------------------ DIMENSIONI DEI BLOCCHI ----------------------
+//
+// EXACT_QB query x EXACT_NB righe: con D=256 un blocco di righe occupa
+// 256 KB (float32) e resta in L2 mentre viene riusato da tutte le query
+// del tile. Il micro-kernel calcola 2 query x 4 righe per volta.
+//
+// ----------------------------------------------------------------
+
+#define EXACT_QB 16
+#define EXACT_NB 256
+
+// Norma al quadrato di un vettore
+static float sq_norm(const float *v, size_t D)
+{
+    float s = 0.0f;
+    for (size_t i = 0; i < D; i++) s += v[i] * v[i];
+    return s;
+}
+
+// Micro-kernel 2x4: out[a*4 + b] = q_a . v_b
+static void dot_2x4(const float *q0, const float *q1,
+                    const float *const v[4], size_t D, float out[8])
+{
+    size_t i = 0;
+
+#if defined(USE_AVX) || defined(USE_AVX_ASM)
+    __m256 acc[8];
+    for (int t = 0; t < 8; t++) acc[t] = _mm256_setzero_ps();
+
+    for (; i + 8 <= D; i += 8) {
+        __m256 x0 = _mm256_loadu_ps(q0 + i);
+        __m256 x1 = _mm256_loadu_ps(q1 + i);
+        for (int b = 0; b < 4; b++) {
+            __m256 y = _mm256_loadu_ps(v[b] + i);
+            acc[b]     = _mm256_add_ps(acc[b],     _mm256_mul_ps(x0, y));
+            acc[4 + b] = _mm256_add_ps(acc[4 + b], _mm256_mul_ps(x1, y));
+        }
+    }
+
+    float tmp[8];
+    for (int t = 0; t < 8; t++) {
+        _mm256_storeu_ps(tmp, acc[t]);
+        out[t] = tmp[0] + tmp[1] + tmp[2] + tmp[3] + tmp[4] + tmp[5] + tmp[6] + tmp[7];
+    }
+#elif defined(USE_SSE2) || defined(USE_SSE2_ASM)
+    __m128 acc[8];
+    for (int t = 0; t < 8; t++) acc[t] = _mm_setzero_ps();
+
+    for (; i + 4 <= D; i += 4) {
+        __m128 x0 = _mm_loadu_ps(q0 + i);
+        __m128 x1 = _mm_loadu_ps(q1 + i);
+        for (int b = 0; b < 4; b++) {
+            __m128 y = _mm_loadu_ps(v[b] + i);
+            acc[b]     = _mm_add_ps(acc[b],     _mm_mul_ps(x0, y));
+            acc[4 + b] = _mm_add_ps(acc[4 + b], _mm_mul_ps(x1, y));
+        }
+    }
+
+    float tmp[4];
+    for (int t = 0; t < 8; t++) {
+        _mm_storeu_ps(tmp, acc[t]);
+        out[t] = tmp[0] + tmp[1] + tmp[2] + tmp[3];
+    }
+#else
+    for (int t = 0; t < 8; t++) out[t] = 0.0f;
+#endif
+
+    // Resto scalare (o intero ciclo nella versione scalare)
+    for (; i < D; i++) {
+        for (int b = 0; b < 4; b++) {
+            out[b]     += q0[i] * v[b][i];
+            out[4 + b] += q1[i] * v[b][i];
+        }
+    }
+}
+
+// ------------------ TOP-K (max-heap su dist_approx) ----------------------
+
+static void heap_sift_down(Neighbor *h, int size, int i)
+{
+    for (;;) {
+        int l = 2 * i + 1, r = l + 1, m = i;
+        if (l < size && h[l].dist_approx > h[m].dist_approx) m = l;
+        if (r < size && h[r].dist_approx > h[m].dist_approx) m = r;
+        if (m == i) return;
+        Neighbor t = h[i]; h[i] = h[m]; h[m] = t;
+        i = m;
+    }
+}
+
+static void heap_push(Neighbor *h, int *size, int k, int id, float d2)
+{
+    if (*size < k) {
+        int i = (*size)++;
+        h[i].id = id;
+        h[i].dist_approx = d2;
+        while (i > 0) {
+            int p = (i - 1) / 2;
+            if (h[p].dist_approx >= h[i].dist_approx) break;
+            Neighbor t = h[i]; h[i] = h[p]; h[p] = t;
+            i = p;
+        }
+    } else if (d2 < h[0].dist_approx) {
+        h[0].id = id;
+        h[0].dist_approx = d2;
+        heap_sift_down(h, k, 0);
+    }
+}
+
+// Ricalcola la distanza reale in modo diretto (nessuna cancellazione
+// numerica) e ordina i vicini in modo crescente.
+static void finalize(const MatrixF32 *ds, const float *q, Neighbor *nb, int size, int k)
+{
+    size_t D = ds->d;
+
+    for (int i = 0; i < size; i++) {
+        const float *v = &ds->data[(size_t)nb[i].id * D];
+        float s = 0.0f;
+        for (size_t j = 0; j < D; j++) {
+            float diff = q[j] - v[j];
+            s += diff * diff;
+        }
+        nb[i].dist_real   = sqrtf(s);
+        nb[i].dist_approx = nb[i].dist_real;
+    }
+
+    // k piccolo: insertion sort
+    for (int i = 1; i < size; i++) {
+        Neighbor t = nb[i];
+        int j = i - 1;
+        while (j >= 0 && nb[j].dist_real > t.dist_real) {
+            nb[j + 1] = nb[j];
+            j--;
+        }
+        nb[j + 1] = t;
+    }
+
+    for (int i = size; i < k; i++) {
+        nb[i].id          = -1;
+        nb[i].dist_approx = FLT_MAX;
+        nb[i].dist_real   = FLT_MAX;
+    }
+}
+
+void exact_knn(const MatrixF32 *ds,
+               const MatrixF32 *queries,
+               int k,
+               Neighbor *results)
+{
+    if (!ds || !queries || !results || k <= 0) return;
+    if (ds->d != queries->d || ds->n == 0) return;
+
+    size_t n  = ds->n;
+    size_t D  = ds->d;
+    size_t nq = queries->n;
+
+    // Norme delle righe del dataset (calcolate una volta sola)
+    float *vnorm = (float *)malloc(n * sizeof(float));
+    if (!vnorm) return;
+
+    #pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < n; i++)
+        vnorm[i] = sq_norm(&ds->data[i * D], D);
+
+    size_t tiles = (nq + EXACT_QB - 1) / EXACT_QB;
+
+    // Ogni thread elabora un tile di query contro tutti i blocchi del dataset
+    #pragma omp parallel for schedule(dynamic)
+    for (size_t t = 0; t < tiles; t++) {
+
+        size_t q_begin = t * EXACT_QB;
+        size_t q_count = nq - q_begin < EXACT_QB ? nq - q_begin : EXACT_QB;
+
+        float qnorm[EXACT_QB];
+        int   hsize[EXACT_QB];
+        for (size_t a = 0; a < q_count; a++) {
+            qnorm[a] = sq_norm(&queries->data[(q_begin + a) * D], D);
+            hsize[a] = 0;
+        }
+
+        for (size_t r0 = 0; r0 < n; r0 += EXACT_NB) {
+            size_t r_end = r0 + EXACT_NB < n ? r0 + EXACT_NB : n;
+
+            for (size_t a = 0; a < q_count; a += 2) {
+                // Con un numero dispari di query l'ultima viene duplicata
+                size_t a1 = a + 1 < q_count ? a + 1 : a;
+                const float *q0 = &queries->data[(q_begin + a)  * D];
+                const float *q1 = &queries->data[(q_begin + a1) * D];
+                Neighbor *h0 = &results[(q_begin + a)  * (size_t)k];
+                Neighbor *h1 = &results[(q_begin + a1) * (size_t)k];
+
+                for (size_t r = r0; r < r_end; r += 4) {
+                    size_t cnt = r_end - r < 4 ? r_end - r : 4;
+                    const float *v[4];
+                    for (size_t b = 0; b < 4; b++)
+                        v[b] = &ds->data[(r + (b < cnt ? b : cnt - 1)) * D];
+
+                    float dot[8];
+                    dot_2x4(q0, q1, v, D, dot);
+
+                    for (size_t b = 0; b < cnt; b++) {
+                        float d0 = qnorm[a] + vnorm[r + b] - 2.0f * dot[b];
+                        heap_push(h0, &hsize[a], k, (int)(r + b), d0 > 0.0f ? d0 : 0.0f);
+                        if (a1 != a) {
+                            float d1 = qnorm[a1] + vnorm[r + b] - 2.0f * dot[4 + b];
+                            heap_push(h1, &hsize[a1], k, (int)(r + b), d1 > 0.0f ? d1 : 0.0f);
+                        }
+                    }
+                }
+            }
+        }
+
+        for (size_t a = 0; a < q_count; a++) {
+            finalize(ds, &queries->data[(q_begin + a) * D],
+                     &results[(q_begin + a) * (size_t)k], hsize[a], k);
+        }
+    }
+
+    free(vnorm);
+}
@@ -0,0 +1,567 @@
+#include "hnsw.h"
+#include "distance.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// Lock per nodo in costruzione: senza OpenMP l'inserimento è seriale
+#ifdef _OPENMP
+typedef omp_lock_t NodeLock;
+#define NODE_LOCK_INIT(l)    omp_init_lock(l)
+#define NODE_LOCK_DESTROY(l) omp_destroy_lock(l)
+#define NODE_LOCK(l)         omp_set_lock(l)
+#define NODE_UNLOCK(l)       omp_unset_lock(l)
+#else
+typedef char NodeLock;
+#define NODE_LOCK_INIT(l)    ((void)(l))
+#define NODE_LOCK_DESTROY(l) ((void)(l))
+#define NODE_LOCK(l)         ((void)(l))
+#define NODE_UNLOCK(l)       ((void)(l))
+#endif
+
+// ------------------ HEAP E STATO DELLA RICERCA ----------------------
+
+typedef struct {
+    int      d;
+    uint32_t id;
+} HItem;
+
+// max = 0: min-heap (candidati da espandere), max = 1: max-heap (risultati)
+typedef struct {
+    HItem *v;
+    size_t n, cap;
+    int    max;
+} Heap;
+
+static int heap_before(const Heap *h, HItem a, HItem b)
+{
+    return h->max ? a.d > b.d : a.d < b.d;
+}
+
+static int heap_push(Heap *h, HItem it)
+{
+    if (h->n == h->cap) {
+        size_t cap = h->cap ? h->cap * 2 : 64;
+        HItem *v = (HItem *)realloc(h->v, cap * sizeof(HItem));
+        if (!v) return -1;
+        h->v = v;
+        h->cap = cap;
+    }
+    size_t i = h->n++;
+    while (i > 0) {
+        size_t p = (i - 1) / 2;
+        if (!heap_before(h, it, h->v[p])) break;
+        h->v[i] = h->v[p];
+        i = p;
+    }
+    h->v[i] = it;
+    return 0;
+}
+
+static HItem heap_pop(Heap *h)
+{
+    HItem top = h->v[0], last = h->v[--h->n];
+    size_t i = 0;
+    for (;;) {
+        size_t c = 2 * i + 1;
+        if (c >= h->n) break;
+        if (c + 1 < h->n && heap_before(h, h->v[c + 1], h->v[c])) c++;
+        if (!heap_before(h, h->v[c], last)) break;
+        h->v[i] = h->v[c];
+        i = c;
+    }
+    if (h->n) h->v[i] = last;
+    return top;
+}
+
+// Stato di una ricerca: bitset dei nodi visitati (azzerato solo sui nodi
+// toccati), heap e copia della lista di archi letta sotto lock
+typedef struct {
+    uint64_t *bits;
+    uint32_t *touched;
+    size_t    nt, tcap;
+    Heap      cand, res;
+    uint32_t *nbuf;
+    size_t    evaluated;
+} Scratch;
+
+static int scratch_init(Scratch *s, size_t n, int M)
+{
+    memset(s, 0, sizeof(Scratch));
+    s->res.max = 1;
+    s->bits = (uint64_t *)calloc(n / 64 + 1, sizeof(uint64_t));
+    s->nbuf = (uint32_t *)malloc((size_t)(2 * M + 2) * sizeof(uint32_t));
+    return (s->bits && s->nbuf) ? 0 : -1;
+}
+
+static void scratch_free(Scratch *s)
+{
+    free(s->bits);
+    free(s->touched);
+    free(s->cand.v);
+    free(s->res.v);
+    free(s->nbuf);
+}
+
+// Marca i come visitato; ritorna 1 se lo era già (o -1 senza memoria)
+static int visit(Scratch *s, uint32_t i)
+{
+    uint64_t b = (uint64_t)1 << (i & 63);
+    if (s->bits[i >> 6] & b) return 1;
+    if (s->nt == s->tcap) {
+        size_t cap = s->tcap ? s->tcap * 2 : 256;
+        uint32_t *t = (uint32_t *)realloc(s->touched, cap * sizeof(uint32_t));
+        if (!t) return -1;
+        s->touched = t;
+        s->tcap = cap;
+    }
+    s->bits[i >> 6] |= b;
+    s->touched[s->nt++] = i;
+    return 0;
+}
+
+static void visit_reset(Scratch *s)
+{
+    for (size_t t = 0; t < s->nt; t++)
+        s->bits[s->touched[t] >> 6] = 0;
+    s->nt = 0;
+}
+
+// Slot di ricerca di un grafo: lo Scratch (bitset di n bit, heap, archi)
+// resta allocato fra una query e l'altra e search_layer azzera solo i nodi
+// toccati dalla ricerca precedente, quindi una ricerca costa quanto i nodi
+// che visita e non O(n). Uno slot per thread concorrente, preso con un CAS;
+// oltre HNSW_SLOTS ricerche simultanee si ricade su uno Scratch temporaneo.
+#define HNSW_SLOTS 64
+
+struct HnswSlot {
+    volatile long busy;
+    int     ready;     // s allocato (dal primo thread che ha preso lo slot)
+    Scratch s;
+    char    pad[64];   // slot adiacenti su righe di cache diverse
+};
+
+// Prende lo slot se libero (0 -> 1); 1 se preso
+static int slot_try(volatile long *busy)
+{
+#if defined(_MSC_VER)
+    return _InterlockedCompareExchange(busy, 1, 0) == 0;
+#else
+    long expected = 0;
+    return __atomic_compare_exchange_n(busy, &expected, 1L, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+#endif
+}
+
+static void slot_release(volatile long *busy)
+{
+#if defined(_MSC_VER)
+    _InterlockedExchange(busy, 0);
+#else
+    __atomic_store_n(busy, 0L, __ATOMIC_RELEASE);
+#endif
+}
+
+static Scratch *slot_acquire(const HnswIndex *g, struct HnswSlot **taken)
+{
+    *taken = NULL;
+    for (int i = 0; g->slots && i < HNSW_SLOTS; i++) {
+        struct HnswSlot *sl = &g->slots[i];
+        if (!slot_try(&sl->busy)) continue;
+        if (!sl->ready) {
+            if (scratch_init(&sl->s, g->n, g->M) != 0) {
+                scratch_free(&sl->s);
+                slot_release(&sl->busy);
+                return NULL;
+            }
+            sl->ready = 1;
+        }
+        *taken = sl;
+        return &sl->s;
+    }
+    return NULL;
+}
+
+// ------------------ GRAFO ----------------------
+
+static uint32_t *links_at(const HnswIndex *g, uint32_t i, int l)
+{
+    if (l == 0) return &g->links0[(size_t)i * (size_t)(1 + 2 * g->M)];
+    return &g->upper[i][(size_t)(l - 1) * (size_t)(1 + g->M)];
+}
+
+static int cap_at(const HnswIndex *g, int l)
+{
+    return l == 0 ? 2 * g->M : g->M;
+}
+
+static int dist_node(const HnswIndex *g, const uint8_t *vp, const uint8_t *vn, uint32_t j)
+{
+    size_t Dp = g->idx->Dp;
+    return index_code_distance(g->idx, vp, vn, &g->idx->vp_all[(size_t)j * Dp], &g->idx->vn_all[(size_t)j * Dp]);
+}
+
+// Copia degli archi di i al livello l (sotto lock in costruzione)
+static size_t read_links(const HnswIndex *g, NodeLock *locks, uint32_t i, int l, uint32_t *out)
+{
+    if (locks) NODE_LOCK(&locks[i]);
+    const uint32_t *ll = links_at(g, i, l);
+    size_t c = ll[0];
+    memcpy(out, ll + 1, c * sizeof(uint32_t));
+    if (locks) NODE_UNLOCK(&locks[i]);
+    return c;
+}
+
+// Discesa greedy al livello l: si passa al vicino più vicino finché ne esiste uno
+static uint32_t greedy(const HnswIndex *g, NodeLock *locks, Scratch *s,
+                       const uint8_t *vp, const uint8_t *vn, uint32_t cur, int *curd, int l)
+{
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        size_t c = read_links(g, locks, cur, l, s->nbuf);
+        for (size_t e = 0; e < c; e++) {
+            int d = dist_node(g, vp, vn, s->nbuf[e]);
+            s->evaluated++;
+            if (d < *curd) {
+                *curd = d;
+                cur = s->nbuf[e];
+                changed = 1;
+            }
+        }
+    }
+    return cur;
+}
+
+// Ricerca a fascio al livello l partendo da ep: al ritorno s->res contiene
+// (max-heap) fino a ef nodi con d~ minore. 0, -1 senza memoria.
+static int search_layer(const HnswIndex *g, NodeLock *locks, Scratch *s,
+                        const uint8_t *vp, const uint8_t *vn,
+                        uint32_t ep, int epd, int ef, int l)
+{
+    s->cand.n = 0;
+    s->res.n = 0;
+    visit_reset(s);
+
+    HItem first = { epd, ep };
+    if (visit(s, ep) < 0 || heap_push(&s->cand, first) || heap_push(&s->res, first))
+        return -1;
+
+    while (s->cand.n) {
+        HItem c = heap_pop(&s->cand);
+        if (c.d > s->res.v[0].d && s->res.n >= (size_t)ef) break;
+
+        size_t cnt = read_links(g, locks, c.id, l, s->nbuf);
+        for (size_t e = 0; e < cnt; e++) {
+            uint32_t j = s->nbuf[e];
+            int v = visit(s, j);
+            if (v < 0) return -1;
+            if (v) continue;
+
+            int d = dist_node(g, vp, vn, j);
+            s->evaluated++;
+            if (s->res.n < (size_t)ef || d < s->res.v[0].d) {
+                HItem it = { d, j };
+                if (heap_push(&s->cand, it) || heap_push(&s->res, it)) return -1;
+                if (s->res.n > (size_t)ef) heap_pop(&s->res);
+            }
+        }
+    }
+    return 0;
+}
+
+// Svuota il max-heap dei risultati in ordine di d~ crescente
+static size_t drain_sorted(Heap *res, HItem *out)
+{
+    size_t n = res->n;
+    for (size_t i = n; i > 0; i--)
+        out[i - 1] = heap_pop(res);
+    return n;
+}
+
+// Euristica di selezione: un candidato (in ordine crescente) entra se è più
+// vicino alla base che a tutti quelli già scelti; così gli archi coprono
+// direzioni diverse invece di addensarsi su un solo gruppo
+static size_t select_neighbors(const HnswIndex *g, const HItem *cand, size_t n, int cap, HItem *out)
+{
+    size_t Dp = g->idx->Dp, m = 0;
+    for (size_t e = 0; e < n && m < (size_t)cap; e++) {
+        const uint8_t *vpe = &g->idx->vp_all[(size_t)cand[e].id * Dp];
+        const uint8_t *vne = &g->idx->vn_all[(size_t)cand[e].id * Dp];
+        int good = 1;
+        for (size_t r = 0; r < m && good; r++)
+            if (dist_node(g, vpe, vne, out[r].id) < cand[e].d) good = 0;
+        if (good) out[m++] = cand[e];
+    }
+    return m;
+}
+
+static int cmp_hitem(const void *a, const void *b)
+{
+    const HItem *x = (const HItem *)a, *y = (const HItem *)b;
+    if (x->d != y->d) return x->d < y->d ? -1 : 1;
+    return x->id < y->id ? -1 : (x->id > y->id);
+}
+
+// Aggiunge l'arco i -> j al livello l; con la lista piena la ricalcola
+// con l'euristica sui vecchi archi + j. tmp: almeno 2 * (cap + 1) elementi.
+static void add_link(const HnswIndex *g, NodeLock *locks, uint32_t i, uint32_t j, int l, HItem *tmp)
+{
+    size_t Dp = g->idx->Dp;
+    int cap = cap_at(g, l);
+
+    if (locks) NODE_LOCK(&locks[i]);
+    uint32_t *ll = links_at(g, i, l);
+    uint32_t c = ll[0];
+
+    int dup = 0;
+    for (uint32_t e = 0; e < c && !dup; e++) dup = ll[1 + e] == j;
+
+    if (!dup && c < (uint32_t)cap) {
+        ll[1 + c] = j;
+        ll[0] = c + 1;
+    } else if (!dup) {
+        const uint8_t *vpi = &g->idx->vp_all[(size_t)i * Dp];
+        const uint8_t *vni = &g->idx->vn_all[(size_t)i * Dp];
+        for (uint32_t e = 0; e < c; e++) {
+            tmp[e].id = ll[1 + e];
+            tmp[e].d  = dist_node(g, vpi, vni, ll[1 + e]);
+        }
+        tmp[c].id = j;
+        tmp[c].d  = dist_node(g, vpi, vni, j);
+        qsort(tmp, (size_t)c + 1, sizeof(HItem), cmp_hitem);
+
+        HItem *sel = tmp + c + 1;
+        size_t m = select_neighbors(g, tmp, (size_t)c + 1, cap, sel);
+        for (size_t e = 0; e < m; e++) ll[1 + e] = sel[e].id;
+        ll[0] = (uint32_t)m;
+    }
+    if (locks) NODE_UNLOCK(&locks[i]);
+}
+
+// ------------------ COSTRUZIONE ----------------------
+
+// Livello casuale (deterministico per nodo): P(L >= l) = M^-l
+static int node_level(uint32_t i, double mult)
+{
+    uint64_t z = (uint64_t)i + 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z ^= z >> 31;
+    double u = ((double)(z >> 11) + 1.0) / 9007199254740992.0;   // (0, 1]
+    int l = (int)(-log(u) * mult);
+    return l < HNSW_MAX_LEVEL ? l : HNSW_MAX_LEVEL;
+}
+
+static int insert(HnswIndex *g, NodeLock *locks, NodeLock *glock, Scratch *s,
+                  HItem *cand, HItem *sel, HItem *tmp, uint32_t i, int ef_c)
+{
+    size_t Dp = g->idx->Dp;
+    const uint8_t *vp = &g->idx->vp_all[(size_t)i * Dp];
+    const uint8_t *vn = &g->idx->vn_all[(size_t)i * Dp];
+    int L = g->level[i];
+
+    NODE_LOCK(glock);
+    uint32_t cur = g->entry;
+    int top = g->max_level;
+    NODE_UNLOCK(glock);
+
+    int curd = dist_node(g, vp, vn, cur);
+    for (int l = top; l > L; l--)
+        cur = greedy(g, locks, s, vp, vn, cur, &curd, l);
+
+    for (int l = (L < top ? L : top); l >= 0; l--) {
+        if (search_layer(g, locks, s, vp, vn, cur, curd, ef_c, l) != 0) return -1;
+        size_t n = drain_sorted(&s->res, cand);
+
+        size_t m = select_neighbors(g, cand, n, cap_at(g, l), sel);
+        for (size_t e = 0; e < m; e++) {
+            if (sel[e].id == i) continue;
+            add_link(g, locks, i, sel[e].id, l, tmp);
+            add_link(g, locks, sel[e].id, i, l, tmp);
+        }
+        if (n) {
+            cur = cand[0].id;
+            curd = cand[0].d;
+        }
+    }
+
+    if (L > top) {
+        NODE_LOCK(glock);
+        if (L > g->max_level) {
+            g->max_level = L;
+            g->entry = i;
+        }
+        NODE_UNLOCK(glock);
+    }
+    return 0;
+}
+
+HnswIndex *build_hnsw(const Index *idx, int M, int ef_construction)
+{
+    if (!idx || idx->n == 0 || idx->n > UINT32_MAX) return NULL;
+    if (M < 2) M = HNSW_DEFAULT_M;
+    if (ef_construction < 1) ef_construction = HNSW_DEFAULT_EF_C;
+    if (ef_construction < M) ef_construction = M;
+
+    size_t n = idx->n;
+    HnswIndex *g = (HnswIndex *)calloc(1, sizeof(HnswIndex));
+    if (!g) return NULL;
+    g->idx = idx;
+    g->n = n;
+    g->M = M;
+
+    g->level  = (uint8_t *)malloc(n);
+    g->links0 = (uint32_t *)calloc(n * (size_t)(1 + 2 * M), sizeof(uint32_t));
+    g->upper  = (uint32_t **)calloc(n, sizeof(uint32_t *));
+    g->slots  = (struct HnswSlot *)calloc(HNSW_SLOTS, sizeof(struct HnswSlot));
+    NodeLock *locks = (NodeLock *)malloc(n * sizeof(NodeLock));
+    if (!g->level || !g->links0 || !g->upper || !g->slots || !locks) {
+        free(locks);
+        free_hnsw(g);
+        return NULL;
+    }
+
+    double mult = 1.0 / log((double)M);
+    int failed = 0;
+    for (size_t i = 0; i < n && !failed; i++) {
+        int L = node_level((uint32_t)i, mult);
+        g->level[i] = (uint8_t)L;
+        if (L > 0) {
+            g->upper[i] = (uint32_t *)calloc((size_t)L * (size_t)(1 + M), sizeof(uint32_t));
+            if (!g->upper[i]) failed = 1;
+        }
+        NODE_LOCK_INIT(&locks[i]);
+    }
+    if (failed) {
+        for (size_t i = 0; i < n; i++) NODE_LOCK_DESTROY(&locks[i]);
+        free(locks);
+        free_hnsw(g);
+        return NULL;
+    }
+
+    NodeLock glock;
+    NODE_LOCK_INIT(&glock);
+    g->entry = 0;
+    g->max_level = g->level[0];
+
+    // Il nodo 0 è il primo punto d'ingresso, gli altri sono inseriti in parallelo
+    #pragma omp parallel reduction(|:failed)
+    {
+        Scratch s;
+        size_t cap = (size_t)ef_construction + (size_t)(4 * M) + 4;
+        HItem *cand = (HItem *)malloc(cap * sizeof(HItem));
+        HItem *sel  = (HItem *)malloc(cap * sizeof(HItem));
+        HItem *tmp  = (HItem *)malloc((size_t)(4 * M + 4) * sizeof(HItem));
+        int ok = scratch_init(&s, n, M) == 0 && cand && sel && tmp;
+        if (!ok) failed = 1;
+
+        #pragma omp for schedule(dynamic, 64)
+        for (long i = 1; i < (long)n; i++) {
+            if (!ok) continue;
+            if (insert(g, locks, &glock, &s, cand, sel, tmp, (uint32_t)i, ef_construction) != 0) {
+                failed = 1;
+                ok = 0;
+            }
+        }
+
+        scratch_free(&s);
+        free(cand);
+        free(sel);
+        free(tmp);
+    }
+
+    NODE_LOCK_DESTROY(&glock);
+    for (size_t i = 0; i < n; i++) NODE_LOCK_DESTROY(&locks[i]);
+    free(locks);
+
+    if (failed) {
+        free_hnsw(g);
+        return NULL;
+    }
+    return g;
+}
+
+void free_hnsw(HnswIndex *g)
+{
+    if (!g) return;
+    if (g->upper)
+        for (size_t i = 0; i < g->n; i++) free(g->upper[i]);
+    if (g->slots)
+        for (int i = 0; i < HNSW_SLOTS; i++)
+            if (g->slots[i].ready) scratch_free(&g->slots[i].s);
+    free(g->slots);
+    free(g->upper);
+    free(g->links0);
+    free(g->level);
+    free(g);
+}
+
+size_t hnsw_memory_bytes(const HnswIndex *g)
+{
+    if (!g) return 0;
+    size_t b = sizeof(HnswIndex)
+             + g->n * (sizeof(uint8_t) + sizeof(uint32_t *))
+             + g->n * (size_t)(1 + 2 * g->M) * sizeof(uint32_t);
+    for (size_t i = 0; i < g->n; i++)
+        b += (size_t)g->level[i] * (size_t)(1 + g->M) * sizeof(uint32_t);
+    return b;
+}
+
+// ------------------ RICERCA ----------------------
+
+size_t hnsw_search(const HnswIndex *g,
+                   const uint8_t *vp_q,
+                   const uint8_t *vn_q,
+                   int ef,
+                   uint32_t *ids,
+                   int *dist,
+                   size_t *evaluated)
+{
+    if (evaluated) *evaluated = 0;
+    if (!g || !vp_q || !vn_q || !ids || !dist) return 0;
+    if (ef < 1) ef = 1;
+
+    // Slot del grafo se libero, altrimenti uno Scratch solo per questa ricerca
+    struct HnswSlot *slot;
+    Scratch tmp, *s = slot_acquire(g, &slot);
+    if (!s) {
+        s = &tmp;
+        if (scratch_init(s, g->n, g->M) != 0) {
+            scratch_free(s);
+            return 0;
+        }
+    }
+
+    HItem *out = (HItem *)malloc((size_t)ef * sizeof(HItem));
+    size_t n = 0;
+    if (out) {
+        uint32_t cur = g->entry;
+        int curd = dist_node(g, vp_q, vn_q, cur);
+        s->evaluated = 1;
+        for (int l = g->max_level; l > 0; l--)
+            cur = greedy(g, NULL, s, vp_q, vn_q, cur, &curd, l);
+
+        if (search_layer(g, NULL, s, vp_q, vn_q, cur, curd, ef, 0) == 0) {
+            n = drain_sorted(&s->res, out);
+            for (size_t i = 0; i < n; i++) {
+                ids[i]  = out[i].id;
+                dist[i] = out[i].d;
+            }
+        }
+        if (evaluated) *evaluated = s->evaluated;
+    }
+
+    if (slot) slot_release(&slot->busy);
+    else      scratch_free(s);
+    free(out);
+    return n;
+}
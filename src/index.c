@@ -1,10 +1,20 @@
 #include "index.h"
 #include "quantization.h"
 #include "distance.h"
+#include "perfcount.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 
+#if defined(__linux__)
+#include <sys/mman.h>
+#elif defined(_WIN32)
+#include <malloc.h>
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
 // ------------------ SELEZIONE DEI PIVOT ----------------------
 //
 // j = Da 0 ad h-1
@@ -19,9 +29,139 @@ static void select_pivots(size_t *pivot_ids, size_t n, int h) {
     }
 }
 
+// Build concorrenti (shard, moduli Python senza OpenMP) non devono mai
+// ottenere la stessa versione: la cache le usa per invalidare i risultati
+uint64_t index_next_version(void) {
+    static volatile int64_t counter = 0;
+#if defined(_MSC_VER)
+    return (uint64_t)_InterlockedIncrement64((volatile __int64 *)&counter);
+#else
+    return (uint64_t)__atomic_add_fetch(&counter, 1, __ATOMIC_RELAXED);
+#endif
+}
+
+// --------------------------------------------------------------
+// ARENA DELL'INDICE
+//
+// pivot_ids | vp_all | vn_all | vp_piv | vn_piv | dist, ognuno a un
+// multiplo di INDEX_ARENA_ALIGN, in un solo blocco azzerato. Su Linux le
+// arene da almeno INDEX_HUGE_PAGE byte sono mappate allineate alla huge
+// page: con THP il kernel le copre con pagine da 2 MB (meno TLB miss nella
+// scansione di vp_all/vn_all e dist).
+// --------------------------------------------------------------
+
+static IndexPages index_pages = INDEX_PAGES_THP;
+
+void index_set_pages(IndexPages pages) {
+    index_pages = pages;
+}
+
+int index_pages_from_name(const char *name) {
+    if (!name) return -1;
+    if (strcmp(name, "small") == 0)   return INDEX_PAGES_SMALL;
+    if (strcmp(name, "thp") == 0)     return INDEX_PAGES_THP;
+    if (strcmp(name, "hugetlb") == 0) return INDEX_PAGES_HUGETLB;
+    return -1;
+}
+
+static size_t arena_round(size_t bytes) {
+    return (bytes + INDEX_ARENA_ALIGN - 1) & ~(size_t)(INDEX_ARENA_ALIGN - 1);
+}
+
+// *bytes diventa la dimensione effettivamente riservata
+static void *arena_alloc(size_t *bytes, int *kind) {
+#if defined(__linux__)
+    if (index_pages != INDEX_PAGES_SMALL && *bytes >= INDEX_HUGE_PAGE) {
+        size_t len = (*bytes + INDEX_HUGE_PAGE - 1) & ~(size_t)(INDEX_HUGE_PAGE - 1);
+
+#ifdef MAP_HUGETLB
+        if (index_pages == INDEX_PAGES_HUGETLB) {
+            void *p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (p != MAP_FAILED) {
+                *bytes = len;
+                *kind = INDEX_ARENA_HUGETLB;
+                return p;
+            }
+        }
+#endif
+        // Una huge page in pi, poi si restituiscono testa e coda non allineate
+        uint8_t *raw = mmap(NULL, len + INDEX_HUGE_PAGE, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (raw != MAP_FAILED) {
+            uintptr_t a = ((uintptr_t)raw + INDEX_HUGE_PAGE - 1) & ~(uintptr_t)(INDEX_HUGE_PAGE - 1);
+            size_t head = a - (uintptr_t)raw;
+            if (head) munmap(raw, head);
+            if (INDEX_HUGE_PAGE - head) munmap((uint8_t *)a + len, INDEX_HUGE_PAGE - head);
+#ifdef MADV_HUGEPAGE
+            madvise((void *)a, len, MADV_HUGEPAGE);
+#endif
+            *bytes = len;
+            *kind = INDEX_ARENA_MMAP;
+            return (void *)a;
+        }
+    }
+#endif
+
+    void *p = NULL;
+#if defined(_WIN32)
+    p = _aligned_malloc(*bytes, INDEX_ARENA_ALIGN);
+#else
+    if (posix_memalign(&p, INDEX_ARENA_ALIGN, *bytes) != 0) p = NULL;
+#endif
+    if (!p) return NULL;
+    memset(p, 0, *bytes);
+    *kind = INDEX_ARENA_HEAP;
+    return p;
+}
+
+static void arena_free(void *p, size_t bytes, int kind) {
+    if (!p) return;
+#if defined(__linux__)
+    if (kind != INDEX_ARENA_HEAP) {
+        munmap(p, bytes);
+        return;
+    }
+#endif
+    (void)bytes; (void)kind;
+#if defined(_WIN32)
+    _aligned_free(p);
+#else
+    free(p);
+#endif
+}
+
+int index_alloc_arena(Index *idx) {
+    size_t n = idx->n, h = idx->h;
+    idx->Dp = index_row_stride(idx->D);
+
+    size_t s_piv  = arena_round(h * sizeof(size_t));
+    size_t s_all  = arena_round(n * idx->Dp);
+    size_t s_pc   = arena_round(h * idx->Dp);
+    size_t s_dist = arena_round(n * h * sizeof(int));
+
+    size_t bytes = s_piv + 2 * s_all + 2 * s_pc + s_dist;
+    uint8_t *a = arena_alloc(&bytes, &idx->arena_kind);
+    if (!a) return -1;
+
+    idx->arena       = a;
+    idx->arena_bytes = bytes;
+    idx->pivot_ids   = (size_t *)a;   a += s_piv;
+    idx->vp_all      = a;             a += s_all;
+    idx->vn_all      = a;             a += s_all;
+    idx->vp_piv      = a;             a += s_pc;
+    idx->vn_piv      = a;             a += s_pc;
+    idx->dist        = (int *)a;
+    return 0;
+}
+
 Index *build_index(const MatrixF32 *ds, int h, int x) {
+    return build_index_graded(ds, h, x, 1);
+}
+
+Index *build_index_graded(const MatrixF32 *ds, int h, int x, int bits) {
 
-    if (!ds || h <= 0 || x <= 0) return NULL;
+    if (!ds || h <= 0 || x <= 0 || bits < 1 || bits > QUANT_MAX_BITS) return NULL;
 
     size_t n = ds->n;
     size_t D = ds->d;
@@ -33,92 +173,53 @@ Index *build_index(const MatrixF32 *ds, int h, int x) {
     idx->n = n;
     idx->h = h;
     idx->D = D;
+    idx->bits = bits;
+    idx->version = index_next_version();
 
-    // Allocazione pivot_ids (identificativi)
-    idx->pivot_ids = malloc(h * sizeof(size_t));
-    if (!idx->pivot_ids) {
+    // Tutti gli array in un'unica arena allineata
+    if (index_alloc_arena(idx) != 0) {
         free(idx);
         return NULL;
     }
+    size_t Dp = idx->Dp;
 
     select_pivots(idx->pivot_ids, n, h);
 
-    // Allocazione vettori quantizzati per tutto il dataset
-    idx->vp_all = malloc(n * D * sizeof(uint8_t));
-    idx->vn_all = malloc(n * D * sizeof(uint8_t));
-
-    if (!idx->vp_all || !idx->vn_all) {
-        free(idx->pivot_ids);
-        free(idx->vp_all);
-        free(idx->vn_all);
-        free(idx);
-        return NULL;
-    }
-
-    // Quantizzazione dataset
+    // Quantizzazione dataset (righe di Dp byte, coda gi a zero)
+    PERF_BEGIN(PERF_PHASE_QUANT);
     for (size_t i = 0; i < n; i++) {
         const float *row = &ds->data[i * D];
-        uint8_t *vp = &idx->vp_all[i * D];
-        uint8_t *vn = &idx->vn_all[i * D];
+        uint8_t *vp = &idx->vp_all[i * Dp];
+        uint8_t *vn = &idx->vn_all[i * Dp];
 
-        quantize_vector(row, vp, vn, D, x);
-    }
-
-    // Allocazione quantizzazioni dei SOLI pivot
-    idx->vp_piv = malloc(h * D * sizeof(uint8_t));
-    idx->vn_piv = malloc(h * D * sizeof(uint8_t));
-
-    if (!idx->vp_piv || !idx->vn_piv) {
-        free(idx->pivot_ids);
-        free(idx->vp_all);
-        free(idx->vn_all);
-        free(idx->vp_piv);
-        free(idx->vn_piv);
-        free(idx);
-        return NULL;
+        quantize_vector_graded(row, vp, vn, D, x, bits);
     }
+    PERF_END(PERF_PHASE_QUANT);
 
     // Copia dei pivot gi quantizzati
     for (int j = 0; j < h; j++) {
         size_t p = idx->pivot_ids[j];
 
-        memcpy(&idx->vp_piv[j * D], &idx->vp_all[p * D], D * sizeof(uint8_t));
-        memcpy(&idx->vn_piv[j * D], &idx->vn_all[p * D], D * sizeof(uint8_t));
-    }
-
-    // Allocazione matrice distanze
-    idx->dist = malloc(n * h * sizeof(int));
-    if (!idx->dist) {
-        free(idx->pivot_ids);
-        free(idx->vp_all);  free(idx->vn_all);
-        free(idx->vp_piv);  free(idx->vn_piv);
-        free(idx);
-        return NULL;
+        memcpy(&idx->vp_piv[j * Dp], &idx->vp_all[p * Dp], Dp * sizeof(uint8_t));
+        memcpy(&idx->vn_piv[j * Dp], &idx->vn_all[p * Dp], Dp * sizeof(uint8_t));
     }
 
     // Calcolo distanze approssimate d(v,p)
-    for (size_t i = 0; i < n; i++) {
-
-        const uint8_t *vpi = &idx->vp_all[i * D];
-        const uint8_t *vni = &idx->vn_all[i * D];
-
-        for (int j = 0; j < h; j++) {
-
-            const uint8_t *vpj = &idx->vp_piv[j * D];
-            const uint8_t *vnj = &idx->vn_piv[j * D];
-
-            int d = approximate_distance(vpi, vni, vpj, vnj, D);
-
-            idx->dist[i * h + j] = d;
-        }
-    }
+    PERF_BEGIN(PERF_PHASE_PIVOT);
+    index_pivot_distances(idx, idx->vp_all, idx->vn_all, n, idx->dist);
+    PERF_END(PERF_PHASE_PIVOT);
 
     return idx;
 }
 
 Index *build_index_f64(const MatrixF64 *ds, int h, int x)
 {
-    if (!ds || h <= 0 || x <= 0) return NULL;
+    return build_index_graded_f64(ds, h, x, 1);
+}
+
+Index *build_index_graded_f64(const MatrixF64 *ds, int h, int x, int bits)
+{
+    if (!ds || h <= 0 || x <= 0 || bits < 1 || bits > QUANT_MAX_BITS) return NULL;
 
     size_t n = ds->n;
     size_t D = ds->d;
@@ -129,87 +230,326 @@ Index *build_index_f64(const MatrixF64 *ds, int h, int x)
     idx->n = n;
     idx->h = (size_t)h;
     idx->D = D;
+    idx->bits = bits;
+    idx->version = index_next_version();
 
-    idx->pivot_ids = malloc(h * sizeof(size_t));
-    if (!idx->pivot_ids) {
+    if (index_alloc_arena(idx) != 0) {
         free(idx);
         return NULL;
     }
+    size_t Dp = idx->Dp;
 
     select_pivots(idx->pivot_ids, n, h);
 
-    idx->vp_all = malloc(n * D * sizeof(uint8_t));
-    idx->vn_all = malloc(n * D * sizeof(uint8_t));
-    if (!idx->vp_all || !idx->vn_all) {
-        free(idx->pivot_ids);
-        free(idx->vp_all);
-        free(idx->vn_all);
-        free(idx);
-        return NULL;
-    }
-
     // Quantizzazione dataset (double)
+    PERF_BEGIN(PERF_PHASE_QUANT);
     for (size_t i = 0; i < n; i++) {
         const double *row = &ds->data[i * D];
-        uint8_t *vp = &idx->vp_all[i * D];
-        uint8_t *vn = &idx->vn_all[i * D];
-        quantize_vector_f64(row, vp, vn, D, x);
+        uint8_t *vp = &idx->vp_all[i * Dp];
+        uint8_t *vn = &idx->vn_all[i * Dp];
+        quantize_vector_graded_f64(row, vp, vn, D, x, bits);
     }
+    PERF_END(PERF_PHASE_QUANT);
 
     // Pivot
-    idx->vp_piv = malloc(h * D * sizeof(uint8_t));
-    idx->vn_piv = malloc(h * D * sizeof(uint8_t));
-    if (!idx->vp_piv || !idx->vn_piv) {
-        free(idx->pivot_ids);
-        free(idx->vp_all); free(idx->vn_all);
-        free(idx->vp_piv); free(idx->vn_piv);
-        free(idx);
-        return NULL;
+    for (int j = 0; j < h; j++) {
+        size_t p = idx->pivot_ids[j];
+        memcpy(&idx->vp_piv[j * Dp], &idx->vp_all[p * Dp], Dp * sizeof(uint8_t));
+        memcpy(&idx->vn_piv[j * Dp], &idx->vn_all[p * Dp], Dp * sizeof(uint8_t));
     }
 
+    PERF_BEGIN(PERF_PHASE_PIVOT);
+    index_pivot_distances(idx, idx->vp_all, idx->vn_all, n, idx->dist);
+    PERF_END(PERF_PHASE_PIVOT);
+
+    return idx;
+}
+
+
+// --------------------------------------------------------------
+// PULIZIA MEMORIA
+// --------------------------------------------------------------
+
+void free_index(Index *idx) {
+    if (!idx) return;
+    free(idx->sorted_id);
+    free(idx->sorted_key);
+    free(idx->hot_dist);
+    free(idx->piv_center);
+    arena_free(idx->arena, idx->arena_bytes, idx->arena_kind);
+    free(idx);
+}
+
+// --------------------------------------------------------------
+// COLONNE ORDINATE PER PIVOT
+//
+// Per una riga v e il pivot p della colonna: |d(v,p) - d(q,p)| <= d*(v),
+// quindi le righe con chiave fuori da [d(q,p) - worst, d(q,p) + worst] sono
+// comunque scartate dal pruning e non serve visitarle.
+// --------------------------------------------------------------
+
+typedef struct {
+    int      key;
+    uint32_t id;
+} SortEntry;
+
+static int cmp_sort_entry(const void *a, const void *b) {
+    const SortEntry *A = (const SortEntry *)a, *B = (const SortEntry *)b;
+    if (A->key != B->key) return (A->key > B->key) - (A->key < B->key);
+    return (A->id > B->id) - (A->id < B->id);
+}
+
+// Varianza di d(v,p_j) sulle n righe
+static double pivot_variance(const Index *idx, int j) {
+    size_t n = idx->n, h = idx->h;
+    double s = 0.0, s2 = 0.0;
+    for (size_t i = 0; i < n; i++) {
+        double v = (double)idx->dist[i * h + (size_t)j];
+        s += v;
+        s2 += v * v;
+    }
+    return s2 / (double)n - (s / (double)n) * (s / (double)n);
+}
+
+int index_sort_pivots(Index *idx, int m) {
+    if (!idx || m < 0 || m > INDEX_MAX_SORTED || (size_t)m > idx->h) return -1;
+
+    free(idx->sorted_id);
+    free(idx->sorted_key);
+    idx->sorted_id  = NULL;
+    idx->sorted_key = NULL;
+    idx->n_sorted   = 0;
+    idx->version    = index_next_version();
+    if (m == 0 || idx->n == 0) return 0;
+
+    size_t n = idx->n;
+    int h = (int)idx->h;
+
+    // Pivot con la varianza maggiore di d(v,p): chiavi pi distribuite,
+    // finestre con meno righe
+    double var[INDEX_MAX_SORTED];
+    int piv[INDEX_MAX_SORTED];
+    for (int c = 0; c < m; c++) { var[c] = -1.0; piv[c] = -1; }
+
     for (int j = 0; j < h; j++) {
-        size_t p = idx->pivot_ids[j];
-        memcpy(&idx->vp_piv[j * D], &idx->vp_all[p * D], D * sizeof(uint8_t));
-        memcpy(&idx->vn_piv[j * D], &idx->vn_all[p * D], D * sizeof(uint8_t));
+        double vj = pivot_variance(idx, j);
+
+        // Inserimento nelle m migliori (ordinate per varianza decrescente)
+        for (int c = 0; c < m; c++) {
+            if (vj > var[c]) {
+                for (int t = m - 1; t > c; t--) { var[t] = var[t - 1]; piv[t] = piv[t - 1]; }
+                var[c] = vj;
+                piv[c] = j;
+                break;
+            }
+        }
     }
 
-    idx->dist = malloc(n * h * sizeof(int));
-    if (!idx->dist) {
-        free(idx->pivot_ids);
-        free(idx->vp_all); free(idx->vn_all);
-        free(idx->vp_piv); free(idx->vn_piv);
-        free(idx);
-        return NULL;
+    uint32_t *ids = malloc((size_t)m * n * sizeof(uint32_t));
+    int *keys = malloc((size_t)m * n * sizeof(int));
+    SortEntry *tmp = malloc(n * sizeof(SortEntry));
+    if (!ids || !keys || !tmp) {
+        free(ids);
+        free(keys);
+        free(tmp);
+        return -1;
     }
 
-    for (size_t i = 0; i < n; i++) {
-        const uint8_t *vpi = &idx->vp_all[i * D];
-        const uint8_t *vni = &idx->vn_all[i * D];
+    for (int c = 0; c < m; c++) {
+        for (size_t i = 0; i < n; i++) {
+            tmp[i].key = idx->dist[i * h + piv[c]];
+            tmp[i].id  = (uint32_t)i;
+        }
+        qsort(tmp, n, sizeof(SortEntry), cmp_sort_entry);
+        for (size_t i = 0; i < n; i++) {
+            ids[(size_t)c * n + i]  = tmp[i].id;
+            keys[(size_t)c * n + i] = tmp[i].key;
+        }
+        idx->sorted_piv[c] = piv[c];
+    }
+    free(tmp);
 
-        for (int j = 0; j < h; j++) {
-            const uint8_t *vpj = &idx->vp_piv[j * D];
-            const uint8_t *vnj = &idx->vn_piv[j * D];
+    idx->sorted_id  = ids;
+    idx->sorted_key = keys;
+    idx->n_sorted   = m;
+    return 0;
+}
 
-            int d = approximate_distance(vpi, vni, vpj, vnj, D);
-            idx->dist[i * h + j] = d;
+size_t index_sorted_lower_bound(const Index *idx, int c, int key) {
+    const int *col = &idx->sorted_key[(size_t)c * idx->n];
+    size_t lo = 0, hi = idx->n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (col[mid] < key) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+int index_sorted_column(const Index *idx, const int *dq_pivot, int k) {
+    int best = 0;
+    long long best_spread = -1;
+    size_t n = idx->n;
+
+    for (int c = 0; c < idx->n_sorted; c++) {
+        const int *col = &idx->sorted_key[(size_t)c * n];
+        size_t pos = index_sorted_lower_bound(idx, c, dq_pivot[idx->sorted_piv[c]]);
+        size_t a = pos > (size_t)k ? pos - (size_t)k : 0;
+        size_t b = pos + (size_t)k < n ? pos + (size_t)k : n - 1;
+        long long spread = (long long)col[b] - (long long)col[a];
+        if (spread > best_spread) {
+            best_spread = spread;
+            best = c;
         }
     }
+    return best;
+}
 
-    return idx;
+// --------------------------------------------------------------
+// CASCATA DEI PIVOT
+//
+// d* = max_j |d(v,p_j) - d(q,p_j)| raggiunge la soglia appena la raggiunge
+// uno qualsiasi dei termini: le colonne calde (compatte, lette in sequenza)
+// scartano gran parte delle righe e le altre colonne di dist sono lette
+// solo per le sopravvissute, con uscita anticipata.
+// --------------------------------------------------------------
+
+static int cmp_int(const void *a, const void *b) {
+    int A = *(const int *)a, B = *(const int *)b;
+    return (A > B) - (A < B);
+}
+
+int index_build_cascade(Index *idx, int m) {
+    if (!idx || m < 0 || m > INDEX_MAX_HOT || (size_t)m > idx->h) return -1;
+
+    free(idx->hot_dist);
+    free(idx->piv_center);
+    idx->hot_dist   = NULL;
+    idx->piv_center = NULL;
+    idx->n_hot      = 0;
+    if (m == 0 || idx->n == 0) return 0;
+
+    size_t n = idx->n;
+    int h = (int)idx->h;
+
+    // Pivot caldi: varianza maggiore di d(v,p), come per le colonne ordinate
+    double var[INDEX_MAX_HOT];
+    int piv[INDEX_MAX_HOT];
+    for (int c = 0; c < m; c++) { var[c] = -1.0; piv[c] = -1; }
+
+    for (int j = 0; j < h; j++) {
+        double vj = pivot_variance(idx, j);
+        for (int c = 0; c < m; c++) {
+            if (vj > var[c]) {
+                for (int t = m - 1; t > c; t--) { var[t] = var[t - 1]; piv[t] = piv[t - 1]; }
+                var[c] = vj;
+                piv[c] = j;
+                break;
+            }
+        }
+    }
+
+    size_t ns = n < INDEX_CENTER_SAMPLE ? n : INDEX_CENTER_SAMPLE;
+    int *hot    = malloc(n * (size_t)m * sizeof(int));
+    int *center = malloc((size_t)h * sizeof(int));
+    int *tmp    = malloc(ns * sizeof(int));
+    if (!hot || !center || !tmp) {
+        free(hot);
+        free(center);
+        free(tmp);
+        return -1;
+    }
+
+    for (size_t i = 0; i < n; i++)
+        for (int c = 0; c < m; c++)
+            hot[i * (size_t)m + c] = idx->dist[i * (size_t)h + (size_t)piv[c]];
+
+    // Mediana di ogni colonna su ns righe a passo costante
+    for (int j = 0; j < h; j++) {
+        for (size_t s = 0; s < ns; s++)
+            tmp[s] = idx->dist[(s * n / ns) * (size_t)h + (size_t)j];
+        qsort(tmp, ns, sizeof(int), cmp_int);
+        center[j] = tmp[ns / 2];
+    }
+    free(tmp);
+
+    memcpy(idx->hot_piv, piv, (size_t)m * sizeof(int));
+    idx->hot_dist   = hot;
+    idx->piv_center = center;
+    idx->n_hot      = m;
+    return 0;
 }
 
+void index_cascade_order(const Index *idx, const int *dq_pivot, int *dq_hot, int *order) {
+    int h = (int)idx->h, m = idx->n_hot, cold = 0;
+
+    for (int c = 0; c < m; c++)
+        dq_hot[c] = dq_pivot[idx->hot_piv[c]];
+
+    // Inserimento per scarto decrescente (h piccolo)
+    for (int j = 0; j < h; j++) {
+        int hot = 0;
+        for (int c = 0; c < m; c++) hot |= idx->hot_piv[c] == j;
+        if (hot) continue;
+
+        int e = abs(dq_pivot[j] - idx->piv_center[j]);
+        int t = cold++;
+        while (t > 0 && abs(dq_pivot[order[t - 1]] - idx->piv_center[order[t - 1]]) < e) {
+            order[t] = order[t - 1];
+            t--;
+        }
+        order[t] = j;
+    }
+}
+
+int *index_cascade_begin(const Index *idx, const int *dq_pivot, int *dq_hot, int *buf) {
+    if (idx->n_hot <= 0) return NULL;
+
+    int *order = idx->h <= INDEX_ORDER_STACK ? buf : (int *)malloc(idx->h * sizeof(int));
+    if (order) index_cascade_order(idx, dq_pivot, dq_hot, order);
+    return order;
+}
+
+void index_cascade_end(int *order, int *buf) {
+    if (order != buf) free(order);
+}
 
 // --------------------------------------------------------------
-// PULIZIA MEMORIA
+// DISTANZE DAI PIVOT
 // --------------------------------------------------------------
 
-void free_index(Index *idx) {
-    if (!idx) return;
-    free(idx->pivot_ids);
-    free(idx->vp_all);
-    free(idx->vn_all);
-    free(idx->vp_piv);
-    free(idx->vn_piv);
-    free(idx->dist);
-    free(idx);
+void index_pivot_distances(const Index *idx, const uint8_t *vp, const uint8_t *vn, size_t nq, int *dq) {
+    size_t Dp = idx->Dp, h = idx->h;
+
+    for (size_t b = 0; b < nq; b += INDEX_PIVOT_BLOCK) {
+        size_t e = b + INDEX_PIVOT_BLOCK < nq ? b + INDEX_PIVOT_BLOCK : nq;
+
+        for (size_t j = 0; j < h; j++) {
+            const uint8_t *vpj = &idx->vp_piv[j * Dp];
+            const uint8_t *vnj = &idx->vn_piv[j * Dp];
+
+            for (size_t i = b; i < e; i++)
+                dq[i * h + j] = index_code_distance(idx, &vp[i * Dp], &vn[i * Dp], vpj, vnj);
+        }
+    }
+}
+
+// --------------------------------------------------------------
+// OCCUPAZIONE DI MEMORIA
+// --------------------------------------------------------------
+
+size_t index_memory_estimate(size_t n, size_t h, size_t D) {
+    size_t Dp = index_row_stride(D);
+    return sizeof(Index)
+         + arena_round(h * sizeof(size_t))            // pivot_ids
+         + 2 * arena_round(n * Dp * sizeof(uint8_t))  // vp_all, vn_all
+         + 2 * arena_round(h * Dp * sizeof(uint8_t))  // vp_piv, vn_piv
+         + arena_round(n * h * sizeof(int));          // dist
+}
+
+size_t index_memory_bytes(const Index *idx) {
+    if (!idx) return 0;
+    return sizeof(Index) + idx->arena_bytes
+         + (size_t)idx->n_sorted * idx->n * (sizeof(uint32_t) + sizeof(int))
+         + (idx->n_hot ? (idx->n * (size_t)idx->n_hot + idx->h) * sizeof(int) : 0);
 }
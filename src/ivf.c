@@ -0,0 +1,259 @@
+#include "ivf.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// ------------------ K-MEANS (Lloyd) ----------------------
+//
+// Il k-means lavora in double per entrambe le precisioni: le righe float32
+// sono convertite al volo. L'addestramento usa al più C * IVF_TRAIN_PER_LIST
+// righe a passo costante (deterministico), poi tutte le n righe vengono
+// assegnate al centroide più vicino.
+//
+// ---------------------------------------------------------
+
+static void row_to_double(const void *data, int f64, size_t D, size_t i, double *out)
+{
+    if (f64) {
+        memcpy(out, (const double *)data + i * D, D * sizeof(double));
+    } else {
+        const float *r = (const float *)data + i * D;
+        for (size_t j = 0; j < D; j++) out[j] = (double)r[j];
+    }
+}
+
+static double sq_dist(const double *a, const double *b, size_t D)
+{
+    double s = 0.0;
+    for (size_t j = 0; j < D; j++) {
+        double t = a[j] - b[j];
+        s += t * t;
+    }
+    return s;
+}
+
+static uint32_t nearest_centroid(const double *cent, size_t C, size_t D, const double *v)
+{
+    uint32_t best = 0;
+    double bd = DBL_MAX;
+    for (size_t c = 0; c < C; c++) {
+        double d = sq_dist(&cent[c * D], v, D);
+        if (d < bd) {
+            bd = d;
+            best = (uint32_t)c;
+        }
+    }
+    return best;
+}
+
+// Centroidi (C x D) addestrati su un campione del dataset
+static double *kmeans_train(const void *data, int f64, size_t n, size_t D, size_t C)
+{
+    size_t m = C * IVF_TRAIN_PER_LIST < n ? C * IVF_TRAIN_PER_LIST : n;
+
+    double   *train = malloc(m * D * sizeof(double));
+    double   *cent  = malloc(C * D * sizeof(double));
+    double   *sum   = malloc(C * D * sizeof(double));
+    size_t   *cnt   = malloc(C * sizeof(size_t));
+    uint32_t *asg   = malloc(m * sizeof(uint32_t));
+    if (!train || !cent || !sum || !cnt || !asg) {
+        free(train); free(cent); free(sum); free(cnt); free(asg);
+        return NULL;
+    }
+
+    // Campione a passo n/m, centroidi iniziali a passo m/C nel campione
+    for (size_t i = 0; i < m; i++)
+        row_to_double(data, f64, D, i * n / m, &train[i * D]);
+    for (size_t c = 0; c < C; c++)
+        memcpy(&cent[c * D], &train[(c * m / C) * D], D * sizeof(double));
+
+    for (int it = 0; it < IVF_ITERS; it++) {
+        #pragma omp parallel for schedule(static)
+        for (long i = 0; i < (long)m; i++)
+            asg[i] = nearest_centroid(cent, C, D, &train[(size_t)i * D]);
+
+        memset(sum, 0, C * D * sizeof(double));
+        memset(cnt, 0, C * sizeof(size_t));
+        for (size_t i = 0; i < m; i++) {
+            double *s = &sum[(size_t)asg[i] * D];
+            for (size_t j = 0; j < D; j++) s[j] += train[i * D + j];
+            cnt[asg[i]]++;
+        }
+
+        // Lista vuota: il centroide resta dov'è
+        for (size_t c = 0; c < C; c++) {
+            if (!cnt[c]) continue;
+            for (size_t j = 0; j < D; j++)
+                cent[c * D + j] = sum[c * D + j] / (double)cnt[c];
+        }
+    }
+
+    free(train); free(sum); free(cnt); free(asg);
+    return cent;
+}
+
+// ------------------ COSTRUZIONE ----------------------
+
+static IvfIndex *ivf_build(const void *data, int f64, size_t n, size_t D, int C, int h, int x)
+{
+    if (!data || n == 0 || C <= 0 || h <= 0 || x <= 0) return NULL;
+    if ((size_t)C > n) C = (int)n;
+
+    IvfIndex *ivf = calloc(1, sizeof(IvfIndex));
+    if (!ivf) return NULL;
+    ivf->C = (size_t)C;
+    ivf->n = n;
+    ivf->D = D;
+
+    uint32_t *list = malloc(n * sizeof(uint32_t));
+    ivf->offset    = calloc((size_t)C + 1, sizeof(size_t));
+    ivf->ids       = malloc(n * sizeof(uint32_t));
+    ivf->centroids = kmeans_train(data, f64, n, D, (size_t)C);
+    if (!list || !ivf->offset || !ivf->ids || !ivf->centroids) {
+        free(list);
+        free_ivf_index(ivf);
+        return NULL;
+    }
+
+    // Assegnazione di tutte le righe (un buffer double per thread)
+    int failed = 0;
+    #pragma omp parallel reduction(|:failed)
+    {
+        double *v = malloc(D * sizeof(double));
+        if (!v) failed = 1;
+        #pragma omp for schedule(static)
+        for (long i = 0; i < (long)n; i++) {
+            if (!v) continue;
+            row_to_double(data, f64, D, (size_t)i, v);
+            list[i] = nearest_centroid(ivf->centroids, (size_t)C, D, v);
+        }
+        free(v);
+    }
+    if (failed) {
+        free(list);
+        free_ivf_index(ivf);
+        return NULL;
+    }
+
+    // Posizioni per lista, righe nell'ordine originale dentro ogni lista
+    for (size_t i = 0; i < n; i++) ivf->offset[list[i] + 1]++;
+    for (int c = 0; c < C; c++) ivf->offset[c + 1] += ivf->offset[c];
+
+    size_t *pos = malloc((size_t)C * sizeof(size_t));
+    size_t es = f64 ? sizeof(double) : sizeof(float);
+    void *perm = malloc(n * D * es);
+    if (!pos || !perm) {
+        free(pos); free(perm); free(list);
+        free_ivf_index(ivf);
+        return NULL;
+    }
+    memcpy(pos, ivf->offset, (size_t)C * sizeof(size_t));
+    for (size_t i = 0; i < n; i++) {
+        size_t p = pos[list[i]]++;
+        ivf->ids[p] = (uint32_t)i;
+        memcpy((char *)perm + p * D * es, (const char *)data + i * D * es, D * es);
+    }
+    free(pos);
+    free(list);
+
+    // Indice a pivot sulla copia riordinata: codici e dist contigui per lista
+    if (f64) {
+        MatrixF64 m = { .n = (uint32_t)n, .d = (uint32_t)D, .data = (double *)perm };
+        ivf->idx = build_index_f64(&m, h, x);
+    } else {
+        MatrixF32 m = { .n = (uint32_t)n, .d = (uint32_t)D, .data = (float *)perm };
+        ivf->idx = build_index(&m, h, x);
+    }
+    free(perm);
+
+    if (!ivf->idx) {
+        free_ivf_index(ivf);
+        return NULL;
+    }
+    return ivf;
+}
+
+IvfIndex *build_ivf_index(const MatrixF32 *ds, int C, int h, int x)
+{
+    if (!ds) return NULL;
+    return ivf_build(ds->data, 0, ds->n, ds->d, C, h, x);
+}
+
+IvfIndex *build_ivf_index_f64(const MatrixF64 *ds, int C, int h, int x)
+{
+    if (!ds) return NULL;
+    return ivf_build(ds->data, 1, ds->n, ds->d, C, h, x);
+}
+
+void free_ivf_index(IvfIndex *ivf)
+{
+    if (!ivf) return;
+    free_index(ivf->idx);
+    free(ivf->centroids);
+    free(ivf->offset);
+    free(ivf->ids);
+    free(ivf);
+}
+
+size_t ivf_memory_bytes(const IvfIndex *ivf)
+{
+    if (!ivf) return 0;
+    return sizeof(IvfIndex)
+         + ivf->C * ivf->D * sizeof(double)
+         + (ivf->C + 1) * sizeof(size_t)
+         + ivf->n * sizeof(uint32_t)
+         + index_memory_bytes(ivf->idx);
+}
+
+// ------------------ SELEZIONE DELLE LISTE ----------------------
+
+// Inserimento ordinato delle nprobe liste più vicine (nprobe piccolo)
+static size_t probe(const IvfIndex *ivf, const float *qf, const double *qd, int nprobe, uint32_t *lists)
+{
+    size_t C = ivf->C, D = ivf->D;
+    size_t np = nprobe > 0 ? (size_t)nprobe : 1;
+    if (np > C) np = C;
+
+    double *best = malloc(np * sizeof(double));
+    if (!best) return 0;
+
+    size_t size = 0;
+    for (size_t c = 0; c < C; c++) {
+        const double *ce = &ivf->centroids[c * D];
+        double d = 0.0;
+        for (size_t j = 0; j < D; j++) {
+            double t = (qf ? (double)qf[j] : qd[j]) - ce[j];
+            d += t * t;
+        }
+
+        if (size == np && d >= best[np - 1]) continue;
+        size_t i = size < np ? size++ : np - 1;
+        while (i > 0 && d < best[i - 1]) {
+            best[i] = best[i - 1];
+            lists[i] = lists[i - 1];
+            i--;
+        }
+        best[i] = d;
+        lists[i] = (uint32_t)c;
+    }
+
+    free(best);
+    return size;
+}
+
+size_t ivf_probe(const IvfIndex *ivf, const float *q, int nprobe, uint32_t *lists)
+{
+    if (!ivf || !q || !lists) return 0;
+    return probe(ivf, q, NULL, nprobe, lists);
+}
+
+size_t ivf_probe_f64(const IvfIndex *ivf, const double *q, int nprobe, uint32_t *lists)
+{
+    if (!ivf || !q || !lists) return 0;
+    return probe(ivf, NULL, q, nprobe, lists);
+}
@@ -3,30 +3,11 @@
 
 #include "config.h"
 #include "matrix.h"
-#include "index.h"
-#include "query.h"
 #include "compare.h"
 #include "distance.h"
 #include "quantization.h"
-
-#include <stdio.h>
-#include <stdlib.h>
-#include <time.h>
-
-#include "config.h"
-#include "matrix.h"
-#include "index.h"
-#include "query.h"
-#include "compare.h"
-#include "distance.h"
-#include "quantization.h"
-
-// ---------------------------------------------
-// Funzione tempo
-// ---------------------------------------------
-double ms(clock_t start, clock_t end) {
-    return 1000.0 * (double)(end - start) / CLOCKS_PER_SEC;
-}
+#include "perfcount.h"
+#include "cli.h"
 
 int main(int argc, char **argv)
 {
@@ -44,11 +25,21 @@ int main(int argc, char **argv)
     Config cfg = {0};
 
     if (parse_args(argc, argv, &cfg) != 0) {
-        printf("Uso: %s -d dataset.ds2 -q query.ds2 -h <pivot> -k <vicini> -x <quant>\n",
+        printf("Uso: %s -d dataset.ds2 -q query.ds2 -h <pivot> -k <vicini> -x <quant> [-e] [-P] [-r <rerank>] [-A <recall> [-M <MB>]] [-S <shard>] [-N <numa>] [-B <pin>] [-t <thread>] [-Q <voci>] [-C <colonne>] [-c <caldi>] [-a <alpha>] [-m <valutazioni>] [-T <ms>] [-I <liste> [-n <nprobe>]] [-G <M> [-E <ef>]] [-H <pagine>] [-b <bit>] [-p <M> [-F] [-O]] [-o <risultati>] [-L <socket>]\n",
                argv[0]);
         return 1;
     }
 
+    // Pagine dell'arena (-H), bit dei codici (-b), budget (-a, -m, -T), -o
+    if (config_validate(&cfg) != 0)
+        return 1;
+
+    // -----------------------------------------------------
+    // MODALITA' SERVER (-L): niente file di query
+    // -----------------------------------------------------
+    if (cfg.listen)
+        return cli_run_server(&cfg);
+
     printf("\n=============================\n");
     printf("     PARAMETRI DI INPUT\n");
     printf("=============================\n");
@@ -87,47 +78,32 @@ int main(int argc, char **argv)
     printf("Query caricate : %u x %u\n\n", qs.n, qs.d);
 
     // -----------------------------------------------------
-    // COSTRUZIONE INDICE + BENCHMARK
+    // MODALITA' SENZA INDICE A PIVOT UNICO (-e, -A, -S, -I, -p, -G)
     // -----------------------------------------------------
-    printf("Costruzione indice...\n");
-
-    clock_t t0 = clock();
-    Index *idx = build_index(&ds, cfg.h, cfg.x);
-    clock_t t1 = clock();
-
-    if (!idx) {
-        printf("ERRORE: impossibile costruire indice.\n");
+    int ret = cli_run_mode(&ds, &qs, &cfg);
+    if (ret >= 0) {
         free_matrix_f32(&ds);
         free_matrix_f32(&qs);
-        return 1;
+        return ret;
     }
 
-    printf("Indice costruito.\n");
-    printf("Tempo build_index(): %.2f ms\n\n", ms(t0, t1));
-
     // -----------------------------------------------------
-    // ESECUZIONE KNN SU TUTTE LE QUERY + BENCHMARK
+    // COSTRUZIONE INDICE + ESECUZIONE KNN SU TUTTE LE QUERY
     // -----------------------------------------------------
     int k = cfg.k;
+    Neighbor *results = NULL;
+    double time_build, time_query;
+
+    ret = cli_run_index(&ds, &qs, &cfg, &results, &time_build, &time_query);
 
-    Neighbor *results = malloc(qs.n * k * sizeof(Neighbor));
-    if (!results) {
-        printf("ERRORE: impossibile allocare memoria risultati.\n");
-        free_index(idx);
+    // Errore o risultati gi scritti (-o): nessun confronto con i golden
+    if (ret != 0 || cfg.out) {
+        free(results);
         free_matrix_f32(&ds);
         free_matrix_f32(&qs);
-        return 1;
+        return ret;
     }
 
-    printf("Esecuzione K-NN su %u query...\n", qs.n);
-
-    clock_t t2 = clock();
-    knn_query_all(&ds, idx, &qs, k, cfg.x, results);
-    clock_t t3 = clock();
-
-    printf("K-NN completato.\n");
-    printf("Tempo knn_query_all(): %.2f ms\n\n", ms(t2, t3));
-
     // -----------------------------------------------------
     // CARICAMENTO RISULTATI
     // -----------------------------------------------------
@@ -137,7 +113,6 @@ int main(int argc, char **argv)
     if (load_matrix_i32("data/results_ids_2000x8_k8_x64_32.ds2", &ref_ids) != 0) {
         printf("ERRORE lettura results_ids.\n");
         free(results);
-        free_index(idx);
         free_matrix_f32(&ds);
         free_matrix_f32(&qs);
         return 1;
@@ -147,7 +122,6 @@ int main(int argc, char **argv)
         printf("ERRORE lettura results_dst.\n");
         free_matrix_i32(&ref_ids);
         free(results);
-        free_index(idx);
         free_matrix_f32(&ds);
         free_matrix_f32(&qs);
         return 1;
@@ -177,11 +151,17 @@ int main(int argc, char **argv)
     printf("=====================================\n");
     printf("               BENCHMARK             \n");
     printf("=====================================\n");
-    printf("build_index()     : %.2f ms\n", ms(t0, t1));
-    printf("knn_query_all()   : %.2f ms\n", ms(t2, t3));
-    printf("Totale runtime    : %.2f ms\n", ms(t0, t3));
+    printf("build_index()     : %.2f ms\n", time_build);
+    printf("knn_query_all()   : %.2f ms\n", time_query);
+    printf("Totale runtime    : %.2f ms\n", time_build + time_query);
     printf("=====================================\n\n");
 
+    if (cfg.perf && perf_active()) {
+        printf("CONTATORI PER FASE (build + query, per thread)\n");
+        perf_print(stdout, 1);
+        printf("\n");
+    }
+
     // -----------------------------------------------------
     // PULIZIA MEMORIA
     // -----------------------------------------------------
@@ -189,7 +169,6 @@ int main(int argc, char **argv)
     free_matrix_f32(&ref_dst);
 
     free(results);
-    free_index(idx);
 
     free_matrix_f32(&ds);
     free_matrix_f32(&qs);
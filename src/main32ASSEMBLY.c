@@ -1,34 +1,16 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <time.h>
 
 #include "config.h"
 #include "matrix.h"
-#include "index.h"
-#include "query.h"
 #include "compare.h"
-#include "distance.h"
-#include "quantization.h"
+#include "perfcount.h"
+#include "cli.h"
 
 #ifdef _OPENMP
 #include <omp.h>
 #endif
 
-// ---------------------------------------------
-// Funzione tempo
-// ---------------------------------------------
-double calc_time_ms(clock_t c_start, clock_t c_end, double w_start, double w_end) {
-#ifdef _OPENMP
-    return (w_end - w_start) * 1000.0;
-#else
-    return 1000.0 * (double)(c_end - c_start) / CLOCKS_PER_SEC;
-#endif
-}
-
-static double ms(clock_t start, clock_t end) {
-    return 1000.0 * (double)(end - start) / CLOCKS_PER_SEC;
-}
-
 int main(int argc, char **argv)
 {
     printf("argc = %d\n", argc);
@@ -50,10 +32,20 @@ int main(int argc, char **argv)
 
     Config cfg = {0};
     if (parse_args(argc, argv, &cfg) != 0) {
-        printf("Uso: %s -d dataset.ds2 -q query.ds2 -h <pivot> -k <vicini> -x <quant>\n", argv[0]);
+        printf("Uso: %s -d dataset.ds2 -q query.ds2 -h <pivot> -k <vicini> -x <quant> [-e] [-P] [-r <rerank>] [-A <recall> [-M <MB>]] [-S <shard>] [-N <numa>] [-B <pin>] [-t <thread>] [-Q <voci>] [-C <colonne>] [-c <caldi>] [-a <alpha>] [-m <valutazioni>] [-T <ms>] [-I <liste> [-n <nprobe>]] [-G <M> [-E <ef>]] [-H <pagine>] [-b <bit>] [-p <M> [-F] [-O]] [-o <risultati>] [-L <socket>]\n", argv[0]);
         return 1;
     }
 
+    // Pagine dell'arena (-H), bit dei codici (-b), budget (-a, -m, -T), -o
+    if (config_validate(&cfg) != 0)
+        return 1;
+
+    // -----------------------------------------------------
+    // MODALITA' SERVER (-L): niente file di query
+    // -----------------------------------------------------
+    if (cfg.listen)
+        return cli_run_server(&cfg);
+
     printf("\n=============================\n");
     printf("  PARAMETRI DI INPUT (SSE2)\n");
     printf("=============================\n");
@@ -85,69 +77,33 @@ int main(int argc, char **argv)
     printf("Dataset caricato: %u x %u\n", ds.n, ds.d);
     printf("Query caricate : %u x %u\n\n", qs.n, qs.d);
 
-    // -------------------------------------
-    // BUILD INDEX
-    // -------------------------------------
-    printf("Costruzione indice...\n");
-
-    clock_t c0 = clock();
-    double w0 = 0;
-    #ifdef _OPENMP
-    w0 = omp_get_wtime();
-    #endif
-
-    Index *idx = build_index(&ds, cfg.h, cfg.x);
-
-    clock_t c1 = clock();
-    double w1 = 0;
-    #ifdef _OPENMP
-    w1 = omp_get_wtime();
-    #endif
-
-    if (!idx) {
-        printf("ERRORE: impossibile costruire indice.\n");
+    // -----------------------------------------------------
+    // MODALITA' SENZA INDICE A PIVOT UNICO (-e, -A, -S, -I, -p, -G)
+    // -----------------------------------------------------
+    int ret = cli_run_mode(&ds, &qs, &cfg);
+    if (ret >= 0) {
         free_matrix_f32(&ds);
         free_matrix_f32(&qs);
-        return 1;
+        return ret;
     }
 
-    double time_build = calc_time_ms(c0, c1, w0, w1);
-    printf("Indice costruito.\n");
-    printf("Tempo build_index(): %.2f ms\n\n", time_build);
-
-    // -------------------------------------
-    // KNN QUERY + BENCHMARK
-    // -------------------------------------
+    // -----------------------------------------------------
+    // COSTRUZIONE INDICE + ESECUZIONE KNN SU TUTTE LE QUERY
+    // -----------------------------------------------------
     int k = cfg.k;
-    Neighbor *results = malloc((size_t)qs.n * (size_t)k * sizeof(Neighbor));
-    if (!results) {
-        printf("ERRORE: allocazione risultati fallita.\n");
-        free_index(idx);
+    Neighbor *results = NULL;
+    double time_build, time_query;
+
+    ret = cli_run_index(&ds, &qs, &cfg, &results, &time_build, &time_query);
+
+    // Errore o risultati gi scritti (-o): nessun confronto con i golden
+    if (ret != 0 || cfg.out) {
+        free(results);
         free_matrix_f32(&ds);
         free_matrix_f32(&qs);
-        return 1;
+        return ret;
     }
 
-    printf("Esecuzione K-NN su %u query...\n", qs.n);
-
-    clock_t c2 = clock();
-    double w2 = 0;
-    #ifdef _OPENMP
-    w2 = omp_get_wtime();
-    #endif
-
-    knn_query_all(&ds, idx, &qs, k, cfg.x, results);
-
-    clock_t c3 = clock();
-    double w3 = 0;
-    #ifdef _OPENMP
-    w3 = omp_get_wtime();
-    #endif
-
-    double time_query = calc_time_ms(c2, c3, w2, w3);
-    printf("K-NN completato.\n");
-    printf("Tempo knn_query_all(): %.2f ms\n\n", time_query);
-
     // -------------------------------------
     // CONFRONTO
     // -------------------------------------
@@ -179,8 +135,13 @@ int main(int argc, char **argv)
     printf("Totale runtime    : %.2f ms\n", time_build + time_query);
     printf("=====================================\n\n");
 
+    if (cfg.perf && perf_active()) {
+        printf("CONTATORI PER FASE (build + query, per thread)\n");
+        perf_print(stdout, 1);
+        printf("\n");
+    }
+
     free(results);
-    free_index(idx);
     free_matrix_f32(&ds);
     free_matrix_f32(&qs);
 
@@ -1,21 +1,11 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <time.h>
 
 #include "config.h"
 #include "matrix.h"
-#include "index.h"
-#include "query64.h"
 #include "compare64.h"
-#include "distance.h"
-#include "quantization.h"
-
-// ---------------------------------------------
-// Funzione tempo
-// ---------------------------------------------
-static double ms(clock_t start, clock_t end) {
-    return 1000.0 * (double)(end - start) / CLOCKS_PER_SEC;
-}
+#include "perfcount.h"
+#include "cli64.h"
 
 int main(int argc, char **argv)
 {
@@ -37,11 +27,21 @@ int main(int argc, char **argv)
 
     if (parse_args(argc, argv, &cfg) != 0) {
         printf("Uso:\n");
-        printf("  %s -d dataset.ds2 -q query.ds2 -h <pivot> -k <vicini> -x <quant>\n",
+        printf("  %s -d dataset.ds2 -q query.ds2 -h <pivot> -k <vicini> -x <quant> [-e] [-P] [-r <rerank>] [-A <recall> [-M <MB>]] [-S <shard>] [-N <numa>] [-B <pin>] [-t <thread>] [-Q <voci>] [-C <colonne>] [-c <caldi>] [-a <alpha>] [-m <valutazioni>] [-T <ms>] [-I <liste> [-n <nprobe>]] [-G <M> [-E <ef>]] [-H <pagine>] [-b <bit>] [-p <M> [-F] [-O]] [-o <risultati>] [-L <socket>]\n",
                argv[0]);
         return 1;
     }
 
+    // Pagine dell'arena (-H), bit dei codici (-b), budget (-a, -m, -T), -o
+    if (config_validate(&cfg) != 0)
+        return 1;
+
+    // -----------------------------------------------------
+    // MODALITA' SERVER (-L): niente file di query
+    // -----------------------------------------------------
+    if (cfg.listen)
+        return cli_run_server_f64(&cfg);
+
     printf("\n=============================\n");
     printf("   PARAMETRI DI INPUT (ASM)\n");
     printf("=============================\n");
@@ -80,47 +80,32 @@ int main(int argc, char **argv)
     printf("Query caricate : %u x %u\n\n", qs.n, qs.d);
 
     // -----------------------------------------------------
-    // COSTRUZIONE INDICE
+    // MODALITA' SENZA INDICE A PIVOT UNICO (-e, -A, -S, -I, -p, -G)
     // -----------------------------------------------------
-    printf("Costruzione indice (64-bit)...\n");
-
-    clock_t t0 = clock();
-    Index *idx = build_index_f64(&ds, cfg.h, cfg.x);
-    clock_t t1 = clock();
-
-    if (!idx) {
-        printf("ERRORE: build_index_f64 fallita.\n");
+    int ret = cli_run_mode_f64(&ds, &qs, &cfg);
+    if (ret >= 0) {
         free_matrix_f64(&ds);
         free_matrix_f64(&qs);
-        return 1;
+        return ret;
     }
 
-    printf("Indice costruito.\n");
-    printf("Tempo build_index(): %.2f ms\n\n", ms(t0, t1));
-
     // -----------------------------------------------------
-    // KNN QUERY + BENCHMARK
+    // COSTRUZIONE INDICE + ESECUZIONE KNN SU TUTTE LE QUERY
     // -----------------------------------------------------
     int k = cfg.k;
+    Neighbor64 *results = NULL;
+    double time_build, time_query;
+
+    ret = cli_run_index_f64(&ds, &qs, &cfg, &results, &time_build, &time_query);
 
-    Neighbor64 *results = malloc(qs.n * k * sizeof(Neighbor64));
-    if (!results) {
-        printf("ERRORE: allocazione risultati fallita.\n");
-        free_index(idx);
+    // Errore o risultati gi scritti (-o): nessun confronto con i golden
+    if (ret != 0 || cfg.out) {
+        free(results);
         free_matrix_f64(&ds);
         free_matrix_f64(&qs);
-        return 1;
+        return ret;
     }
 
-    printf("Esecuzione K-NN (AVX2 ASM) su %u query...\n", qs.n);
-
-    clock_t t2 = clock();
-    knn_query_all_f64(&ds, idx, &qs, k, cfg.x, results);
-    clock_t t3 = clock();
-
-    printf("K-NN completato.\n");
-    printf("Tempo knn_query_all(): %.2f ms\n\n", ms(t2, t3));
-
     // -----------------------------------------------------
     // CARICAMENTO RISULTATI 64-BIT
     // -----------------------------------------------------
@@ -150,16 +135,21 @@ int main(int argc, char **argv)
     printf("=====================================\n");
     printf("      BENCHMARK 64-bit ASM AVX2       \n");
     printf("=====================================\n");
-    printf("build_index()     : %.2f ms\n", ms(t0, t1));
-    printf("knn_query_all()   : %.2f ms\n", ms(t2, t3));
-    printf("Totale runtime    : %.2f ms\n", ms(t0, t3));
+    printf("build_index()     : %.2f ms\n", time_build);
+    printf("knn_query_all()   : %.2f ms\n", time_query);
+    printf("Totale runtime    : %.2f ms\n", time_build + time_query);
     printf("=====================================\n\n");
 
+    if (cfg.perf && perf_active()) {
+        printf("CONTATORI PER FASE (build + query, per thread)\n");
+        perf_print(stdout, 1);
+        printf("\n");
+    }
+
 cleanup:
     free_matrix_i32(&ref_ids);
     free_matrix_f64(&ref_dst);
     free(results);
-    free_index(idx);
     free_matrix_f64(&ds);
     free_matrix_f64(&qs);
 
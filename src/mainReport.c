@@ -1,129 +1,588 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <float.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <sys/resource.h>
+#endif
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "matrix.h"
+#include "index.h"
+#include "query.h"
+#include "query64.h"
+#include "exact.h"
+#include "exact64.h"
+#include "perfcount.h"
+#include "affinity.h"
 
 // --------------------------------------------------------
-// CONFIGURAZIONE PERCORSI E ARGOMENTI
+// BENCHMARK IN-PROCESS
+//
+// Collega direttamente il motore (niente eseguibili esterni ne' parsing
+// dell'output): per ogni combinazione di precisione, h, x, k e numero di
+// thread e percorso di query (-M) esegue W run di warm-up e R trial
+// misurati con un orologio monotono. Riporta build, QPS, latenze per query (p50/p95/p99), recall@k
+// rispetto al K-NN esatto e occupazione di memoria dell'indice; con -P
+// anche i contatori hardware per fase e per thread (solo trial misurati).
+// Output: <prefix>.json, <prefix>.csv, <prefix>.txt, <prefix>.html
 // --------------------------------------------------------
 
+#define MAX_LIST    16
+#define MAX_RESULTS 4096
+
+// Percorsi di query misurati (-M): il ciclo per query su knn_query_single,
+// knn_query_all (OpenMP) e knn_query_all_opt (pool di thread persistente)
+enum { PATH_SINGLE, PATH_ALL, PATH_OPT, PATH_COUNT };
+static const char *path_names[PATH_COUNT] = { "single", "all", "opt" };
+
 typedef struct {
-    char *label;        // Etichetta
-    char *exe_path;     // Percorso eseguibile
-    int   is_64bit;     // 1 --> 64-bit, 0 --> 32-bit
-} TestConfig;
-
-// Lista di tutte le configurazioni richieste
-TestConfig TESTS[] = {
-    // 32-BIT SCALARE / SSE
-    { "32-bit Scalar (C)",          "bin\\Release_Scalar\\progetto_knn.exe",        0 },
-    { "32-bit SSE2 (Intrinsic)",    "bin\\Release_SSE2\\progetto_knn.exe",          0 },
-    { "32-bit SSE2 (Assembly)",     "bin\\Release_SSE2ASSEMBLY\\progetto_knn.exe",  0 },
-    { "32-bit SSE2 + OpenMP",       "bin\\Release_SSE2_OpenMP\\progetto_knn.exe",   0 },
-
-    // 64-BIT SCALARE / AVX
-    { "64-bit Scalar (C)",          "bin\\Release_Scalar64\\progetto_knn.exe",      1 },
-    { "64-bit AVX2 (Intrinsic)",    "bin\\Release_AVX64\\progetto_knn.exe",         1 },
-    { "64-bit AVX2 (Assembly)",     "bin\\Release_AVX64ASSEMBLY\\progetto_knn.exe", 1 },
-    { "64-bit AVX2 + OpenMP",       "bin\\Release_AVX64_OpenMP\\progetto_knn.exe",  1 },
-
-    { NULL, NULL, 0 }
-};
-
-// Argomenti
-const char *ARGS_32 = "-d data/dataset_2000x256_32.ds2 -q data/query_2000x256_32.ds2 -h 16 -k 8 -x 64";
-const char *ARGS_64 = "-d data/dataset_2000x256_64.ds2 -q data/query_2000x256_64.ds2 -h 16 -k 8 -x 64";
-
-// Struttura per salvare i risultati
-typedef struct {
-    double build_time;
-    double query_time;
-    double total_time;
-    int    valid;
-} TestResult;
+    const char *ds_path;
+    const char *q_path;
+    int   prec;                 // 32, 64 oppure 0 = entrambe (file in data/)
+    int   h[MAX_LIST], nh;
+    int   x[MAX_LIST], nx;
+    int   k[MAX_LIST], nk;
+    int   t[MAX_LIST], nt;      // numero di thread
+    unsigned paths;             // maschera dei percorsi (1 << PATH_*)
+    int   warmup;
+    int   trials;
+    int   perf;                 // -P: contatori per fase (perfcount.h)
+    int   pin;                  // -B: pinning dei thread (PinPolicy, default compact)
+    int   place;                // -N: collocazione dell'indice (PlacePolicy)
+    const char *prefix;
+} BenchArgs;
 
-TestResult results[20];
+typedef struct {
+    int    prec;
+    int    h, x, k, threads;
+    int    path;                // PATH_*
+    double build_ms;            // mediana sui trial
+    double query_ms;            // mediana sui trial
+    double qps;
+    double p50_us, p95_us, p99_us;
+    double recall;              // recall@k rispetto al K-NN esatto
+    size_t index_bytes;
+    PerfThreadStats  perf;          // totale sui thread
+    PerfThreadStats *perf_thr;      // per thread (NULL se -P assente)
+    int              perf_nthr;
+} BenchResult;
+
+static BenchResult results[MAX_RESULTS];
+static int n_results = 0;
 
 // --------------------------------------------------------
 // FUNZIONI DI SUPPORTO
 // --------------------------------------------------------
 
-// Esegue il comando e parsa l'output per trovare i tempi
-TestResult run_test(int test_idx) {
-    TestResult res = {0, 0, 0, 0};
-    char command[1024];
-    char line[1024];
+// Orologio monotono (wall-clock) in nanosecondi
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double A = *(const double *)a, B = *(const double *)b;
+    return (A > B) - (A < B);
+}
+
+// Percentile p (0..100) di un array GIA' ordinato
+static double percentile(const double *sorted, size_t n, double p) {
+    if (n == 0) return 0.0;
+    size_t i = (size_t)(p / 100.0 * (double)(n - 1) + 0.5);
+    return sorted[i < n ? i : n - 1];
+}
+
+static double median(double *v, int n) {
+    qsort(v, n, sizeof(double), cmp_double);
+    return n % 2 ? v[n / 2] : 0.5 * (v[n / 2 - 1] + v[n / 2]);
+}
+
+static long peak_rss_kb(void) {
+#ifdef __linux__
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) == 0) return ru.ru_maxrss;
+#endif
+    return 0;
+}
 
-    TestConfig cfg = TESTS[test_idx];
-    const char *args = cfg.is_64bit ? ARGS_64 : ARGS_32;
+// Lista di interi separati da virgola: "8,16,32"
+static int parse_list(const char *s, int *out) {
+    int n = 0;
+    while (s && *s && n < MAX_LIST) {
+        out[n++] = atoi(s);
+        s = strchr(s, ',');
+        if (s) s++;
+    }
+    return n;
+}
 
-    // Verifica esistenza file
-    FILE *fcheck = fopen(cfg.exe_path, "r");
-    if (!fcheck) {
-        printf("[SKIP] File non trovato: %s\n", cfg.exe_path);
-        return res;
+// Lista di percorsi separati da virgola: "single,opt" (0 se un nome e' ignoto)
+static unsigned parse_paths(const char *s) {
+    unsigned mask = 0;
+    while (s && *s) {
+        size_t len = strcspn(s, ",");
+        int p = 0;
+        while (p < PATH_COUNT && (strlen(path_names[p]) != len || strncmp(s, path_names[p], len) != 0)) p++;
+        if (p == PATH_COUNT) return 0;
+        mask |= 1u << p;
+        s += len;
+        if (*s) s++;
     }
-    fclose(fcheck);
+    return mask;
+}
+
+static const char *backend_label(void) {
+#if defined(USE_AVX_ASM)
+    return "AVX2 assembly";
+#elif defined(USE_SSE2_ASM)
+    return "SSE2 assembly";
+#elif defined(USE_AVX)
+    return "AVX2 intrinsics";
+#elif defined(USE_SSE2)
+    return "SSE2 intrinsics";
+#else
+    return "scalar C";
+#endif
+}
 
-    printf("Running: %-30s ... ", cfg.label);
-    fflush(stdout);
+// Frazione degli id restituiti presenti fra i k vicini esatti
+static double recall_at_k(const int *ids, const int *truth, size_t nq, int k) {
+    size_t hit = 0;
+    for (size_t q = 0; q < nq; q++)
+        for (int a = 0; a < k; a++)
+            for (int b = 0; b < k; b++)
+                if (ids[q * k + a] >= 0 && ids[q * k + a] == truth[q * k + b]) { hit++; break; }
+    return nq ? (double)hit / (double)(nq * (size_t)k) : 0.0;
+}
 
-    // Costruisce il comando
-    sprintf(command, ".\\%s %s", cfg.exe_path, args);
+// Statistiche dei contatori accumulate durante i trial misurati
+static void collect_perf(BenchResult *r) {
+    if (!perf_active()) return;
+    PerfThreadStats tmp[PERF_MAX_THREADS];
+    int n = perf_snapshot(tmp, PERF_MAX_THREADS);
+
+    perf_total(&r->perf);
+    r->perf_thr = malloc((size_t)n * sizeof(PerfThreadStats));
+    if (!r->perf_thr) return;
+
+    // Solo i thread che hanno effettivamente lavorato in questa configurazione
+    for (int t = 0; t < n; t++) {
+        uint64_t calls = 0;
+        for (int p = 0; p < PERF_PHASES; p++) calls += tmp[t].calls[p];
+        if (calls) r->perf_thr[r->perf_nthr++] = tmp[t];
+    }
+}
+
+static void summarize(BenchResult *r, double *build, double *query, double *lat,
+                      int trials, size_t nq) {
+    qsort(lat, (size_t)trials * nq, sizeof(double), cmp_double);
+    r->p50_us   = percentile(lat, (size_t)trials * nq, 50.0);
+    r->p95_us   = percentile(lat, (size_t)trials * nq, 95.0);
+    r->p99_us   = percentile(lat, (size_t)trials * nq, 99.0);
+    r->build_ms = median(build, trials);
+    r->query_ms = median(query, trials);
+    r->qps      = r->query_ms > 0 ? (double)nq / (r->query_ms / 1000.0) : 0.0;
+}
+
+// --------------------------------------------------------
+// FLOAT32
+// --------------------------------------------------------
 
-    // Apre la pipe per leggere l'output del programma
-    FILE *pipe = _popen(command, "r");
-    if (!pipe) {
-        printf("ERRORE: impossibile eseguire comando.\n");
-        return res;
+static int run_config_f32(const MatrixF32 *ds, const MatrixF32 *qs, const int *truth,
+                          int h, int x, int k, int threads, int path, int warmup, int trials,
+                          int place, BenchResult *r) {
+    size_t nq = qs->n, D = qs->d;
+    double *build = malloc(trials * sizeof(double));
+    double *query = malloc(trials * sizeof(double));
+    double *lat   = malloc((size_t)trials * nq * sizeof(double));
+    Neighbor *res = malloc(nq * (size_t)k * sizeof(Neighbor));
+    int *ids      = malloc(nq * (size_t)k * sizeof(int));
+    if (!build || !query || !lat || !res || !ids) {
+        free(build); free(query); free(lat); free(res); free(ids);
+        return -1;
     }
 
-    // Legge riga per riga l'output
-    while (fgets(line, sizeof(line), pipe)) {
-        if (strstr(line, "build_index()")) {
-            char *p = strchr(line, ':');
-            if (p) res.build_time = atof(p + 1);
+    for (int t = -warmup; t < trials; t++) {
+        if (t == 0) perf_reset();
+
+        double t0 = now_ns();
+        Index *idx = build_index(ds, h, x);
+        double t1 = now_ns();
+        if (!idx) {
+            free(build); free(query); free(lat); free(res); free(ids);
+            return -1;
+        }
+
+        // Collocazione NUMA (-N), fuori dal tempo di build
+        IndexReplicas *reps = NULL;
+        if (place == PLACE_INTERLEAVE) index_interleave(idx);
+        if (place == PLACE_REPLICA)    reps = index_replicate(idx);
+
+        double *L = &lat[(size_t)(t < 0 ? 0 : t) * nq];
+
+        double t2 = now_ns();
+        if (path == PATH_SINGLE) {
+            #pragma omp parallel for schedule(dynamic) num_threads(threads)
+            for (size_t qi = 0; qi < nq; qi++) {
+                double s = now_ns();
+                const Index *li = reps ? index_replica_local(reps) : idx;
+                knn_query_single(ds, li, &qs->data[qi * D], k, x, &res[qi * k]);
+                L[qi] = (now_ns() - s) / 1000.0;
+            }
+        } else if (path == PATH_ALL) {
+#ifdef _OPENMP
+            int prev = omp_get_max_threads();
+            omp_set_num_threads(threads);
+#endif
+            knn_query_all(ds, idx, qs, k, x, res);
+#ifdef _OPENMP
+            omp_set_num_threads(prev);
+#endif
+        } else {
+            QueryOptions opt;
+            query_default_options(&opt);
+            opt.num_threads = threads;
+            knn_query_all_opt(ds, idx, qs, k, x, &opt, res);
+        }
+        double t3 = now_ns();
+
+        // Percorsi batch: nessuna latenza per singola query, si usa il
+        // tempo ammortizzato (p50 = p95 = p99)
+        if (path != PATH_SINGLE)
+            for (size_t qi = 0; qi < nq; qi++) L[qi] = (t3 - t2) / 1000.0 / (double)nq;
+
+        if (t >= 0) {
+            build[t] = (t1 - t0) / 1e6;
+            query[t] = (t3 - t2) / 1e6;
         }
-        else if (strstr(line, "knn_query_all()")) {
-            char *p = strchr(line, ':');
-            if (p) res.query_time = atof(p + 1);
+        if (t == trials - 1) {
+            for (size_t i = 0; i < nq * (size_t)k; i++) ids[i] = res[i].id;
+            r->recall      = recall_at_k(ids, truth, nq, k);
+            r->index_bytes = index_memory_bytes(idx);
         }
+        free_index_replicas(reps);
+        free_index(idx);
     }
 
-    _pclose(pipe);
+    summarize(r, build, query, lat, trials, nq);
+    collect_perf(r);
+    free(build); free(query); free(lat); free(res); free(ids);
+    return 0;
+}
 
-    res.total_time = res.build_time + res.query_time;
-    if (res.total_time > 0) {
-        res.valid = 1;
-        printf("DONE (%.2f ms)\n", res.total_time);
-    } else {
-        printf("FAILED (No output parsing)\n");
+static void bench_f32(const BenchArgs *a, const char *ds_path, const char *q_path) {
+    MatrixF32 ds = {0}, qs = {0};
+    if (load_matrix_f32(ds_path, &ds) != 0 || load_matrix_f32(q_path, &qs) != 0 || ds.d != qs.d) {
+        printf("[SKIP] impossibile leggere %s / %s\n", ds_path, q_path);
+        free_matrix_f32(&ds);
+        free_matrix_f32(&qs);
+        return;
+    }
+    printf("\n[32-bit] dataset %u x %u, query %u\n", ds.n, ds.d, qs.n);
+
+    for (int ik = 0; ik < a->nk; ik++) {
+        int k = a->k[ik];
+        Neighbor *ex = malloc((size_t)qs.n * k * sizeof(Neighbor));
+        int *truth = malloc((size_t)qs.n * k * sizeof(int));
+        if (!ex || !truth) { free(ex); free(truth); continue; }
+        exact_knn(&ds, &qs, k, ex);
+        for (size_t i = 0; i < (size_t)qs.n * k; i++) truth[i] = ex[i].id;
+        free(ex);
+
+        for (int ih = 0; ih < a->nh; ih++)
+        for (int ix = 0; ix < a->nx; ix++)
+        for (int it = 0; it < a->nt; it++)
+        for (int ip = 0; ip < PATH_COUNT && n_results < MAX_RESULTS; ip++) {
+            if (!(a->paths & (1u << ip))) continue;
+            BenchResult *r = &results[n_results];
+            memset(r, 0, sizeof(*r));
+            r->prec = 32; r->h = a->h[ih]; r->x = a->x[ix]; r->k = k; r->threads = a->t[it];
+            r->path = ip;
+            affinity_pin_threads(r->threads, (PinPolicy)a->pin);
+            printf("  h=%-3d x=%-4d k=%-3d T=%-3d %-6s ... ", r->h, r->x, k, r->threads, path_names[ip]);
+            fflush(stdout);
+            if (run_config_f32(&ds, &qs, truth, r->h, r->x, k, r->threads, r->path,
+                               a->warmup, a->trials, a->place, r) != 0) {
+                printf("FAILED\n");
+                continue;
+            }
+            printf("build %.2f ms | %.0f QPS | p99 %.1f us | recall %.3f\n",
+                   r->build_ms, r->qps, r->p99_us, r->recall);
+            n_results++;
+        }
+        free(truth);
     }
 
-    return res;
+    free_matrix_f32(&ds);
+    free_matrix_f32(&qs);
 }
 
-void write_html_report(const char *filename) {
-    FILE *f = fopen(filename, "w");
-    if (!f) return;
+// --------------------------------------------------------
+// FLOAT64
+// --------------------------------------------------------
 
-    // Minimi per 32-bit e 64-bit
-    double min_build_32 = DBL_MAX, min_query_32 = DBL_MAX, min_tot_32 = DBL_MAX;
-    double min_build_64 = DBL_MAX, min_query_64 = DBL_MAX, min_tot_64 = DBL_MAX;
+static int run_config_f64(const MatrixF64 *ds, const MatrixF64 *qs, const int *truth,
+                          int h, int x, int k, int threads, int path, int warmup, int trials,
+                          int place, BenchResult *r) {
+    size_t nq = qs->n, D = qs->d;
+    double *build   = malloc(trials * sizeof(double));
+    double *query   = malloc(trials * sizeof(double));
+    double *lat     = malloc((size_t)trials * nq * sizeof(double));
+    Neighbor64 *res = malloc(nq * (size_t)k * sizeof(Neighbor64));
+    int *ids        = malloc(nq * (size_t)k * sizeof(int));
+    if (!build || !query || !lat || !res || !ids) {
+        free(build); free(query); free(lat); free(res); free(ids);
+        return -1;
+    }
 
-    // Calcolo minimi
-    for (int i = 0; TESTS[i].label != NULL; i++) {
-        if (!results[i].valid) continue;
+    for (int t = -warmup; t < trials; t++) {
+        if (t == 0) perf_reset();
 
-        if (TESTS[i].is_64bit) {
-            if (results[i].build_time < min_build_64) min_build_64 = results[i].build_time;
-            if (results[i].query_time < min_query_64) min_query_64 = results[i].query_time;
-            if (results[i].total_time < min_tot_64)   min_tot_64   = results[i].total_time;
+        double t0 = now_ns();
+        Index *idx = build_index_f64(ds, h, x);
+        double t1 = now_ns();
+        if (!idx) {
+            free(build); free(query); free(lat); free(res); free(ids);
+            return -1;
+        }
+
+        // Collocazione NUMA (-N), fuori dal tempo di build
+        IndexReplicas *reps = NULL;
+        if (place == PLACE_INTERLEAVE) index_interleave(idx);
+        if (place == PLACE_REPLICA)    reps = index_replicate(idx);
+
+        double *L = &lat[(size_t)(t < 0 ? 0 : t) * nq];
+
+        double t2 = now_ns();
+        if (path == PATH_SINGLE) {
+            #pragma omp parallel for schedule(dynamic) num_threads(threads)
+            for (size_t qi = 0; qi < nq; qi++) {
+                double s = now_ns();
+                const Index *li = reps ? index_replica_local(reps) : idx;
+                knn_query_single_f64(ds, li, &qs->data[qi * D], k, x, &res[qi * k]);
+                L[qi] = (now_ns() - s) / 1000.0;
+            }
+        } else if (path == PATH_ALL) {
+#ifdef _OPENMP
+            int prev = omp_get_max_threads();
+            omp_set_num_threads(threads);
+#endif
+            knn_query_all_f64(ds, idx, qs, k, x, res);
+#ifdef _OPENMP
+            omp_set_num_threads(prev);
+#endif
         } else {
-            if (results[i].build_time < min_build_32) min_build_32 = results[i].build_time;
-            if (results[i].query_time < min_query_32) min_query_32 = results[i].query_time;
-            if (results[i].total_time < min_tot_32)   min_tot_32   = results[i].total_time;
+            QueryOptions opt;
+            query_default_options(&opt);
+            opt.num_threads = threads;
+            knn_query_all_opt_f64(ds, idx, qs, k, x, &opt, res);
+        }
+        double t3 = now_ns();
+
+        // Percorsi batch: nessuna latenza per singola query, si usa il
+        // tempo ammortizzato (p50 = p95 = p99)
+        if (path != PATH_SINGLE)
+            for (size_t qi = 0; qi < nq; qi++) L[qi] = (t3 - t2) / 1000.0 / (double)nq;
+
+        if (t >= 0) {
+            build[t] = (t1 - t0) / 1e6;
+            query[t] = (t3 - t2) / 1e6;
+        }
+        if (t == trials - 1) {
+            for (size_t i = 0; i < nq * (size_t)k; i++) ids[i] = res[i].id;
+            r->recall      = recall_at_k(ids, truth, nq, k);
+            r->index_bytes = index_memory_bytes(idx);
+        }
+        free_index_replicas(reps);
+        free_index(idx);
+    }
+
+    summarize(r, build, query, lat, trials, nq);
+    collect_perf(r);
+    free(build); free(query); free(lat); free(res); free(ids);
+    return 0;
+}
+
+static void bench_f64(const BenchArgs *a, const char *ds_path, const char *q_path) {
+    MatrixF64 ds = {0}, qs = {0};
+    if (load_matrix_f64(ds_path, &ds) != 0 || load_matrix_f64(q_path, &qs) != 0 || ds.d != qs.d) {
+        printf("[SKIP] impossibile leggere %s / %s\n", ds_path, q_path);
+        free_matrix_f64(&ds);
+        free_matrix_f64(&qs);
+        return;
+    }
+    printf("\n[64-bit] dataset %u x %u, query %u\n", ds.n, ds.d, qs.n);
+
+    for (int ik = 0; ik < a->nk; ik++) {
+        int k = a->k[ik];
+        Neighbor64 *ex = malloc((size_t)qs.n * k * sizeof(Neighbor64));
+        int *truth = malloc((size_t)qs.n * k * sizeof(int));
+        if (!ex || !truth) { free(ex); free(truth); continue; }
+        exact_knn_f64(&ds, &qs, k, ex);
+        for (size_t i = 0; i < (size_t)qs.n * k; i++) truth[i] = ex[i].id;
+        free(ex);
+
+        for (int ih = 0; ih < a->nh; ih++)
+        for (int ix = 0; ix < a->nx; ix++)
+        for (int it = 0; it < a->nt; it++)
+        for (int ip = 0; ip < PATH_COUNT && n_results < MAX_RESULTS; ip++) {
+            if (!(a->paths & (1u << ip))) continue;
+            BenchResult *r = &results[n_results];
+            memset(r, 0, sizeof(*r));
+            r->prec = 64; r->h = a->h[ih]; r->x = a->x[ix]; r->k = k; r->threads = a->t[it];
+            r->path = ip;
+            affinity_pin_threads(r->threads, (PinPolicy)a->pin);
+            printf("  h=%-3d x=%-4d k=%-3d T=%-3d %-6s ... ", r->h, r->x, k, r->threads, path_names[ip]);
+            fflush(stdout);
+            if (run_config_f64(&ds, &qs, truth, r->h, r->x, k, r->threads, r->path,
+                               a->warmup, a->trials, a->place, r) != 0) {
+                printf("FAILED\n");
+                continue;
+            }
+            printf("build %.2f ms | %.0f QPS | p99 %.1f us | recall %.3f\n",
+                   r->build_ms, r->qps, r->p99_us, r->recall);
+            n_results++;
+        }
+        free(truth);
+    }
+
+    free_matrix_f64(&ds);
+    free_matrix_f64(&qs);
+}
+
+// --------------------------------------------------------
+// REPORT: JSON / CSV / TXT / HTML
+// --------------------------------------------------------
+
+static FILE *open_out(const char *prefix, const char *ext) {
+    char path[1024];
+    snprintf(path, sizeof(path), "%s.%s", prefix, ext);
+    FILE *f = fopen(path, "w");
+    if (!f) printf("ERRORE: impossibile scrivere %s\n", path);
+    return f;
+}
+
+// {"fase": {"evento": valore, ...}, ...}; eventi non disponibili omessi
+static void json_perf(FILE *f, const PerfThreadStats *s) {
+    unsigned mask = perf_events_mask();
+    fprintf(f, "{");
+    for (int p = 0; p < PERF_PHASES; p++) {
+        fprintf(f, "\"%s\": {\"calls\": %llu", perf_phase_name(p), (unsigned long long)s->calls[p]);
+        for (int e = 0; e < PERF_EVENTS; e++)
+            if (mask & (1u << e))
+                fprintf(f, ", \"%s\": %llu", perf_event_name(e), (unsigned long long)s->v[p][e]);
+        fprintf(f, "}%s", p + 1 < PERF_PHASES ? ", " : "");
+    }
+    fprintf(f, "}");
+}
+
+static void write_json(const char *prefix) {
+    FILE *f = open_out(prefix, "json");
+    if (!f) return;
+    fprintf(f, "{\n  \"backend\": \"%s\",\n  \"peak_rss_kb\": %ld,\n  \"results\": [\n",
+            backend_label(), peak_rss_kb());
+    for (int i = 0; i < n_results; i++) {
+        const BenchResult *r = &results[i];
+        fprintf(f, "    {\"precision\": %d, \"h\": %d, \"x\": %d, \"k\": %d, \"threads\": %d, "
+                   "\"path\": \"%s\", \"build_ms\": %.3f, \"query_ms\": %.3f, \"qps\": %.1f, "
+                   "\"p50_us\": %.2f, \"p95_us\": %.2f, \"p99_us\": %.2f, "
+                   "\"recall\": %.4f, \"index_bytes\": %zu",
+                r->prec, r->h, r->x, r->k, r->threads, path_names[r->path],
+                r->build_ms, r->query_ms, r->qps,
+                r->p50_us, r->p95_us, r->p99_us, r->recall, r->index_bytes);
+        if (r->perf_thr) {
+            fprintf(f, ", \"perf\": ");
+            json_perf(f, &r->perf);
+            fprintf(f, ", \"perf_threads\": [");
+            for (int t = 0; t < r->perf_nthr; t++) {
+                json_perf(f, &r->perf_thr[t]);
+                if (t + 1 < r->perf_nthr) fprintf(f, ", ");
+            }
+            fprintf(f, "]");
         }
+        fprintf(f, "}%s\n", i + 1 < n_results ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+    fclose(f);
+}
+
+static void write_csv(const char *prefix) {
+    FILE *f = open_out(prefix, "csv");
+    if (!f) return;
+    unsigned mask = perf_active() ? perf_events_mask() : 0;
+
+    fprintf(f, "precision,h,x,k,threads,path,build_ms,query_ms,qps,p50_us,p95_us,p99_us,recall,index_bytes");
+    // Una colonna per (fase, evento) disponibile, es. "rerank:cycles"
+    for (int p = 0; p < PERF_PHASES; p++)
+        for (int e = 0; e < PERF_EVENTS; e++)
+            if (mask & (1u << e)) fprintf(f, ",%s:%s", perf_phase_name(p), perf_event_name(e));
+    fprintf(f, "\n");
+
+    for (int i = 0; i < n_results; i++) {
+        const BenchResult *r = &results[i];
+        fprintf(f, "%d,%d,%d,%d,%d,%s,%.3f,%.3f,%.1f,%.2f,%.2f,%.2f,%.4f,%zu",
+                r->prec, r->h, r->x, r->k, r->threads, path_names[r->path], r->build_ms, r->query_ms, r->qps,
+                r->p50_us, r->p95_us, r->p99_us, r->recall, r->index_bytes);
+        for (int p = 0; p < PERF_PHASES; p++)
+            for (int e = 0; e < PERF_EVENTS; e++)
+                if (mask & (1u << e)) fprintf(f, ",%llu", (unsigned long long)r->perf.v[p][e]);
+        fprintf(f, "\n");
+    }
+    fclose(f);
+}
+
+static void write_txt(const char *prefix) {
+    FILE *f = open_out(prefix, "txt");
+    if (!f) return;
+    fprintf(f, "BACKEND: %s\n", backend_label());
+    fprintf(f, "%-4s %4s %4s %4s %3s %-6s | %10s | %10s | %10s | %9s | %9s | %6s | %9s\n",
+            "PREC", "h", "x", "k", "T", "PATH", "BUILD ms", "QUERY ms", "QPS", "p50 us", "p99 us", "RECALL", "MEM KB");
+    fprintf(f, "----------------------------------------------------------------------------------------------------------------\n");
+    for (int i = 0; i < n_results; i++) {
+        const BenchResult *r = &results[i];
+        fprintf(f, "%-4d %4d %4d %4d %3d %-6s | %10.2f | %10.2f | %10.0f | %9.1f | %9.1f | %6.3f | %9zu\n",
+                r->prec, r->h, r->x, r->k, r->threads, path_names[r->path], r->build_ms, r->query_ms, r->qps,
+                r->p50_us, r->p99_us, r->recall, r->index_bytes / 1024);
+    }
+
+    if (perf_active()) {
+        unsigned mask = perf_events_mask();
+        fprintf(f, "\nCONTATORI PER FASE (somma dei trial misurati)\n");
+        for (int i = 0; i < n_results; i++) {
+            const BenchResult *r = &results[i];
+            fprintf(f, "\n%d-bit h=%d x=%d k=%d T=%d %s\n", r->prec, r->h, r->x, r->k, r->threads,
+                    path_names[r->path]);
+            for (int p = 0; p < PERF_PHASES; p++) {
+                fprintf(f, "  %-20s %10llu", perf_phase_name(p), (unsigned long long)r->perf.calls[p]);
+                for (int e = 0; e < PERF_EVENTS; e++)
+                    if (mask & (1u << e))
+                        fprintf(f, "  %s=%llu", perf_event_name(e), (unsigned long long)r->perf.v[p][e]);
+                fprintf(f, "\n");
+            }
+        }
+    }
+    fclose(f);
+}
+
+void write_html_report(const char *prefix) {
+    FILE *f = open_out(prefix, "html");
+    if (!f) return;
+
+    // Migliori per precisione (indice 0 = 32 bit, 1 = 64 bit)
+    double min_build[2] = {DBL_MAX, DBL_MAX}, max_qps[2] = {0, 0}, min_p99[2] = {DBL_MAX, DBL_MAX};
+    for (int i = 0; i < n_results; i++) {
+        int g = results[i].prec == 64;
+        if (results[i].build_ms < min_build[g]) min_build[g] = results[i].build_ms;
+        if (results[i].qps > max_qps[g])       max_qps[g]   = results[i].qps;
+        if (results[i].p99_us < min_p99[g])     min_p99[g]   = results[i].p99_us;
     }
 
     // HTML + CSS
@@ -139,84 +598,140 @@ void write_html_report(const char *filename) {
     fprintf(f, "</style></head><body>");
 
     fprintf(f, "<h1>Benchmark Report: K-NN Optimization</h1>");
-    fprintf(f, "<p>Generato automaticamente tramite Launcher.</p>");
+    fprintf(f, "<p>Backend: <b>%s</b> &mdash; picco RSS %ld KB.</p>", backend_label(), peak_rss_kb());
 
     fprintf(f, "<table>");
     fprintf(f, "<thead><tr>");
-    fprintf(f, "<th>Configurazione</th><th>Build (ms)</th><th>Query (ms)</th><th>Totale (ms)</th>");
+    fprintf(f, "<th>Configurazione</th><th>Build (ms)</th><th>Query (ms)</th><th>QPS</th>"
+               "<th>p50 (us)</th><th>p95 (us)</th><th>p99 (us)</th><th>Recall@k</th><th>Indice (KB)</th>");
     fprintf(f, "</tr></thead><tbody>");
 
-    for (int i = 0; TESTS[i].label != NULL; i++) {
-        if (!results[i].valid) continue;
-
-        int is64 = TESTS[i].is_64bit;
+    for (int i = 0; i < n_results; i++) {
+        const BenchResult *r = &results[i];
+        int g = r->prec == 64;
 
         fprintf(f, "<tr>");
-        fprintf(f, "<td class='label'>%s</td>", TESTS[i].label);
-
-        // BUILD
-        if ((!is64 && results[i].build_time == min_build_32) ||
-            ( is64 && results[i].build_time == min_build_64))
-            fprintf(f, "<td class='best'>%.2f</td>", results[i].build_time);
-        else
-            fprintf(f, "<td>%.2f</td>", results[i].build_time);
-
-        // QUERY
-        if ((!is64 && results[i].query_time == min_query_32) ||
-            ( is64 && results[i].query_time == min_query_64))
-            fprintf(f, "<td class='best'>%.2f</td>", results[i].query_time);
-        else
-            fprintf(f, "<td>%.2f</td>", results[i].query_time);
-
-        // TOTAL
-        if ((!is64 && results[i].total_time == min_tot_32) ||
-            ( is64 && results[i].total_time == min_tot_64))
-            fprintf(f, "<td class='best'>%.2f</td>", results[i].total_time);
-        else
-            fprintf(f, "<td>%.2f</td>", results[i].total_time);
-
+        fprintf(f, "<td class='label'>%d-bit h=%d x=%d k=%d T=%d %s</td>", r->prec, r->h, r->x, r->k,
+                r->threads, path_names[r->path]);
+        fprintf(f, "<td%s>%.2f</td>", r->build_ms == min_build[g] ? " class='best'" : "", r->build_ms);
+        fprintf(f, "<td>%.2f</td>", r->query_ms);
+        fprintf(f, "<td%s>%.0f</td>", r->qps == max_qps[g] ? " class='best'" : "", r->qps);
+        fprintf(f, "<td>%.1f</td><td>%.1f</td>", r->p50_us, r->p95_us);
+        fprintf(f, "<td%s>%.1f</td>", r->p99_us == min_p99[g] ? " class='best'" : "", r->p99_us);
+        fprintf(f, "<td>%.3f</td><td>%zu</td>", r->recall, r->index_bytes / 1024);
         fprintf(f, "</tr>");
     }
 
     fprintf(f, "</tbody></table>");
 
     fprintf(f,
-        "<p><i>* Valori pi bassi indicano prestazioni migliori.<br>"
+        "<p><i>* Tempi: mediana dei trial (orologio monotono). Latenze: percentili "
+        "su tutte le query di tutti i trial (percorsi all/opt: tempo ammortizzato per query).<br>"
         "Le celle evidenziate rappresentano la miglior prestazione "
-        "allinterno del gruppo 32-bit o 64-bit.</i></p>");
+        "all'interno del gruppo 32-bit o 64-bit.</i></p>");
 
     fprintf(f, "</body></html>");
     fclose(f);
-
-    printf("\nReport HTML corretto salvato in: %s\n", filename);
 }
 
+// --------------------------------------------------------
+// MAIN
+// --------------------------------------------------------
 
-int main() {
-    printf("==================================================\n");
-    printf("      AUTOMATED BENCHMARK SUITE (FULL)            \n");
-    printf("==================================================\n\n");
+static void usage(const char *prog) {
+    printf("Uso: %s [-p 32|64 -d dataset.ds2 -q query.ds2] [-H 8,16] [-X 32,64] [-K 8]\n"
+           "          [-T 1,2,4] [-w <warmup>] [-r <trial>] [-o <prefisso output>] [-P]\n"
+           "          [-B compact|scatter|none] [-N default|interleave|replica] [-M single,all,opt]\n", prog);
+}
 
-    for (int i = 0; TESTS[i].label != NULL; i++) {
-        results[i] = run_test(i);
+int main(int argc, char **argv) {
+    BenchArgs a;
+    memset(&a, 0, sizeof(a));
+    a.warmup = 1;
+    a.trials = 5;
+    a.prefix = "report_completo";
+    a.pin    = PIN_COMPACT;
+    a.paths  = (1u << PATH_COUNT) - 1;
+
+    for (int i = 1; i < argc; ++i) {
+        if      (strcmp(argv[i], "-d") == 0 && i + 1 < argc) a.ds_path = argv[++i];
+        else if (strcmp(argv[i], "-q") == 0 && i + 1 < argc) a.q_path  = argv[++i];
+        else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) a.prec    = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-H") == 0 && i + 1 < argc) a.nh = parse_list(argv[++i], a.h);
+        else if (strcmp(argv[i], "-X") == 0 && i + 1 < argc) a.nx = parse_list(argv[++i], a.x);
+        else if (strcmp(argv[i], "-K") == 0 && i + 1 < argc) a.nk = parse_list(argv[++i], a.k);
+        else if (strcmp(argv[i], "-T") == 0 && i + 1 < argc) a.nt = parse_list(argv[++i], a.t);
+        else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) a.warmup  = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) a.trials  = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) a.prefix  = argv[++i];
+        else if (strcmp(argv[i], "-P") == 0)                 a.perf    = 1;
+        else if (strcmp(argv[i], "-B") == 0 && i + 1 < argc) a.pin     = pin_policy_from_name(argv[++i]);
+        else if (strcmp(argv[i], "-N") == 0 && i + 1 < argc) a.place   = place_policy_from_name(argv[++i]);
+        else if (strcmp(argv[i], "-M") == 0 && i + 1 < argc) a.paths   = parse_paths(argv[++i]);
+        else {
+            printf("Parametro non riconosciuto: %s\n", argv[i]);
+            usage(argv[0]);
+            return 1;
+        }
     }
 
-    write_html_report("report_completo.html");
+    if ((a.ds_path || a.q_path) && (!a.ds_path || !a.q_path || (a.prec != 32 && a.prec != 64))) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (a.pin < 0 || a.place < 0) {
+        printf("-B accetta none|compact|scatter, -N default|interleave|replica\n");
+        usage(argv[0]);
+        return 1;
+    }
+    if (a.paths == 0) {
+        printf("-M accetta una lista di single|all|opt\n");
+        usage(argv[0]);
+        return 1;
+    }
+    if (a.trials < 1) a.trials = 1;
+    if (a.warmup < 0) a.warmup = 0;
+
+    // Valori di default: la configurazione di riferimento del progetto
+    if (a.nh == 0) { a.h[0] = 16; a.nh = 1; }
+    if (a.nx == 0) { a.x[0] = 64; a.nx = 1; }
+    if (a.nk == 0) { a.k[0] = 8;  a.nk = 1; }
+    if (a.nt == 0) {
+#ifdef _OPENMP
+        a.t[0] = 1; a.t[1] = omp_get_max_threads(); a.nt = a.t[1] > 1 ? 2 : 1;
+#else
+        a.t[0] = 1; a.nt = 1;
+#endif
+    }
 
-    FILE *ftxt = fopen("report_completo.txt", "w");
-    if (ftxt) {
-        fprintf(ftxt, "%-30s | %10s | %10s | %10s\n", "CONFIG", "BUILD", "QUERY", "TOTAL");
-        fprintf(ftxt, "------------------------------------------------------------------\n");
-        for (int i = 0; TESTS[i].label != NULL; i++) {
-            if(results[i].valid) {
-                fprintf(ftxt, "%-30s | %10.2f | %10.2f | %10.2f\n",
-                        TESTS[i].label, results[i].build_time, results[i].query_time, results[i].total_time);
-            }
-        }
-        fclose(ftxt);
+    printf("==================================================\n");
+    printf("      BENCHMARK SUITE (in-process)                \n");
+    printf("==================================================\n");
+    printf("Backend: %s | warm-up %d | trial %d\n", backend_label(), a.warmup, a.trials);
+    printf("NUMA: %d nodi | pinning %s | indice %s\n", affinity_nodes(),
+           a.pin == PIN_SCATTER ? "scatter" : a.pin == PIN_COMPACT ? "compact" : "none",
+           a.place == PLACE_REPLICA ? "replica per nodo" : a.place == PLACE_INTERLEAVE ? "interleave" : "first-touch");
+    if (a.perf && perf_init() == 0)
+        printf("[PERF] perf_event_open non disponibile: contatori disattivati\n");
+#ifndef _OPENMP
+    printf("[INFO] OpenMP DISATTIVATO: il numero di thread e' ignorato (1 thread)\n");
+#endif
+
+    if (a.ds_path) {
+        if (a.prec == 32) bench_f32(&a, a.ds_path, a.q_path);
+        else              bench_f64(&a, a.ds_path, a.q_path);
+    } else {
+        if (a.prec != 64) bench_f32(&a, "data/dataset_2000x256_32.ds2", "data/query_2000x256_32.ds2");
+        if (a.prec != 32) bench_f64(&a, "data/dataset_2000x256_64.ds2", "data/query_2000x256_64.ds2");
     }
 
-    printf("\nPremere INVIO per uscire...");
-    getchar();
-    return 0;
+    write_json(a.prefix);
+    write_csv(a.prefix);
+    write_txt(a.prefix);
+    write_html_report(a.prefix);
+
+    printf("\nReport salvati in: %s.{json,csv,txt,html}\n", a.prefix);
+
+    for (int i = 0; i < n_results; i++) free(results[i].perf_thr);
+    return n_results > 0 ? 0 : 1;
 }
@@ -1,7 +1,17 @@
 #include "matrix.h"
+#include "matrix_formats.h"
 #include <stdio.h>
 #include <stdlib.h>
 
+// Formati diversi dal .ds2: file mappato o convertito (matrix_formats.c)
+static int load_other(const char *path, MatrixType t, uint32_t *n, uint32_t *d,
+                      void **data, struct MatrixMap **map)
+{
+    MatrixFormat fmt = matrix_format(path);
+    if (fmt == MATRIX_FMT_DS2) return 1;
+    return matrix_load_file(path, fmt, t, n, d, data, map);
+}
+
 // Lettura matrice
 static int read_header(FILE *f, uint32_t *n, uint32_t *d)
 {
@@ -16,6 +26,13 @@ int load_matrix_f32(const char *path, MatrixF32 *m)
 {
     if (!path || !m) return -1;
 
+    void *mapped = NULL;
+    int rc = load_other(path, MATRIX_T_F32, &m->n, &m->d, &mapped, &m->map);
+    if (rc <= 0) {
+        if (rc == 0) m->data = (float*)mapped;
+        return rc;
+    }
+
     FILE *f = fopen(path, "rb");
     if (!f) {
         perror("fopen");
@@ -46,6 +63,7 @@ int load_matrix_f32(const char *path, MatrixF32 *m)
     m->n = n;
     m->d = d;
     m->data = data;
+    m->map = NULL;
 
     return 0;
 }
@@ -53,8 +71,10 @@ int load_matrix_f32(const char *path, MatrixF32 *m)
 void free_matrix_f32(MatrixF32 *m)
 {
     if (!m) return;
-    free(m->data);
+    if (m->map) matrix_unmap(m->map);
+    else free(m->data);
     m->data = NULL;
+    m->map = NULL;
     m->n = m->d = 0;
 }
 
@@ -64,6 +84,13 @@ int load_matrix_f64(const char *path, MatrixF64 *m)
 {
     if (!path || !m) return -1;
 
+    void *mapped = NULL;
+    int rc = load_other(path, MATRIX_T_F64, &m->n, &m->d, &mapped, &m->map);
+    if (rc <= 0) {
+        if (rc == 0) m->data = (double*)mapped;
+        return rc;
+    }
+
     FILE *f = fopen(path, "rb");
     if (!f) {
         perror("fopen");
@@ -94,6 +121,7 @@ int load_matrix_f64(const char *path, MatrixF64 *m)
     m->n = n;
     m->d = d;
     m->data = data;
+    m->map = NULL;
 
     return 0;
 }
@@ -101,8 +129,10 @@ int load_matrix_f64(const char *path, MatrixF64 *m)
 void free_matrix_f64(MatrixF64 *m)
 {
     if (!m) return;
-    free(m->data);
+    if (m->map) matrix_unmap(m->map);
+    else free(m->data);
     m->data = NULL;
+    m->map = NULL;
     m->n = m->d = 0;
 }
 
@@ -112,6 +142,13 @@ int load_matrix_i32(const char *path, MatrixI32 *m)
 {
     if (!path || !m) return -1;
 
+    void *mapped = NULL;
+    int rc = load_other(path, MATRIX_T_I32, &m->n, &m->d, &mapped, &m->map);
+    if (rc <= 0) {
+        if (rc == 0) m->data = (int32_t*)mapped;
+        return rc;
+    }
+
     FILE *f = fopen(path, "rb");
     if (!f) {
         perror("fopen");
@@ -142,6 +179,7 @@ int load_matrix_i32(const char *path, MatrixI32 *m)
     m->n = n;
     m->d = d;
     m->data = data;
+    m->map = NULL;
 
     return 0;
 }
@@ -149,7 +187,9 @@ int load_matrix_i32(const char *path, MatrixI32 *m)
 void free_matrix_i32(MatrixI32 *m)
 {
     if (!m) return;
-    free(m->data);
+    if (m->map) matrix_unmap(m->map);
+    else free(m->data);
     m->data = NULL;
+    m->map = NULL;
     m->n = m->d = 0;
 }
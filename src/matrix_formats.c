@@ -0,0 +1,457 @@
+#include "matrix_formats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+struct MatrixMap {
+    uint8_t *base;
+    size_t   len;
+    int      mapped;   // 1: mmap, 0: buffer malloc (Windows)
+};
+
+// Righe da leggere nel file: parte da p, stride byte fra una riga e la
+// successiva, d elementi di tipo t. prefix: ogni riga è preceduta dalla
+// dimensione int32 (4 byte prima di p + i * stride).
+typedef struct {
+    const uint8_t *p;
+    size_t         n, d, stride;
+    MatrixType     t;
+    int            prefix;
+} MatrixSrc;
+
+static size_t type_size(MatrixType t)
+{
+    switch (t) {
+    case MATRIX_T_F64:
+    case MATRIX_T_I64: return 8;
+    case MATRIX_T_U8:  return 1;
+    default:           return 4;
+    }
+}
+
+static uint16_t rd16(const uint8_t *p) { uint16_t v; memcpy(&v, p, 2); return v; }
+static uint32_t rd32(const uint8_t *p) { uint32_t v; memcpy(&v, p, 4); return v; }
+static uint64_t rd64(const uint8_t *p) { uint64_t v; memcpy(&v, p, 8); return v; }
+
+// ===================== MAPPATURA =====================
+
+static MatrixMap *map_file(const char *path)
+{
+    MatrixMap *m = (MatrixMap *)calloc(1, sizeof(MatrixMap));
+    if (!m) return NULL;
+
+#if !defined(_WIN32)
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror("open");
+        free(m);
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        fprintf(stderr, "%s: file vuoto o illeggibile\n", path);
+        close(fd);
+        free(m);
+        return NULL;
+    }
+    // Copy-on-write: la matrice resta scrivibile come con malloc, il file no
+    void *base = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        perror("mmap");
+        free(m);
+        return NULL;
+    }
+    m->base   = (uint8_t *)base;
+    m->len    = (size_t)st.st_size;
+    m->mapped = 1;
+#else
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror("fopen");
+        free(m);
+        return NULL;
+    }
+    long len = -1;
+    if (fseek(f, 0, SEEK_END) == 0) len = ftell(f);
+    if (len <= 0 || fseek(f, 0, SEEK_SET) != 0 ||
+        !(m->base = (uint8_t *)malloc((size_t)len)) ||
+        fread(m->base, 1, (size_t)len, f) != (size_t)len) {
+        fprintf(stderr, "%s: file vuoto o illeggibile\n", path);
+        fclose(f);
+        free(m->base);
+        free(m);
+        return NULL;
+    }
+    fclose(f);
+    m->len = (size_t)len;
+#endif
+    return m;
+}
+
+void matrix_unmap(MatrixMap *map)
+{
+    if (!map) return;
+#if !defined(_WIN32)
+    if (map->mapped) munmap(map->base, map->len);
+    else
+#endif
+    free(map->base);
+    free(map);
+}
+
+// Pagine intere di [p, p + len) già convertite: restituite al sistema
+static void map_release(MatrixMap *map, const uint8_t *p, size_t len)
+{
+#if !defined(_WIN32) && defined(MADV_DONTNEED)
+    if (!map->mapped) return;
+    uintptr_t pg = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t lo = ((uintptr_t)p + pg - 1) & ~(pg - 1);
+    uintptr_t hi = ((uintptr_t)p + len) & ~(pg - 1);
+    if (hi > lo) madvise((void *)lo, hi - lo, MADV_DONTNEED);
+#else
+    (void)map; (void)p; (void)len;
+#endif
+}
+
+// ===================== FORMATI =====================
+
+// Estensione (con il punto) della parte di percorso [path, end)
+static int has_ext(const char *path, size_t end, const char *ext)
+{
+    size_t e = strlen(ext);
+    return end >= e && memcmp(path + end - e, ext, e) == 0;
+}
+
+MatrixFormat matrix_format(const char *path)
+{
+    if (!path) return MATRIX_FMT_DS2;
+    size_t len = strlen(path);
+    if (has_ext(path, len, ".fvecs")) return MATRIX_FMT_FVECS;
+    if (has_ext(path, len, ".ivecs")) return MATRIX_FMT_IVECS;
+    if (has_ext(path, len, ".bvecs")) return MATRIX_FMT_BVECS;
+    if (has_ext(path, len, ".npy"))   return MATRIX_FMT_NPY;
+    if (has_ext(path, len, ".npz") || strstr(path, ".npz:")) return MATRIX_FMT_NPZ;
+    return MATRIX_FMT_DS2;
+}
+
+// .fvecs/.ivecs/.bvecs: righe di 4 + d * es byte, tutte con la stessa d
+static int parse_vecs(const char *path, const MatrixMap *map, MatrixType t, MatrixSrc *src)
+{
+    size_t es = type_size(t);
+    uint32_t d = map->len >= 4 ? rd32(map->base) : 0;
+    size_t row = 4 + (size_t)d * es;
+    if (d == 0 || d > (uint32_t)INT32_MAX || map->len % row != 0) {
+        fprintf(stderr, "%s: file .vecs non valido (dimensione %u, %zu byte)\n", path, d, map->len);
+        return -1;
+    }
+    src->p      = map->base + 4;
+    src->n      = map->len / row;
+    src->d      = d;
+    src->stride = row;
+    src->t      = t;
+    src->prefix = 1;
+    return 0;
+}
+
+// Valore (stringa fra apici o tupla fra parentesi) della chiave key del
+// dizionario di intestazione .npy, copiato in out
+static int npy_field(const char *hdr, size_t hlen, const char *key, char *out, size_t cap)
+{
+    char pat[32];
+    snprintf(pat, sizeof(pat), "'%s':", key);
+    size_t pl = strlen(pat);
+    for (size_t i = 0; i + pl <= hlen; i++) {
+        if (memcmp(hdr + i, pat, pl) != 0) continue;
+        size_t j = i + pl;
+        while (j < hlen && hdr[j] == ' ') j++;
+        if (j >= hlen) return -1;
+        char close = hdr[j] == '(' ? ')' : hdr[j] == '\'' ? '\'' : ',';
+        size_t k = (close == ',') ? j : j + 1;
+        size_t s = k;
+        while (k < hlen && hdr[k] != close && hdr[k] != '}') k++;
+        if (k >= hlen || k - s >= cap) return -1;
+        memcpy(out, hdr + s, k - s);
+        out[k - s] = '\0';
+        return 0;
+    }
+    return -1;
+}
+
+// Array .npy in [p, p + len): intestazione NumPy 1.0/2.0/3.0, 2-D, ordine C
+static int parse_npy(const char *path, const uint8_t *p, size_t len, MatrixSrc *src)
+{
+    static const uint8_t magic[6] = { 0x93, 'N', 'U', 'M', 'P', 'Y' };
+    if (len < 10 || memcmp(p, magic, 6) != 0) {
+        fprintf(stderr, "%s: intestazione .npy non valida\n", path);
+        return -1;
+    }
+    size_t off = p[6] == 1 ? 10 : 12;
+    size_t hlen = off > len ? 0 : off == 10 ? rd16(p + 8) : rd32(p + 8);
+    if (off > len || hlen > len - off) {
+        fprintf(stderr, "%s: intestazione .npy troncata\n", path);
+        return -1;
+    }
+
+    const char *hdr = (const char *)p + off;
+    char descr[16], order[16], shape[64];
+    if (npy_field(hdr, hlen, "descr", descr, sizeof(descr)) != 0 ||
+        npy_field(hdr, hlen, "fortran_order", order, sizeof(order)) != 0 ||
+        npy_field(hdr, hlen, "shape", shape, sizeof(shape)) != 0) {
+        fprintf(stderr, "%s: intestazione .npy incompleta\n", path);
+        return -1;
+    }
+
+    MatrixType t;
+    if      (!strcmp(descr, "<f4")) t = MATRIX_T_F32;
+    else if (!strcmp(descr, "<f8")) t = MATRIX_T_F64;
+    else if (!strcmp(descr, "<i4")) t = MATRIX_T_I32;
+    else if (!strcmp(descr, "<i8")) t = MATRIX_T_I64;
+    else if (!strcmp(descr, "|u1") || !strcmp(descr, "<u1")) t = MATRIX_T_U8;
+    else {
+        fprintf(stderr, "%s: tipo .npy '%s' non supportato (f4, f8, i4, i8, u1)\n", path, descr);
+        return -1;
+    }
+
+    unsigned long long n = 0, d = 0;
+    char extra = 0;
+    if (strncmp(order, "False", 5) != 0 ||
+        sscanf(shape, " %llu , %llu %c", &n, &d, &extra) != 2 || d == 0) {
+        fprintf(stderr, "%s: serve un array 2-D in ordine C (shape (%s))\n", path, shape);
+        return -1;
+    }
+
+    size_t es = type_size(t);
+    off += hlen;
+    if (d > (len - off) / es || (d && n > (len - off) / (d * es))) {
+        fprintf(stderr, "%s: dati .npy troncati\n", path);
+        return -1;
+    }
+    src->p      = p + off;
+    src->n      = (size_t)n;
+    src->d      = (size_t)d;
+    src->stride = (size_t)d * es;
+    src->t      = t;
+    src->prefix = 0;
+    return 0;
+}
+
+// Archivio .npz: directory centrale (anche ZIP64, come la scrive np.savez),
+// entry "name.npy" o la prima .npy se name è NULL, memorizzata senza
+// compressione
+static int parse_npz(const char *path, const MatrixMap *map, const char *name, MatrixSrc *src)
+{
+    const uint8_t *b = map->base;
+    size_t len = map->len;
+
+    // Fine della directory centrale: firma negli ultimi 22 + 65535 byte
+    size_t eocd = (size_t)-1;
+    size_t lo = len > 22 + 65535 ? len - 22 - 65535 : 0;
+    for (size_t i = len >= 22 ? len - 21 : 0; i-- > lo; )
+        if (rd32(b + i) == 0x06054b50u) { eocd = i; break; }
+    if (eocd == (size_t)-1) {
+        fprintf(stderr, "%s: archivio .npz non valido\n", path);
+        return -1;
+    }
+    uint64_t entries = rd16(b + eocd + 10);
+    uint64_t cdoff   = rd32(b + eocd + 16);
+    if (eocd >= 20 && rd32(b + eocd - 20) == 0x07064b50u) {
+        uint64_t z = rd64(b + eocd - 20 + 8);
+        if (z + 56 <= len && rd32(b + z) == 0x06064b50u) {
+            entries = rd64(b + z + 32);
+            cdoff   = rd64(b + z + 48);
+        }
+    }
+
+    size_t nl_want = name ? strlen(name) : 0;
+    uint64_t c = cdoff;
+    for (uint64_t e = 0; e < entries; e++) {
+        if (c + 46 > len || rd32(b + c) != 0x02014b50u) break;
+        uint16_t method = rd16(b + c + 10);
+        uint64_t csize  = rd32(b + c + 20);
+        uint64_t usize  = rd32(b + c + 24);
+        uint16_t nl = rd16(b + c + 28), xl = rd16(b + c + 30), cl = rd16(b + c + 32);
+        uint64_t lho    = rd32(b + c + 42);
+        const char *en  = (const char *)b + c + 46;
+        if (c + 46 + nl + xl > len) break;
+
+        // Campo extra ZIP64 (id 1): solo i valori a 0xFFFFFFFF, in ordine
+        for (size_t x = 0; x + 4 <= xl; ) {
+            const uint8_t *f = b + c + 46 + nl + x;
+            uint16_t id = rd16(f), fl = rd16(f + 2);
+            if (id == 1) {
+                const uint8_t *v = f + 4, *ve = f + 4 + fl;
+                if (usize == 0xffffffffu && v + 8 <= ve) { usize = rd64(v); v += 8; }
+                if (csize == 0xffffffffu && v + 8 <= ve) { csize = rd64(v); v += 8; }
+                if (lho   == 0xffffffffu && v + 8 <= ve) { lho   = rd64(v); }
+            }
+            x += 4 + (size_t)fl;
+        }
+
+        int match = name ? ((nl == nl_want + 4 && !memcmp(en, name, nl_want) && !memcmp(en + nl_want, ".npy", 4)) ||
+                            (nl == nl_want && !memcmp(en, name, nl_want)))
+                         : (nl >= 4 && !memcmp(en + nl - 4, ".npy", 4));
+        if (match) {
+            if (method != 0) {
+                fprintf(stderr, "%s: entry %.*s compressa (np.savez_compressed): usare np.savez\n",
+                        path, (int)nl, en);
+                return -1;
+            }
+            if (lho + 30 > len || rd32(b + lho) != 0x04034b50u) break;
+            uint64_t data = lho + 30 + rd16(b + lho + 26) + rd16(b + lho + 28);
+            if (data + usize > len || csize != usize) break;
+            return parse_npy(path, b + data, (size_t)usize, src);
+        }
+        c += 46 + (uint64_t)nl + xl + cl;
+    }
+
+    if (name) fprintf(stderr, "%s: array '%s' non trovato nell'archivio\n", path, name);
+    else      fprintf(stderr, "%s: nessun array .npy nell'archivio\n", path);
+    return -1;
+}
+
+// ===================== CONVERSIONE =====================
+
+// Una riga di d elementi di tipo st in dst (tipo dt); -1 se un valore non
+// è rappresentabile (int64 fuori da int32) o la conversione non ha senso
+static int convert_row(const uint8_t *s, MatrixType st, void *dst, MatrixType dt, size_t d)
+{
+    if (st == dt) {
+        memcpy(dst, s, d * type_size(st));
+        return 0;
+    }
+    if (dt == MATRIX_T_F32 || dt == MATRIX_T_F64) {
+        for (size_t j = 0; j < d; j++) {
+            double v;
+            switch (st) {
+            case MATRIX_T_F32: { float f;   memcpy(&f, s + 4 * j, 4); v = f; break; }
+            case MATRIX_T_F64: {            memcpy(&v, s + 8 * j, 8);        break; }
+            case MATRIX_T_I32: { int32_t x; memcpy(&x, s + 4 * j, 4); v = x; break; }
+            case MATRIX_T_I64: { int64_t x; memcpy(&x, s + 8 * j, 8); v = (double)x; break; }
+            default:           v = s[j]; break;
+            }
+            if (dt == MATRIX_T_F32) ((float *)dst)[j] = (float)v;
+            else                    ((double *)dst)[j] = v;
+        }
+        return 0;
+    }
+
+    int32_t *o = (int32_t *)dst;
+    for (size_t j = 0; j < d; j++) {
+        switch (st) {
+        case MATRIX_T_I32: memcpy(&o[j], s + 4 * j, 4); break;
+        case MATRIX_T_I64: {
+            int64_t x;
+            memcpy(&x, s + 8 * j, 8);
+            if (x < INT32_MIN || x > INT32_MAX) return -1;
+            o[j] = (int32_t)x;
+            break;
+        }
+        case MATRIX_T_U8:  o[j] = s[j]; break;
+        default:           return -1;   // float -> id
+        }
+    }
+    return 0;
+}
+
+int matrix_load_file(const char *path, MatrixFormat fmt, MatrixType t,
+                     uint32_t *n, uint32_t *d, void **data, MatrixMap **map)
+{
+    if (!path || !n || !d || !data || !map || fmt == MATRIX_FMT_DS2) return -1;
+
+    // "archivio.npz:nome" -> file "archivio.npz", array "nome"
+    char *file = NULL;
+    const char *name = NULL;
+    if (fmt == MATRIX_FMT_NPZ) {
+        const char *sep = strstr(path, ".npz:");
+        if (sep) {
+            size_t fl = (size_t)(sep - path) + 4;
+            file = (char *)malloc(fl + 1);
+            if (!file) return -1;
+            memcpy(file, path, fl);
+            file[fl] = '\0';
+            name = sep + 5;
+        }
+    }
+
+    MatrixMap *mm = map_file(file ? file : path);
+    free(file);
+    if (!mm) return -1;
+
+    MatrixSrc src;
+    int rc;
+    switch (fmt) {
+    case MATRIX_FMT_FVECS: rc = parse_vecs(path, mm, MATRIX_T_F32, &src); break;
+    case MATRIX_FMT_IVECS: rc = parse_vecs(path, mm, MATRIX_T_I32, &src); break;
+    case MATRIX_FMT_BVECS: rc = parse_vecs(path, mm, MATRIX_T_U8, &src);  break;
+    case MATRIX_FMT_NPY:   rc = parse_npy(path, mm->base, mm->len, &src); break;
+    default:               rc = parse_npz(path, mm, name, &src);          break;
+    }
+    if (rc == 0 && (src.n > UINT32_MAX || src.d > UINT32_MAX)) {
+        fprintf(stderr, "%s: %zu x %zu oltre il limite di 2^32 righe/colonne\n", path, src.n, src.d);
+        rc = -1;
+    }
+    if (rc != 0) {
+        matrix_unmap(mm);
+        return -1;
+    }
+
+    // Stesso tipo e righe contigue: i dati restano nella mappatura
+    size_t es = type_size(t);
+    if (!src.prefix && src.t == t && (uintptr_t)src.p % es == 0) {
+        *n = (uint32_t)src.n;
+        *d = (uint32_t)src.d;
+        *data = (void *)src.p;
+        *map = mm;
+        return 0;
+    }
+
+    uint8_t *out = (uint8_t *)malloc(src.n * src.d * es + 1);
+    if (!out) {
+        matrix_unmap(mm);
+        return -1;
+    }
+#if !defined(_WIN32) && defined(MADV_SEQUENTIAL)
+    if (mm->mapped) madvise(mm->base, mm->len, MADV_SEQUENTIAL);
+#endif
+
+    size_t chunk = MATRIX_CHUNK / src.stride;
+    if (chunk == 0) chunk = 1;
+    for (size_t i0 = 0; i0 < src.n && rc == 0; i0 += chunk) {
+        size_t cnt = src.n - i0 < chunk ? src.n - i0 : chunk;
+        for (size_t i = i0; i < i0 + cnt; i++) {
+            const uint8_t *row = src.p + i * src.stride;
+            if (src.prefix && rd32(row - 4) != (uint32_t)src.d) {
+                fprintf(stderr, "%s: riga %zu con dimensione %u invece di %zu\n",
+                        path, i, rd32(row - 4), src.d);
+                rc = -1;
+                break;
+            }
+            if (convert_row(row, src.t, out + i * src.d * es, t, src.d) != 0) {
+                fprintf(stderr, "%s: riga %zu non convertibile nel tipo richiesto\n", path, i);
+                rc = -1;
+                break;
+            }
+        }
+        map_release(mm, src.p + i0 * src.stride, cnt * src.stride);
+    }
+    matrix_unmap(mm);
+    if (rc != 0) {
+        free(out);
+        return -1;
+    }
+
+    *n = (uint32_t)src.n;
+    *d = (uint32_t)src.d;
+    *data = out;
+    *map = NULL;
+    return 0;
+}
@@ -0,0 +1,356 @@
+#include "perfcount.h"
+
+#include <string.h>
+
+static const char *PHASE_NAMES[PERF_PHASES] = {
+    "quant", "pivot_table", "lower_bound", "approx", "rerank"
+};
+
+static const char *EVENT_NAMES[PERF_EVENTS] = {
+    "time_ns", "cycles", "instructions", "llc_misses", "branch_misses"
+};
+
+// Contatori di scansione: uno slot per thread, scritto solo dal suo thread.
+// Gli slot distano 128 byte, quindi i contatori di due thread non cadono
+// mai nella stessa riga di cache. Oltre PERF_MAX_THREADS thread si ricade
+// sullo slot condiviso con incrementi atomici.
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define PERF_TLS       __declspec(thread)
+#define SCAN_ADD(p, v) _InterlockedExchangeAdd64((volatile __int64 *)(p), (__int64)(v))
+#define SCAN_GET(p)    ((uint64_t)_InterlockedExchangeAdd64((volatile __int64 *)(p), 0))
+#define SCAN_SET(p, v) (*(volatile uint64_t *)(p) = (v))
+#else
+#define PERF_TLS       __thread
+#define SCAN_ADD(p, v) __atomic_fetch_add((p), (v), __ATOMIC_RELAXED)
+#define SCAN_GET(p)    __atomic_load_n((p), __ATOMIC_RELAXED)
+#define SCAN_SET(p, v) __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#endif
+
+typedef struct {
+    uint64_t scanned;
+    uint64_t pruned;
+    char     pad[112];
+} ScanSlot;
+
+static ScanSlot g_scan[PERF_MAX_THREADS + 1];   // ultimo: slot condiviso
+static uint64_t g_scan_slots = 0;
+static PERF_TLS ScanSlot *t_scan = NULL;
+
+void perf_scan_add(uint64_t scanned, uint64_t pruned)
+{
+    if (!t_scan) {
+        uint64_t i = SCAN_ADD(&g_scan_slots, 1);
+        t_scan = &g_scan[i < PERF_MAX_THREADS ? i : PERF_MAX_THREADS];
+    }
+    if (t_scan == &g_scan[PERF_MAX_THREADS]) {
+        SCAN_ADD(&t_scan->scanned, scanned);
+        SCAN_ADD(&t_scan->pruned, pruned);
+        return;
+    }
+    SCAN_SET(&t_scan->scanned, t_scan->scanned + scanned);
+    SCAN_SET(&t_scan->pruned, t_scan->pruned + pruned);
+}
+
+void perf_scan_read(uint64_t *scanned, uint64_t *pruned)
+{
+    uint64_t n = SCAN_GET(&g_scan_slots), sc = 0, pr = 0;
+    if (n > PERF_MAX_THREADS) n = PERF_MAX_THREADS;
+    for (uint64_t i = 0; i < n; i++) {
+        sc += SCAN_GET(&g_scan[i].scanned);
+        pr += SCAN_GET(&g_scan[i].pruned);
+    }
+    sc += SCAN_GET(&g_scan[PERF_MAX_THREADS].scanned);
+    pr += SCAN_GET(&g_scan[PERF_MAX_THREADS].pruned);
+    if (scanned) *scanned = sc;
+    if (pruned)  *pruned  = pr;
+}
+
+int perf_enabled = 0;
+
+const char *perf_phase_name(int p) { return (p >= 0 && p < PERF_PHASES) ? PHASE_NAMES[p] : "?"; }
+const char *perf_event_name(int e) { return (e >= 0 && e < PERF_EVENTS) ? EVENT_NAMES[e] : "?"; }
+
+#if defined(__linux__) && !defined(QP_NO_PERF)
+
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+// ------------------ STATO GLOBALE E PER THREAD ----------------------
+//
+// Ogni thread apre il proprio gruppo di contatori (pid = 0, cpu = -1:
+// segue il thread su qualunque CPU) alla prima fase misurata e lo legge
+// con una sola read() grazie a PERF_FORMAT_GROUP. Il leader è il
+// task-clock software, così il gruppo esiste anche dove la PMU non è
+// esposta (VM, container); gli eventi hardware si aggiungono se possibile.
+//
+// Ai confini di fase (anche ogni blocco di 256 righe della scansione) una
+// read() per confine dominerebbe le fasi brevi: gli eventi hardware sono
+// mappati in memoria e letti con rdpmc, il tempo è quello del clock
+// monotono (vDSO). read() resta il ripiego per gli eventi che il kernel
+// non espone a rdpmc (indice 0 o cap_user_rdpmc assente).
+//
+// --------------------------------------------------------------------
+
+static unsigned g_mask   = 0;
+static int      g_threads = 0;
+static PerfThreadStats g_stats[PERF_MAX_THREADS];
+
+static __thread int      t_slot = -1;
+static __thread int      t_fd   = -1;   // -2 = apertura fallita
+static __thread int      t_pos[PERF_EVENTS];   // posizione nel buffer di gruppo, -1 = assente
+static __thread uint64_t t_start[PERF_EVENTS];
+static __thread volatile struct perf_event_mmap_page *t_page[PERF_EVENTS];   // NULL = solo read()
+
+static int open_event(uint32_t type, uint64_t config, int group_fd)
+{
+    struct perf_event_attr a;
+    memset(&a, 0, sizeof(a));
+    a.size           = sizeof(a);
+    a.type           = type;
+    a.config         = config;
+    a.disabled       = group_fd == -1;   // solo il leader parte disabilitato
+    a.exclude_kernel = 1;                // consentito con perf_event_paranoid <= 2
+    a.exclude_hv     = 1;
+    a.read_format    = PERF_FORMAT_GROUP;
+    return (int)syscall(SYS_perf_event_open, &a, 0, -1, group_fd, 0);
+}
+
+static unsigned open_group(void)
+{
+    static const struct { uint32_t type; uint64_t config; } EV[PERF_EVENTS] = {
+        { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    };
+
+    for (int e = 0; e < PERF_EVENTS; e++) {
+        t_pos[e]  = -1;
+        t_page[e] = NULL;
+    }
+
+    t_fd = open_event(EV[0].type, EV[0].config, -1);
+    if (t_fd < 0) {
+        t_fd = -2;
+        return 0;
+    }
+
+    unsigned mask = 1u << PERF_EV_TIME;
+    int pos = 0;
+    t_pos[PERF_EV_TIME] = pos++;
+
+    for (int e = 1; e < PERF_EVENTS; e++) {
+        int fd = open_event(EV[e].type, EV[e].config, t_fd);
+        if (fd < 0) continue;            // i descrittori figli restano aperti fino all'uscita
+        t_pos[e] = pos++;
+        mask |= 1u << e;
+
+        void *pg = mmap(NULL, (size_t)sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, fd, 0);
+        if (pg != MAP_FAILED) t_page[e] = (volatile struct perf_event_mmap_page *)pg;
+    }
+
+    ioctl(t_fd, PERF_EVENT_IOC_RESET,  PERF_IOC_FLAG_GROUP);
+    ioctl(t_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    return mask;
+}
+
+// Legge tutti i contatori del gruppo del thread corrente
+static int read_group(uint64_t out[PERF_EVENTS])
+{
+    uint64_t buf[1 + PERF_EVENTS];
+    if (read(t_fd, buf, sizeof(buf)) < (ssize_t)sizeof(uint64_t)) return -1;
+
+    for (int e = 0; e < PERF_EVENTS; e++)
+        out[e] = (t_pos[e] >= 0 && (uint64_t)t_pos[e] < buf[0]) ? buf[1 + t_pos[e]] : 0;
+    return 0;
+}
+
+// Contatore dell'evento con rdpmc (protocollo seqlock della pagina mmap):
+// 0 se letto, -1 se il kernel non lo espone in questo momento
+static int read_rdpmc(volatile struct perf_event_mmap_page *pc, uint64_t *out)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    uint32_t seq, idx;
+    uint64_t count;
+
+    if (!pc) return -1;
+    do {
+        seq = pc->lock;
+        __atomic_signal_fence(__ATOMIC_SEQ_CST);
+        idx = pc->index;
+        if (!pc->cap_user_rdpmc || idx == 0) return -1;
+
+        uint32_t lo, hi;
+        __asm__ volatile("rdpmc" : "=a"(lo), "=d"(hi) : "c"(idx - 1));
+        int w = pc->pmc_width;
+        uint64_t pmc = ((uint64_t)hi << 32) | lo;
+        pmc = (uint64_t)((int64_t)(pmc << (64 - w)) >> (64 - w));   // estensione del segno
+        count = (uint64_t)pc->offset + pmc;
+
+        __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    } while (pc->lock != seq);
+
+    *out = count;
+    return 0;
+#else
+    (void)pc; (void)out;
+    return -1;
+#endif
+}
+
+// Valori correnti per i confini di fase: tempo monotono, eventi hardware con
+// rdpmc; una sola read() del gruppo per quelli non leggibili così
+static int read_now(uint64_t out[PERF_EVENTS])
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    unsigned missing = 0;
+    for (int e = 1; e < PERF_EVENTS; e++) {
+        out[e] = 0;
+        if (t_pos[e] >= 0 && read_rdpmc(t_page[e], &out[e]) != 0) missing |= 1u << e;
+    }
+    if (missing) {
+        uint64_t g[PERF_EVENTS];
+        if (read_group(g) != 0) return -1;
+        for (int e = 1; e < PERF_EVENTS; e++)
+            if (missing & (1u << e)) out[e] = g[e];
+    }
+
+    out[PERF_EV_TIME] = (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+    return 0;
+}
+
+static int ensure_thread(void)
+{
+    if (t_fd == -2) return -1;
+    if (t_fd == -1) {
+        if (open_group() == 0) return -1;
+        t_slot = __atomic_fetch_add(&g_threads, 1, __ATOMIC_RELAXED);
+        if (t_slot >= PERF_MAX_THREADS) {
+            close(t_fd);
+            t_fd = -2;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+unsigned perf_init(void)
+{
+    if (ensure_thread() != 0) return 0;
+    g_mask   = 0;
+    for (int e = 0; e < PERF_EVENTS; e++)
+        if (t_pos[e] >= 0) g_mask |= 1u << e;
+    perf_reset();
+    perf_enabled = 1;
+    return g_mask;
+}
+
+unsigned perf_events_mask(void) { return g_mask; }
+
+void perf_reset(void)
+{
+    memset(g_stats, 0, sizeof(g_stats));
+}
+
+void perf_phase_begin(PerfPhase p)
+{
+    (void)p;
+    if (ensure_thread() != 0) return;
+    read_now(t_start);
+}
+
+void perf_phase_end(PerfPhase p)
+{
+    uint64_t now[PERF_EVENTS];
+    if (t_fd < 0 || read_now(now) != 0) return;
+
+    PerfThreadStats *s = &g_stats[t_slot];
+    for (int e = 0; e < PERF_EVENTS; e++)
+        s->v[p][e] += now[e] - t_start[e];
+    s->calls[p]++;
+}
+
+int perf_snapshot(PerfThreadStats *out, int max_threads)
+{
+    int n = g_threads < PERF_MAX_THREADS ? g_threads : PERF_MAX_THREADS;
+    if (n > max_threads) n = max_threads;
+    memcpy(out, g_stats, (size_t)n * sizeof(PerfThreadStats));
+    return n;
+}
+
+#else   // ------------------ STUB (non Linux) ----------------------
+
+static PerfThreadStats g_stats[1];
+static const int g_threads = 0;
+
+unsigned perf_init(void)          { return 0; }
+unsigned perf_events_mask(void)   { return 0; }
+void     perf_reset(void)         { }
+void     perf_phase_begin(PerfPhase p) { (void)p; }
+void     perf_phase_end(PerfPhase p)   { (void)p; }
+
+int perf_snapshot(PerfThreadStats *out, int max_threads)
+{
+    (void)out; (void)max_threads;
+    return 0;
+}
+
+#endif
+
+void perf_total(PerfThreadStats *out)
+{
+    int n = g_threads < PERF_MAX_THREADS ? g_threads : PERF_MAX_THREADS;
+    memset(out, 0, sizeof(*out));
+    for (int t = 0; t < n; t++)
+        for (int p = 0; p < PERF_PHASES; p++) {
+            for (int e = 0; e < PERF_EVENTS; e++) out->v[p][e] += g_stats[t].v[p][e];
+            out->calls[p] += g_stats[t].calls[p];
+        }
+}
+
+static void print_row(FILE *f, const char *label, const PerfThreadStats *s, int p, unsigned mask)
+{
+    fprintf(f, "%-20s %10llu", label, (unsigned long long)s->calls[p]);
+    fprintf(f, " %12.3f", s->v[p][PERF_EV_TIME] / 1e6);
+    for (int e = 1; e < PERF_EVENTS; e++) {
+        if (mask & (1u << e)) fprintf(f, " %14llu", (unsigned long long)s->v[p][e]);
+        else                  fprintf(f, " %14s", "n/d");
+    }
+    if ((mask & (1u << PERF_EV_CYCLES)) && (mask & (1u << PERF_EV_INSTR)) && s->v[p][PERF_EV_CYCLES])
+        fprintf(f, " %6.2f", (double)s->v[p][PERF_EV_INSTR] / (double)s->v[p][PERF_EV_CYCLES]);
+    fprintf(f, "\n");
+}
+
+void perf_print(FILE *f, int per_thread)
+{
+    unsigned mask = perf_events_mask();
+    if (!mask) {
+        fprintf(f, "[PERF] contatori non disponibili (perf_event_open)\n");
+        return;
+    }
+
+    fprintf(f, "%-20s %10s %12s %14s %14s %14s %14s %6s\n",
+            "FASE", "CHIAMATE", "TEMPO ms", "CYCLES", "INSTRUCTIONS", "LLC MISS", "BRANCH MISS", "IPC");
+
+    PerfThreadStats tot;
+    perf_total(&tot);
+    for (int p = 0; p < PERF_PHASES; p++)
+        print_row(f, PHASE_NAMES[p], &tot, p, mask);
+
+    if (!per_thread) return;
+
+    int n = g_threads < PERF_MAX_THREADS ? g_threads : PERF_MAX_THREADS;
+    for (int t = 0; t < n; t++) {
+        fprintf(f, "-- thread %d\n", t);
+        for (int p = 0; p < PERF_PHASES; p++)
+            if (g_stats[t].calls[p]) print_row(f, PHASE_NAMES[p], &g_stats[t], p, mask);
+    }
+}
@@ -0,0 +1,331 @@
+#include "pool.h"
+
+#include <stdlib.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#if !defined(_WIN32)
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define cpu_relax() _mm_pause()
+#else
+#define cpu_relax() ((void)0)
+#endif
+
+// ------------------ PROTOCOLLO ----------------------
+//
+// Il chiamante (sotto submit) pubblica il lavoro, imposta pending al numero
+// di worker e incrementa gen. Ogni worker vede gen cambiare (spin o
+// condition variable), prende blocchi da next finché ce ne sono e decrementa
+// pending; l'ultimo sveglia il chiamante se questo si è addormentato.
+// Un worker con tid >= used salta il lavoro ma conferma comunque.
+//
+// ----------------------------------------------------
+
+struct ThreadPool {
+    int        n;            // thread totali, chiamante compreso
+    PoolWait   wait;
+    long       spin_ns;
+    pthread_t *tid;
+
+    pthread_mutex_t submit;  // un job alla volta
+
+    pthread_mutex_t lock;    // protegge i dormienti e le condition variable
+    pthread_cond_t  wake;    // worker -> nuovo job
+    pthread_cond_t  done;    // chiamante -> job finito
+    int             sleepers;
+    int             waiting; // il chiamante dorme su done
+
+    atomic_uint     gen;
+    atomic_int      pending;
+    atomic_size_t   next;
+    int             stop;
+
+    // Job corrente
+    PoolTask task;
+    void    *ctx;
+    size_t   n_items;
+    size_t   chunk;
+    int      used;
+};
+
+static long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static void run_chunks(ThreadPool *p, int tid)
+{
+    for (;;) {
+        size_t b = atomic_fetch_add_explicit(&p->next, p->chunk, memory_order_relaxed);
+        if (b >= p->n_items) break;
+        size_t e = b + p->chunk < p->n_items ? b + p->chunk : p->n_items;
+        p->task(p->ctx, b, e, tid);
+    }
+}
+
+// Attesa attiva finché *v == old, al massimo spin_ns; 1 se il valore è cambiato
+static int spin_until_changed(const ThreadPool *p, atomic_uint *v, unsigned old)
+{
+    if (p->wait != POOL_SPIN) return 0;
+    long deadline = now_ns() + p->spin_ns;
+    for (int i = 1; ; i++) {
+        if (atomic_load_explicit(v, memory_order_acquire) != old) return 1;
+        cpu_relax();
+        if ((i & 255) == 0 && now_ns() > deadline) return 0;
+    }
+}
+
+typedef struct { ThreadPool *p; int id; } WorkerArg;
+
+static void *worker_main(void *arg)
+{
+    ThreadPool *p = ((WorkerArg *)arg)->p;
+    int id        = ((WorkerArg *)arg)->id;
+    free(arg);
+
+    unsigned seen = 0;
+    for (;;) {
+        if (!spin_until_changed(p, &p->gen, seen)) {
+            pthread_mutex_lock(&p->lock);
+            p->sleepers++;
+            while (atomic_load(&p->gen) == seen && !p->stop)
+                pthread_cond_wait(&p->wake, &p->lock);
+            p->sleepers--;
+            pthread_mutex_unlock(&p->lock);
+        }
+        if (p->stop) break;
+        seen = atomic_load_explicit(&p->gen, memory_order_acquire);
+
+        if (id < p->used) run_chunks(p, id);
+
+        if (atomic_fetch_sub_explicit(&p->pending, 1, memory_order_acq_rel) == 1) {
+            pthread_mutex_lock(&p->lock);
+            if (p->waiting) pthread_cond_signal(&p->done);
+            pthread_mutex_unlock(&p->lock);
+        }
+    }
+    return NULL;
+}
+
+static int online_cpus(void)
+{
+    long c = sysconf(_SC_NPROCESSORS_ONLN);
+    return c > 0 ? (int)c : 1;
+}
+
+ThreadPool *pool_create(int threads, PoolWait wait, int spin_us)
+{
+    ThreadPool *p = calloc(1, sizeof(ThreadPool));
+    if (!p) return NULL;
+
+    p->n       = threads > 0 ? threads : online_cpus();
+    p->wait    = wait;
+    p->spin_ns = (spin_us > 0 ? spin_us : 50) * 1000L;
+    pthread_mutex_init(&p->submit, NULL);
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->wake, NULL);
+    pthread_cond_init(&p->done, NULL);
+    atomic_init(&p->gen, 0);
+    atomic_init(&p->pending, 0);
+    atomic_init(&p->next, 0);
+
+    p->tid = calloc((size_t)p->n, sizeof(pthread_t));
+    if (!p->tid) {
+        free(p);
+        return NULL;
+    }
+
+    // Il thread 0 è il chiamante: si creano n - 1 worker
+    for (int i = 1; i < p->n; i++) {
+        WorkerArg *a = malloc(sizeof(WorkerArg));
+        if (a) {
+            a->p  = p;
+            a->id = i;
+        }
+        if (!a || pthread_create(&p->tid[i], NULL, worker_main, a) != 0) {
+            free(a);
+            p->n = i;          // i worker già avviati restano validi
+            break;
+        }
+    }
+    return p;
+}
+
+void pool_destroy(ThreadPool *p)
+{
+    if (!p) return;
+
+    pthread_mutex_lock(&p->submit);
+    pthread_mutex_lock(&p->lock);
+    p->stop = 1;
+    atomic_fetch_add(&p->gen, 1);
+    pthread_cond_broadcast(&p->wake);
+    pthread_mutex_unlock(&p->lock);
+    pthread_mutex_unlock(&p->submit);
+
+    for (int i = 1; i < p->n; i++) pthread_join(p->tid[i], NULL);
+
+    pthread_mutex_destroy(&p->submit);
+    pthread_mutex_destroy(&p->lock);
+    pthread_cond_destroy(&p->wake);
+    pthread_cond_destroy(&p->done);
+    free(p->tid);
+    free(p);
+}
+
+int pool_size(const ThreadPool *p)
+{
+    return p ? p->n : 1;
+}
+
+void pool_parallel_for(ThreadPool *p, int num_threads, size_t n, size_t chunk,
+                       PoolTask task, void *ctx)
+{
+    if (n == 0 || !task) return;
+    if (chunk == 0) chunk = 1;
+
+    int used = (p && num_threads > 0 && num_threads < p->n) ? num_threads : pool_size(p);
+    if ((size_t)used > (n + chunk - 1) / chunk) used = (int)((n + chunk - 1) / chunk);
+
+    // Un solo thread utile: niente dispatch
+    if (!p || used <= 1) {
+        task(ctx, 0, n, 0);
+        return;
+    }
+
+    pthread_mutex_lock(&p->submit);
+
+    p->task    = task;
+    p->ctx     = ctx;
+    p->n_items = n;
+    p->chunk   = chunk;
+    p->used    = used;
+    atomic_store_explicit(&p->next, 0, memory_order_relaxed);
+    atomic_store_explicit(&p->pending, p->n - 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&p->gen, 1, memory_order_release);
+
+    pthread_mutex_lock(&p->lock);
+    if (p->sleepers) pthread_cond_broadcast(&p->wake);
+    pthread_mutex_unlock(&p->lock);
+
+    run_chunks(p, 0);
+
+    // Attesa dei worker: prima attiva (se POOL_SPIN), poi su done
+    long deadline = now_ns() + (p->wait == POOL_SPIN ? p->spin_ns : 0);
+    for (int i = 1; atomic_load_explicit(&p->pending, memory_order_acquire) > 0; i++) {
+        cpu_relax();
+        if ((i & 255) == 0 && now_ns() > deadline) {
+            pthread_mutex_lock(&p->lock);
+            p->waiting = 1;
+            while (atomic_load(&p->pending) > 0)
+                pthread_cond_wait(&p->done, &p->lock);
+            p->waiting = 0;
+            pthread_mutex_unlock(&p->lock);
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&p->submit);
+}
+
+// ------------------ POOL CONDIVISO ----------------------
+
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static ThreadPool     *g_pool = NULL;
+
+ThreadPool *pool_default(void)
+{
+    pthread_mutex_lock(&g_lock);
+    if (!g_pool) g_pool = pool_create(0, POOL_SPIN, 0);
+    ThreadPool *p = g_pool;
+    pthread_mutex_unlock(&g_lock);
+    return p;
+}
+
+int pool_configure(int threads, PoolWait wait, int spin_us)
+{
+    ThreadPool *p = pool_create(threads, wait, spin_us);
+    if (!p) return -1;
+
+    pthread_mutex_lock(&g_lock);
+    ThreadPool *old = g_pool;
+    g_pool = p;
+    pthread_mutex_unlock(&g_lock);
+
+    pool_destroy(old);
+    return 0;
+}
+
+#else   // ---- Windows: nessun pool, regione OpenMP con num_threads ----
+
+struct ThreadPool {
+    int n;
+};
+
+static ThreadPool g_pool = { 0 };
+
+ThreadPool *pool_create(int threads, PoolWait wait, int spin_us)
+{
+    (void)wait; (void)spin_us;
+    ThreadPool *p = malloc(sizeof(ThreadPool));
+    if (p) p->n = threads;
+    return p;
+}
+
+void pool_destroy(ThreadPool *p) { free(p); }
+
+int pool_size(const ThreadPool *p)
+{
+    if (p && p->n > 0) return p->n;
+#ifdef _OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+void pool_parallel_for(ThreadPool *p, int num_threads, size_t n, size_t chunk,
+                       PoolTask task, void *ctx)
+{
+    if (n == 0 || !task) return;
+    if (chunk == 0) chunk = 1;
+
+    int used = (num_threads > 0 && num_threads < pool_size(p)) ? num_threads : pool_size(p);
+    long blocks = (long)((n + chunk - 1) / chunk);
+
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic) num_threads(used)
+#endif
+    for (long b = 0; b < blocks; b++) {
+        size_t s = (size_t)b * chunk;
+        size_t e = s + chunk < n ? s + chunk : n;
+#ifdef _OPENMP
+        task(ctx, s, e, omp_get_thread_num());
+#else
+        task(ctx, s, e, 0);
+#endif
+    }
+    (void)used;
+}
+
+ThreadPool *pool_default(void) { return &g_pool; }
+
+int pool_configure(int threads, PoolWait wait, int spin_us)
+{
+    (void)wait; (void)spin_us;
+    g_pool.n = threads;
+    return 0;
+}
+
+#endif
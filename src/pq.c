@@ -0,0 +1,527 @@
+#include "pq.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#if defined(USE_AVX)
+    #include <immintrin.h>
+#elif defined(__SSSE3__)
+    #include <tmmintrin.h>   // pshufb a 128 bit
+#endif
+
+// ------------------ ROTAZIONE (OPQ parametrica) ----------------------
+//
+// Autovettori della covarianza del campione (Jacobi ciclico), poi ogni
+// valore proprio, dal più grande, va al sottospazio non pieno con il
+// prodotto dei valori già assegnati più piccolo: la varianza è ripartita
+// in modo simile fra gli M sottospazi e la rotazione (ortonormale) non
+// cambia le distanze euclidee.
+//
+// ---------------------------------------------------------
+
+#define JACOBI_SWEEPS 30
+
+// A (D x D, simmetrica) diventa diagonale; V (D x D) riceve gli autovettori
+// per colonna
+static void jacobi_eigen(double *A, double *V, size_t D)
+{
+    for (size_t i = 0; i < D; i++)
+        for (size_t j = 0; j < D; j++)
+            V[i * D + j] = i == j ? 1.0 : 0.0;
+
+    for (int sweep = 0; sweep < JACOBI_SWEEPS; sweep++) {
+        double off = 0.0, diag = 0.0;
+        for (size_t i = 0; i < D; i++) {
+            diag += A[i * D + i] * A[i * D + i];
+            for (size_t j = i + 1; j < D; j++) off += A[i * D + j] * A[i * D + j];
+        }
+        if (off <= 1e-24 * diag) break;
+
+        for (size_t p = 0; p < D; p++) {
+            for (size_t q = p + 1; q < D; q++) {
+                double apq = A[p * D + q];
+                if (fabs(apq) < 1e-300) continue;
+
+                double theta = (A[q * D + q] - A[p * D + p]) / (2.0 * apq);
+                double t = (theta >= 0 ? 1.0 : -1.0) / (fabs(theta) + sqrt(theta * theta + 1.0));
+                double c = 1.0 / sqrt(t * t + 1.0), s = t * c;
+
+                for (size_t k = 0; k < D; k++) {
+                    double akp = A[k * D + p], akq = A[k * D + q];
+                    A[k * D + p] = c * akp - s * akq;
+                    A[k * D + q] = s * akp + c * akq;
+                }
+                for (size_t k = 0; k < D; k++) {
+                    double apk = A[p * D + k], aqk = A[q * D + k];
+                    A[p * D + k] = c * apk - s * aqk;
+                    A[q * D + k] = s * apk + c * aqk;
+                }
+                for (size_t k = 0; k < D; k++) {
+                    double vkp = V[k * D + p], vkq = V[k * D + q];
+                    V[k * D + p] = c * vkp - s * vkq;
+                    V[k * D + q] = s * vkp + c * vkq;
+                }
+            }
+        }
+    }
+}
+
+// Rotazione (M*dsub x D) dal campione train (m x D, double)
+static float *opq_rotation(const double *train, size_t m, size_t D, size_t M, size_t dsub)
+{
+    double *mean  = calloc(D, sizeof(double));
+    double *cov   = calloc(D * D, sizeof(double));
+    double *V     = malloc(D * D * sizeof(double));
+    size_t *order = malloc(D * sizeof(size_t));
+    size_t *fill  = calloc(M, sizeof(size_t));
+    double *logp  = calloc(M, sizeof(double));
+    float  *R     = calloc(M * dsub * D, sizeof(float));
+    if (!mean || !cov || !V || !order || !fill || !logp || !R) {
+        free(mean); free(cov); free(V); free(order); free(fill); free(logp); free(R);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < m; i++)
+        for (size_t j = 0; j < D; j++) mean[j] += train[i * D + j];
+    for (size_t j = 0; j < D; j++) mean[j] /= (double)m;
+
+    #pragma omp parallel for schedule(dynamic)
+    for (long a = 0; a < (long)D; a++) {
+        for (size_t b = (size_t)a; b < D; b++) {
+            double s = 0.0;
+            for (size_t i = 0; i < m; i++)
+                s += (train[i * D + a] - mean[a]) * (train[i * D + b] - mean[b]);
+            cov[a * D + b] = cov[b * D + a] = s / (double)m;
+        }
+    }
+
+    jacobi_eigen(cov, V, D);
+
+    // Autovalori in ordine decrescente (inserimento: D piccolo rispetto a n)
+    for (size_t j = 0; j < D; j++) {
+        size_t i = j;
+        while (i > 0 && cov[order[i - 1] * D + order[i - 1]] < cov[j * D + j]) {
+            order[i] = order[i - 1];
+            i--;
+        }
+        order[i] = j;
+    }
+
+    for (size_t e = 0; e < D; e++) {
+        size_t best = M;
+        for (size_t s = 0; s < M; s++)
+            if (fill[s] < dsub && (best == M || logp[s] < logp[best])) best = s;
+
+        double lambda = cov[order[e] * D + order[e]];
+        logp[best] += log(lambda > 1e-12 ? lambda : 1e-12);
+
+        float *row = &R[(best * dsub + fill[best]++) * D];
+        for (size_t j = 0; j < D; j++) row[j] = (float)V[j * D + order[e]];
+    }
+
+    free(mean); free(cov); free(V); free(order); free(fill); free(logp);
+    return R;
+}
+
+// ------------------ PROIEZIONE E CODIFICA ----------------------
+
+static void project(const PqIndex *pq, const float *qf, const double *qd, float *y)
+{
+    size_t D = pq->D, Dr = pq_rotated_dim(pq);
+
+    if (!pq->R) {
+        for (size_t j = 0; j < D; j++) y[j] = qf ? qf[j] : (float)qd[j];
+        for (size_t j = D; j < Dr; j++) y[j] = 0.0f;
+        return;
+    }
+
+    for (size_t r = 0; r < Dr; r++) {
+        const float *row = &pq->R[r * D];
+        double s = 0.0;
+        for (size_t j = 0; j < D; j++) s += (double)row[j] * (qf ? (double)qf[j] : qd[j]);
+        y[r] = (float)s;
+    }
+}
+
+void pq_project(const PqIndex *pq, const float *q, float *y)
+{
+    if (pq && q && y) project(pq, q, NULL, y);
+}
+
+void pq_project_f64(const PqIndex *pq, const double *q, float *y)
+{
+    if (pq && q && y) project(pq, NULL, q, y);
+}
+
+static float sub_dist(const float *a, const float *b, size_t d)
+{
+    float s = 0.0f;
+    for (size_t t = 0; t < d; t++) {
+        float u = a[t] - b[t];
+        s += u * u;
+    }
+    return s;
+}
+
+// Centroide più vicino al sottovettore y del sottospazio m
+static uint8_t nearest(const PqIndex *pq, size_t m, const float *y)
+{
+    const float *cent = &pq->centroids[m * pq->ks * pq->dsub];
+    size_t best = 0;
+    float bd = FLT_MAX;
+    for (size_t c = 0; c < pq->ks; c++) {
+        float d = sub_dist(&cent[c * pq->dsub], y, pq->dsub);
+        if (d < bd) {
+            bd = d;
+            best = c;
+        }
+    }
+    return (uint8_t)best;
+}
+
+// Sottospazi con codici nel layout fast-scan: M arrotondato a pari
+static size_t fs_subspaces(const PqIndex *pq)
+{
+    return ((size_t)pq->M + 1) & ~(size_t)1;
+}
+
+static size_t codes_bytes(const PqIndex *pq)
+{
+    if (pq->nbits == 8) return pq->n * (size_t)pq->M;
+    size_t blocks = (pq->n + PQ_BLOCK - 1) / PQ_BLOCK;
+    return blocks * fs_subspaces(pq) * (PQ_BLOCK / 2);
+}
+
+static void encode_row(PqIndex *pq, size_t i, const float *y)
+{
+    for (size_t m = 0; m < (size_t)pq->M; m++) {
+        uint8_t c = nearest(pq, m, &y[m * pq->dsub]);
+        if (pq->nbits == 8) {
+            pq->codes[i * (size_t)pq->M + m] = c;
+            continue;
+        }
+        // Righe t e t + 16 del blocco nello stesso byte
+        size_t t = i % PQ_BLOCK;
+        uint8_t *blk = &pq->codes[(i / PQ_BLOCK) * fs_subspaces(pq) * (PQ_BLOCK / 2)];
+        blk[m * (PQ_BLOCK / 2) + (t & 15)] |= (uint8_t)(t < 16 ? c : c << 4);
+    }
+}
+
+// ------------------ ADDESTRAMENTO ----------------------
+
+// k-means (Lloyd) di ogni sottospazio sulle m righe ruotate Y (m x Dr).
+// Ritorna 0, -1 se un buffer di lavoro non è allocato (centroidi incompleti).
+static int train_subspaces(PqIndex *pq, const float *Y, size_t m)
+{
+    size_t ks = pq->ks, ds = pq->dsub, Dr = pq_rotated_dim(pq);
+    int failed = 0;
+
+    #pragma omp parallel for schedule(dynamic) reduction(|:failed)
+    for (long s = 0; s < (long)pq->M; s++) {
+        float  *cent = &pq->centroids[(size_t)s * ks * ds];
+        double *sum  = malloc(ks * ds * sizeof(double));
+        size_t *cnt  = malloc(ks * sizeof(size_t));
+        if (!sum || !cnt) {
+            free(sum); free(cnt);
+            failed = 1;
+            continue;
+        }
+
+        // Centroidi iniziali a passo m/ks nel campione
+        for (size_t c = 0; c < ks; c++)
+            memcpy(&cent[c * ds], &Y[(c * m / ks) * Dr + (size_t)s * ds], ds * sizeof(float));
+
+        for (int it = 0; it < PQ_ITERS; it++) {
+            memset(sum, 0, ks * ds * sizeof(double));
+            memset(cnt, 0, ks * sizeof(size_t));
+            for (size_t i = 0; i < m; i++) {
+                const float *y = &Y[i * Dr + (size_t)s * ds];
+                size_t c = nearest(pq, (size_t)s, y);
+                for (size_t t = 0; t < ds; t++) sum[c * ds + t] += y[t];
+                cnt[c]++;
+            }
+            // Centroide senza righe: resta dov'è
+            for (size_t c = 0; c < ks; c++) {
+                if (!cnt[c]) continue;
+                for (size_t t = 0; t < ds; t++)
+                    cent[c * ds + t] = (float)(sum[c * ds + t] / (double)cnt[c]);
+            }
+        }
+        free(sum);
+        free(cnt);
+    }
+    return failed ? -1 : 0;
+}
+
+static void row_to_double(const void *data, int f64, size_t D, size_t i, double *out)
+{
+    if (f64) {
+        memcpy(out, (const double *)data + i * D, D * sizeof(double));
+    } else {
+        const float *r = (const float *)data + i * D;
+        for (size_t j = 0; j < D; j++) out[j] = (double)r[j];
+    }
+}
+
+static PqIndex *pq_build(const void *data, int f64, size_t n, size_t D, int M, int nbits, int opq)
+{
+    if (!data || n == 0 || D == 0 || M <= 0 || M > PQ_MAX_M || (size_t)M > D) return NULL;
+    if (nbits != 8 && nbits != 4) return NULL;
+
+    PqIndex *pq = calloc(1, sizeof(PqIndex));
+    if (!pq) return NULL;
+    pq->n     = n;
+    pq->D     = D;
+    pq->M     = M;
+    pq->nbits = nbits;
+    pq->ks    = (size_t)1 << nbits;
+    pq->dsub  = (D + (size_t)M - 1) / (size_t)M;
+
+    size_t Dr = pq_rotated_dim(pq);
+    size_t m  = pq->ks * PQ_TRAIN_PER_C < n ? pq->ks * PQ_TRAIN_PER_C : n;
+
+    double *train = malloc(m * D * sizeof(double));
+    float  *Y     = malloc(m * Dr * sizeof(float));
+    pq->centroids = malloc((size_t)M * pq->ks * pq->dsub * sizeof(float));
+    pq->codes     = calloc(codes_bytes(pq), 1);
+    if (!train || !Y || !pq->centroids || !pq->codes) {
+        free(train); free(Y);
+        free_pq_index(pq);
+        return NULL;
+    }
+
+    // Campione a passo n/m, poi (con OPQ) rotazione stimata sul campione
+    for (size_t i = 0; i < m; i++)
+        row_to_double(data, f64, D, i * n / m, &train[i * D]);
+
+    if (opq && !(pq->R = opq_rotation(train, m, D, (size_t)M, pq->dsub))) {
+        free(train); free(Y);
+        free_pq_index(pq);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < m; i++)
+        project(pq, NULL, &train[i * D], &Y[i * Dr]);
+    free(train);
+
+    int trained = train_subspaces(pq, Y, m);
+    free(Y);
+    if (trained != 0) {
+        free_pq_index(pq);
+        return NULL;
+    }
+
+    // Codifica di tutte le righe: un blocco fast-scan per iterazione, così
+    // ogni byte di codice è scritto da un solo thread
+    size_t blocks = (n + PQ_BLOCK - 1) / PQ_BLOCK;
+    int failed = 0;
+    #pragma omp parallel reduction(|:failed)
+    {
+        double *v = malloc(D * sizeof(double));
+        float  *y = malloc(Dr * sizeof(float));
+        if (!v || !y) failed = 1;
+        #pragma omp for schedule(static)
+        for (long b = 0; b < (long)blocks; b++) {
+            if (!v || !y) continue;
+            size_t end = ((size_t)b + 1) * PQ_BLOCK < n ? ((size_t)b + 1) * PQ_BLOCK : n;
+            for (size_t i = (size_t)b * PQ_BLOCK; i < end; i++) {
+                row_to_double(data, f64, D, i, v);
+                project(pq, NULL, v, y);
+                encode_row(pq, i, y);
+            }
+        }
+        free(v);
+        free(y);
+    }
+    if (failed) {
+        free_pq_index(pq);
+        return NULL;
+    }
+    return pq;
+}
+
+PqIndex *build_pq_index(const MatrixF32 *ds, int M, int nbits, int opq)
+{
+    if (!ds) return NULL;
+    return pq_build(ds->data, 0, ds->n, ds->d, M, nbits, opq);
+}
+
+PqIndex *build_pq_index_f64(const MatrixF64 *ds, int M, int nbits, int opq)
+{
+    if (!ds) return NULL;
+    return pq_build(ds->data, 1, ds->n, ds->d, M, nbits, opq);
+}
+
+void free_pq_index(PqIndex *pq)
+{
+    if (!pq) return;
+    free(pq->R);
+    free(pq->centroids);
+    free(pq->codes);
+    free(pq);
+}
+
+size_t pq_memory_bytes(const PqIndex *pq)
+{
+    if (!pq) return 0;
+    return sizeof(PqIndex)
+         + codes_bytes(pq)
+         + (size_t)pq->M * pq->ks * pq->dsub * sizeof(float)
+         + (pq->R ? pq_rotated_dim(pq) * pq->D * sizeof(float) : 0);
+}
+
+// ------------------ TABELLE E SCANSIONE ----------------------
+
+void pq_tables(const PqIndex *pq, const float *y, float *T)
+{
+    if (!pq || !y || !T) return;
+
+    size_t ks = pq->ks, ds = pq->dsub;
+    for (size_t m = 0; m < (size_t)pq->M; m++) {
+        const float *cent = &pq->centroids[m * ks * ds];
+        for (size_t c = 0; c < ks; c++)
+            T[m * ks + c] = sub_dist(&cent[c * ds], &y[m * ds], ds);
+    }
+}
+
+// Inserimento ordinato fra i kk migliori (come ivf probe: kk piccolo)
+static void keep(uint32_t *ids, float *dist, size_t *size, size_t kk, uint32_t id, float d)
+{
+    if (*size == kk && d >= dist[kk - 1]) return;
+    size_t i = *size < kk ? (*size)++ : kk - 1;
+    while (i > 0 && d < dist[i - 1]) {
+        dist[i] = dist[i - 1];
+        ids[i] = ids[i - 1];
+        i--;
+    }
+    dist[i] = d;
+    ids[i] = id;
+}
+
+// 8 bit: M letture di tabella float per riga
+static size_t scan8(const PqIndex *pq, const float *T, size_t kk, uint32_t *ids, float *dist)
+{
+    size_t M = (size_t)pq->M, size = 0;
+
+    for (size_t i = 0; i < pq->n; i++) {
+        const uint8_t *c = &pq->codes[i * M];
+        float d0 = 0.0f, d1 = 0.0f;
+        size_t m = 0;
+        for (; m + 1 < M; m += 2) {
+            d0 += T[m * 256 + c[m]];
+            d1 += T[(m + 1) * 256 + c[m + 1]];
+        }
+        if (m < M) d0 += T[m * 256 + c[m]];
+        keep(ids, dist, &size, kk, (uint32_t)i, d0 + d1);
+    }
+    return size;
+}
+
+// Somme a 16 bit delle tabelle quantizzate qT (Mp x 16) per le 32 righe
+// del blocco blk
+static void block_sums(const uint8_t *blk, const uint8_t *qT, size_t Mp, uint16_t *acc)
+{
+#if defined(USE_AVX)
+    // Due sottospazi per registro: corsia bassa m, corsia alta m + 1
+    __m256i lo4 = _mm256_set1_epi8(0x0f), zero = _mm256_setzero_si256();
+    __m256i a0 = zero, a1 = zero, a2 = zero, a3 = zero;
+    for (size_t m = 0; m < Mp; m += 2) {
+        __m256i c   = _mm256_loadu_si256((const __m256i *)&blk[m * 16]);
+        __m256i lut = _mm256_loadu_si256((const __m256i *)&qT[m * 16]);
+        __m256i dl  = _mm256_shuffle_epi8(lut, _mm256_and_si256(c, lo4));
+        __m256i dh  = _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(c, 4), lo4));
+        a0 = _mm256_add_epi16(a0, _mm256_unpacklo_epi8(dl, zero));
+        a1 = _mm256_add_epi16(a1, _mm256_unpackhi_epi8(dl, zero));
+        a2 = _mm256_add_epi16(a2, _mm256_unpacklo_epi8(dh, zero));
+        a3 = _mm256_add_epi16(a3, _mm256_unpackhi_epi8(dh, zero));
+    }
+    _mm_storeu_si128((__m128i *)&acc[0],  _mm_add_epi16(_mm256_castsi256_si128(a0), _mm256_extracti128_si256(a0, 1)));
+    _mm_storeu_si128((__m128i *)&acc[8],  _mm_add_epi16(_mm256_castsi256_si128(a1), _mm256_extracti128_si256(a1, 1)));
+    _mm_storeu_si128((__m128i *)&acc[16], _mm_add_epi16(_mm256_castsi256_si128(a2), _mm256_extracti128_si256(a2, 1)));
+    _mm_storeu_si128((__m128i *)&acc[24], _mm_add_epi16(_mm256_castsi256_si128(a3), _mm256_extracti128_si256(a3, 1)));
+#elif defined(__SSSE3__)
+    __m128i lo4 = _mm_set1_epi8(0x0f), zero = _mm_setzero_si128();
+    __m128i a0 = zero, a1 = zero, a2 = zero, a3 = zero;
+    for (size_t m = 0; m < Mp; m++) {
+        __m128i c   = _mm_loadu_si128((const __m128i *)&blk[m * 16]);
+        __m128i lut = _mm_loadu_si128((const __m128i *)&qT[m * 16]);
+        __m128i dl  = _mm_shuffle_epi8(lut, _mm_and_si128(c, lo4));
+        __m128i dh  = _mm_shuffle_epi8(lut, _mm_and_si128(_mm_srli_epi16(c, 4), lo4));
+        a0 = _mm_add_epi16(a0, _mm_unpacklo_epi8(dl, zero));
+        a1 = _mm_add_epi16(a1, _mm_unpackhi_epi8(dl, zero));
+        a2 = _mm_add_epi16(a2, _mm_unpacklo_epi8(dh, zero));
+        a3 = _mm_add_epi16(a3, _mm_unpackhi_epi8(dh, zero));
+    }
+    _mm_storeu_si128((__m128i *)&acc[0],  a0);
+    _mm_storeu_si128((__m128i *)&acc[8],  a1);
+    _mm_storeu_si128((__m128i *)&acc[16], a2);
+    _mm_storeu_si128((__m128i *)&acc[24], a3);
+#else
+    memset(acc, 0, PQ_BLOCK * sizeof(uint16_t));
+    for (size_t m = 0; m < Mp; m++) {
+        const uint8_t *c = &blk[m * 16], *lut = &qT[m * 16];
+        for (size_t t = 0; t < 16; t++) {
+            acc[t]      += lut[c[t] & 15];
+            acc[t + 16] += lut[c[t] >> 4];
+        }
+    }
+#endif
+}
+
+// 4 bit: tabelle ridotte a uint8 con una scala comune (min per sottospazio
+// sottratto), distanza = bias + somma / scala
+static size_t scan4(const PqIndex *pq, const float *T, size_t kk, uint32_t *ids, float *dist)
+{
+    size_t M = (size_t)pq->M, Mp = fs_subspaces(pq), size = 0;
+
+    uint8_t qT[PQ_MAX_M * 16];
+    float bias = 0.0f, range = 0.0f;
+    for (size_t m = 0; m < M; m++) {
+        float lo = FLT_MAX, hi = 0.0f;
+        for (size_t c = 0; c < 16; c++) {
+            if (T[m * 16 + c] < lo) lo = T[m * 16 + c];
+            if (T[m * 16 + c] > hi) hi = T[m * 16 + c];
+        }
+        bias += lo;
+        if (hi - lo > range) range = hi - lo;
+    }
+    float scale = range > 0.0f ? 255.0f / range : 1.0f;
+
+    for (size_t m = 0; m < M; m++) {
+        float lo = FLT_MAX;
+        for (size_t c = 0; c < 16; c++)
+            if (T[m * 16 + c] < lo) lo = T[m * 16 + c];
+        for (size_t c = 0; c < 16; c++) {
+            float v = (T[m * 16 + c] - lo) * scale + 0.5f;
+            qT[m * 16 + c] = (uint8_t)(v < 255.0f ? v : 255.0f);
+        }
+    }
+    if (Mp > M) memset(&qT[M * 16], 0, 16);   // sottospazio di riempimento: codice 0
+
+    size_t blocks = (pq->n + PQ_BLOCK - 1) / PQ_BLOCK;
+    uint16_t acc[PQ_BLOCK];
+    for (size_t b = 0; b < blocks; b++) {
+        block_sums(&pq->codes[b * Mp * (PQ_BLOCK / 2)], qT, Mp, acc);
+
+        size_t rows = pq->n - b * PQ_BLOCK < PQ_BLOCK ? pq->n - b * PQ_BLOCK : PQ_BLOCK;
+        for (size_t t = 0; t < rows; t++) {
+            float d = bias + (float)acc[t] / scale;
+            if (size == kk && d >= dist[kk - 1]) continue;
+            keep(ids, dist, &size, kk, (uint32_t)(b * PQ_BLOCK + t), d);
+        }
+    }
+    return size;
+}
+
+size_t pq_scan(const PqIndex *pq, const float *T, size_t kk, uint32_t *ids, float *dist)
+{
+    if (!pq || !T || !ids || !dist || kk == 0) return 0;
+    if (kk > pq->n) kk = pq->n;
+    return pq->nbits == 8 ? scan8(pq, T, kk, ids, dist) : scan4(pq, T, kk, ids, dist);
+}
@@ -31,9 +31,21 @@ static int cmp_abs_desc_f64(const void *a, const void *b)
     return 0;
 }
 
+// Livello della j-esima componente per modulo decrescente fra le x scelte
+static uint8_t quant_level(int j, int x, int bits)
+{
+    int L = (1 << bits) - 1;
+    return (uint8_t)(L - (int)((long long)j * L / x));
+}
+
 // ====================== FLOAT32 ======================
 
 void quantize_vector(const float *v, uint8_t *vp, uint8_t *vn, size_t D, int x)
+{
+    quantize_vector_graded(v, vp, vn, D, x, 1);
+}
+
+void quantize_vector_graded(const float *v, uint8_t *vp, uint8_t *vn, size_t D, int x, int bits)
 {
     memset(vp, 0, D * sizeof(uint8_t));
     memset(vn, 0, D * sizeof(uint8_t));
@@ -53,10 +65,11 @@ void quantize_vector(const float *v, uint8_t *vp, uint8_t *vn, size_t D, int x)
 
     for (int j = 0; j < x; j++) {
         size_t idx = absvals[j].index;
+        uint8_t level = quant_level(j, x, bits);
         if (v[idx] >= 0.0f)
-            vp[idx] = 1;
+            vp[idx] = level;
         else
-            vn[idx] = 1;
+            vn[idx] = level;
     }
 
     free(absvals);
@@ -65,6 +78,11 @@ void quantize_vector(const float *v, uint8_t *vp, uint8_t *vn, size_t D, int x)
 // ====================== FLOAT64 (Double) ======================
 
 void quantize_vector_f64(const double *v, uint8_t *vp, uint8_t *vn, size_t D, int x)
+{
+    quantize_vector_graded_f64(v, vp, vn, D, x, 1);
+}
+
+void quantize_vector_graded_f64(const double *v, uint8_t *vp, uint8_t *vn, size_t D, int x, int bits)
 {
     memset(vp, 0, D * sizeof(uint8_t));
     memset(vn, 0, D * sizeof(uint8_t));
@@ -84,10 +102,11 @@ void quantize_vector_f64(const double *v, uint8_t *vp, uint8_t *vn, size_t D, in
 
     for (int j = 0; j < x; j++) {
         size_t idx = absvals[j].index;
+        uint8_t level = quant_level(j, x, bits);
         if (v[idx] >= 0.0)
-            vp[idx] = 1;
+            vp[idx] = level;
         else
-            vn[idx] = 1;
+            vn[idx] = level;
     }
 
     free(absvals);
@@ -29,13 +29,23 @@ static void mm_free_destructor(PyObject* capsule) {
     }
 }
 
+// Ferma il motore di submit senza il GIL: le richieste ancora in coda
+// completano i propri Future, che lo richiedono dal thread del motore
+static void QuantPivot32_close_async(QuantPivot32Object *self) {
+	if (self->input->async == NULL)
+		return;
+	Py_BEGIN_ALLOW_THREADS
+	submit_close(self->input);
+	Py_END_ALLOW_THREADS
+}
+
 // Deallocazione (pulizia memoria quando l'oggetto viene distrutto)
 static void QuantPivot32_dealloc(QuantPivot32Object *self) {
 	// Libera memoria allocata
 	if (self->input->P != NULL)
 		_mm_free(self->input->P);
-	if (self->input->index != NULL)
-		free_index((Index*)self->input->index);
+	QuantPivot32_close_async(self);
+	release(self->input);
 	// Decrementa riferimenti agli array NumPy
 	Py_XDECREF(self->DS_array);
 	Py_XDECREF(self->Q_array);
@@ -64,33 +74,40 @@ static int QuantPivot32_init(QuantPivot32Object *self, PyObject *args, PyObject
 	self->input->id_nn = NULL;		// identificativi dei vicini
 	self->input->dist_nn = NULL;	// distanze dai vicini
 	self->input->silent = 0;		// modalità silenziosa
+	self->input->r = 1;				// re-rank (1 = disattivato)
+	self->input->S = 1;				// shard (1 = indice unico)
+	self->input->num_threads = 0;	// thread del pool (0 = tutti)
+	self->input->cols = 0;			// colonne ordinate (0 = scansione completa)
+	self->input->cascade = 0;		// pivot caldi della cascata (0 = nessuna)
+	self->input->alpha = 0.0f;		// pruning esatto
+	self->input->max_evals = 0;		// nessun budget di distanze
+	self->input->deadline_ms = 0.0;	// nessuna scadenza
+	self->input->partial = NULL;	// flag delle query parziali (non richiesti)
+	self->input->C = 0;				// liste IVF (0 = nessuna)
+	self->input->nprobe = 8;		// liste sondate per query (IVF)
+	self->input->graph = NULL;		// grafo HNSW (assente)
+	self->input->M = 0;				// archi per nodo (0 = nessun grafo)
+	self->input->ef_c = HNSW_DEFAULT_EF_C;	// fascio in costruzione
+	self->input->ef = HNSW_DEFAULT_EF;	// fascio in ricerca
+	self->input->pq_m = 0;			// sotto-quantizzatori PQ (0 = nessuno)
+	self->input->pq_bits = 8;		// bit per codice PQ
+	self->input->opq = 0;			// rotazione OPQ (disattivata)
+	self->input->async = NULL;		// motore di submit (creato al primo uso)
     return 0;
 }
 
-// Metodo fit
-static PyObject* QuantPivot32_fit(QuantPivot32Object *self, PyObject *args, PyObject *kwargs) {
-	PyArrayObject *ds_array;
-
-	int h, x, silent = 1;
-
-	static char *kwlist[] = {"dataset", "n_pivots", "quant_level", "silent", NULL};
-
-	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O!ii|i", kwlist,
-									&PyArray_Type, &ds_array,
-									&h, &x, &silent)) {
-		return NULL;
-	}
-
+// Valida il dataset e lo registra in input (DS, N, D) con riferimento all'array
+static int QuantPivot32_set_dataset(QuantPivot32Object *self, PyArrayObject *ds_array) {
 	// Verifica che sia un array NumPy valido
 	if (PyArray_NDIM(ds_array) != 2) {
 		PyErr_SetString(PyExc_ValueError, "Data must be a 2D array");
-		return NULL;
+		return -1;
 	}
 
 	// Verifica che sia float32
 	if (PyArray_TYPE(ds_array) != NPY_FLOAT32) {
 		PyErr_SetString(PyExc_TypeError, "Data must be float32");
-		return NULL;
+		return -1;
 	}
 
 	// Verifica che siano array contigui
@@ -101,13 +118,93 @@ static PyObject* QuantPivot32_fit(QuantPivot32Object *self, PyObject *args, PyOb
 	if(!PyArray_IS_C_CONTIGUOUS(ds_array)){
 		PyErr_SetString(PyExc_ValueError,
 			"Input array (DS) must be C-contiguous (use numpy.ascontiguousarray)");
-		return NULL;
+		return -1;
 	}
 
 	// Estrai dimensioni
 	self->input->N = (int)PyArray_DIM(ds_array, 0);
 	self->input->D = (int)PyArray_DIM(ds_array, 1);
 
+	// Salva riferimento all'array con INCREF
+	Py_INCREF(ds_array);
+	Py_XDECREF(self->DS_array);
+	self->DS_array = ds_array;
+
+	self->input->DS = dataset;
+	return 0;
+}
+
+// Metodo fit
+static PyObject* QuantPivot32_fit(QuantPivot32Object *self, PyObject *args, PyObject *kwargs) {
+	PyArrayObject *ds_array;
+
+	int h, x, silent = 1, rerank = 1, shards = 1, num_threads = 0, sorted_pivots = 0;
+	int ivf_lists = 0, nprobe = 8;
+	int hnsw_m = 0, ef_construction = HNSW_DEFAULT_EF_C, ef_search = HNSW_DEFAULT_EF;
+	int pq_m = 0, pq_bits = 8, opq = 0, pivot_cascade = 0;
+
+	static char *kwlist[] = {"dataset", "n_pivots", "quant_level", "silent", "rerank", "shards",
+							 "num_threads", "sorted_pivots", "ivf_lists", "nprobe",
+							 "hnsw_m", "ef_construction", "ef_search", "pq_m", "pq_bits", "opq", "pivot_cascade", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O!ii|iiiiiiiiiiiiii", kwlist,
+									&PyArray_Type, &ds_array,
+									&h, &x, &silent, &rerank, &shards, &num_threads,
+									&sorted_pivots, &ivf_lists, &nprobe,
+									&hnsw_m, &ef_construction, &ef_search,
+									&pq_m, &pq_bits, &opq, &pivot_cascade)) {
+		return NULL;
+	}
+
+	if (hnsw_m < 0 || hnsw_m == 1 || ef_construction < 1 || ef_search < 1) {
+		PyErr_SetString(PyExc_ValueError, "hnsw_m must be 0 or >= 2, ef_construction and ef_search >= 1");
+		return NULL;
+	}
+
+	if (hnsw_m > 0 && (shards > 1 || ivf_lists > 0)) {
+		PyErr_SetString(PyExc_ValueError, "hnsw_m cannot be combined with shards or ivf_lists");
+		return NULL;
+	}
+
+	if (ivf_lists < 0 || nprobe < 1) {
+		PyErr_SetString(PyExc_ValueError, "ivf_lists must be >= 0 and nprobe >= 1");
+		return NULL;
+	}
+
+	if (ivf_lists > 0 && (shards > 1 || sorted_pivots > 0 || pivot_cascade > 0)) {
+		PyErr_SetString(PyExc_ValueError, "ivf_lists cannot be combined with shards, sorted_pivots or pivot_cascade");
+		return NULL;
+	}
+
+	if (pq_m < 0 || pq_m > PQ_MAX_M || (pq_bits != 8 && pq_bits != 4)) {
+		PyErr_SetString(PyExc_ValueError, "pq_m must be in 0..256 and pq_bits 8 or 4");
+		return NULL;
+	}
+
+	if (pq_m > 0 && (shards > 1 || ivf_lists > 0 || hnsw_m > 0 || sorted_pivots > 0 || pivot_cascade > 0)) {
+		PyErr_SetString(PyExc_ValueError, "pq_m cannot be combined with shards, ivf_lists, hnsw_m, sorted_pivots or pivot_cascade");
+		return NULL;
+	}
+
+	// Dimensione letta solo per array 2D (il resto è validato da set_dataset)
+	if (PyArray_NDIM(ds_array) == 2 && pq_m > (int)PyArray_DIM(ds_array, 1)) {
+		PyErr_SetString(PyExc_ValueError, "pq_m must not exceed the dataset dimension");
+		return NULL;
+	}
+
+	if (sorted_pivots < 0 || sorted_pivots > INDEX_MAX_SORTED || sorted_pivots > h) {
+		PyErr_SetString(PyExc_ValueError, "sorted_pivots must be 0, 1 or 2 (and <= n_pivots)");
+		return NULL;
+	}
+
+	if (pivot_cascade < 0 || pivot_cascade > INDEX_MAX_HOT || pivot_cascade > h) {
+		PyErr_SetString(PyExc_ValueError, "pivot_cascade must be in 0..16 (and <= n_pivots)");
+		return NULL;
+	}
+
+	if (QuantPivot32_set_dataset(self, ds_array) != 0)
+		return NULL;
+
 	// Estrae il numero di pivot
 	self->input->h = h;
 
@@ -117,12 +214,38 @@ static PyObject* QuantPivot32_fit(QuantPivot32Object *self, PyObject *args, PyOb
 	// Estrae il flag silent
 	self->input->silent = silent;
 
-	// Salva riferimento all'array con INCREF
-	Py_INCREF(ds_array);
-	Py_XDECREF(self->DS_array);
-	self->DS_array = ds_array;
+	// Fattore di re-rank (k*r candidati approssimati)
+	self->input->r = rerank > 1 ? rerank : 1;
 
-	self->input->DS = dataset;
+	// L'eventuale indice precedente appartiene al vecchio dataset
+	QuantPivot32_close_async(self);
+	release(self->input);
+
+	// Numero di shard (1 = indice unico)
+	self->input->S = shards > 1 ? shards : 1;
+
+	// Thread del pool usati da predict (0 = tutti)
+	self->input->num_threads = num_threads > 0 ? num_threads : 0;
+
+	// Colonne ordinate per pivot (0 = scansione completa)
+	self->input->cols = sorted_pivots;
+
+	// Pivot caldi della cascata di d* (0 = d* su tutti i pivot)
+	self->input->cascade = pivot_cascade;
+
+	// Indice IVF: liste k-means e liste sondate per query (0 = indice a pivot)
+	self->input->C = ivf_lists;
+	self->input->nprobe = nprobe;
+
+	// Grafo HNSW sull'indice (0 = nessun grafo)
+	self->input->M = hnsw_m;
+	self->input->ef_c = ef_construction;
+	self->input->ef = ef_search;
+
+	// Quantizzazione prodotto al posto dell'indice a pivot (0 = nessuna)
+	self->input->pq_m = pq_m;
+	self->input->pq_bits = pq_bits;
+	self->input->opq = opq ? 1 : 0;
 
 	// ========================================= //
 	fit(self->input);
@@ -133,55 +256,39 @@ static PyObject* QuantPivot32_fit(QuantPivot32Object *self, PyObject *args, PyOb
 	return (PyObject *)self;
 }
 
-// Metodo predict
-static PyObject* QuantPivot32_predict(QuantPivot32Object *self, PyObject *args, PyObject *kwargs) {
-	PyArrayObject* query_array;
-	int k, silent = 0;
-
-	static char* kwlist[] = {"query", "k", "silent", NULL};
-
-	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O!i|i", kwlist,
-									&PyArray_Type, &query_array,
-									&k, &silent))
-		return NULL;
-
-	// Verifica che fit sia stato chiamato
-	if (self->input->index == NULL) {
-		PyErr_SetString(PyExc_RuntimeError,
-					"Model not fitted, call fit() before predict()");
-		return NULL;
-	}
-
+// Valida un array di query (2D, float32, contiguo, stessa D del dataset)
+static int QuantPivot32_check_query(QuantPivot32Object *self, PyArrayObject *query_array) {
 	// Verifica che Q sia un array NumPy valido
 	if (PyArray_NDIM(query_array) != 2) {
 		PyErr_SetString(PyExc_ValueError, "Data must be a 2D array");
-		return NULL;
+		return -1;
 	}
 
 	// Verifica che sia float32
 	if (PyArray_TYPE(query_array) != NPY_FLOAT32) {
 		PyErr_SetString(PyExc_TypeError, "Data must be float32");
-		return NULL;
+		return -1;
 	}
 
-	// Verifica che siano array contigui
-	type* query = (type*)(PyArrayObject*)PyArray_DATA(query_array);
-
 	// Load non allineate: nessun vincolo di allineamento, solo contiguità C.
 	if(!PyArray_IS_C_CONTIGUOUS(query_array)){
 		PyErr_SetString(PyExc_ValueError,
 			"Query array (Q) must be C-contiguous (use numpy.ascontiguousarray)");
-		return NULL;
+		return -1;
 	}
 
-	// Estrai dimensioni
-	self->input->nq = (int)PyArray_DIM(query_array, 0);
+	// Le query devono avere la stessa dimensione del dataset
+	if ((int)PyArray_DIM(query_array, 1) != self->input->D) {
+		PyErr_SetString(PyExc_ValueError, "Query dimension differs from dataset dimension");
+		return -1;
+	}
+	return 0;
+}
 
-	// Salva il puntatore alla query e mantiene un riferimento all'array
-	self->input->Q = query;
-	Py_INCREF(query_array);
-	Py_XDECREF(self->Q_array);
-	self->Q_array = query_array;
+// Registra nq, k, silent e alloca id_nn/dist_nn (nq x k)
+static int QuantPivot32_alloc_results(QuantPivot32Object *self, int nq, int k, int silent) {
+	// Estrai dimensioni
+	self->input->nq = nq;
 
 	// Estrae il numero di K vicini
 	self->input->k = k;
@@ -192,10 +299,38 @@ static PyObject* QuantPivot32_predict(QuantPivot32Object *self, PyObject *args,
 	self->input->id_nn = (int*) _mm_malloc(self->input->nq * self->input->k * sizeof(int), align);
 	self->input->dist_nn = (type*) _mm_malloc(self->input->nq * self->input->k * sizeof(type), align);
 
-	// ========================================= //
-	predict(self->input);
-	// ========================================= //
+	if (self->input->id_nn == NULL || self->input->dist_nn == NULL) {
+		if (self->input->id_nn) _mm_free(self->input->id_nn);
+		if (self->input->dist_nn) _mm_free(self->input->dist_nn);
+		PyErr_NoMemory();
+		return -1;
+	}
+	return 0;
+}
+
+// Valida l'array delle query e lo registra in input (Q, nq, k, silent)
+static int QuantPivot32_set_query(QuantPivot32Object *self, PyArrayObject *query_array, int k, int silent) {
+	if (QuantPivot32_check_query(self, query_array) != 0)
+		return -1;
+
+	type* query = (type*)(PyArrayObject*)PyArray_DATA(query_array);
+
+	if (k <= 0) {
+		PyErr_SetString(PyExc_ValueError, "k must be positive");
+		return -1;
+	}
 
+	// Salva il puntatore alla query e mantiene un riferimento all'array
+	self->input->Q = query;
+	Py_INCREF(query_array);
+	Py_XDECREF(self->Q_array);
+	self->Q_array = query_array;
+
+	return QuantPivot32_alloc_results(self, (int)PyArray_DIM(query_array, 0), k, silent);
+}
+
+// Impacchetta id_nn/dist_nn in una tupla (ids, distances) di array NumPy
+static PyObject* QuantPivot32_results(QuantPivot32Object *self) {
 	npy_intp dims[2] = {self->input->nq, self->input->k};
 
 
@@ -236,6 +371,582 @@ static PyObject* QuantPivot32_predict(QuantPivot32Object *self, PyObject *args,
     return result;
 }
 
+// Metodo predict
+static PyObject* QuantPivot32_predict(QuantPivot32Object *self, PyObject *args, PyObject *kwargs) {
+	PyArrayObject* query_array;
+	int k, silent = 0, num_threads = -1, ef = -1, return_partial = 0;
+	float alpha = 0.0f;
+	Py_ssize_t max_evals = 0;
+	double deadline_ms = 0.0;
+
+	static char* kwlist[] = {"query", "k", "silent", "num_threads", "ef",
+							 "alpha", "max_evals", "deadline_ms", "return_partial", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O!i|iiifndp", kwlist,
+									&PyArray_Type, &query_array,
+									&k, &silent, &num_threads, &ef,
+									&alpha, &max_evals, &deadline_ms, &return_partial))
+		return NULL;
+
+	// Verifica che fit sia stato chiamato
+	if (self->input->index == NULL) {
+		PyErr_SetString(PyExc_RuntimeError,
+					"Model not fitted, call fit() before predict()");
+		return NULL;
+	}
+
+	// Ricerca anytime: budget e pruning rilassato solo sull'indice a pivot
+	if (alpha < 0.0f || max_evals < 0 || deadline_ms < 0.0) {
+		PyErr_SetString(PyExc_ValueError, "alpha, max_evals and deadline_ms must be >= 0");
+		return NULL;
+	}
+	if ((alpha > 0.0f || max_evals > 0 || deadline_ms > 0.0 || return_partial) &&
+		(self->input->graph || self->input->C > 0 || self->input->pq_m > 0 || self->input->S > 1)) {
+		PyErr_SetString(PyExc_ValueError,
+					"alpha, max_evals, deadline_ms and return_partial are not available with shards, ivf_lists, hnsw_m or pq_m");
+		return NULL;
+	}
+
+	if (QuantPivot32_set_query(self, query_array, k, silent) != 0)
+		return NULL;
+
+	// Un flag per query: 1 se il budget si è esaurito prima della fine della scansione
+	PyArrayObject *partial = NULL;
+	if (return_partial) {
+		npy_intp nq = self->input->nq;
+		partial = (PyArrayObject*)PyArray_ZEROS(1, &nq, NPY_BOOL, 0);
+		if (partial == NULL) {
+			_mm_free(self->input->id_nn);
+			_mm_free(self->input->dist_nn);
+			return NULL;
+		}
+		self->input->partial = (uint8_t*)PyArray_DATA(partial);
+	}
+
+	// num_threads ed ef per questa chiamata (-1 = valore scelto in fit)
+	int saved = self->input->num_threads, saved_ef = self->input->ef;
+	if (num_threads >= 0) self->input->num_threads = num_threads;
+	if (ef >= 1) self->input->ef = ef;
+	self->input->alpha = alpha;
+	self->input->max_evals = (size_t)max_evals;
+	self->input->deadline_ms = deadline_ms;
+
+	// ========================================= //
+	predict(self->input);
+	// ========================================= //
+
+	self->input->num_threads = saved;
+	self->input->ef = saved_ef;
+	self->input->alpha = 0.0f;
+	self->input->max_evals = 0;
+	self->input->deadline_ms = 0.0;
+	self->input->partial = NULL;
+
+	PyObject *result = QuantPivot32_results(self);
+	if (partial == NULL || result == NULL) {
+		Py_XDECREF(partial);
+		return result;
+	}
+
+	// (ids, distances, partial)
+	PyObject *triple = PyTuple_Pack(3, PyTuple_GET_ITEM(result, 0), PyTuple_GET_ITEM(result, 1), (PyObject*)partial);
+	Py_DECREF(result);
+	Py_DECREF(partial);
+	return triple;
+}
+
+// Metodo predict_filtered: K-NN solo fra le righe ammesse da una maschera
+static PyObject* QuantPivot32_predict_filtered(QuantPivot32Object *self, PyObject *args, PyObject *kwargs) {
+	PyArrayObject* query_array;
+	PyObject *allow = Py_None, *deny = Py_None;
+	int k, silent = 0;
+
+	static char* kwlist[] = {"query", "k", "allow", "deny", "silent", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O!i|OOi", kwlist,
+									&PyArray_Type, &query_array,
+									&k, &allow, &deny, &silent))
+		return NULL;
+
+	// Verifica che fit sia stato chiamato
+	if (self->input->index == NULL) {
+		PyErr_SetString(PyExc_RuntimeError,
+					"Model not fitted, call fit() before predict_filtered()");
+		return NULL;
+	}
+
+	if (self->input->C > 0 || self->input->pq_m > 0) {
+		PyErr_SetString(PyExc_ValueError, "predict_filtered() is not available with ivf_lists > 0 or pq_m > 0");
+		return NULL;
+	}
+
+	if ((allow == Py_None) == (deny == Py_None)) {
+		PyErr_SetString(PyExc_ValueError, "Pass exactly one of allow and deny");
+		return NULL;
+	}
+
+	if (QuantPivot32_check_query(self, query_array) != 0)
+		return NULL;
+
+	// Maschera booleana (N,) condivisa o (nq, N) per query
+	PyArrayObject *mask = (PyArrayObject*)PyArray_FROM_OTF(allow != Py_None ? allow : deny,
+														  NPY_BOOL, NPY_ARRAY_IN_ARRAY);
+	if (mask == NULL)
+		return NULL;
+
+	npy_intp N = self->input->N, nq = PyArray_DIM(query_array, 0);
+	int nd = PyArray_NDIM(mask);
+	if (!((nd == 1 && PyArray_DIM(mask, 0) == N) ||
+		  (nd == 2 && PyArray_DIM(mask, 0) == nq && PyArray_DIM(mask, 1) == N))) {
+		Py_DECREF(mask);
+		PyErr_SetString(PyExc_ValueError, "Mask must have shape (N,) or (nq, N)");
+		return NULL;
+	}
+
+	// Bitmap di 64 righe per parola, una per filtro
+	size_t nf = nd == 1 ? 1 : (size_t)nq;
+	size_t words = ((size_t)N + 63) / 64;
+	uint64_t *bits = (uint64_t*)calloc((nf * words) != 0 ? nf * words : 1, sizeof(uint64_t));
+	RowFilter *filters = (RowFilter*)malloc(nf * sizeof(RowFilter));
+	if (bits == NULL || filters == NULL) {
+		free(bits);
+		free(filters);
+		Py_DECREF(mask);
+		return PyErr_NoMemory();
+	}
+
+	const npy_bool *m = (const npy_bool*)PyArray_DATA(mask);
+	for (size_t f = 0; f < nf; f++) {
+		uint64_t *w = &bits[f * words];
+		for (npy_intp i = 0; i < N; i++)
+			if (m[f * (size_t)N + (size_t)i])
+				w[i >> 6] |= (uint64_t)1 << (i & 63);
+		filters[f].bits = w;
+		filters[f].base = 0;
+		filters[f].deny = deny != Py_None;
+	}
+	Py_DECREF(mask);
+
+	if (QuantPivot32_set_query(self, query_array, k, silent) != 0) {
+		free(bits);
+		free(filters);
+		return NULL;
+	}
+
+	// ========================================= //
+	predict_filtered(self->input, filters, nf);
+	// ========================================= //
+
+	free(bits);
+	free(filters);
+
+	return QuantPivot32_results(self);
+}
+
+// Classe concurrent.futures.Future, importata al primo submit
+static PyObject *future_class = NULL;
+
+// Completamento di submit: chiamata dal thread del motore (o dal chiamante
+// con indice partizionato), risolve il Future passato come user
+static void QuantPivot32_submit_done(void *user, const int *ids, const type *dist, int nq, int k) {
+	PyObject *future = (PyObject *)user;
+	PyGILState_STATE gil = PyGILState_Ensure();
+
+	// Future annullato mentre era in coda: nessun risultato
+	PyObject *run = PyObject_CallMethod(future, "set_running_or_notify_cancel", NULL);
+	if (run != NULL && PyObject_IsTrue(run)) {
+		PyObject *ret;
+		if (ids == NULL) {
+			PyObject *exc = PyObject_CallFunction(PyExc_MemoryError, "s", "submit: out of memory");
+			ret = exc ? PyObject_CallMethod(future, "set_exception", "(N)", exc) : NULL;
+		} else {
+			npy_intp dims[2] = {nq, k};
+			PyObject *id_nn_array   = PyArray_SimpleNew(2, dims, NPY_INT32);
+			PyObject *dist_nn_array = PyArray_SimpleNew(2, dims, NPY_FLOAT32);
+			if (id_nn_array && dist_nn_array) {
+				memcpy(PyArray_DATA((PyArrayObject*)id_nn_array), ids, (size_t)nq * k * sizeof(int));
+				memcpy(PyArray_DATA((PyArrayObject*)dist_nn_array), dist, (size_t)nq * k * sizeof(type));
+				// Stessa tupla (ids, distances) di predict
+				ret = PyObject_CallMethod(future, "set_result", "((NN))", id_nn_array, dist_nn_array);
+			} else {
+				Py_XDECREF(id_nn_array);
+				Py_XDECREF(dist_nn_array);
+				ret = NULL;
+			}
+		}
+		Py_XDECREF(ret);
+	}
+	Py_XDECREF(run);
+
+	if (PyErr_Occurred())
+		PyErr_WriteUnraisable(future);
+
+	// Riferimento preso da submit
+	Py_DECREF(future);
+	PyGILState_Release(gil);
+}
+
+// Metodo submit: accoda le query e restituisce subito un Future
+static PyObject* QuantPivot32_submit(QuantPivot32Object *self, PyObject *args, PyObject *kwargs) {
+	PyArrayObject* query_array;
+	int k;
+
+	static char* kwlist[] = {"query", "k", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O!i", kwlist,
+									&PyArray_Type, &query_array, &k))
+		return NULL;
+
+	// Verifica che fit sia stato chiamato
+	if (self->input->index == NULL) {
+		PyErr_SetString(PyExc_RuntimeError,
+					"Model not fitted, call fit() before submit()");
+		return NULL;
+	}
+
+	if (QuantPivot32_check_query(self, query_array) != 0)
+		return NULL;
+
+	int nq = (int)PyArray_DIM(query_array, 0);
+	if (k <= 0 || nq <= 0) {
+		PyErr_SetString(PyExc_ValueError, "k and the number of queries must be positive");
+		return NULL;
+	}
+
+	if (future_class == NULL) {
+		PyObject *mod = PyImport_ImportModule("concurrent.futures");
+		if (mod == NULL)
+			return NULL;
+		future_class = PyObject_GetAttrString(mod, "Future");
+		Py_DECREF(mod);
+		if (future_class == NULL)
+			return NULL;
+	}
+
+	// Il motore nasce con il GIL, così due thread non lo creano entrambi
+	if (submit_open(self->input, NULL) != 0) {
+		PyErr_SetString(PyExc_RuntimeError, "Unable to start the async engine");
+		return NULL;
+	}
+
+	PyObject *future = PyObject_CallObject(future_class, NULL);
+	if (future == NULL)
+		return NULL;
+
+	// Riferimento del motore, rilasciato da QuantPivot32_submit_done
+	Py_INCREF(future);
+
+	// Le query sono copiate; senza GIL perché a coda piena submit attende
+	int ret;
+	Py_BEGIN_ALLOW_THREADS
+	ret = submit_query(self->input, (const type*)PyArray_DATA(query_array), nq, k,
+					   QuantPivot32_submit_done, future);
+	Py_END_ALLOW_THREADS
+
+	if (ret != 0) {
+		Py_DECREF(future);
+		Py_DECREF(future);
+		PyErr_SetString(PyExc_RuntimeError, "submit failed (out of memory)");
+		return NULL;
+	}
+	return future;
+}
+
+// Tupla (offsets, ids, distances) di array NumPy da un risultato CSR di nq
+// righe (predict_range / predict_graph), i cui buffer vengono liberati
+static PyObject* QuantPivot32_csr(npy_intp nq, size_t *offsets, int *ids, type *dist) {
+	npy_intp n_off = nq + 1, total = (npy_intp)offsets[nq];
+	PyObject *off_array  = PyArray_SimpleNew(1, &n_off, NPY_INT64);
+	PyObject *id_array   = PyArray_SimpleNew(1, &total, NPY_INT32);
+	PyObject *dist_array = PyArray_SimpleNew(1, &total, NPY_FLOAT32);
+	PyObject *result = NULL;
+
+	if (off_array && id_array && dist_array) {
+		int64_t *o = (int64_t *)PyArray_DATA((PyArrayObject*)off_array);
+		for (npy_intp i = 0; i < n_off; i++)
+			o[i] = (int64_t)offsets[i];
+		memcpy(PyArray_DATA((PyArrayObject*)id_array), ids, (size_t)total * sizeof(int));
+		memcpy(PyArray_DATA((PyArrayObject*)dist_array), dist, (size_t)total * sizeof(type));
+		// Vicini della riga i: ids[offsets[i]:offsets[i+1]]
+		result = PyTuple_Pack(3, off_array, id_array, dist_array);
+	}
+	Py_XDECREF(off_array);
+	Py_XDECREF(id_array);
+	Py_XDECREF(dist_array);
+
+	free(offsets);
+	free(ids);
+	free(dist);
+	return result;
+}
+
+// Metodo range_query: tutti i punti entro il raggio r, in formato CSR
+static PyObject* QuantPivot32_range_query(QuantPivot32Object *self, PyObject *args, PyObject *kwargs) {
+	PyArrayObject* query_array;
+	double r, r_real = -1.0;
+
+	static char* kwlist[] = {"query", "r", "r_real", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O!d|d", kwlist,
+									&PyArray_Type, &query_array, &r, &r_real))
+		return NULL;
+
+	// Verifica che fit sia stato chiamato
+	if (self->input->index == NULL) {
+		PyErr_SetString(PyExc_RuntimeError,
+					"Model not fitted, call fit() before range_query()");
+		return NULL;
+	}
+
+	if (self->input->C > 0 || self->input->pq_m > 0) {
+		PyErr_SetString(PyExc_ValueError, "range_query() is not available with ivf_lists > 0 or pq_m > 0");
+		return NULL;
+	}
+
+	if (QuantPivot32_check_query(self, query_array) != 0)
+		return NULL;
+
+	int nq = (int)PyArray_DIM(query_array, 0);
+	size_t *offsets = NULL;
+	int *ids = NULL;
+	type *dist = NULL;
+
+	// ========================================= //
+	int ret = predict_range(self->input, (const type*)PyArray_DATA(query_array), nq,
+							r, r_real, &offsets, &ids, &dist);
+	// ========================================= //
+
+	if (ret != 0)
+		return PyErr_NoMemory();
+
+	return QuantPivot32_csr(nq, offsets, ids, dist);
+}
+
+// Metodo query_by_id: K-NN delle righe del dataset indicate per indice
+static PyObject* QuantPivot32_query_by_id(QuantPivot32Object *self, PyObject *args, PyObject *kwargs) {
+	PyObject *ids_obj;
+	int k, silent = 0;
+
+	static char* kwlist[] = {"ids", "k", "silent", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "Oi|i", kwlist, &ids_obj, &k, &silent))
+		return NULL;
+
+	// Verifica che fit sia stato chiamato
+	if (self->input->index == NULL) {
+		PyErr_SetString(PyExc_RuntimeError,
+					"Model not fitted, call fit() before query_by_id()");
+		return NULL;
+	}
+
+	if (self->input->S > 1 || self->input->C > 0 || self->input->pq_m > 0) {
+		PyErr_SetString(PyExc_ValueError, "query_by_id() is not available with shards, ivf_lists or pq_m");
+		return NULL;
+	}
+
+	if (k <= 0) {
+		PyErr_SetString(PyExc_ValueError, "k must be positive");
+		return NULL;
+	}
+
+	PyArrayObject *ids = (PyArrayObject*)PyArray_FROM_OTF(ids_obj, NPY_INT64, NPY_ARRAY_IN_ARRAY);
+	if (ids == NULL)
+		return NULL;
+	if (PyArray_NDIM(ids) != 1) {
+		Py_DECREF(ids);
+		PyErr_SetString(PyExc_ValueError, "ids must be a 1D array");
+		return NULL;
+	}
+
+	// Righe come uint32 (gli id degli indici sono int)
+	npy_intp nq = PyArray_DIM(ids, 0);
+	const int64_t *src = (const int64_t*)PyArray_DATA(ids);
+	uint32_t *rows = (uint32_t*)malloc((nq ? (size_t)nq : 1) * sizeof(uint32_t));
+	if (rows == NULL) {
+		Py_DECREF(ids);
+		return PyErr_NoMemory();
+	}
+	for (npy_intp i = 0; i < nq; i++) {
+		if (src[i] < 0 || src[i] >= self->input->N) {
+			free(rows);
+			Py_DECREF(ids);
+			PyErr_SetString(PyExc_IndexError, "ids out of range");
+			return NULL;
+		}
+		rows[i] = (uint32_t)src[i];
+	}
+	Py_DECREF(ids);
+
+	if (QuantPivot32_alloc_results(self, (int)nq, k, silent) != 0) {
+		free(rows);
+		return NULL;
+	}
+
+	// ========================================= //
+	predict_by_id(self->input, rows);
+	// ========================================= //
+
+	free(rows);
+	return QuantPivot32_results(self);
+}
+
+// Metodo knn_graph: k vicini di tutte le righe del dataset, in formato CSR
+static PyObject* QuantPivot32_knn_graph(QuantPivot32Object *self, PyObject *args, PyObject *kwargs) {
+	int k;
+
+	static char* kwlist[] = {"k", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "i", kwlist, &k))
+		return NULL;
+
+	// Verifica che fit sia stato chiamato
+	if (self->input->index == NULL) {
+		PyErr_SetString(PyExc_RuntimeError,
+					"Model not fitted, call fit() before knn_graph()");
+		return NULL;
+	}
+
+	if (self->input->S > 1 || self->input->C > 0 || self->input->pq_m > 0) {
+		PyErr_SetString(PyExc_ValueError, "knn_graph() is not available with shards, ivf_lists or pq_m");
+		return NULL;
+	}
+
+	if (k <= 0) {
+		PyErr_SetString(PyExc_ValueError, "k must be positive");
+		return NULL;
+	}
+
+	size_t *offsets = NULL;
+	int *ids = NULL;
+	type *dist = NULL;
+	int ret;
+
+	// Il lavoro è tutto in C: gli altri thread Python possono proseguire
+	Py_BEGIN_ALLOW_THREADS
+	// ========================================= //
+	ret = predict_graph(self->input, k, &offsets, &ids, &dist);
+	// ========================================= //
+	Py_END_ALLOW_THREADS
+
+	if (ret != 0)
+		return PyErr_NoMemory();
+
+	return QuantPivot32_csr(self->input->N, offsets, ids, dist);
+}
+
+// Metodo predict_exact: K-NN esatto (forza bruta) sul dataset passato a fit()
+static PyObject* QuantPivot32_predict_exact(QuantPivot32Object *self, PyObject *args, PyObject *kwargs) {
+	PyArrayObject* query_array;
+	int k, silent = 0;
+
+	static char* kwlist[] = {"query", "k", "silent", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O!i|i", kwlist,
+									&PyArray_Type, &query_array,
+									&k, &silent))
+		return NULL;
+
+	// Serve solo il dataset, non l'indice a pivot
+	if (self->input->DS == NULL) {
+		PyErr_SetString(PyExc_RuntimeError,
+					"Model not fitted, call fit() before predict_exact()");
+		return NULL;
+	}
+
+	if (QuantPivot32_set_query(self, query_array, k, silent) != 0)
+		return NULL;
+
+	// ========================================= //
+	predict_exact(self->input);
+	// ========================================= //
+
+	return QuantPivot32_results(self);
+}
+
+// Metodo autotune: sceglie h, x e il fattore di re-rank per la recall richiesta
+static PyObject* QuantPivot32_autotune(QuantPivot32Object *self, PyObject *args, PyObject *kwargs) {
+	PyArrayObject *ds_array;
+	PyObject *query_obj = Py_None;
+	int k = 8, build = 1, sample_n = 5000, sample_q = 200, silent = 1;
+	double recall = 0.9;
+	Py_ssize_t mem_budget = 0;
+
+	static char *kwlist[] = {"dataset", "k", "recall", "query", "mem_budget", "build",
+							 "sample_n", "sample_q", "silent", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O!|idOnpiii", kwlist,
+									&PyArray_Type, &ds_array,
+									&k, &recall, &query_obj, &mem_budget, &build,
+									&sample_n, &sample_q, &silent))
+		return NULL;
+
+	if (k <= 0 || recall <= 0.0 || recall > 1.0 || mem_budget < 0) {
+		PyErr_SetString(PyExc_ValueError, "k must be positive, recall in (0, 1], mem_budget >= 0");
+		return NULL;
+	}
+
+	if (QuantPivot32_set_dataset(self, ds_array) != 0)
+		return NULL;
+
+	// Il vecchio indice non corrisponde più al dataset
+	QuantPivot32_close_async(self);
+	release(self->input);
+	self->input->S = 1;
+
+	// Query opzionali: senza query si campionano righe del dataset
+	self->input->Q = NULL;
+	self->input->nq = 0;
+	if (query_obj != Py_None) {
+		if (!PyArray_Check(query_obj)) {
+			PyErr_SetString(PyExc_TypeError, "query must be a numpy array or None");
+			return NULL;
+		}
+		if (QuantPivot32_check_query(self, (PyArrayObject*)query_obj) != 0)
+			return NULL;
+		self->input->Q = (type*)PyArray_DATA((PyArrayObject*)query_obj);
+		self->input->nq = (int)PyArray_DIM((PyArrayObject*)query_obj, 0);
+	}
+	self->input->silent = silent;
+
+	TuneOptions opt;
+	tune_default_options(&opt);
+	opt.k             = k;
+	opt.target_recall = recall;
+	opt.mem_budget    = (size_t)mem_budget;
+	opt.sample_n      = sample_n;
+	opt.sample_q      = sample_q;
+	opt.verbose       = !silent;
+
+	TuneResult best;
+	int ret;
+
+	// ========================================= //
+	Py_BEGIN_ALLOW_THREADS
+	ret = tune(self->input, &opt, build, &best);
+	Py_END_ALLOW_THREADS
+	// ========================================= //
+
+	// Le query servivano solo al campione
+	self->input->Q = NULL;
+	self->input->nq = -1;
+
+	if (ret < 0) {
+		PyErr_SetString(PyExc_MemoryError, "autotune failed (out of memory)");
+		return NULL;
+	}
+
+	return Py_BuildValue("{s:i,s:i,s:i,s:d,s:d,s:n,s:O,s:i,s:O}",
+						 "h", best.h,
+						 "x", best.x,
+						 "rerank", best.r,
+						 "recall", best.recall,
+						 "query_us", best.query_us,
+						 "index_bytes", (Py_ssize_t)best.index_bytes,
+						 "met", ret == 0 ? Py_True : Py_False,
+						 "evaluated", best.evaluated,
+						 "built", self->input->index != NULL ? Py_True : Py_False);
+}
+
 // Tabella dei metodi
 static PyMethodDef QuantPivot32_methods[] = {
 	{
@@ -248,6 +959,27 @@ static PyMethodDef QuantPivot32_methods[] = {
 		"  n_pivots: number of pivots\n"
 		"  x: quantization level\n"
 		"  s: silent (default=False)\n"
+		"  rerank: re-rank k*rerank approximate candidates (default=1)\n"
+		"  shards: split the rows into this many independently indexed shards (default=1)\n"
+		"  num_threads: worker threads used by predict, 0 = whole pool (default=0)\n"
+		"  sorted_pivots: rows sorted by distance to 1 or 2 pivots; queries expand\n"
+		"    outward from the query's position instead of scanning all rows (default=0)\n"
+		"  pivot_cascade: check the lower bound on this many high-variance pivots\n"
+		"    first, kept in a compact array, and read the other pivots only for rows\n"
+		"    not yet pruned; same results, less pivot-table traffic (default=0)\n"
+		"  ivf_lists: cluster the rows into this many k-means lists; queries scan only\n"
+		"    the nprobe lists with the closest centroid (default=0, no IVF)\n"
+		"  nprobe: lists scanned per query with ivf_lists > 0 (default=8)\n"
+		"  hnsw_m: also build a proximity graph with this many links per node; predict\n"
+		"    and submit then search the graph and re-rank by real distance (default=0)\n"
+		"  ef_construction: beam width while building the graph (default=100)\n"
+		"  ef_search: beam width of graph queries, >= k (default=64)\n"
+		"  pq_m: replace the pivot index with product-quantization codes of pq_m\n"
+		"    sub-quantizers; queries scan the codes with lookup tables and re-rank\n"
+		"    k*rerank candidates by real distance (rerank=1 uses 8) (default=0)\n"
+		"  pq_bits: 8 (256 centroids, one byte per sub-quantizer) or 4 (16 centroids,\n"
+		"    blocked fast-scan codes) (default=8)\n"
+		"  opq: rotate the vectors before product quantization (default=False)\n"
 		"\n"
 		"Returns:\n"
 		"  self"
@@ -261,9 +993,119 @@ static PyMethodDef QuantPivot32_methods[] = {
 		"  query: numpy array of shape (nq, D)\n"
 		"  k: number of neighbors\n"
 		"  s: silent (default=False)\n"
+		"  num_threads: worker threads for this call, -1 = value given to fit (default=-1)\n"
+		"  ef: graph beam width for this call, -1 = value given to fit (default=-1)\n"
+		"  alpha: relaxed pruning, a row is skipped when alpha * d* >= current worst;\n"
+		"    values > 1 evaluate fewer rows at some recall cost (default=0, exact)\n"
+		"  max_evals: approximate distances per query, 0 = unlimited (default=0)\n"
+		"  deadline_ms: time per query in milliseconds, 0 = unlimited (default=0)\n"
+		"  return_partial: also return a bool array flagging the queries that ran out\n"
+		"    of budget and hold the best k found so far (default=False)\n"
+		"  The last four options need the plain pivot index (no shards, ivf_lists,\n"
+		"  hnsw_m or pq_m).\n"
+		"\n"
+		"Returns:\n"
+		"  (ids, distances), or (ids, distances, partial) with return_partial"
+	},
+	{
+		"predict_filtered",
+		(PyCFunction)QuantPivot32_predict_filtered,
+		METH_VARARGS | METH_KEYWORDS,
+		"K-NN restricted to the rows selected by a boolean mask\n\n"
+		"The mask is applied inside the scan, so k allowed rows are returned\n"
+		"whenever at least k exist. Very selective masks scan only the allowed ids.\n\n"
+		"Parameters:\n"
+		"  query: numpy array of shape (nq, D)\n"
+		"  k: number of neighbors\n"
+		"  allow: bool array (N,) shared by all queries or (nq, N) per query\n"
+		"  deny: same shape, rows to exclude (pass exactly one of allow/deny)\n"
+		"\n"
+		"Returns:\n"
+		"  (ids, distances) as predict, id = -1 beyond the allowed rows"
+	},
+	{
+		"submit",
+		(PyCFunction)QuantPivot32_submit,
+		METH_VARARGS | METH_KEYWORDS,
+		"Queue a query batch and return immediately\n\n"
+		"Batches submitted concurrently are merged into tiles by a background\n"
+		"engine thread. Use asyncio.wrap_future() to await the result.\n\n"
+		"Parameters:\n"
+		"  query: numpy array of shape (nq, D), copied\n"
+		"  k: number of neighbors\n"
+		"\n"
+		"Returns:\n"
+		"  concurrent.futures.Future resolving to (ids, distances) as predict"
+	},
+	{
+		"range_query",
+		(PyCFunction)QuantPivot32_range_query,
+		METH_VARARGS | METH_KEYWORDS,
+		"All points within radius r of each query (pivot pruning, static threshold)\n\n"
+		"Parameters:\n"
+		"  query: numpy array of shape (nq, D)\n"
+		"  r: radius on the approximate distance scale\n"
+		"  r_real: keep only points with Euclidean distance <= r_real, < 0 = off (default=-1)\n"
+		"\n"
+		"Returns:\n"
+		"  (offsets, ids, distances) in CSR form: the neighbors of query i are\n"
+		"  ids[offsets[i]:offsets[i+1]] in increasing id order, with their real distances"
+	},
+	{
+		"query_by_id",
+		(PyCFunction)QuantPivot32_query_by_id,
+		METH_VARARGS | METH_KEYWORDS,
+		"K-NN of dataset rows given by index, reusing their stored codes and\n"
+		"pivot distances (no quantization, no query-pivot distances)\n\n"
+		"Parameters:\n"
+		"  ids: 1D array of row indices into the fitted dataset\n"
+		"  k: number of neighbors\n"
+		"\n"
+		"Returns:\n"
+		"  (ids, distances) as predict(dataset[ids], k); each row is among its own neighbors"
+	},
+	{
+		"knn_graph",
+		(PyCFunction)QuantPivot32_knn_graph,
+		METH_VARARGS | METH_KEYWORDS,
+		"k-NN graph of the fitted dataset (self-join on the stored codes)\n\n"
+		"Each pair of rows is evaluated once and updates both neighbor lists;\n"
+		"row tiles are processed in parallel.\n\n"
+		"Parameters:\n"
+		"  k: neighbors per row\n"
+		"\n"
+		"Returns:\n"
+		"  (offsets, ids, distances) in CSR form: the min(k, N-1) neighbors of row i\n"
+		"  (itself excluded) are ids[offsets[i]:offsets[i+1]], by increasing real distance"
+	},
+	{
+		"predict_exact",
+		(PyCFunction)QuantPivot32_predict_exact,
+		METH_VARARGS | METH_KEYWORDS,
+		"Exact brute-force K-NN on the fitted dataset\n\n"
+		"Parameters:\n"
+		"  query: numpy array of shape (nq, D)\n"
+		"  k: number of neighbors\n"
+		"\n"
+		"Returns:\n"
+		"  (ids, distances), neighbors sorted by increasing distance"
+	},
+	{
+		"autotune",
+		(PyCFunction)QuantPivot32_autotune,
+		METH_VARARGS | METH_KEYWORDS,
+		"Search (n_pivots, quant_level, rerank) for a recall@k target\n\n"
+		"Parameters:\n"
+		"  dataset: numpy array of shape (N, D)\n"
+		"  k: number of neighbors (default=8)\n"
+		"  recall: required recall@k on the sample (default=0.9)\n"
+		"  query: optional query sample (default: rows of the dataset)\n"
+		"  mem_budget: max index size in bytes, 0 = unlimited\n"
+		"  build: build the final index when the target is met (default=True)\n"
+		"  sample_n, sample_q: dataset rows / queries in the sample\n"
 		"\n"
 		"Returns:\n"
-		"  numpy array of indices"
+		"  dict with h, x, rerank, recall, query_us, index_bytes, met, evaluated, built"
 	},
 	{NULL, NULL, 0, NULL}
 };
@@ -283,11 +1125,46 @@ static PyTypeObject QuantPivot32Type = {
 };
 
 
+// Funzione di modulo configure_pool: dimensione e attesa del pool condiviso
+static PyObject* quantpivot32_configure_pool(PyObject *mod, PyObject *args, PyObject *kwargs) {
+	int threads = 0, spin = 1, spin_us = 0;
+
+	static char *kwlist[] = {"threads", "spin", "spin_us", NULL};
+
+	(void)mod;
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|ipi", kwlist, &threads, &spin, &spin_us))
+		return NULL;
+
+	if (pool_configure(threads, spin ? POOL_SPIN : POOL_PARK, spin_us) != 0) {
+		PyErr_SetString(PyExc_RuntimeError, "Unable to create the thread pool");
+		return NULL;
+	}
+	return PyLong_FromLong(pool_size(pool_default()));
+}
+
+static PyMethodDef quantpivot32_functions[] = {
+	{
+		"configure_pool",
+		(PyCFunction)quantpivot32_configure_pool,
+		METH_VARARGS | METH_KEYWORDS,
+		"Recreate the worker pool shared by every QuantPivot of this module\n\n"
+		"Parameters:\n"
+		"  threads: pool size, 0 = online CPUs (default=0)\n"
+		"  spin: idle workers spin before parking (default=True)\n"
+		"  spin_us: spin time in microseconds, 0 = 50 (default=0)\n"
+		"\n"
+		"Returns:\n"
+		"  pool size"
+	},
+	{NULL, NULL, 0, NULL}
+};
+
 static struct PyModuleDef quantpivot32_module = {
     PyModuleDef_HEAD_INIT,
     .m_name = "_quantpivot32",        // Nome del modulo C
     .m_doc = "Quantized Pivot Indexing and Querying (32bit)",  // Docstring
     .m_size = -1,                     // -1 significa che il modulo non mantiene stato
+    .m_methods = quantpivot32_functions,
 };
 
 // Inizializzazione del modulo
@@ -2,7 +2,11 @@
 #include "common.h"
 #include "matrix.h"
 #include "index.h"
+#include "pool.h"
 #include "query64.h"
+#include "exact64.h"
+#include "autotune64.h"
+#include "async64.h"
 
 /*
  * Back-end 64 bit (Double Precision, AVX2), versione seriale.
@@ -16,12 +20,219 @@ void fit(params *input) {
     ds.d    = (uint32_t)input->D;
     ds.data = input->DS;
 
-    input->index = (void *)build_index_f64(&ds, input->h, input->x);
+    if (input->pq_m > 0)
+        input->index = (void *)build_pq_index_f64(&ds, input->pq_m, input->pq_bits, input->opq);
+    else if (input->C > 0)
+        input->index = (void *)build_ivf_index_f64(&ds, input->C, input->h, input->x);
+    else if (input->S > 1)
+        input->index = (void *)build_sharded_index_f64(&ds, input->S, input->h, input->x);
+    else
+        input->index = (void *)build_index_f64(&ds, input->h, input->x);
+
+    // Colonne ordinate per pivot: senza memoria resta la scansione completa
+    if (input->index && input->cols > 0 && input->C <= 0 && input->pq_m <= 0) {
+        if (input->S > 1)
+            sharded_sort_pivots((ShardedIndex *)input->index, input->cols);
+        else
+            index_sort_pivots((Index *)input->index, input->cols);
+    }
+
+    // Cascata dei pivot: senza memoria d* resta su tutti i pivot
+    if (input->index && input->cascade > 0 && input->C <= 0 && input->pq_m <= 0) {
+        if (input->S > 1)
+            sharded_build_cascade((ShardedIndex *)input->index, input->cascade);
+        else
+            index_build_cascade((Index *)input->index, input->cascade);
+    }
+
+    // Grafo HNSW sui codici dell'indice unico
+    if (input->index && input->M > 0 && input->C <= 0 && input->pq_m <= 0 && input->S <= 1)
+        input->graph = (void *)build_hnsw((Index *)input->index, input->M, input->ef_c);
+}
+
+// Completamento di submit_query: ids/dist (nq x k) valgono solo durante la
+// chiamata; NULL se la conversione dei risultati  fallita
+typedef void (*SubmitDone)(void *user, const int *ids, const type *dist, int nq, int k);
+
+typedef struct {
+    SubmitDone done;
+    void      *user;
+} SubmitCtx;
+
+// Converte i vicini in ids/distanze reali e avvisa il chiamante
+static void submit_deliver(SubmitCtx *c, const Neighbor64 *res, int nq, int k) {
+    int  *ids  = (int *)malloc((size_t)nq * (size_t)k * sizeof(int));
+    type *dist = (type *)malloc((size_t)nq * (size_t)k * sizeof(type));
+
+    if (ids && dist && res) {
+        for (int i = 0; i < nq * k; i++) {
+            ids[i]  = res[i].id;
+            dist[i] = res[i].dist_real;
+        }
+        c->done(c->user, ids, dist, nq, k);
+    } else
+        c->done(c->user, NULL, NULL, nq, k);
+
+    free(ids);
+    free(dist);
+}
+
+static void submit_complete(AsyncRequest64 *req, void *user) {
+    size_t nq;
+    int k;
+    const Neighbor64 *res = async_results_f64(req, &nq, &k);
+    submit_deliver((SubmitCtx *)user, res, (int)nq, k);
+    free(user);
+}
+
+// Avvia il motore asincrono sull'indice corrente (opt NULL = default).
+// Ritorna 0, -1 senza indice o su errore.
+int submit_open(params *input, const AsyncOptions *opt) {
+    if (!input->index) return -1;
+    if (input->async || input->S > 1 || input->C > 0 || input->pq_m > 0 || input->graph) return 0;   // gi attivo / non serve
+
+    MatrixF64 ds; ds.n = (uint32_t)input->N; ds.d = (uint32_t)input->D; ds.data = input->DS;
+
+    AsyncOptions o;
+    if (opt) o = *opt;
+    else {
+        async_default_options(&o);
+        o.num_threads = input->num_threads;
+    }
+    input->async = (void *)async_engine_create_f64(&ds, (Index *)input->index, input->x, &o);
+    return input->async ? 0 : -1;
+}
+
+// Accoda nq query (copiate) e ritorna subito: done viene chiamata dal thread
+// del motore. Con indice partizionato, IVF, PQ o grafo la ricerca  sincrona. Ritorna 0,
+// ASYNC_FULL (coda piena, motore non bloccante) o -1.
+int submit_query(params *input, const type *Q, int nq, int k, SubmitDone done, void *user) {
+    if (!input->index || !Q || nq <= 0 || k <= 0 || !done) return -1;
+
+    if (input->S > 1 || input->C > 0 || input->pq_m > 0 || input->graph) {
+        MatrixF64 ds; ds.n = (uint32_t)input->N; ds.d = (uint32_t)input->D; ds.data = input->DS;
+        MatrixF64 qs; qs.n = (uint32_t)nq;       qs.d = (uint32_t)input->D; qs.data = (type *)Q;
+
+        Neighbor64 *res = (Neighbor64 *)malloc((size_t)nq * (size_t)k * sizeof(Neighbor64));
+        if (res && input->graph)
+            knn_query_hnsw_all_f64(&ds, (HnswIndex *)input->graph, &qs, k, input->x, input->ef, res);
+        else if (res && input->C > 0)
+            knn_query_ivf_all_f64(&ds, (IvfIndex *)input->index, &qs, k, input->x, input->nprobe, res);
+        else if (res && input->pq_m > 0)
+            knn_query_pq_all_f64(&ds, (PqIndex *)input->index, &qs, k, input->r > 1 ? input->r : PQ_DEFAULT_RERANK, res);
+        else if (res)
+            knn_query_sharded_all_f64(&ds, (ShardedIndex *)input->index, &qs, k, input->x, res);
+        SubmitCtx c = { done, user };
+        submit_deliver(&c, res, nq, k);
+        free(res);
+        return 0;
+    }
+
+    if (submit_open(input, NULL) != 0) return -1;
+
+    SubmitCtx *c = (SubmitCtx *)malloc(sizeof(SubmitCtx));
+    if (!c) return -1;
+    c->done = done;
+    c->user = user;
+
+    int ret = async_submit_f64((AsyncEngine64 *)input->async, Q, (size_t)nq, k, submit_complete, c, NULL);
+    if (ret != 0) free(c);
+    return ret;
+}
+
+// Esegue le richieste in coda e ferma il motore
+void submit_close(params *input) {
+    AsyncEngine64 *eng = (AsyncEngine64 *)input->async;
+    input->async = NULL;
+    async_engine_destroy_f64(eng);
+}
+
+// Libera l'indice (unico, partizionato, IVF o PQ, secondo S, C e pq_m) e il grafo
+void release(params *input) {
+    submit_close(input);
+    free_hnsw((HnswIndex *)input->graph);
+    input->graph = NULL;
+    if (!input->index) return;
+    if (input->pq_m > 0)
+        free_pq_index((PqIndex *)input->index);
+    else if (input->C > 0)
+        free_ivf_index((IvfIndex *)input->index);
+    else if (input->S > 1)
+        free_sharded_index((ShardedIndex *)input->index);
+    else
+        free_index((Index *)input->index);
+    input->index = NULL;
 }
 
 void predict(params *input) {
-    Index *idx = (Index *)input->index;
-    if (!idx) return;
+    if (!input->index) return;
+
+    MatrixF64 ds; ds.n = (uint32_t)input->N;  ds.d = (uint32_t)input->D; ds.data = input->DS;
+    MatrixF64 qs; qs.n = (uint32_t)input->nq; qs.d = (uint32_t)input->D; qs.data = input->Q;
+
+    int k = input->k;
+    Neighbor64 *res = (Neighbor64 *)malloc((size_t)input->nq * (size_t)k * sizeof(Neighbor64));
+    if (!res) return;
+
+    // Indice partizionato: fan-out sugli shard (il re-rank non si applica);
+    // IVF: solo le nprobe liste pi vicine a ogni query; grafo: ricerca a fascio;
+    // PQ: ADC su tutti i codici e re-rank dei k*r candidati
+    if (input->graph)
+        knn_query_hnsw_all_f64(&ds, (HnswIndex *)input->graph, &qs, k, input->x, input->ef, res);
+    else if (input->C > 0)
+        knn_query_ivf_all_f64(&ds, (IvfIndex *)input->index, &qs, k, input->x, input->nprobe, res);
+    else if (input->pq_m > 0)
+        knn_query_pq_all_f64(&ds, (PqIndex *)input->index, &qs, k, input->r > 1 ? input->r : PQ_DEFAULT_RERANK, res);
+    else if (input->S > 1)
+        knn_query_sharded_all_f64(&ds, (ShardedIndex *)input->index, &qs, k, input->x, res);
+    else {
+        // Pool di thread persistente condiviso fra gli indici (pool.h)
+        QueryOptions opt;
+        query_default_options(&opt);
+        opt.r           = input->r;
+        opt.num_threads = input->num_threads;
+        opt.alpha       = input->alpha;
+        opt.max_evals   = input->max_evals;
+        opt.deadline_ms = input->deadline_ms;
+        opt.partial     = input->partial;
+        knn_query_all_opt_f64(&ds, (Index *)input->index, &qs, k, input->x, &opt, res);
+    }
+
+    for (int i = 0; i < input->nq; i++) {
+        for (int j = 0; j < k; j++) {
+            input->id_nn[i * k + j]   = res[i * k + j].id;
+            input->dist_nn[i * k + j] = res[i * k + j].dist_real;
+        }
+    }
+
+    free(res);
+}
+
+// K-NN esatto (forza bruta): non usa l'indice, solo DS e Q
+void predict_exact(params *input) {
+    MatrixF64 ds; ds.n = (uint32_t)input->N;  ds.d = (uint32_t)input->D; ds.data = input->DS;
+    MatrixF64 qs; qs.n = (uint32_t)input->nq; qs.d = (uint32_t)input->D; qs.data = input->Q;
+
+    int k = input->k;
+    Neighbor64 *res = (Neighbor64 *)malloc((size_t)input->nq * (size_t)k * sizeof(Neighbor64));
+    if (!res) return;
+
+    exact_knn_f64(&ds, &qs, k, res);
+
+    for (int i = 0; i < input->nq; i++) {
+        for (int j = 0; j < k; j++) {
+            input->id_nn[i * k + j]   = res[i * k + j].id;
+            input->dist_nn[i * k + j] = res[i * k + j].dist_real;
+        }
+    }
+
+    free(res);
+}
+
+// K-NN filtrato: come predict, solo fra le righe ammesse dai filtri
+// (nf = 1 condiviso, nf = nq uno per query)
+void predict_filtered(params *input, const RowFilter *filters, size_t nf) {
+    if (!input->index || input->C > 0 || input->pq_m > 0) return;
 
     MatrixF64 ds; ds.n = (uint32_t)input->N;  ds.d = (uint32_t)input->D; ds.data = input->DS;
     MatrixF64 qs; qs.n = (uint32_t)input->nq; qs.d = (uint32_t)input->D; qs.data = input->Q;
@@ -30,7 +241,76 @@ void predict(params *input) {
     Neighbor64 *res = (Neighbor64 *)malloc((size_t)input->nq * (size_t)k * sizeof(Neighbor64));
     if (!res) return;
 
-    knn_query_all_f64(&ds, idx, &qs, k, input->x, res);
+    if (input->S > 1)
+        knn_query_sharded_all_filtered_f64(&ds, (ShardedIndex *)input->index, &qs, k, input->x, filters, nf, res);
+    else
+        knn_query_all_filtered_f64(&ds, (Index *)input->index, &qs, k, input->x, filters, nf, res);
+
+    for (int i = 0; i < input->nq; i++) {
+        for (int j = 0; j < k; j++) {
+            input->id_nn[i * k + j]   = res[i * k + j].id;
+            input->dist_nn[i * k + j] = res[i * k + j].dist_real;
+        }
+    }
+
+    free(res);
+}
+
+// Separa un risultato CSR di nq righe in offsets (nq + 1), id e distanze
+// reali allocati con malloc; res viene liberato. Ritorna 0, -1 su errore.
+static int unpack_csr(RangeResult64 *res, size_t nq, size_t **offsets, int **ids, type **dist) {
+    size_t total = res->offsets[nq];
+    *offsets = res->offsets;
+    *ids  = (int *)malloc((total ? total : 1) * sizeof(int));
+    *dist = (type *)malloc((total ? total : 1) * sizeof(type));
+    if (!*ids || !*dist) {
+        free(*ids);
+        free(*dist);
+        free_range_result_f64(res);
+        return -1;
+    }
+
+    for (size_t c = 0; c < total; c++) {
+        (*ids)[c]  = res->items[c].id;
+        (*dist)[c] = res->items[c].dist_real;
+    }
+
+    // offsets passa al chiamante
+    free(res->items);
+    free(res);
+    return 0;
+}
+
+// Ricerca per raggio sulle nq query Q: offsets (nq + 1), id e distanze reali
+// in formato CSR, allocati con malloc. Ritorna 0, -1 su errore.
+int predict_range(params *input, const type *Q, int nq, double r, double r_real,
+                  size_t **offsets, int **ids, type **dist) {
+    if (!input->index || input->C > 0 || input->pq_m > 0) return -1;
+
+    MatrixF64 ds; ds.n = (uint32_t)input->N; ds.d = (uint32_t)input->D; ds.data = input->DS;
+    MatrixF64 qs; qs.n = (uint32_t)nq;       qs.d = (uint32_t)input->D; qs.data = (type *)Q;
+
+    RangeResult64 *res;
+    if (input->S > 1)
+        res = range_query_sharded_all_f64(&ds, (ShardedIndex *)input->index, &qs, input->x, (type)r, (type)r_real);
+    else
+        res = range_query_all_f64(&ds, (Index *)input->index, &qs, input->x, (type)r, (type)r_real);
+    return unpack_csr(res, (size_t)nq, offsets, ids, dist);
+}
+
+// K-NN delle righe ids[0 .. nq) del dataset con codici e distanze dai pivot
+// gi nell'indice, risultato in id_nn/dist_nn come predict. Solo per
+// l'indice a pivot unico.
+void predict_by_id(params *input, const uint32_t *ids) {
+    if (!input->index || input->C > 0 || input->pq_m > 0 || input->S > 1) return;
+
+    MatrixF64 ds; ds.n = (uint32_t)input->N; ds.d = (uint32_t)input->D; ds.data = input->DS;
+
+    int k = input->k;
+    Neighbor64 *res = (Neighbor64 *)malloc((size_t)input->nq * (size_t)k * sizeof(Neighbor64));
+    if (!res) return;
+
+    knn_query_by_id_all_f64(&ds, (Index *)input->index, ids, (size_t)input->nq, k, input->r, res);
 
     for (int i = 0; i < input->nq; i++) {
         for (int j = 0; j < k; j++) {
@@ -41,3 +321,41 @@ void predict(params *input) {
 
     free(res);
 }
+
+// Grafo dei k vicini di tutte le N righe (self-join) nello stesso formato
+// CSR di predict_range. Ritorna 0, -1 su errore.
+int predict_graph(params *input, int k, size_t **offsets, int **ids, type **dist) {
+    if (!input->index || input->C > 0 || input->pq_m > 0 || input->S > 1) return -1;
+
+    MatrixF64 ds; ds.n = (uint32_t)input->N; ds.d = (uint32_t)input->D; ds.data = input->DS;
+
+    RangeResult64 *res = knn_graph_f64(&ds, (Index *)input->index, k);
+    if (!res) return -1;
+    return unpack_csr(res, (size_t)input->N, offsets, ids, dist);
+}
+
+// Autotune di h, x, r sul dataset DS (query Q opzionali: NULL -> campionate
+// da DS). Con build != 0 e target raggiunto l'indice viene sostituito e
+// h, x, r aggiornati. Ritorna 0 / 1 / -1 come autotune_f64().
+int tune(params *input, const TuneOptions *opt, int build, TuneResult *best) {
+    MatrixF64 ds; ds.n = (uint32_t)input->N;  ds.d = (uint32_t)input->D; ds.data = input->DS;
+    MatrixF64 qs; qs.n = (uint32_t)input->nq; qs.d = (uint32_t)input->D; qs.data = input->Q;
+
+    Index *idx = NULL;
+    int ret = autotune_f64(&ds, input->Q ? &qs : NULL, opt, best, build ? &idx : NULL);
+
+    if (ret == 0 && idx) {
+        release(input);
+        input->index = (void *)idx;
+        input->S = 1;
+        input->cols = 0;
+        input->cascade = 0;
+        input->C = 0;
+        input->pq_m = 0;
+        input->M = 0;
+        input->h = best->h;
+        input->x = best->x;
+        input->r = best->r;
+    }
+    return ret;
+}
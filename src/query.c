@@ -1,15 +1,28 @@
 #include <stdlib.h>
 #include <math.h>
+#include <float.h>
+#include <limits.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "query.h"
 #include "quantization.h"
 #include "distance.h"
+#include "perfcount.h"
+#include "pool.h"
 
 #ifdef _OPENMP
 #include <omp.h>
 #endif
 
+// Punti del dataset elaborati per blocco: prima si calcolano i limiti
+// inferiori d* dell'intero blocco, poi si esegue pruning + distanza
+// approssimata. Il risultato  identico alla scansione punto per punto.
+#define SCAN_BLOCK 256
+
+// Sopravvissuti di cui block_scan anticipa il prefetch dei codici
+#define PREFETCH_AHEAD 8
+
 // Trova il vicino peggiore (max distanza approssimata)
 static int find_worst_neighbor(const Neighbor *neighbors, int k)
 {
@@ -25,16 +38,288 @@ static int find_worst_neighbor(const Neighbor *neighbors, int k)
     return worst;
 }
 
-// KNN per UNA query
-void knn_query_single(const MatrixF32 *ds,
-                      const Index *idx,
-                      const float *q,
-                      int k,
-                      int x,
-                      Neighbor *neighbors)
+// Scansione a partire dalla colonna ordinata dell'indice: le righe sono
+// visitate dalla posizione di d(q,p) verso l'esterno, scegliendo ogni volta
+// il lato con la chiave pi vicina; appena lo scarto |d(v,p) - d(q,p)|
+// raggiunge il vicino peggiore tutte le righe restanti verrebbero scartate
+// dal pruning e la scansione termina. Ritorna le righe visitate.
+// Con bud (QueryOptions: alpha, max_evals, deadline_ms) il pruning diventa
+// alpha * d* >= peggiore e la scansione si ferma a budget esaurito.
+static size_t sorted_scan(const Index *idx,
+                          const uint8_t *vp_q,
+                          const uint8_t *vn_q,
+                          const int *dq_pivot,
+                          int k,
+                          Neighbor *neighbors,
+                          size_t *pruned,
+                          ScanBudget *bud)
 {
-    if (!ds || !idx || !q || !neighbors) return;
+    size_t n = idx->n;
+    size_t Dp = idx->Dp;
+    int h = (int)idx->h;
+    float alpha = bud ? bud->alpha : 1.0f;
+
+    int c = index_sorted_column(idx, dq_pivot, k);
+    const uint32_t *ids = &idx->sorted_id[(size_t)c * n];
+    const int *key = &idx->sorted_key[(size_t)c * n];
+    int dq = dq_pivot[idx->sorted_piv[c]];
+
+    size_t hi = index_sorted_lower_bound(idx, c, dq), lo = hi;
+    size_t visited = 0;
+
+    while (lo > 0 || hi < n) {
+        if (bud && visited % SCAN_BLOCK == 0 && !scan_budget_check(bud)) break;
+
+        long long gl = lo > 0 ? (long long)dq - key[lo - 1] : LLONG_MAX;
+        long long gh = hi < n ? (long long)key[hi] - dq : LLONG_MAX;
+        long long gap = gl <= gh ? gl : gh;
+
+        int worst = find_worst_neighbor(neighbors, k);
+        float worst_approx = neighbors[worst].dist_approx;
+        if (alpha * (float)gap >= worst_approx) break;
+
+        size_t i = gl <= gh ? ids[--lo] : ids[hi++];
+        visited++;
+
+        // Limite inferiore su tutti i pivot
+        const int *dv = &idx->dist[i * h];
+        int best = 0;
+        for (int j = 0; j < h; j++) {
+            int diff = dv[j] - dq_pivot[j];
+            if (diff < 0) diff = -diff;
+            if (diff > best) best = diff;
+        }
+
+        // PRUNING
+        if (alpha * (float)best >= worst_approx) {
+            (*pruned)++;
+            continue;
+        }
+
+        if (bud && !scan_budget_spend(bud)) break;
+
+        const uint8_t *vpi = &idx->vp_all[i * Dp];
+        const uint8_t *vni = &idx->vn_all[i * Dp];
+        int d_approx = index_code_distance(idx, vp_q, vn_q, vpi, vni);
+
+        if ((float)d_approx < worst_approx) {
+            neighbors[worst].id          = (int)i;
+            neighbors[worst].dist_approx = (float)d_approx;
+        }
+    }
+    return visited;
+}
+
+// Soglia intera della cascata: (float)d* < worst se e solo se d* < limit
+static int cascade_limit(float worst)
+{
+    if (worst >= (float)INT_MAX) return INT_MAX;
+    if (worst <= 0.0f) return 0;
+    return (int)ceilf(worst);
+}
+
+// Scansione a blocchi delle righe [begin, end) dell'indice in due passate.
+// La prima calcola i limiti inferiori d* del blocco (lettura sequenziale di
+// dist) e tiene solo le righe sotto il vicino peggiore di inizio blocco:
+// poich il peggiore pu solo scendere, le altre sarebbero comunque
+// scartate. La seconda rilegge d* col peggiore corrente e calcola la
+// distanza approssimata dei sopravvissuti, con il prefetch dei codici
+// PREFETCH_AHEAD sopravvissuti in anticipo. Risultato e conteggi identici
+// alla scansione punto per punto. Con la cascata (Index.n_hot) d* parte
+// dai pivot caldi e si ferma appena raggiunge il peggiore di inizio blocco:
+// esatto per i sopravvissuti, quindi la seconda passata non cambia.
+// dq_hot/order della cascata sono calcolati una volta per query dal
+// chiamante (index_cascade_begin; order NULL: d* su tutti i pivot).
+// bud come in sorted_scan (NULL: pruning esatto, nessun limite).
+static void block_scan(const Index *idx,
+                       const uint8_t *vp_q,
+                       const uint8_t *vn_q,
+                       const int *dq_pivot,
+                       const int *dq_hot,
+                       const int *order,
+                       size_t begin,
+                       size_t end,
+                       int k,
+                       Neighbor *neighbors,
+                       size_t *pruned,
+                       ScanBudget *bud)
+{
+    size_t Dp = idx->Dp;
+    float alpha = bud ? bud->alpha : 1.0f;
+    int h = (int)idx->h;
+    int d_star[SCAN_BLOCK];
+    uint16_t surv[SCAN_BLOCK];
+
+    for (size_t i0 = begin; i0 < end; i0 += SCAN_BLOCK) {
+        size_t cnt = end - i0 < SCAN_BLOCK ? end - i0 : SCAN_BLOCK;
+        size_t ns = 0;
+
+        // Scadenza una volta per blocco, prima del limite inferiore
+        if (bud && !scan_budget_check(bud)) break;
+
+        // Limite inferiore calcolato attraverso pivot + sopravvissuti
+        PERF_BEGIN(PERF_PHASE_LB);
+        float worst0 = neighbors[find_worst_neighbor(neighbors, k)].dist_approx;
+        int limit = cascade_limit(worst0 / alpha);
+        for (size_t b = 0; b < cnt; b++) {
+            int best;
+            if (order) {
+                best = index_cascade_bound(idx, i0 + b, dq_hot, dq_pivot, order, limit);
+            } else {
+                const int *dv = &idx->dist[(i0 + b) * h];   // d(v_i, p_j)
+                best = 0;
+                for (int j = 0; j < h; j++) {
+                    int diff = dv[j] - dq_pivot[j];
+                    if (diff < 0) diff = -diff;
+                    if (diff > best) best = diff;
+                }
+            }
+            d_star[b] = best;
+            surv[ns] = (uint16_t)b;
+            ns += alpha * (float)best < worst0;
+        }
+        *pruned += cnt - ns;
+        PERF_END(PERF_PHASE_LB);
+
+        PERF_BEGIN(PERF_PHASE_APPROX);
+        for (size_t s = 0; s < ns && s < PREFETCH_AHEAD; s++)
+            index_prefetch_codes(idx, i0 + surv[s]);
+
+        for (size_t s = 0; s < ns; s++) {
+            size_t b = surv[s];
+            size_t i = i0 + b;
+
+            if (s + PREFETCH_AHEAD < ns)
+                index_prefetch_codes(idx, i0 + surv[s + PREFETCH_AHEAD]);
+
+            // Distanza approssimata peggiore nella lista
+            int worst = find_worst_neighbor(neighbors, k);
+            float worst_approx = neighbors[worst].dist_approx;
+
+            // PRUNING
+            if (alpha * (float)d_star[b] >= worst_approx) {
+                (*pruned)++;
+                continue;
+            }
+
+            if (bud && !scan_budget_spend(bud)) break;
+
+            // Calcolo distanza approssimata tra v_i e la query
+            const uint8_t *vpi = &idx->vp_all[i * Dp];
+            const uint8_t *vni = &idx->vn_all[i * Dp];
+
+            int d_approx = index_code_distance(idx, vp_q, vn_q, vpi, vni);
+
+            if ((float)d_approx < worst_approx) {
+                neighbors[worst].id          = (int)i;
+                neighbors[worst].dist_approx = (float)d_approx;
+            }
+        }
+        PERF_END(PERF_PHASE_APPROX);
+        if (bud && bud->partial) break;
+    }
+}
+
+// Distanza reale dei k candidati (id -1: FLT_MAX)
+static void real_distances(const MatrixF32 *ds, const float *q, int k, Neighbor *neighbors)
+{
+    size_t D = ds->d;
+
+    PERF_BEGIN(PERF_PHASE_RERANK);
+    for (int i = 0; i < k; i++) {
+        if (neighbors[i].id < 0) {
+            neighbors[i].dist_real = FLT_MAX;
+            continue;
+        }
+
+        const float *v = &ds->data[(size_t)neighbors[i].id * D];
+        neighbors[i].dist_real = euclidean_distance(q, v, D);
+    }
+    PERF_END(PERF_PHASE_RERANK);
+}
+
+// Scansione dei punti del dataset e distanza reale dei candidati per una
+// query gi quantizzata (vp_q, vn_q) con le sue distanze dai pivot dq_pivot.
+// k <= n e vicini gi inizializzati a cura del chiamante.
+static void scan_query(const MatrixF32 *ds,
+                       const Index *idx,
+                       const float *q,
+                       const uint8_t *vp_q,
+                       const uint8_t *vn_q,
+                       const int *dq_pivot,
+                       int k,
+                       ScanBudget *bud,
+                       Neighbor *neighbors)
+{
+    size_t n = ds->n;
+
+    // Scansione punti del dataset
+    size_t scanned = n, pruned = 0;
+
+    if (idx->n_sorted > 0) {
+        // Colonna ordinata: solo le righe vicine a d(q,p)
+        PERF_BEGIN(PERF_PHASE_APPROX);
+        scanned = sorted_scan(idx, vp_q, vn_q, dq_pivot, k, neighbors, &pruned, bud);
+        PERF_END(PERF_PHASE_APPROX);
+    } else {
+        int dq_hot[INDEX_MAX_HOT], buf[INDEX_ORDER_STACK];
+        int *order = index_cascade_begin(idx, dq_pivot, dq_hot, buf);
+        block_scan(idx, vp_q, vn_q, dq_pivot, dq_hot, order, 0, n, k, neighbors, &pruned, bud);
+        index_cascade_end(order, buf);
+    }
+    perf_scan_add(scanned, pruned);
+
+    real_distances(ds, q, k, neighbors);
+}
+
+// Come scan_query, ma con i candidati presi dalla cache se il codice della
+// query  gi noto (altrimenti scansione e inserimento). cache NULL o
+// memoria insufficiente: scan_query. Con bud il risultato, forse parziale
+// o con pruning rilassato, non viene inserito.
+static void scan_query_cached(const MatrixF32 *ds,
+                              const Index *idx,
+                              const float *q,
+                              const uint8_t *vp_q,
+                              const uint8_t *vn_q,
+                              const int *dq_pivot,
+                              int k,
+                              QueryCache *cache,
+                              ScanBudget *bud,
+                              Neighbor *neighbors)
+{
+    int *ids = cache ? (int *)malloc(2 * (size_t)k * sizeof(int)) : NULL;
+    if (!ids) {
+        scan_query(ds, idx, q, vp_q, vn_q, dq_pivot, k, bud, neighbors);
+        return;
+    }
+    int *dist = ids + k;
+
+    if (query_cache_get(cache, idx, vp_q, vn_q, k, ids, dist)) {
+        for (int i = 0; i < k; i++) {
+            neighbors[i].id          = ids[i];
+            neighbors[i].dist_approx = ids[i] < 0 ? FLT_MAX : (float)dist[i];
+        }
+        real_distances(ds, q, k, neighbors);
+    } else {
+        scan_query(ds, idx, q, vp_q, vn_q, dq_pivot, k, bud, neighbors);
+        for (int i = 0; i < k; i++) {
+            ids[i]  = neighbors[i].id;
+            dist[i] = neighbors[i].id < 0 ? 0 : (int)neighbors[i].dist_approx;
+        }
+        if (!bud) query_cache_put(cache, idx, vp_q, vn_q, k, ids, dist);
+    }
+    free(ids);
+}
 
+// KNN per UNA query
+static void query_single(const MatrixF32 *ds,
+                         const Index *idx,
+                         const float *q,
+                         int k,
+                         int x,
+                         QueryCache *cache,
+                         Neighbor *neighbors)
+{
     size_t n = ds->n;
     size_t D = ds->d;
     int h = (int)idx->h;
@@ -49,15 +334,17 @@ void knn_query_single(const MatrixF32 *ds,
     }
 
     // Quantizzazione query
-    uint8_t *vp_q = (uint8_t *)malloc(D * sizeof(uint8_t));
-    uint8_t *vn_q = (uint8_t *)malloc(D * sizeof(uint8_t));
+    uint8_t *vp_q = (uint8_t *)calloc(idx->Dp, sizeof(uint8_t));
+    uint8_t *vn_q = (uint8_t *)calloc(idx->Dp, sizeof(uint8_t));
     if (!vp_q || !vn_q) {
         free(vp_q);
         free(vn_q);
         return;
     }
 
-    quantize_vector(q, vp_q, vn_q, D, x);
+    PERF_BEGIN(PERF_PHASE_QUANT);
+    quantize_vector_graded(q, vp_q, vn_q, D, x, idx->bits);
+    PERF_END(PERF_PHASE_QUANT);
 
     // Distanze approssimata query-pivot
     int *dq_pivot = (int *)malloc(h * sizeof(int));
@@ -67,58 +354,209 @@ void knn_query_single(const MatrixF32 *ds,
         return;
     }
 
-    for (int j = 0; j < h; j++) {
-        const uint8_t *vpj = &idx->vp_piv[j * D];
-        const uint8_t *vnj = &idx->vn_piv[j * D];
-        dq_pivot[j] = approximate_distance(vp_q, vn_q, vpj, vnj, D);
-    }
+    PERF_BEGIN(PERF_PHASE_PIVOT);
+    index_pivot_distances(idx, vp_q, vn_q, 1, dq_pivot);
+    PERF_END(PERF_PHASE_PIVOT);
 
-    // Scansione punti del dataset
-    for (size_t i = 0; i < n; i++) {
+    scan_query_cached(ds, idx, q, vp_q, vn_q, dq_pivot, k, cache, NULL, neighbors);
 
-        // Limite inferiore calcolato attraverso pivot:
-        int d_star = 0;
-        for (int j = 0; j < h; j++) {
-            int dvp = idx->dist[i * h + j];  // d(v_i, p_j)
-            int diff = dvp - dq_pivot[j];
-            if (diff < 0) diff = -diff;
-            if (diff > d_star) d_star = diff;
-        }
+    free(vp_q);
+    free(vn_q);
+    free(dq_pivot);
+}
 
-        // Distanza approssimata peggiore nella lista
-        int worst = find_worst_neighbor(neighbors, k);
-        float worst_approx = neighbors[worst].dist_approx;
+void knn_query_single(const MatrixF32 *ds,
+                      const Index *idx,
+                      const float *q,
+                      int k,
+                      int x,
+                      Neighbor *neighbors)
+{
+    if (!ds || !idx || !q || !neighbors) return;
+    query_single(ds, idx, q, k, x, NULL, neighbors);
+}
 
-        // PRUNING
-        if ((float)d_star >= worst_approx)
-            continue;
+void knn_query_single_cached(const MatrixF32 *ds,
+                             const Index *idx,
+                             const float *q,
+                             int k,
+                             int x,
+                             QueryCache *cache,
+                             Neighbor *neighbors)
+{
+    if (!ds || !idx || !q || !neighbors) return;
+    query_single(ds, idx, q, k, x, cache, neighbors);
+}
 
-        // Calcolo distanza approssimata tra v_i e la query
-        const uint8_t *vpi = &idx->vp_all[i * D];
-        const uint8_t *vni = &idx->vn_all[i * D];
+// Ordinamento crescente per distanza reale (id -1 in coda: distanza FLT_MAX)
+static int cmp_neighbor_real(const void *a, const void *b)
+{
+    float A = ((const Neighbor *)a)->dist_real;
+    float B = ((const Neighbor *)b)->dist_real;
+    return (A > B) - (A < B);
+}
 
-        int d_approx = approximate_distance(vp_q, vn_q, vpi, vni, D);
+// I k migliori per distanza reale fra i kk candidati (riordinati sul posto);
+// slot oltre kk con id -1
+static void rerank_select(Neighbor *cand, int kk, int k, Neighbor *neighbors)
+{
+    qsort(cand, (size_t)kk, sizeof(Neighbor), cmp_neighbor_real);
 
-        if ((float)d_approx < worst_approx) {
-            neighbors[worst].id          = (int)i;
-            neighbors[worst].dist_approx = (float)d_approx;
+    for (int i = 0; i < k; i++) {
+        if (i < kk) {
+            neighbors[i] = cand[i];
+        } else {
+            neighbors[i].id          = -1;
+            neighbors[i].dist_approx = FLT_MAX;
+            neighbors[i].dist_real   = FLT_MAX;
         }
     }
+}
 
-    // Calcolo distanza reale per i candidati trovati
-    for (int i = 0; i < k; i++) {
-        if (neighbors[i].id < 0) {
-            neighbors[i].dist_real = FLT_MAX;
-            continue;
+void knn_query_single_rerank(const MatrixF32 *ds,
+                             const Index *idx,
+                             const float *q,
+                             int k,
+                             int x,
+                             int r,
+                             Neighbor *neighbors)
+{
+    if (!ds || !idx || !q || !neighbors || k <= 0) return;
+
+    if (r < 1) r = 1;
+    int kk = k * r;
+    if (kk > (int)ds->n) kk = (int)ds->n;
+
+    Neighbor *cand = (Neighbor *)malloc((size_t)kk * sizeof(Neighbor));
+    if (!cand) return;
+
+    knn_query_single(ds, idx, q, kk, x, cand);
+    rerank_select(cand, kk, k, neighbors);
+
+    free(cand);
+}
+
+// ------------------ QUERY PREELABORATE ----------------------
+
+// Query preparate e poi scandite per blocco da knn_query_all(_rerank/_opt):
+// la memoria dei codici resta limitata anche con molte query
+#define PREP_BLOCK 1024
+
+// Righe [begin, end) di qc: quantizzazione delle query Q (stesse righe) e
+// matrice delle distanze dai pivot a blocchi (index_pivot_distances)
+static void prepare_rows(const Index *idx, const float *Q, int x, QueryCodes *qc, size_t begin, size_t end)
+{
+    size_t D = idx->D, Dp = qc->D;
+
+    PERF_BEGIN(PERF_PHASE_QUANT);
+    for (size_t i = begin; i < end; i++)
+        quantize_vector_graded(&Q[i * D], &qc->vp[i * Dp], &qc->vn[i * Dp], D, x, idx->bits);
+    PERF_END(PERF_PHASE_QUANT);
+
+    PERF_BEGIN(PERF_PHASE_PIVOT);
+    index_pivot_distances(idx, &qc->vp[begin * Dp], &qc->vn[begin * Dp], end - begin, &qc->dq[begin * qc->h]);
+    PERF_END(PERF_PHASE_PIVOT);
+}
+
+QueryCodes *prepare_queries(const Index *idx, const MatrixF32 *queries, int x)
+{
+    if (!idx || !queries || queries->d != idx->D) return NULL;
+
+    QueryCodes *qc = query_codes_alloc(queries->n, idx->Dp, idx->h);
+    if (!qc) return NULL;
+
+    size_t nb = (qc->nq + INDEX_PIVOT_BLOCK - 1) / INDEX_PIVOT_BLOCK;
+
+    #pragma omp parallel for schedule(static)
+    for (long b = 0; b < (long)nb; b++) {
+        size_t begin = (size_t)b * INDEX_PIVOT_BLOCK;
+        size_t end = begin + INDEX_PIVOT_BLOCK < qc->nq ? begin + INDEX_PIVOT_BLOCK : qc->nq;
+        prepare_rows(idx, queries->data, x, qc, begin, end);
+    }
+    return qc;
+}
+
+// Query i di qc (vettore originale q), con re-rank dei k*r candidati se r > 1,
+// candidati dalla cache se cache != NULL e budget bud se != NULL
+static void query_prepared(const MatrixF32 *ds,
+                           const Index *idx,
+                           const float *q,
+                           const QueryCodes *qc,
+                           size_t i,
+                           int k,
+                           int r,
+                           QueryCache *cache,
+                           ScanBudget *bud,
+                           Neighbor *neighbors)
+{
+    int kk = r > 1 ? k * r : k;
+    if (kk > (int)ds->n) kk = (int)ds->n;
+
+    Neighbor *cand = neighbors;
+    if (r > 1) {
+        cand = (Neighbor *)malloc((size_t)kk * sizeof(Neighbor));
+        if (!cand) return;
+    }
+
+    for (int j = 0; j < kk; j++) {
+        cand[j].id          = -1;
+        cand[j].dist_approx = FLT_MAX;
+        cand[j].dist_real   = FLT_MAX;
+    }
+
+    scan_query_cached(ds, idx, q, &qc->vp[i * qc->D], &qc->vn[i * qc->D], &qc->dq[i * qc->h], kk, cache, bud, cand);
+
+    if (cand != neighbors) {
+        rerank_select(cand, kk, k, neighbors);
+        free(cand);
+    }
+}
+
+void knn_query_single_prepared(const MatrixF32 *ds,
+                               const Index *idx,
+                               const float *q,
+                               const QueryCodes *qc,
+                               size_t i,
+                               int k,
+                               Neighbor *neighbors)
+{
+    if (!ds || !idx || !q || !qc || i >= qc->nq || !neighbors) return;
+    query_prepared(ds, idx, q, qc, i, k, 1, NULL, NULL, neighbors);
+}
+
+// Blocchi di PREP_BLOCK query: preparazione in parallelo, poi scansione
+static void query_all_prepared(const MatrixF32 *ds,
+                               const Index *idx,
+                               const MatrixF32 *queries,
+                               int k,
+                               int x,
+                               int r,
+                               Neighbor *results)
+{
+    size_t nq = queries->n, D = queries->d;
+    QueryCodes *qc = query_codes_alloc(nq < PREP_BLOCK ? nq : PREP_BLOCK, idx->Dp, idx->h);
+
+    if (!qc) return;
+
+    for (size_t q0 = 0; q0 < nq; q0 += PREP_BLOCK) {
+        size_t qn = nq - q0 < PREP_BLOCK ? nq - q0 : PREP_BLOCK;
+        const float *Q = &queries->data[q0 * D];
+        size_t nb = (qn + INDEX_PIVOT_BLOCK - 1) / INDEX_PIVOT_BLOCK;
+
+        #pragma omp parallel for schedule(static)
+        for (long b = 0; b < (long)nb; b++) {
+            size_t begin = (size_t)b * INDEX_PIVOT_BLOCK;
+            size_t end = begin + INDEX_PIVOT_BLOCK < qn ? begin + INDEX_PIVOT_BLOCK : qn;
+            prepare_rows(idx, Q, x, qc, begin, end);
         }
 
-        const float *v = &ds->data[(size_t)neighbors[i].id * D];
-        neighbors[i].dist_real = euclidean_distance(q, v, D);
+        // Ogni thread elabora una query da solo
+        #pragma omp parallel for schedule(dynamic)
+        for (long i = 0; i < (long)qn; i++)
+            query_prepared(ds, idx, &Q[(size_t)i * D], qc, (size_t)i, k, r, NULL, NULL, &results[(q0 + (size_t)i) * k]);
     }
 
-    free(vp_q);
-    free(vn_q);
-    free(dq_pivot);
+    free_query_codes(qc);
 }
 
 // KNN per tutte le query
@@ -131,12 +569,1333 @@ void knn_query_all(const MatrixF32 *ds,
 {
     if (!ds || !idx || !queries || !results) return;
 
+    query_all_prepared(ds, idx, queries, k, x, 1, results);
+}
+
+void knn_query_all_rerank(const MatrixF32 *ds,
+                          const Index *idx,
+                          const MatrixF32 *queries,
+                          int k,
+                          int x,
+                          int r,
+                          Neighbor *results)
+{
+    if (!ds || !idx || !queries || !results || k <= 0) return;
+
+    query_all_prepared(ds, idx, queries, k, x, r < 1 ? 1 : r, results);
+}
+
+// ------------------ POOL DI THREAD PERSISTENTE ----------------------
+
+// Query consegnate a un worker per volta: abbastanza da ammortizzare il
+// dispatch, abbastanza poche da bilanciare il carico
+#define POOL_QCHUNK 8
+
+typedef struct {
+    const MatrixF32  *ds;
+    const Index      *idx;
+    const float      *Q;       // prima query del blocco
+    int               k, x, r;
+    QueryCodes       *qc;
+    QueryCache       *cache;
+    Neighbor         *results; // risultati della prima query del blocco
+    const QueryOptions *opt;   // alpha e budget se budget != 0
+    int               budget;
+    uint8_t          *partial; // flag della prima query del blocco (o NULL)
+} QueryTask;
+
+static void prepare_task(void *ctx, size_t begin, size_t end, int tid)
+{
+    const QueryTask *t = (const QueryTask *)ctx;
+    (void)tid;
+    prepare_rows(t->idx, t->Q, t->x, t->qc, begin, end);
+}
+
+static void query_task(void *ctx, size_t begin, size_t end, int tid)
+{
+    const QueryTask *t = (const QueryTask *)ctx;
+    size_t D = t->idx->D;
+    (void)tid;
+
+    for (size_t i = begin; i < end; i++) {
+        ScanBudget b, *bud = NULL;
+        if (t->budget) {
+            scan_budget_init(&b, t->opt);
+            bud = &b;
+        }
+        query_prepared(t->ds, t->idx, &t->Q[i * D], t->qc, i, t->k, t->r, t->cache, bud, &t->results[i * t->k]);
+        if (t->partial) t->partial[i] = bud ? (uint8_t)b.partial : 0;
+    }
+}
+
+void knn_query_all_opt(const MatrixF32 *ds,
+                       const Index *idx,
+                       const MatrixF32 *queries,
+                       int k,
+                       int x,
+                       const QueryOptions *opt,
+                       Neighbor *results)
+{
+    if (!ds || !idx || !queries || !results || k <= 0) return;
+
+    QueryOptions def;
+    if (!opt) { query_default_options(&def); opt = &def; }
+
+    size_t nq = queries->n, D = queries->d;
+    int budget = query_budget_active(opt);
+    QueryCodes *qc = query_codes_alloc(nq < PREP_BLOCK ? nq : PREP_BLOCK, idx->Dp, idx->h);
+    if (!qc) return;
+
+    // Stessi due stadi di knn_query_all, entrambi sul pool
+    for (size_t q0 = 0; q0 < nq; q0 += PREP_BLOCK) {
+        size_t qn = nq - q0 < PREP_BLOCK ? nq - q0 : PREP_BLOCK;
+        QueryTask t = { ds, idx, &queries->data[q0 * D], k, x, opt->r, qc, opt->cache, &results[q0 * k],
+                        opt, budget, opt->partial ? &opt->partial[q0] : NULL };
+        pool_parallel_for(pool_default(), opt->num_threads, qn, INDEX_PIVOT_BLOCK, prepare_task, &t);
+        pool_parallel_for(pool_default(), opt->num_threads, qn, POOL_QCHUNK, query_task, &t);
+    }
+
+    free_query_codes(qc);
+}
+
+int knn_query_single_opt(const MatrixF32 *ds,
+                         const Index *idx,
+                         const float *q,
+                         int k,
+                         int x,
+                         const QueryOptions *opt,
+                         Neighbor *neighbors)
+{
+    if (!ds || !idx || !q || !neighbors || k <= 0) return 0;
+
+    QueryOptions def;
+    if (!opt) { query_default_options(&def); opt = &def; }
+
+    QueryCodes *qc = query_codes_alloc(1, idx->Dp, idx->h);
+    if (!qc) return 0;
+    prepare_rows(idx, q, x, qc, 0, 1);
+
+    ScanBudget b, *bud = NULL;
+    if (query_budget_active(opt)) {
+        scan_budget_init(&b, opt);
+        bud = &b;
+    }
+    query_prepared(ds, idx, q, qc, 0, k, opt->r, opt->cache, bud, neighbors);
+
+    free_query_codes(qc);
+    return bud ? b.partial : 0;
+}
+
+// KNN con una replica dell'indice per nodo NUMA: ogni thread legge la
+// replica del nodo su cui gira (thread fissati con affinity_pin_threads)
+void knn_query_all_replicated(const MatrixF32 *ds,
+                              const IndexReplicas *rep,
+                              const MatrixF32 *queries,
+                              int k,
+                              int x,
+                              int r,
+                              Neighbor *results)
+{
+    if (!ds || !rep || !queries || !results) return;
+
     #pragma omp parallel for schedule(dynamic)
     for (size_t qi = 0; qi < queries->n; qi++) {
         const float *q = &queries->data[qi * queries->d];
-        Neighbor *nb = &results[qi * k];
+        const Index *idx = index_replica_local(rep);
+        if (r > 1)
+            knn_query_single_rerank(ds, idx, q, k, x, r, &results[qi * k]);
+        else
+            knn_query_single(ds, idx, q, k, x, &results[qi * k]);
+    }
+}
 
-        // Ogni thread elabora una query da solo
-        knn_query_single(ds, idx, q, k, x, nb);
+// ------------------ INDICE PARTIZIONATO (ShardedIndex) ----------------------
+//
+// Ogni shard restituisce i propri k vicini (id locali); il merge converte
+// gli id in globali (offset dello shard) e tiene i k con distanza
+// approssimata minore (a parit, distanza reale), in ordine crescente.
+// Le distanze approssimate sono confrontabili fra shard perch la
+// quantizzazione dipende solo dal vettore, non dai pivot.
+//
+// ----------------------------------------------------------------------------
+
+// Query elaborate insieme da knn_query_sharded_all (buffer S*k per query)
+#define SHARD_QB 64
+
+static int neighbor_before(const Neighbor *a, const Neighbor *b)
+{
+    if (a->dist_approx != b->dist_approx) return a->dist_approx < b->dist_approx;
+    return a->dist_real < b->dist_real;
+}
+
+static void init_neighbors(Neighbor *nb, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        nb[i].id          = -1;
+        nb[i].dist_approx = FLT_MAX;
+        nb[i].dist_real   = FLT_MAX;
+    }
+}
+
+static void merge_shards(const ShardedIndex *sx, const Neighbor *part, int k, Neighbor *out)
+{
+    int size = 0;
+
+    for (size_t s = 0; s < sx->S; s++) {
+        for (int j = 0; j < k; j++) {
+            Neighbor c = part[s * k + j];
+            if (c.id < 0) continue;
+            c.id += (int)sx->offset[s];
+
+            if (size == k && !neighbor_before(&c, &out[k - 1])) continue;
+
+            // Inserimento ordinato (k piccolo)
+            int i = size < k ? size++ : k - 1;
+            while (i > 0 && neighbor_before(&c, &out[i - 1])) {
+                out[i] = out[i - 1];
+                i--;
+            }
+            out[i] = c;
+        }
+    }
+
+    init_neighbors(&out[size], (size_t)(k - size));
+}
+
+// KNN per UNA query: gli shard sono interrogati in parallelo
+void knn_query_sharded_single(const MatrixF32 *ds,
+                              const ShardedIndex *sx,
+                              const float *q,
+                              int k,
+                              int x,
+                              Neighbor *neighbors)
+{
+    if (!ds || !sx || !q || !neighbors || k <= 0) return;
+
+    Neighbor *part = (Neighbor *)malloc(sx->S * (size_t)k * sizeof(Neighbor));
+    if (!part) return;
+    init_neighbors(part, sx->S * (size_t)k);
+
+    #pragma omp parallel for schedule(dynamic)
+    for (long s = 0; s < (long)sx->S; s++) {
+        MatrixF32 view = shard_view(ds, sx, (size_t)s);
+        knn_query_single(&view, sx->shards[s], q, k, x, &part[(size_t)s * k]);
+    }
+
+    merge_shards(sx, part, k, neighbors);
+    free(part);
+}
+
+// KNN per tutte le query: le coppie (query, shard) di un blocco sono
+// distribuite fra i thread, poi ogni query fonde i suoi S risultati
+void knn_query_sharded_all(const MatrixF32 *ds,
+                           const ShardedIndex *sx,
+                           const MatrixF32 *queries,
+                           int k,
+                           int x,
+                           Neighbor *results)
+{
+    if (!ds || !sx || !queries || !results || k <= 0) return;
+
+    size_t S  = sx->S;
+    size_t nq = queries->n;
+    size_t D  = queries->d;
+
+    Neighbor *part = (Neighbor *)malloc(SHARD_QB * S * (size_t)k * sizeof(Neighbor));
+    if (!part) return;
+
+    for (size_t q0 = 0; q0 < nq; q0 += SHARD_QB) {
+        size_t qc = nq - q0 < SHARD_QB ? nq - q0 : SHARD_QB;
+        init_neighbors(part, qc * S * (size_t)k);
+
+        #pragma omp parallel for schedule(dynamic)
+        for (long t = 0; t < (long)(qc * S); t++) {
+            size_t qi = (size_t)t / S, s = (size_t)t % S;
+            MatrixF32 view = shard_view(ds, sx, s);
+            knn_query_single(&view, sx->shards[s], &queries->data[(q0 + qi) * D],
+                             k, x, &part[(size_t)t * k]);
+        }
+
+        #pragma omp parallel for schedule(static)
+        for (long qi = 0; qi < (long)qc; qi++)
+            merge_shards(sx, &part[(size_t)qi * S * k], k, &results[(q0 + qi) * (size_t)k]);
+    }
+
+    free(part);
+}
+
+// ------------------ RICERCA PER RAGGIO (RangeResult) ----------------------
+//
+// Stessa scansione di knn_query_single, ma la soglia del pruning  il
+// raggio r invece del vicino peggiore:  fissa per tutta la scansione, quindi
+// si scartano tutti i punti con d* > r senza aggiornare alcuna lista.
+//
+// ----------------------------------------------------------------------------
+
+// Vicini di una query in costruzione (capacit raddoppiata quando serve)
+typedef struct {
+    Neighbor *v;
+    size_t    n, cap;
+} RangeBuf;
+
+static int range_push(RangeBuf *b, int id, float d_approx)
+{
+    if (b->n == b->cap) {
+        size_t cap = b->cap ? 2 * b->cap : 16;
+        Neighbor *v = (Neighbor *)realloc(b->v, cap * sizeof(Neighbor));
+        if (!v) return -1;
+        b->v = v;
+        b->cap = cap;
     }
+    b->v[b->n].id          = id;
+    b->v[b->n].dist_approx = d_approx;
+    b->v[b->n].dist_real   = FLT_MAX;
+    b->n++;
+    return 0;
+}
+
+// Chiave intera della colonna ordinata, saturata (r pu essere enorme)
+static int range_key(double v)
+{
+    if (v <= (double)INT_MIN) return INT_MIN;
+    if (v >= (double)INT_MAX) return INT_MAX;
+    return (int)v;
+}
+
+static int cmp_neighbor_id(const void *a, const void *b)
+{
+    int A = ((const Neighbor *)a)->id;
+    int B = ((const Neighbor *)b)->id;
+    return (A > B) - (A < B);
+}
+
+// Range con colonna ordinata: fra le colonne si sceglie quella con meno
+// righe nella finestra, poi si visitano solo quelle. I risultati sono
+// riordinati per id come nella scansione completa. Ritorna le righe visitate.
+static size_t range_sorted_scan(const Index *idx,
+                                const uint8_t *vp_q,
+                                const uint8_t *vn_q,
+                                const int *dq_pivot,
+                                float r,
+                                RangeBuf *out,
+                                size_t *pruned,
+                                int *ret)
+{
+    size_t Dp = idx->Dp;
+    int h = (int)idx->h;
+    size_t first = out->n;
+
+    int c = 0;
+    size_t lo = 0, hi = 0;
+    for (int t = 0; t < idx->n_sorted; t++) {
+        int dq = dq_pivot[idx->sorted_piv[t]];
+        // chiave >= dq - r  e  chiave <= dq + r (chiavi intere)
+        size_t a = index_sorted_lower_bound(idx, t, range_key(ceil((double)dq - (double)r)));
+        double up = floor((double)dq + (double)r);
+        size_t b = up >= (double)INT_MAX ? idx->n : index_sorted_lower_bound(idx, t, range_key(up) + 1);
+        if (t == 0 || b - a < hi - lo) {
+            c = t;
+            lo = a;
+            hi = b;
+        }
+    }
+
+    const uint32_t *ids = &idx->sorted_id[(size_t)c * idx->n];
+
+    for (size_t p = lo; p < hi; p++) {
+        size_t i = ids[p];
+
+        const int *dv = &idx->dist[i * h];
+        int best = 0;
+        for (int j = 0; j < h; j++) {
+            int diff = dv[j] - dq_pivot[j];
+            if (diff < 0) diff = -diff;
+            if (diff > best) best = diff;
+        }
+
+        // PRUNING con soglia fissa
+        if ((float)best > r) {
+            (*pruned)++;
+            continue;
+        }
+
+        const uint8_t *vpi = &idx->vp_all[i * Dp];
+        const uint8_t *vni = &idx->vn_all[i * Dp];
+        int d_approx = index_code_distance(idx, vp_q, vn_q, vpi, vni);
+
+        if ((float)d_approx <= r && range_push(out, (int)i, (float)d_approx) != 0) {
+            *ret = -1;
+            break;
+        }
+    }
+
+    qsort(&out->v[first], out->n - first, sizeof(Neighbor), cmp_neighbor_id);
+    return hi - lo;
+}
+
+// Aggiunge a out i punti con distanza approssimata <= r (e reale <= r_real
+// se r_real >= 0), in ordine crescente di id. Ritorna 0, -1 se manca memoria.
+static int range_scan(const MatrixF32 *ds,
+                      const Index *idx,
+                      const float *q,
+                      int x,
+                      float r,
+                      float r_real,
+                      RangeBuf *out)
+{
+    size_t n = ds->n;
+    size_t D = ds->d;
+    int h = (int)idx->h;
+
+    uint8_t *vp_q = (uint8_t *)calloc(idx->Dp, sizeof(uint8_t));
+    uint8_t *vn_q = (uint8_t *)calloc(idx->Dp, sizeof(uint8_t));
+    int *dq_pivot = (int *)malloc(h * sizeof(int));
+    if (!vp_q || !vn_q || !dq_pivot) {
+        free(vp_q);
+        free(vn_q);
+        free(dq_pivot);
+        return -1;
+    }
+
+    PERF_BEGIN(PERF_PHASE_QUANT);
+    quantize_vector_graded(q, vp_q, vn_q, D, x, idx->bits);
+    PERF_END(PERF_PHASE_QUANT);
+
+    PERF_BEGIN(PERF_PHASE_PIVOT);
+    index_pivot_distances(idx, vp_q, vn_q, 1, dq_pivot);
+    PERF_END(PERF_PHASE_PIVOT);
+
+    size_t scanned = n, pruned = 0;
+    size_t first = out->n;
+    int ret = 0;
+
+    if (idx->n_sorted > 0) {
+        // Colonna ordinata: solo la finestra [d(q,p) - r, d(q,p) + r]
+        PERF_BEGIN(PERF_PHASE_APPROX);
+        scanned = range_sorted_scan(idx, vp_q, vn_q, dq_pivot, r, out, &pruned, &ret);
+        PERF_END(PERF_PHASE_APPROX);
+    } else {
+        int d_star[SCAN_BLOCK];
+
+        // Cascata: soglia fissa, d* > r se e solo se d* >= limit
+        int dq_hot[INDEX_MAX_HOT], buf[INDEX_ORDER_STACK];
+        int limit = cascade_limit(floorf(r) + 1.0f);
+        int *order = index_cascade_begin(idx, dq_pivot, dq_hot, buf);
+
+        for (size_t i0 = 0; i0 < n && ret == 0; i0 += SCAN_BLOCK) {
+            size_t cnt = n - i0 < SCAN_BLOCK ? n - i0 : SCAN_BLOCK;
+
+            PERF_BEGIN(PERF_PHASE_LB);
+            for (size_t b = 0; b < cnt; b++) {
+                if (order) {
+                    d_star[b] = index_cascade_bound(idx, i0 + b, dq_hot, dq_pivot, order, limit);
+                    continue;
+                }
+                const int *dv = &idx->dist[(i0 + b) * h];
+                int best = 0;
+                for (int j = 0; j < h; j++) {
+                    int diff = dv[j] - dq_pivot[j];
+                    if (diff < 0) diff = -diff;
+                    if (diff > best) best = diff;
+                }
+                d_star[b] = best;
+            }
+            PERF_END(PERF_PHASE_LB);
+
+            PERF_BEGIN(PERF_PHASE_APPROX);
+            for (size_t b = 0; b < cnt; b++) {
+                size_t i = i0 + b;
+
+                // PRUNING con soglia fissa
+                if ((float)d_star[b] > r) {
+                    pruned++;
+                    continue;
+                }
+
+                const uint8_t *vpi = &idx->vp_all[i * idx->Dp];
+                const uint8_t *vni = &idx->vn_all[i * idx->Dp];
+                int d_approx = index_code_distance(idx, vp_q, vn_q, vpi, vni);
+
+                if ((float)d_approx <= r && range_push(out, (int)i, (float)d_approx) != 0) {
+                    ret = -1;
+                    break;
+                }
+            }
+            PERF_END(PERF_PHASE_APPROX);
+        }
+        index_cascade_end(order, buf);
+    }
+    perf_scan_add(scanned, pruned);
+
+    // Distanza reale dei candidati ed eventuale filtro su r_real
+    PERF_BEGIN(PERF_PHASE_RERANK);
+    size_t kept = first;
+    for (size_t c = first; c < out->n; c++) {
+        Neighbor nb = out->v[c];
+        nb.dist_real = euclidean_distance(q, &ds->data[(size_t)nb.id * D], D);
+        if (r_real >= 0.0f && nb.dist_real > r_real) continue;
+        out->v[kept++] = nb;
+    }
+    out->n = kept;
+    PERF_END(PERF_PHASE_RERANK);
+
+    free(vp_q);
+    free(vn_q);
+    free(dq_pivot);
+    return ret;
+}
+
+// Concatena i buffer di nq query in un RangeResult e li libera
+static RangeResult *range_pack(RangeBuf *bufs, size_t nq)
+{
+    RangeResult *res = (RangeResult *)malloc(sizeof(RangeResult));
+    size_t total = 0;
+    for (size_t i = 0; i < nq; i++) total += bufs[i].n;
+
+    if (res) {
+        res->nq      = nq;
+        res->offsets = (size_t *)malloc((nq + 1) * sizeof(size_t));
+        res->items   = (Neighbor *)malloc((total ? total : 1) * sizeof(Neighbor));
+        if (!res->offsets || !res->items) {
+            free_range_result(res);
+            res = NULL;
+        }
+    }
+
+    size_t pos = 0;
+    for (size_t i = 0; i < nq; i++) {
+        if (res) {
+            res->offsets[i] = pos;
+            if (bufs[i].n) memcpy(&res->items[pos], bufs[i].v, bufs[i].n * sizeof(Neighbor));
+            pos += bufs[i].n;
+        }
+        free(bufs[i].v);
+    }
+    if (res) res->offsets[nq] = pos;
+
+    free(bufs);
+    return res;
+}
+
+RangeResult *range_query_single(const MatrixF32 *ds,
+                                const Index *idx,
+                                const float *q,
+                                int x,
+                                float r,
+                                float r_real)
+{
+    if (!ds || !idx || !q) return NULL;
+
+    RangeBuf *buf = (RangeBuf *)calloc(1, sizeof(RangeBuf));
+    if (!buf) return NULL;
+
+    if (range_scan(ds, idx, q, x, r, r_real, buf) != 0) {
+        free(buf->v);
+        free(buf);
+        return NULL;
+    }
+    return range_pack(buf, 1);
+}
+
+RangeResult *range_query_all(const MatrixF32 *ds,
+                             const Index *idx,
+                             const MatrixF32 *queries,
+                             int x,
+                             float r,
+                             float r_real)
+{
+    if (!ds || !idx || !queries) return NULL;
+
+    size_t nq = queries->n;
+    RangeBuf *bufs = (RangeBuf *)calloc(nq ? nq : 1, sizeof(RangeBuf));
+    if (!bufs) return NULL;
+
+    int failed = 0;
+
+    #pragma omp parallel for schedule(dynamic) reduction(|:failed)
+    for (long qi = 0; qi < (long)nq; qi++) {
+        const float *q = &queries->data[(size_t)qi * queries->d];
+        if (range_scan(ds, idx, q, x, r, r_real, &bufs[qi]) != 0) failed = 1;
+    }
+
+    if (failed) {
+        for (size_t i = 0; i < nq; i++) free(bufs[i].v);
+        free(bufs);
+        return NULL;
+    }
+    return range_pack(bufs, nq);
+}
+
+// Shard in ordine di riga: concatenando i risultati gli id restano crescenti
+RangeResult *range_query_sharded_all(const MatrixF32 *ds,
+                                     const ShardedIndex *sx,
+                                     const MatrixF32 *queries,
+                                     int x,
+                                     float r,
+                                     float r_real)
+{
+    if (!ds || !sx || !queries) return NULL;
+
+    size_t nq = queries->n;
+    RangeResult **part = (RangeResult **)calloc(sx->S, sizeof(RangeResult *));
+    RangeBuf *bufs = (RangeBuf *)calloc(nq ? nq : 1, sizeof(RangeBuf));
+    int failed = !part || !bufs;
+
+    for (size_t s = 0; s < sx->S && !failed; s++) {
+        MatrixF32 view = shard_view(ds, sx, s);
+        part[s] = range_query_all(&view, sx->shards[s], queries, x, r, r_real);
+        if (!part[s]) failed = 1;
+    }
+
+    for (size_t i = 0; i < nq && !failed; i++) {
+        for (size_t s = 0; s < sx->S && !failed; s++) {
+            const RangeResult *p = part[s];
+            for (size_t c = p->offsets[i]; c < p->offsets[i + 1]; c++) {
+                Neighbor nb = p->items[c];
+                if (range_push(&bufs[i], nb.id + (int)sx->offset[s], nb.dist_approx) != 0) {
+                    failed = 1;
+                    break;
+                }
+                bufs[i].v[bufs[i].n - 1].dist_real = nb.dist_real;
+            }
+        }
+    }
+
+    if (part)
+        for (size_t s = 0; s < sx->S; s++) free_range_result(part[s]);
+    free(part);
+
+    if (failed) {
+        if (bufs)
+            for (size_t i = 0; i < nq; i++) free(bufs[i].v);
+        free(bufs);
+        return NULL;
+    }
+    return range_pack(bufs, nq);
+}
+
+void free_range_result(RangeResult *res)
+{
+    if (!res) return;
+    free(res->offsets);
+    free(res->items);
+    free(res);
+}
+
+// ------------------ K-NN FILTRATO (RowFilter) ----------------------
+//
+// Il filtro  applicato nella scansione, prima del limite inferiore: le
+// righe escluse non costano n d* n la distanza approssimata e la lista
+// contiene sempre k righe ammesse (se ce ne sono). Con un filtro molto
+// selettivo (<= n / ROW_FILTER_SPARSE righe ammesse) si scandisce
+// direttamente l'elenco degli id ammessi.
+//
+// ----------------------------------------------------------------------------
+
+// Scansione di knn_query_single ristretta alle righe ammesse da f, oppure
+// (rows != NULL) alle n_rows righe elencate in rows
+static void knn_filtered_scan(const MatrixF32 *ds,
+                              const Index *idx,
+                              const float *q,
+                              int k,
+                              int x,
+                              const RowFilter *f,
+                              const uint32_t *rows,
+                              size_t n_rows,
+                              Neighbor *neighbors)
+{
+    size_t n = ds->n;
+    size_t D = ds->d;
+    int h = (int)idx->h;
+
+    if (k > (int)n) k = (int)n;
+
+    for (int i = 0; i < k; i++) {
+        neighbors[i].id          = -1;
+        neighbors[i].dist_approx = FLT_MAX;
+        neighbors[i].dist_real   = FLT_MAX;
+    }
+
+    uint8_t *vp_q = (uint8_t *)calloc(idx->Dp, sizeof(uint8_t));
+    uint8_t *vn_q = (uint8_t *)calloc(idx->Dp, sizeof(uint8_t));
+    int *dq_pivot = (int *)malloc(h * sizeof(int));
+    if (!vp_q || !vn_q || !dq_pivot) {
+        free(vp_q);
+        free(vn_q);
+        free(dq_pivot);
+        return;
+    }
+
+    PERF_BEGIN(PERF_PHASE_QUANT);
+    quantize_vector_graded(q, vp_q, vn_q, D, x, idx->bits);
+    PERF_END(PERF_PHASE_QUANT);
+
+    PERF_BEGIN(PERF_PHASE_PIVOT);
+    index_pivot_distances(idx, vp_q, vn_q, 1, dq_pivot);
+    PERF_END(PERF_PHASE_PIVOT);
+
+    size_t total = rows ? n_rows : n;
+    size_t row[SCAN_BLOCK];
+    int d_star[SCAN_BLOCK];
+    size_t scanned = 0, pruned = 0;
+
+    for (size_t i0 = 0; i0 < total; i0 += SCAN_BLOCK) {
+        size_t cnt = total - i0 < SCAN_BLOCK ? total - i0 : SCAN_BLOCK;
+
+        // Filtro + limite inferiore; le righe escluse hanno d* = -1
+        PERF_BEGIN(PERF_PHASE_LB);
+        for (size_t b = 0; b < cnt; b++) {
+            size_t i = rows ? rows[i0 + b] : i0 + b;
+            row[b] = i;
+            if (!rows && !row_filter_allows(f, i)) {
+                d_star[b] = -1;
+                continue;
+            }
+            const int *dv = &idx->dist[i * h];
+            int best = 0;
+            for (int j = 0; j < h; j++) {
+                int diff = dv[j] - dq_pivot[j];
+                if (diff < 0) diff = -diff;
+                if (diff > best) best = diff;
+            }
+            d_star[b] = best;
+            scanned++;
+        }
+        PERF_END(PERF_PHASE_LB);
+
+        PERF_BEGIN(PERF_PHASE_APPROX);
+        for (size_t b = 0; b < cnt; b++) {
+            if (d_star[b] < 0) continue;
+            size_t i = row[b];
+
+            int worst = find_worst_neighbor(neighbors, k);
+            float worst_approx = neighbors[worst].dist_approx;
+
+            // PRUNING
+            if ((float)d_star[b] >= worst_approx) {
+                pruned++;
+                continue;
+            }
+
+            const uint8_t *vpi = &idx->vp_all[i * idx->Dp];
+            const uint8_t *vni = &idx->vn_all[i * idx->Dp];
+            int d_approx = index_code_distance(idx, vp_q, vn_q, vpi, vni);
+
+            if ((float)d_approx < worst_approx) {
+                neighbors[worst].id          = (int)i;
+                neighbors[worst].dist_approx = (float)d_approx;
+            }
+        }
+        PERF_END(PERF_PHASE_APPROX);
+    }
+    perf_scan_add(scanned, pruned);
+
+    PERF_BEGIN(PERF_PHASE_RERANK);
+    for (int i = 0; i < k; i++) {
+        if (neighbors[i].id < 0) continue;
+        const float *v = &ds->data[(size_t)neighbors[i].id * D];
+        neighbors[i].dist_real = euclidean_distance(q, v, D);
+    }
+    PERF_END(PERF_PHASE_RERANK);
+
+    free(vp_q);
+    free(vn_q);
+    free(dq_pivot);
+}
+
+// Elenco degli id ammessi se il filtro  selettivo, altrimenti NULL
+// (scansione con test del bit). *n_rows = righe elencate.
+static uint32_t *filter_rows(const RowFilter *f, size_t n, size_t *n_rows)
+{
+    *n_rows = 0;
+    size_t allowed = row_filter_count(f, n);
+    if (allowed * ROW_FILTER_SPARSE > n) return NULL;
+
+    uint32_t *rows = (uint32_t *)malloc((allowed ? allowed : 1) * sizeof(uint32_t));
+    if (rows) *n_rows = row_filter_rows(f, n, rows);
+    return rows;
+}
+
+void knn_query_single_filtered(const MatrixF32 *ds,
+                               const Index *idx,
+                               const float *q,
+                               int k,
+                               int x,
+                               const RowFilter *f,
+                               Neighbor *neighbors)
+{
+    if (!ds || !idx || !q || !neighbors || k <= 0) return;
+    if (!f || !f->bits) {
+        knn_query_single(ds, idx, q, k, x, neighbors);
+        return;
+    }
+
+    size_t n_rows;
+    uint32_t *rows = filter_rows(f, ds->n, &n_rows);
+    knn_filtered_scan(ds, idx, q, k, x, f, rows, n_rows, neighbors);
+    free(rows);
+}
+
+void knn_query_all_filtered(const MatrixF32 *ds,
+                            const Index *idx,
+                            const MatrixF32 *queries,
+                            int k,
+                            int x,
+                            const RowFilter *filters,
+                            size_t n_filters,
+                            Neighbor *results)
+{
+    if (!ds || !idx || !queries || !results || k <= 0) return;
+    if (!filters || (n_filters != 1 && n_filters != queries->n)) return;
+    if (n_filters == 1 && !filters->bits) {
+        knn_query_all(ds, idx, queries, k, x, results);
+        return;
+    }
+
+    // Filtro condiviso: l'elenco degli id ammessi si costruisce una volta
+    size_t n_rows = 0;
+    uint32_t *rows = n_filters == 1 ? filter_rows(filters, ds->n, &n_rows) : NULL;
+
+    #pragma omp parallel for schedule(dynamic)
+    for (long qi = 0; qi < (long)queries->n; qi++) {
+        const float *q = &queries->data[(size_t)qi * queries->d];
+        Neighbor *nb = &results[(size_t)qi * k];
+        if (n_filters == 1)
+            knn_filtered_scan(ds, idx, q, k, x, filters, rows, n_rows, nb);
+        else
+            knn_query_single_filtered(ds, idx, q, k, x, &filters[qi], nb);
+    }
+
+    free(rows);
+}
+
+// Indice partizionato: il filtro di ogni shard parte dalla sua prima riga
+void knn_query_sharded_all_filtered(const MatrixF32 *ds,
+                                    const ShardedIndex *sx,
+                                    const MatrixF32 *queries,
+                                    int k,
+                                    int x,
+                                    const RowFilter *filters,
+                                    size_t n_filters,
+                                    Neighbor *results)
+{
+    if (!ds || !sx || !queries || !results || k <= 0) return;
+    if (!filters || (n_filters != 1 && n_filters != queries->n)) return;
+
+    size_t S  = sx->S;
+    size_t nq = queries->n;
+    size_t D  = queries->d;
+    int shared = n_filters == 1;
+
+    if (shared && !filters->bits) {
+        knn_query_sharded_all(ds, sx, queries, k, x, results);
+        return;
+    }
+
+    // Filtro condiviso: filtro ed elenco degli id ammessi di ogni shard si
+    // costruiscono una volta, come nel caso non partizionato
+    RowFilter *sf     = shared ? (RowFilter *)malloc(S * sizeof(RowFilter)) : NULL;
+    uint32_t **rows   = shared ? (uint32_t **)calloc(S, sizeof(uint32_t *)) : NULL;
+    size_t    *n_rows = shared ? (size_t *)calloc(S, sizeof(size_t)) : NULL;
+    Neighbor *part = (Neighbor *)malloc(SHARD_QB * S * (size_t)k * sizeof(Neighbor));
+    if (!part || (shared && (!sf || !rows || !n_rows))) {
+        free(sf);
+        free(rows);
+        free(n_rows);
+        free(part);
+        return;
+    }
+    for (size_t s = 0; shared && s < S; s++) {
+        sf[s] = filters[0];
+        sf[s].base += sx->offset[s];
+        rows[s] = filter_rows(&sf[s], sx->offset[s + 1] - sx->offset[s], &n_rows[s]);
+    }
+
+    for (size_t q0 = 0; q0 < nq; q0 += SHARD_QB) {
+        size_t qc = nq - q0 < SHARD_QB ? nq - q0 : SHARD_QB;
+        init_neighbors(part, qc * S * (size_t)k);
+
+        #pragma omp parallel for schedule(dynamic)
+        for (long t = 0; t < (long)(qc * S); t++) {
+            size_t qi = (size_t)t / S, s = (size_t)t % S;
+            MatrixF32 view = shard_view(ds, sx, s);
+            const float *q = &queries->data[(q0 + qi) * D];
+            if (shared) {
+                knn_filtered_scan(&view, sx->shards[s], q, k, x, &sf[s], rows[s], n_rows[s], &part[(size_t)t * k]);
+            } else {
+                RowFilter f = filters[q0 + qi];
+                f.base += sx->offset[s];
+                knn_query_single_filtered(&view, sx->shards[s], q, k, x, &f, &part[(size_t)t * k]);
+            }
+        }
+
+        #pragma omp parallel for schedule(static)
+        for (long qi = 0; qi < (long)qc; qi++)
+            merge_shards(sx, &part[(size_t)qi * S * k], k, &results[(q0 + qi) * (size_t)k]);
+    }
+
+    for (size_t s = 0; shared && s < S; s++) free(rows[s]);
+    free(sf);
+    free(rows);
+    free(n_rows);
+    free(part);
+}
+
+// ------------------ IVF ----------------------
+
+// Scansione di knn_query_single ristretta alle nprobe liste con il
+// centroide pi vicino a q. Le righe di una lista sono contigue in
+// ivf->idx: gli id trovati sono posizioni, riportati alle righe originali
+// del dataset prima del calcolo della distanza reale.
+void knn_query_ivf_single(const MatrixF32 *ds,
+                          const IvfIndex *ivf,
+                          const float *q,
+                          int k,
+                          int x,
+                          int nprobe,
+                          Neighbor *neighbors)
+{
+    if (!ds || !ivf || !q || !neighbors) return;
+
+    const Index *idx = ivf->idx;
+    size_t n = ds->n;
+    size_t D = ds->d;
+    int h = (int)idx->h;
+
+    if (k > (int)n) k = (int)n;
+
+    for (int i = 0; i < k; i++) {
+        neighbors[i].id          = -1;
+        neighbors[i].dist_approx = FLT_MAX;
+        neighbors[i].dist_real   = FLT_MAX;
+    }
+
+    size_t np = nprobe > 0 ? (size_t)nprobe : 1;
+    if (np > ivf->C) np = ivf->C;
+
+    uint8_t  *vp_q     = (uint8_t *)calloc(idx->Dp, sizeof(uint8_t));
+    uint8_t  *vn_q     = (uint8_t *)calloc(idx->Dp, sizeof(uint8_t));
+    int      *dq_pivot = (int *)malloc(h * sizeof(int));
+    uint32_t *lists    = (uint32_t *)malloc(np * sizeof(uint32_t));
+    if (!vp_q || !vn_q || !dq_pivot || !lists) {
+        free(vp_q); free(vn_q); free(dq_pivot); free(lists);
+        return;
+    }
+
+    PERF_BEGIN(PERF_PHASE_QUANT);
+    quantize_vector_graded(q, vp_q, vn_q, D, x, idx->bits);
+    PERF_END(PERF_PHASE_QUANT);
+
+    // Distanze query-pivot e liste da sondare
+    PERF_BEGIN(PERF_PHASE_PIVOT);
+    index_pivot_distances(idx, vp_q, vn_q, 1, dq_pivot);
+    np = ivf_probe(ivf, q, (int)np, lists);
+    PERF_END(PERF_PHASE_PIVOT);
+
+    // Ordine della cascata una volta per query, comune alle liste sondate
+    int dq_hot[INDEX_MAX_HOT], buf[INDEX_ORDER_STACK];
+    int *order = index_cascade_begin(idx, dq_pivot, dq_hot, buf);
+
+    size_t scanned = 0, pruned = 0;
+    for (size_t l = 0; l < np; l++) {
+        size_t begin = ivf->offset[lists[l]];
+        size_t end   = ivf->offset[lists[l] + 1];
+        block_scan(idx, vp_q, vn_q, dq_pivot, dq_hot, order, begin, end, k, neighbors, &pruned, NULL);
+        scanned += end - begin;
+    }
+    index_cascade_end(order, buf);
+    perf_scan_add(scanned, pruned);
+
+    // Posizioni -> righe originali, poi distanza reale
+    PERF_BEGIN(PERF_PHASE_RERANK);
+    for (int i = 0; i < k; i++) {
+        if (neighbors[i].id < 0) {
+            neighbors[i].dist_real = FLT_MAX;
+            continue;
+        }
+
+        neighbors[i].id = (int)ivf->ids[neighbors[i].id];
+        const float *v = &ds->data[(size_t)neighbors[i].id * D];
+        neighbors[i].dist_real = euclidean_distance(q, v, D);
+    }
+    PERF_END(PERF_PHASE_RERANK);
+
+    free(vp_q);
+    free(vn_q);
+    free(dq_pivot);
+    free(lists);
+}
+
+void knn_query_ivf_all(const MatrixF32 *ds,
+                       const IvfIndex *ivf,
+                       const MatrixF32 *queries,
+                       int k,
+                       int x,
+                       int nprobe,
+                       Neighbor *results)
+{
+    if (!ds || !ivf || !queries || !results) return;
+
+    #pragma omp parallel for schedule(dynamic)
+    for (size_t qi = 0; qi < queries->n; qi++) {
+        const float *q = &queries->data[qi * queries->d];
+        knn_query_ivf_single(ds, ivf, q, k, x, nprobe, &results[qi * k]);
+    }
+}
+
+// ------------------ GRAFO (HNSW) ----------------------
+
+// Ricerca sul grafo con fascio max(ef, k) guidata da d~, poi re-rank per
+// distanza euclidea reale dei candidati: i k migliori in ordine crescente
+void knn_query_hnsw_single(const MatrixF32 *ds,
+                           const HnswIndex *g,
+                           const float *q,
+                           int k,
+                           int x,
+                           int ef,
+                           Neighbor *neighbors)
+{
+    if (!ds || !g || !q || !neighbors || k <= 0) return;
+
+    size_t D = ds->d;
+    if (ef < k) ef = k;
+
+    for (int i = 0; i < k; i++) {
+        neighbors[i].id          = -1;
+        neighbors[i].dist_approx = FLT_MAX;
+        neighbors[i].dist_real   = FLT_MAX;
+    }
+
+    uint8_t  *vp_q = (uint8_t *)calloc(g->idx->Dp, sizeof(uint8_t));
+    uint8_t  *vn_q = (uint8_t *)calloc(g->idx->Dp, sizeof(uint8_t));
+    uint32_t *ids  = (uint32_t *)malloc((size_t)ef * sizeof(uint32_t));
+    int      *dist = (int *)malloc((size_t)ef * sizeof(int));
+    Neighbor *cand = (Neighbor *)malloc((size_t)ef * sizeof(Neighbor));
+    if (!vp_q || !vn_q || !ids || !dist || !cand) {
+        free(vp_q); free(vn_q); free(ids); free(dist); free(cand);
+        return;
+    }
+
+    PERF_BEGIN(PERF_PHASE_QUANT);
+    quantize_vector_graded(q, vp_q, vn_q, D, x, g->idx->bits);
+    PERF_END(PERF_PHASE_QUANT);
+
+    size_t evaluated = 0;
+    PERF_BEGIN(PERF_PHASE_APPROX);
+    size_t c = hnsw_search(g, vp_q, vn_q, ef, ids, dist, &evaluated);
+    PERF_END(PERF_PHASE_APPROX);
+    perf_scan_add(evaluated, 0);
+
+    PERF_BEGIN(PERF_PHASE_RERANK);
+    for (size_t i = 0; i < c; i++) {
+        cand[i].id          = (int)ids[i];
+        cand[i].dist_approx = (float)dist[i];
+        cand[i].dist_real   = euclidean_distance(q, &ds->data[(size_t)ids[i] * D], D);
+    }
+    qsort(cand, c, sizeof(Neighbor), cmp_neighbor_real);
+    PERF_END(PERF_PHASE_RERANK);
+
+    for (size_t i = 0; i < c && i < (size_t)k; i++)
+        neighbors[i] = cand[i];
+
+    free(vp_q);
+    free(vn_q);
+    free(ids);
+    free(dist);
+    free(cand);
+}
+
+void knn_query_hnsw_all(const MatrixF32 *ds,
+                        const HnswIndex *g,
+                        const MatrixF32 *queries,
+                        int k,
+                        int x,
+                        int ef,
+                        Neighbor *results)
+{
+    if (!ds || !g || !queries || !results) return;
+
+    #pragma omp parallel for schedule(dynamic)
+    for (size_t qi = 0; qi < queries->n; qi++) {
+        const float *q = &queries->data[qi * queries->d];
+        knn_query_hnsw_single(ds, g, q, k, x, ef, &results[qi * k]);
+    }
+}
+
+// ------------------ QUANTIZZAZIONE PRODOTTO (PQ) ----------------------
+
+// Scansione ADC di tutti i codici per i k*r candidati con distanza
+// approssimata minore, poi re-rank per distanza euclidea reale sulle righe
+// originali: i k migliori in ordine crescente
+void knn_query_pq_single(const MatrixF32 *ds,
+                         const PqIndex *pq,
+                         const float *q,
+                         int k,
+                         int r,
+                         Neighbor *neighbors)
+{
+    if (!ds || !pq || !q || !neighbors || k <= 0) return;
+
+    size_t D = ds->d;
+    if (r < 1) r = 1;
+    size_t kk = (size_t)k * (size_t)r;
+    if (kk > pq->n) kk = pq->n;
+
+    for (int i = 0; i < k; i++) {
+        neighbors[i].id          = -1;
+        neighbors[i].dist_approx = FLT_MAX;
+        neighbors[i].dist_real   = FLT_MAX;
+    }
+    if (kk == 0) return;
+
+    float    *y    = (float *)malloc(pq_rotated_dim(pq) * sizeof(float));
+    float    *T    = (float *)malloc((size_t)pq->M * pq->ks * sizeof(float));
+    uint32_t *ids  = (uint32_t *)malloc(kk * sizeof(uint32_t));
+    float    *dist = (float *)malloc(kk * sizeof(float));
+    Neighbor *cand = (Neighbor *)malloc(kk * sizeof(Neighbor));
+    if (!y || !T || !ids || !dist || !cand) {
+        free(y); free(T); free(ids); free(dist); free(cand);
+        return;
+    }
+
+    // Rotazione e tabelle ADC al posto della quantizzazione della query
+    PERF_BEGIN(PERF_PHASE_QUANT);
+    pq_project(pq, q, y);
+    pq_tables(pq, y, T);
+    PERF_END(PERF_PHASE_QUANT);
+
+    PERF_BEGIN(PERF_PHASE_APPROX);
+    size_t c = pq_scan(pq, T, kk, ids, dist);
+    PERF_END(PERF_PHASE_APPROX);
+    perf_scan_add(pq->n, 0);
+
+    PERF_BEGIN(PERF_PHASE_RERANK);
+    for (size_t i = 0; i < c; i++) {
+        cand[i].id          = (int)ids[i];
+        cand[i].dist_approx = dist[i];
+        cand[i].dist_real   = euclidean_distance(q, &ds->data[(size_t)ids[i] * D], D);
+    }
+    qsort(cand, c, sizeof(Neighbor), cmp_neighbor_real);
+    PERF_END(PERF_PHASE_RERANK);
+
+    for (size_t i = 0; i < c && i < (size_t)k; i++)
+        neighbors[i] = cand[i];
+
+    free(y);
+    free(T);
+    free(ids);
+    free(dist);
+    free(cand);
+}
+
+void knn_query_pq_all(const MatrixF32 *ds,
+                      const PqIndex *pq,
+                      const MatrixF32 *queries,
+                      int k,
+                      int r,
+                      Neighbor *results)
+{
+    if (!ds || !pq || !queries || !results) return;
+
+    #pragma omp parallel for schedule(dynamic)
+    for (size_t qi = 0; qi < queries->n; qi++) {
+        const float *q = &queries->data[qi * queries->d];
+        knn_query_pq_single(ds, pq, q, k, r, &results[qi * k]);
+    }
+}
+
+// ------------------ K-NN PER ID E GRAFO K-NN ----------------------
+//
+// Una riga del dataset ha gi nell'indice il proprio codice (vp_all,
+// vn_all) e le distanze dai pivot (la sua riga di dist): come query non va
+// n quantizzata n confrontata con i pivot.
+
+// Vista dell'indice come query preparate: la query i  la riga i
+static QueryCodes index_as_queries(const Index *idx)
+{
+    QueryCodes qc;
+    qc.nq = idx->n;
+    qc.D  = idx->Dp;
+    qc.h  = idx->h;
+    qc.vp = idx->vp_all;
+    qc.vn = idx->vn_all;
+    qc.dq = idx->dist;
+    return qc;
+}
+
+void knn_query_by_id(const MatrixF32 *ds,
+                     const Index *idx,
+                     size_t id,
+                     int k,
+                     int r,
+                     Neighbor *neighbors)
+{
+    if (!ds || !idx || !neighbors || k <= 0 || id >= idx->n || ds->n != idx->n) return;
+
+    QueryCodes qc = index_as_queries(idx);
+    query_prepared(ds, idx, &ds->data[id * ds->d], &qc, id, k, r, NULL, NULL, neighbors);
+}
+
+void knn_query_by_id_all(const MatrixF32 *ds,
+                         const Index *idx,
+                         const uint32_t *ids,
+                         size_t n_ids,
+                         int k,
+                         int r,
+                         Neighbor *results)
+{
+    if (!ds || !idx || !ids || !results || k <= 0 || ds->n != idx->n) return;
+
+    #pragma omp parallel for schedule(dynamic)
+    for (long i = 0; i < (long)n_ids; i++)
+        knn_query_by_id(ds, idx, ids[i], k, r, &results[(size_t)i * k]);
+}
+
+// Righe per tessera del grafo: codici e righe di dist di due tessere
+// restano in L2 mentre si confrontano tutte le coppie
+#define GRAPH_TILE 256
+
+// Liste dei k vicini di tutte le righe, con il peggiore di ognuna
+typedef struct {
+    Neighbor *nb;      // n x k
+    float    *worst;   // dist_approx del peggiore
+    int      *slot;    // suo slot
+    int       k;
+} GraphLists;
+
+static void graph_offer(GraphLists *g, size_t i, int j, float d)
+{
+    Neighbor *nb = &g->nb[i * g->k];
+    nb[g->slot[i]].id          = j;
+    nb[g->slot[i]].dist_approx = d;
+    g->slot[i]  = find_worst_neighbor(nb, g->k);
+    g->worst[i] = nb[g->slot[i]].dist_approx;
+}
+
+// Tutte le coppie (i, j), i nella tessera [a0, a1) e j in [b0, b1) (j > i
+// sulla diagonale). d* e d~ sono simmetrici: calcolati una volta, valgono
+// per entrambe le liste, ognuna col proprio peggiore (stessa regola di
+// pruning di block_scan). Ritorna le coppie scartate da d*.
+static size_t graph_tile(const Index *idx, GraphLists *g, size_t a0, size_t a1, size_t b0, size_t b1)
+{
+    size_t Dp = idx->Dp, h = idx->h, pruned = 0;
+
+    for (size_t i = a0; i < a1; i++) {
+        const int *di = &idx->dist[i * h];
+        const uint8_t *vpi = &idx->vp_all[i * Dp];
+        const uint8_t *vni = &idx->vn_all[i * Dp];
+
+        for (size_t j = a0 == b0 ? i + 1 : b0; j < b1; j++) {
+            const int *dj = &idx->dist[j * h];
+            int best = 0;
+            for (size_t p = 0; p < h; p++) {
+                int diff = di[p] - dj[p];
+                if (diff < 0) diff = -diff;
+                if (diff > best) best = diff;
+            }
+
+            float wi = g->worst[i], wj = g->worst[j];
+            int to_i = (float)best < wi, to_j = (float)best < wj;
+            if (!to_i && !to_j) {
+                pruned++;
+                continue;
+            }
+
+            float d = (float)index_code_distance(idx, vpi, vni, &idx->vp_all[j * Dp], &idx->vn_all[j * Dp]);
+            if (to_i && d < wi) graph_offer(g, i, (int)j, d);
+            if (to_j && d < wj) graph_offer(g, j, (int)i, d);
+        }
+    }
+    return pruned;
+}
+
+// Coppie di tessere in turni all'italiana (metodo del cerchio): in un turno
+// ogni tessera compare al pi una volta, quindi le tessere di un turno
+// aggiornano liste disgiunte e vanno in parallelo senza lock. Prima il
+// turno delle diagonali, poi B - 1 turni di B / 2 coppie (B pari).
+static void graph_rounds(const Index *idx, GraphLists *g)
+{
+    size_t n = idx->n;
+    size_t nt = (n + GRAPH_TILE - 1) / GRAPH_TILE;
+    size_t B = nt + (nt & 1);
+    size_t pruned = 0;
+
+    PERF_BEGIN(PERF_PHASE_APPROX);
+    #pragma omp parallel for schedule(dynamic) reduction(+:pruned)
+    for (long t = 0; t < (long)nt; t++) {
+        size_t a0 = (size_t)t * GRAPH_TILE, a1 = a0 + GRAPH_TILE < n ? a0 + GRAPH_TILE : n;
+        pruned += graph_tile(idx, g, a0, a1, a0, a1);
+    }
+
+    for (size_t r = 0; r + 1 < B; r++) {
+        #pragma omp parallel for schedule(dynamic) reduction(+:pruned)
+        for (long p = 0; p < (long)(B / 2); p++) {
+            size_t a = p == 0 ? r : (r + (size_t)p) % (B - 1);
+            size_t b = p == 0 ? B - 1 : (r + B - 1 - (size_t)p) % (B - 1);
+            if (a >= nt || b >= nt) continue;
+            if (a > b) { size_t t = a; a = b; b = t; }
+
+            size_t a0 = a * GRAPH_TILE, a1 = a0 + GRAPH_TILE < n ? a0 + GRAPH_TILE : n;
+            size_t b0 = b * GRAPH_TILE, b1 = b0 + GRAPH_TILE < n ? b0 + GRAPH_TILE : n;
+            pruned += graph_tile(idx, g, a0, a1, b0, b1);
+        }
+    }
+    PERF_END(PERF_PHASE_APPROX);
+
+    perf_scan_add(n * (n - 1) / 2, pruned);
+}
+
+RangeResult *knn_graph(const MatrixF32 *ds, const Index *idx, int k)
+{
+    if (!ds || !idx || k <= 0 || ds->n != idx->n || ds->d != idx->D || idx->n == 0) return NULL;
+
+    size_t n = idx->n, D = ds->d;
+    GraphLists g;
+    g.k     = k;
+    g.nb    = (Neighbor *)malloc(n * (size_t)k * sizeof(Neighbor));
+    g.worst = (float *)malloc(n * sizeof(float));
+    g.slot  = (int *)malloc(n * sizeof(int));
+    RangeResult *res = (RangeResult *)malloc(sizeof(RangeResult));
+    size_t *offsets = (size_t *)malloc((n + 1) * sizeof(size_t));
+    if (!g.nb || !g.worst || !g.slot || !res || !offsets) {
+        free(g.nb); free(g.worst); free(g.slot); free(res); free(offsets);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < n * (size_t)k; i++) {
+        g.nb[i].id          = -1;
+        g.nb[i].dist_approx = FLT_MAX;
+        g.nb[i].dist_real   = FLT_MAX;
+    }
+    for (size_t i = 0; i < n; i++) {
+        g.worst[i] = FLT_MAX;
+        g.slot[i]  = 0;
+    }
+
+    graph_rounds(idx, &g);
+
+    // Distanza reale e ordine crescente; le righe hanno tutte m vicini
+    #pragma omp parallel for schedule(static)
+    for (long i = 0; i < (long)n; i++) {
+        Neighbor *nb = &g.nb[(size_t)i * k];
+        real_distances(ds, &ds->data[(size_t)i * D], k, nb);
+        qsort(nb, (size_t)k, sizeof(Neighbor), cmp_neighbor_real);
+    }
+
+    size_t m = (size_t)k < n - 1 ? (size_t)k : n - 1;
+    for (size_t i = 0; i < n; i++) {
+        if (m < (size_t)k)
+            memmove(&g.nb[i * m], &g.nb[i * (size_t)k], m * sizeof(Neighbor));
+        offsets[i] = i * m;
+    }
+    offsets[n] = n * m;
+
+    Neighbor *items = (Neighbor *)realloc(g.nb, (m ? n * m : 1) * sizeof(Neighbor));
+    res->nq      = n;
+    res->offsets = offsets;
+    res->items   = items ? items : g.nb;
+
+    free(g.worst);
+    free(g.slot);
+    return res;
 }
@@ -1,14 +1,23 @@
 #include "query64.h"
 #include "quantization.h"
 #include "distance.h"
+#include "perfcount.h"
+#include "pool.h"
 
 #include <float.h>
+#include <limits.h>
+#include <math.h>
 #include <stdlib.h>
+#include <string.h>
 
 #ifdef _OPENMP
 #include <omp.h>
 #endif
 
+// Limiti inferiori calcolati per blocchi di punti (vedi query.c)
+#define SCAN_BLOCK 256
+#define PREFETCH_AHEAD 8
+
 static int find_worst_neighbor64(const Neighbor64 *neighbors, int k)
 {
     int worst = 0;
@@ -22,15 +31,258 @@ static int find_worst_neighbor64(const Neighbor64 *neighbors, int k)
     return worst;
 }
 
-void knn_query_single_f64(const MatrixF64 *ds,
-                          const Index *idx,
-                          const double *q,
+// Scansione dalla colonna ordinata (vedi sorted_scan in query.c)
+static size_t sorted_scan64(const Index *idx,
+                          const uint8_t *vp_q,
+                          const uint8_t *vn_q,
+                          const int *dq_pivot,
                           int k,
-                          int x,
-                          Neighbor64 *neighbors)
+                          Neighbor64 *neighbors,
+                          size_t *pruned,
+                          ScanBudget *bud)
 {
-    if (!ds || !idx || !q || !neighbors) return;
+    size_t n = idx->n;
+    size_t Dp = idx->Dp;
+    int h = (int)idx->h;
+    float alpha = bud ? bud->alpha : 1.0f;
+
+    int c = index_sorted_column(idx, dq_pivot, k);
+    const uint32_t *ids = &idx->sorted_id[(size_t)c * n];
+    const int *key = &idx->sorted_key[(size_t)c * n];
+    int dq = dq_pivot[idx->sorted_piv[c]];
+
+    size_t hi = index_sorted_lower_bound(idx, c, dq), lo = hi;
+    size_t visited = 0;
+
+    while (lo > 0 || hi < n) {
+        if (bud && visited % SCAN_BLOCK == 0 && !scan_budget_check(bud)) break;
+
+        long long gl = lo > 0 ? (long long)dq - key[lo - 1] : LLONG_MAX;
+        long long gh = hi < n ? (long long)key[hi] - dq : LLONG_MAX;
+        long long gap = gl <= gh ? gl : gh;
+
+        int worst = find_worst_neighbor64(neighbors, k);
+        double worst_approx = neighbors[worst].dist_approx;
+        if (alpha * (double)gap >= worst_approx) break;
+
+        size_t i = gl <= gh ? ids[--lo] : ids[hi++];
+        visited++;
+
+        // Limite inferiore su tutti i pivot
+        const int *dv = &idx->dist[i * h];
+        int best = 0;
+        for (int j = 0; j < h; j++) {
+            int diff = dv[j] - dq_pivot[j];
+            if (diff < 0) diff = -diff;
+            if (diff > best) best = diff;
+        }
+
+        // PRUNING
+        if (alpha * (double)best >= worst_approx) {
+            (*pruned)++;
+            continue;
+        }
+
+        if (bud && !scan_budget_spend(bud)) break;
+
+        const uint8_t *vpi = &idx->vp_all[i * Dp];
+        const uint8_t *vni = &idx->vn_all[i * Dp];
+        int d_approx = index_code_distance(idx, vp_q, vn_q, vpi, vni);
+
+        if ((double)d_approx < worst_approx) {
+            neighbors[worst].id          = (int)i;
+            neighbors[worst].dist_approx = (double)d_approx;
+        }
+    }
+    return visited;
+}
+
+// Soglia intera della cascata: d* < worst
+static int cascade_limit64(double worst)
+{
+    if (worst >= (double)INT_MAX) return INT_MAX;
+    if (worst <= 0.0) return 0;
+    return (int)ceil(worst);
+}
+
+// Righe [begin, end) a blocchi in due passate, sopravvissuti con prefetch
+// dei codici (vedi block_scan in query.c)
+static void block_scan64(const Index *idx,
+                         const uint8_t *vp_q,
+                         const uint8_t *vn_q,
+                         const int *dq_pivot,
+                         const int *dq_hot,
+                         const int *order,
+                         size_t begin,
+                         size_t end,
+                         int k,
+                         Neighbor64 *neighbors,
+                         size_t *pruned,
+                         ScanBudget *bud)
+{
+    size_t Dp = idx->Dp;
+    float alpha = bud ? bud->alpha : 1.0f;
+    int h = (int)idx->h;
+    int d_star[SCAN_BLOCK];
+    uint16_t surv[SCAN_BLOCK];
+
+    for (size_t i0 = begin; i0 < end; i0 += SCAN_BLOCK) {
+        size_t cnt = end - i0 < SCAN_BLOCK ? end - i0 : SCAN_BLOCK;
+        size_t ns = 0;
+
+        // Scadenza una volta per blocco, prima del limite inferiore
+        if (bud && !scan_budget_check(bud)) break;
+
+        PERF_BEGIN(PERF_PHASE_LB);
+        double worst0 = neighbors[find_worst_neighbor64(neighbors, k)].dist_approx;
+        int limit = cascade_limit64(worst0 / alpha);
+        for (size_t b = 0; b < cnt; b++) {
+            int best;
+            if (order) {
+                best = index_cascade_bound(idx, i0 + b, dq_hot, dq_pivot, order, limit);
+            } else {
+                const int *dv = &idx->dist[(i0 + b) * h];
+                best = 0;
+                for (int j = 0; j < h; j++) {
+                    int diff = dv[j] - dq_pivot[j];
+                    if (diff < 0) diff = -diff;
+                    if (diff > best) best = diff;
+                }
+            }
+            d_star[b] = best;
+            surv[ns] = (uint16_t)b;
+            ns += alpha * (double)best < worst0;
+        }
+        *pruned += cnt - ns;
+        PERF_END(PERF_PHASE_LB);
+
+        PERF_BEGIN(PERF_PHASE_APPROX);
+        for (size_t s = 0; s < ns && s < PREFETCH_AHEAD; s++)
+            index_prefetch_codes(idx, i0 + surv[s]);
+
+        for (size_t s = 0; s < ns; s++) {
+            size_t b = surv[s];
+            size_t i = i0 + b;
+
+            if (s + PREFETCH_AHEAD < ns)
+                index_prefetch_codes(idx, i0 + surv[s + PREFETCH_AHEAD]);
+
+            int worst = find_worst_neighbor64(neighbors, k);
+            double worst_approx = neighbors[worst].dist_approx;
+
+            if (alpha * (double)d_star[b] >= worst_approx) {
+                (*pruned)++;
+                continue;
+            }
+
+            if (bud && !scan_budget_spend(bud)) break;
+
+            const uint8_t *vpi = &idx->vp_all[i * Dp];
+            const uint8_t *vni = &idx->vn_all[i * Dp];
+
+            int d_approx = index_code_distance(idx, vp_q, vn_q, vpi, vni);
+
+            if ((double)d_approx < worst_approx) {
+                neighbors[worst].id          = (int)i;
+                neighbors[worst].dist_approx = (double)d_approx;
+            }
+        }
+        PERF_END(PERF_PHASE_APPROX);
+        if (bud && bud->partial) break;
+    }
+}
+
+static void real_distances64(const MatrixF64 *ds, const double *q, int k, Neighbor64 *neighbors)
+{
+    size_t D = ds->d;
+
+    PERF_BEGIN(PERF_PHASE_RERANK);
+    for (int i = 0; i < k; i++) {
+        if (neighbors[i].id < 0) {
+            neighbors[i].dist_real = DBL_MAX;
+            continue;
+        }
+
+        const double *v = &ds->data[(size_t)neighbors[i].id * D];
+        neighbors[i].dist_real = euclidean_distance_f64(q, v, D);
+    }
+    PERF_END(PERF_PHASE_RERANK);
+}
+
+// Scansione + distanza reale per una query gi preparata (vedi scan_query in query.c)
+static void scan_query64(const MatrixF64 *ds,
+                         const Index *idx,
+                         const double *q,
+                         const uint8_t *vp_q,
+                         const uint8_t *vn_q,
+                         const int *dq_pivot,
+                         int k,
+                         ScanBudget *bud,
+                         Neighbor64 *neighbors)
+{
+    size_t n = ds->n;
+
+    size_t scanned = n, pruned = 0;
+
+    if (idx->n_sorted > 0) {
+        PERF_BEGIN(PERF_PHASE_APPROX);
+        scanned = sorted_scan64(idx, vp_q, vn_q, dq_pivot, k, neighbors, &pruned, bud);
+        PERF_END(PERF_PHASE_APPROX);
+    } else {
+        int dq_hot[INDEX_MAX_HOT], buf[INDEX_ORDER_STACK];
+        int *order = index_cascade_begin(idx, dq_pivot, dq_hot, buf);
+        block_scan64(idx, vp_q, vn_q, dq_pivot, dq_hot, order, 0, n, k, neighbors, &pruned, bud);
+        index_cascade_end(order, buf);
+    }
+    perf_scan_add(scanned, pruned);
+
+    real_distances64(ds, q, k, neighbors);
+}
+
+// Candidati dalla cache o scansione e inserimento (vedi query.c)
+static void scan_query_cached64(const MatrixF64 *ds,
+                                const Index *idx,
+                                const double *q,
+                                const uint8_t *vp_q,
+                                const uint8_t *vn_q,
+                                const int *dq_pivot,
+                                int k,
+                                QueryCache *cache,
+                                ScanBudget *bud,
+                                Neighbor64 *neighbors)
+{
+    int *ids = cache ? (int *)malloc(2 * (size_t)k * sizeof(int)) : NULL;
+    if (!ids) {
+        scan_query64(ds, idx, q, vp_q, vn_q, dq_pivot, k, bud, neighbors);
+        return;
+    }
+    int *dist = ids + k;
 
+    if (query_cache_get(cache, idx, vp_q, vn_q, k, ids, dist)) {
+        for (int i = 0; i < k; i++) {
+            neighbors[i].id          = ids[i];
+            neighbors[i].dist_approx = ids[i] < 0 ? DBL_MAX : (double)dist[i];
+        }
+        real_distances64(ds, q, k, neighbors);
+    } else {
+        scan_query64(ds, idx, q, vp_q, vn_q, dq_pivot, k, bud, neighbors);
+        for (int i = 0; i < k; i++) {
+            ids[i]  = neighbors[i].id;
+            dist[i] = neighbors[i].id < 0 ? 0 : (int)neighbors[i].dist_approx;
+        }
+        if (!bud) query_cache_put(cache, idx, vp_q, vn_q, k, ids, dist);
+    }
+    free(ids);
+}
+
+static void query_single64(const MatrixF64 *ds,
+                           const Index *idx,
+                           const double *q,
+                           int k,
+                           int x,
+                           QueryCache *cache,
+                           Neighbor64 *neighbors)
+{
     size_t n = ds->n;
     size_t D = ds->d;
     int h = (int)idx->h;
@@ -43,76 +295,1463 @@ void knn_query_single_f64(const MatrixF64 *ds,
         neighbors[i].dist_real   = DBL_MAX;
     }
 
-    uint8_t *vp_q = (uint8_t*)malloc(D);
-    uint8_t *vn_q = (uint8_t*)malloc(D);
+    uint8_t *vp_q = (uint8_t *)calloc(idx->Dp, sizeof(uint8_t));
+    uint8_t *vn_q = (uint8_t *)calloc(idx->Dp, sizeof(uint8_t));
     if (!vp_q || !vn_q) {
-        free(vp_q); free(vn_q);
+        free(vp_q);
+        free(vn_q);
         return;
     }
 
-    quantize_vector_f64(q, vp_q, vn_q, D, x);
+    PERF_BEGIN(PERF_PHASE_QUANT);
+    quantize_vector_graded_f64(q, vp_q, vn_q, D, x, idx->bits);
+    PERF_END(PERF_PHASE_QUANT);
 
-    int *dq_pivot = (int*)malloc(h * sizeof(int));
+    int *dq_pivot = (int *)malloc(h * sizeof(int));
     if (!dq_pivot) {
-        free(vp_q); free(vn_q);
+        free(vp_q);
+        free(vn_q);
         return;
     }
 
-    for (int j = 0; j < h; j++) {
-        const uint8_t *vpj = &idx->vp_piv[j * D];
-        const uint8_t *vnj = &idx->vn_piv[j * D];
-        dq_pivot[j] = approximate_distance(vp_q, vn_q, vpj, vnj, D);
-    }
+    PERF_BEGIN(PERF_PHASE_PIVOT);
+    index_pivot_distances(idx, vp_q, vn_q, 1, dq_pivot);
+    PERF_END(PERF_PHASE_PIVOT);
 
-    for (size_t i = 0; i < n; i++) {
+    scan_query_cached64(ds, idx, q, vp_q, vn_q, dq_pivot, k, cache, NULL, neighbors);
 
-        int d_star = 0;
-        for (int j = 0; j < h; j++) {
-            int dvp = idx->dist[i * h + j];
-            int diff = dvp - dq_pivot[j];
-            if (diff < 0) diff = -diff;
-            if (diff > d_star) d_star = diff;
-        }
+    free(vp_q);
+    free(vn_q);
+    free(dq_pivot);
+}
 
-        int worst = find_worst_neighbor64(neighbors, k);
-        double worst_approx = neighbors[worst].dist_approx;
+void knn_query_single_f64(const MatrixF64 *ds,
+                          const Index *idx,
+                          const double *q,
+                          int k,
+                          int x,
+                          Neighbor64 *neighbors)
+{
+    if (!ds || !idx || !q || !neighbors) return;
+    query_single64(ds, idx, q, k, x, NULL, neighbors);
+}
 
-        if ((double)d_star >= worst_approx)
-            continue;
+void knn_query_single_cached_f64(const MatrixF64 *ds,
+                                 const Index *idx,
+                                 const double *q,
+                                 int k,
+                                 int x,
+                                 QueryCache *cache,
+                                 Neighbor64 *neighbors)
+{
+    if (!ds || !idx || !q || !neighbors) return;
+    query_single64(ds, idx, q, k, x, cache, neighbors);
+}
 
-        const uint8_t *vpi = &idx->vp_all[i * D];
-        const uint8_t *vni = &idx->vn_all[i * D];
+static int cmp_neighbor64_real(const void *a, const void *b)
+{
+    double A = ((const Neighbor64 *)a)->dist_real;
+    double B = ((const Neighbor64 *)b)->dist_real;
+    return (A > B) - (A < B);
+}
 
-        int d_approx = approximate_distance(vp_q, vn_q, vpi, vni, D);
+static void rerank_select64(Neighbor64 *cand, int kk, int k, Neighbor64 *neighbors)
+{
+    qsort(cand, (size_t)kk, sizeof(Neighbor64), cmp_neighbor64_real);
 
-        if ((double)d_approx < worst_approx) {
-            neighbors[worst].id          = (int)i;
-            neighbors[worst].dist_approx = (double)d_approx;
+    for (int i = 0; i < k; i++) {
+        if (i < kk) {
+            neighbors[i] = cand[i];
+        } else {
+            neighbors[i].id          = -1;
+            neighbors[i].dist_approx = DBL_MAX;
+            neighbors[i].dist_real   = DBL_MAX;
         }
     }
+}
 
-    for (int i = 0; i < k; i++) {
-        if (neighbors[i].id < 0) {
-            neighbors[i].dist_real = DBL_MAX;
-            continue;
+void knn_query_single_rerank_f64(const MatrixF64 *ds,
+                                 const Index *idx,
+                                 const double *q,
+                                 int k,
+                                 int x,
+                                 int r,
+                                 Neighbor64 *neighbors)
+{
+    if (!ds || !idx || !q || !neighbors || k <= 0) return;
+
+    if (r < 1) r = 1;
+    int kk = k * r;
+    if (kk > (int)ds->n) kk = (int)ds->n;
+
+    Neighbor64 *cand = (Neighbor64 *)malloc((size_t)kk * sizeof(Neighbor64));
+    if (!cand) return;
+
+    knn_query_single_f64(ds, idx, q, kk, x, cand);
+    rerank_select64(cand, kk, k, neighbors);
+
+    free(cand);
+}
+
+// ------------------ QUERY PREELABORATE (vedi query.c) ----------------------
+
+#define PREP_BLOCK 1024
+
+static void prepare_rows64(const Index *idx, const double *Q, int x, QueryCodes *qc, size_t begin, size_t end)
+{
+    size_t D = idx->D, Dp = qc->D;
+
+    PERF_BEGIN(PERF_PHASE_QUANT);
+    for (size_t i = begin; i < end; i++)
+        quantize_vector_graded_f64(&Q[i * D], &qc->vp[i * Dp], &qc->vn[i * Dp], D, x, idx->bits);
+    PERF_END(PERF_PHASE_QUANT);
+
+    PERF_BEGIN(PERF_PHASE_PIVOT);
+    index_pivot_distances(idx, &qc->vp[begin * Dp], &qc->vn[begin * Dp], end - begin, &qc->dq[begin * qc->h]);
+    PERF_END(PERF_PHASE_PIVOT);
+}
+
+QueryCodes *prepare_queries_f64(const Index *idx, const MatrixF64 *queries, int x)
+{
+    if (!idx || !queries || queries->d != idx->D) return NULL;
+
+    QueryCodes *qc = query_codes_alloc(queries->n, idx->Dp, idx->h);
+    if (!qc) return NULL;
+
+    size_t nb = (qc->nq + INDEX_PIVOT_BLOCK - 1) / INDEX_PIVOT_BLOCK;
+
+    #pragma omp parallel for schedule(static)
+    for (long b = 0; b < (long)nb; b++) {
+        size_t begin = (size_t)b * INDEX_PIVOT_BLOCK;
+        size_t end = begin + INDEX_PIVOT_BLOCK < qc->nq ? begin + INDEX_PIVOT_BLOCK : qc->nq;
+        prepare_rows64(idx, queries->data, x, qc, begin, end);
+    }
+    return qc;
+}
+
+static void query_prepared64(const MatrixF64 *ds,
+                             const Index *idx,
+                             const double *q,
+                             const QueryCodes *qc,
+                             size_t i,
+                             int k,
+                             int r,
+                             QueryCache *cache,
+                             ScanBudget *bud,
+                             Neighbor64 *neighbors)
+{
+    int kk = r > 1 ? k * r : k;
+    if (kk > (int)ds->n) kk = (int)ds->n;
+
+    Neighbor64 *cand = neighbors;
+    if (r > 1) {
+        cand = (Neighbor64 *)malloc((size_t)kk * sizeof(Neighbor64));
+        if (!cand) return;
+    }
+
+    for (int j = 0; j < kk; j++) {
+        cand[j].id          = -1;
+        cand[j].dist_approx = DBL_MAX;
+        cand[j].dist_real   = DBL_MAX;
+    }
+
+    scan_query_cached64(ds, idx, q, &qc->vp[i * qc->D], &qc->vn[i * qc->D], &qc->dq[i * qc->h], kk, cache, bud, cand);
+
+    if (cand != neighbors) {
+        rerank_select64(cand, kk, k, neighbors);
+        free(cand);
+    }
+}
+
+void knn_query_single_prepared_f64(const MatrixF64 *ds,
+                                   const Index *idx,
+                                   const double *q,
+                                   const QueryCodes *qc,
+                                   size_t i,
+                                   int k,
+                                   Neighbor64 *neighbors)
+{
+    if (!ds || !idx || !q || !qc || i >= qc->nq || !neighbors) return;
+    query_prepared64(ds, idx, q, qc, i, k, 1, NULL, NULL, neighbors);
+}
+
+static void query_all_prepared64(const MatrixF64 *ds,
+                                 const Index *idx,
+                                 const MatrixF64 *queries,
+                                 int k,
+                                 int x,
+                                 int r,
+                                 Neighbor64 *results)
+{
+    size_t nq = queries->n, D = queries->d;
+    QueryCodes *qc = query_codes_alloc(nq < PREP_BLOCK ? nq : PREP_BLOCK, idx->Dp, idx->h);
+
+    if (!qc) return;
+
+    for (size_t q0 = 0; q0 < nq; q0 += PREP_BLOCK) {
+        size_t qn = nq - q0 < PREP_BLOCK ? nq - q0 : PREP_BLOCK;
+        const double *Q = &queries->data[q0 * D];
+        size_t nb = (qn + INDEX_PIVOT_BLOCK - 1) / INDEX_PIVOT_BLOCK;
+
+        #pragma omp parallel for schedule(static)
+        for (long b = 0; b < (long)nb; b++) {
+            size_t begin = (size_t)b * INDEX_PIVOT_BLOCK;
+            size_t end = begin + INDEX_PIVOT_BLOCK < qn ? begin + INDEX_PIVOT_BLOCK : qn;
+            prepare_rows64(idx, Q, x, qc, begin, end);
         }
-        const double *v = &ds->data[(size_t)neighbors[i].id * D];
-        neighbors[i].dist_real = euclidean_distance_f64(q, v, D);
+
+        #pragma omp parallel for schedule(dynamic)
+        for (long i = 0; i < (long)qn; i++)
+            query_prepared64(ds, idx, &Q[(size_t)i * D], qc, (size_t)i, k, r, NULL, NULL, &results[(q0 + (size_t)i) * k]);
     }
 
-    free(vp_q);
-    free(vn_q);
-    free(dq_pivot);
+    free_query_codes(qc);
 }
 
 void knn_query_all_f64(const MatrixF64 *ds, const Index *idx, const MatrixF64 *queries, int k, int x, Neighbor64 *results)
 {
     if (!ds || !idx || !queries || !results) return;
 
+    query_all_prepared64(ds, idx, queries, k, x, 1, results);
+}
+
+void knn_query_all_rerank_f64(const MatrixF64 *ds, const Index *idx, const MatrixF64 *queries, int k, int x, int r, Neighbor64 *results)
+{
+    if (!ds || !idx || !queries || !results || k <= 0) return;
+
+    query_all_prepared64(ds, idx, queries, k, x, r < 1 ? 1 : r, results);
+}
+
+// ------------------ POOL DI THREAD PERSISTENTE (vedi query.c) ----------------------
+
+#define POOL_QCHUNK 8
+
+typedef struct {
+    const MatrixF64 *ds;
+    const Index     *idx;
+    const double    *Q;
+    int              k, x, r;
+    QueryCodes      *qc;
+    QueryCache      *cache;
+    Neighbor64      *results;
+    const QueryOptions *opt;
+    int              budget;
+    uint8_t         *partial;
+} QueryTask64;
+
+static void prepare_task64(void *ctx, size_t begin, size_t end, int tid)
+{
+    const QueryTask64 *t = (const QueryTask64 *)ctx;
+    (void)tid;
+    prepare_rows64(t->idx, t->Q, t->x, t->qc, begin, end);
+}
+
+static void query_task64(void *ctx, size_t begin, size_t end, int tid)
+{
+    const QueryTask64 *t = (const QueryTask64 *)ctx;
+    size_t D = t->idx->D;
+    (void)tid;
+
+    for (size_t i = begin; i < end; i++) {
+        ScanBudget b, *bud = NULL;
+        if (t->budget) {
+            scan_budget_init(&b, t->opt);
+            bud = &b;
+        }
+        query_prepared64(t->ds, t->idx, &t->Q[i * D], t->qc, i, t->k, t->r, t->cache, bud, &t->results[i * t->k]);
+        if (t->partial) t->partial[i] = bud ? (uint8_t)b.partial : 0;
+    }
+}
+
+void knn_query_all_opt_f64(const MatrixF64 *ds, const Index *idx, const MatrixF64 *queries, int k, int x,
+                           const QueryOptions *opt, Neighbor64 *results)
+{
+    if (!ds || !idx || !queries || !results || k <= 0) return;
+
+    QueryOptions def;
+    if (!opt) { query_default_options(&def); opt = &def; }
+
+    size_t nq = queries->n, D = queries->d;
+    int budget = query_budget_active(opt);
+    QueryCodes *qc = query_codes_alloc(nq < PREP_BLOCK ? nq : PREP_BLOCK, idx->Dp, idx->h);
+    if (!qc) return;
+
+    for (size_t q0 = 0; q0 < nq; q0 += PREP_BLOCK) {
+        size_t qn = nq - q0 < PREP_BLOCK ? nq - q0 : PREP_BLOCK;
+        QueryTask64 t = { ds, idx, &queries->data[q0 * D], k, x, opt->r, qc, opt->cache, &results[q0 * k],
+                          opt, budget, opt->partial ? &opt->partial[q0] : NULL };
+        pool_parallel_for(pool_default(), opt->num_threads, qn, INDEX_PIVOT_BLOCK, prepare_task64, &t);
+        pool_parallel_for(pool_default(), opt->num_threads, qn, POOL_QCHUNK, query_task64, &t);
+    }
+
+    free_query_codes(qc);
+}
+
+int knn_query_single_opt_f64(const MatrixF64 *ds, const Index *idx, const double *q, int k, int x,
+                             const QueryOptions *opt, Neighbor64 *neighbors)
+{
+    if (!ds || !idx || !q || !neighbors || k <= 0) return 0;
+
+    QueryOptions def;
+    if (!opt) { query_default_options(&def); opt = &def; }
+
+    QueryCodes *qc = query_codes_alloc(1, idx->Dp, idx->h);
+    if (!qc) return 0;
+    prepare_rows64(idx, q, x, qc, 0, 1);
+
+    ScanBudget b, *bud = NULL;
+    if (query_budget_active(opt)) {
+        scan_budget_init(&b, opt);
+        bud = &b;
+    }
+    query_prepared64(ds, idx, q, qc, 0, k, opt->r, opt->cache, bud, neighbors);
+
+    free_query_codes(qc);
+    return bud ? b.partial : 0;
+}
+
+// Replica per nodo NUMA (vedi query.c)
+void knn_query_all_replicated_f64(const MatrixF64 *ds,
+                                  const IndexReplicas *rep,
+                                  const MatrixF64 *queries,
+                                  int k,
+                                  int x,
+                                  int r,
+                                  Neighbor64 *results)
+{
+    if (!ds || !rep || !queries || !results) return;
+
     #pragma omp parallel for schedule(dynamic)
     for (size_t qi = 0; qi < queries->n; qi++) {
         const double *q = &queries->data[qi * queries->d];
-        Neighbor64 *nb = &results[qi * k];
-        knn_query_single_f64(ds, idx, q, k, x, nb);
+        const Index *idx = index_replica_local(rep);
+        if (r > 1)
+            knn_query_single_rerank_f64(ds, idx, q, k, x, r, &results[qi * k]);
+        else
+            knn_query_single_f64(ds, idx, q, k, x, &results[qi * k]);
+    }
+}
+
+// ------------------ INDICE PARTIZIONATO (vedi query.c) ----------------------
+
+#define SHARD_QB 64
+
+static int neighbor64_before(const Neighbor64 *a, const Neighbor64 *b)
+{
+    if (a->dist_approx != b->dist_approx) return a->dist_approx < b->dist_approx;
+    return a->dist_real < b->dist_real;
+}
+
+static void init_neighbors64(Neighbor64 *nb, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        nb[i].id          = -1;
+        nb[i].dist_approx = DBL_MAX;
+        nb[i].dist_real   = DBL_MAX;
+    }
+}
+
+static void merge_shards64(const ShardedIndex *sx, const Neighbor64 *part, int k, Neighbor64 *out)
+{
+    int size = 0;
+
+    for (size_t s = 0; s < sx->S; s++) {
+        for (int j = 0; j < k; j++) {
+            Neighbor64 c = part[s * k + j];
+            if (c.id < 0) continue;
+            c.id += (int)sx->offset[s];
+
+            if (size == k && !neighbor64_before(&c, &out[k - 1])) continue;
+
+            int i = size < k ? size++ : k - 1;
+            while (i > 0 && neighbor64_before(&c, &out[i - 1])) {
+                out[i] = out[i - 1];
+                i--;
+            }
+            out[i] = c;
+        }
+    }
+
+    init_neighbors64(&out[size], (size_t)(k - size));
+}
+
+void knn_query_sharded_single_f64(const MatrixF64 *ds,
+                                  const ShardedIndex *sx,
+                                  const double *q,
+                                  int k,
+                                  int x,
+                                  Neighbor64 *neighbors)
+{
+    if (!ds || !sx || !q || !neighbors || k <= 0) return;
+
+    Neighbor64 *part = (Neighbor64*)malloc(sx->S * (size_t)k * sizeof(Neighbor64));
+    if (!part) return;
+    init_neighbors64(part, sx->S * (size_t)k);
+
+    #pragma omp parallel for schedule(dynamic)
+    for (long s = 0; s < (long)sx->S; s++) {
+        MatrixF64 view = shard_view_f64(ds, sx, (size_t)s);
+        knn_query_single_f64(&view, sx->shards[s], q, k, x, &part[(size_t)s * k]);
+    }
+
+    merge_shards64(sx, part, k, neighbors);
+    free(part);
+}
+
+void knn_query_sharded_all_f64(const MatrixF64 *ds, const ShardedIndex *sx, const MatrixF64 *queries, int k, int x, Neighbor64 *results)
+{
+    if (!ds || !sx || !queries || !results || k <= 0) return;
+
+    size_t S  = sx->S;
+    size_t nq = queries->n;
+    size_t D  = queries->d;
+
+    Neighbor64 *part = (Neighbor64*)malloc(SHARD_QB * S * (size_t)k * sizeof(Neighbor64));
+    if (!part) return;
+
+    for (size_t q0 = 0; q0 < nq; q0 += SHARD_QB) {
+        size_t qc = nq - q0 < SHARD_QB ? nq - q0 : SHARD_QB;
+        init_neighbors64(part, qc * S * (size_t)k);
+
+        #pragma omp parallel for schedule(dynamic)
+        for (long t = 0; t < (long)(qc * S); t++) {
+            size_t qi = (size_t)t / S, s = (size_t)t % S;
+            MatrixF64 view = shard_view_f64(ds, sx, s);
+            knn_query_single_f64(&view, sx->shards[s], &queries->data[(q0 + qi) * D],
+                                 k, x, &part[(size_t)t * k]);
+        }
+
+        #pragma omp parallel for schedule(static)
+        for (long qi = 0; qi < (long)qc; qi++)
+            merge_shards64(sx, &part[(size_t)qi * S * k], k, &results[(q0 + qi) * (size_t)k]);
+    }
+
+    free(part);
+}
+
+// ------------------ RICERCA PER RAGGIO (RangeResult64) ----------------------
+//
+// Stessa scansione di knn_query_single_f64, ma la soglia del pruning  il
+// raggio r invece del vicino peggiore:  fissa per tutta la scansione, quindi
+// si scartano tutti i punti con d* > r senza aggiornare alcuna lista.
+//
+// ----------------------------------------------------------------------------
+
+// Vicini di una query in costruzione (capacit raddoppiata quando serve)
+typedef struct {
+    Neighbor64 *v;
+    size_t    n, cap;
+} RangeBuf64;
+
+static int range_push64(RangeBuf64 *b, int id, double d_approx)
+{
+    if (b->n == b->cap) {
+        size_t cap = b->cap ? 2 * b->cap : 16;
+        Neighbor64 *v = (Neighbor64 *)realloc(b->v, cap * sizeof(Neighbor64));
+        if (!v) return -1;
+        b->v = v;
+        b->cap = cap;
     }
+    b->v[b->n].id          = id;
+    b->v[b->n].dist_approx = d_approx;
+    b->v[b->n].dist_real   = DBL_MAX;
+    b->n++;
+    return 0;
+}
+
+// Chiave intera della colonna ordinata, saturata
+static int range_key64(double v)
+{
+    if (v <= (double)INT_MIN) return INT_MIN;
+    if (v >= (double)INT_MAX) return INT_MAX;
+    return (int)v;
+}
+
+static int cmp_neighbor64_id(const void *a, const void *b)
+{
+    int A = ((const Neighbor64 *)a)->id;
+    int B = ((const Neighbor64 *)b)->id;
+    return (A > B) - (A < B);
+}
+
+// Range con colonna ordinata (vedi range_sorted_scan in query.c)
+static size_t range_sorted_scan64(const Index *idx,
+                                const uint8_t *vp_q,
+                                const uint8_t *vn_q,
+                                const int *dq_pivot,
+                                double r,
+                                RangeBuf64 *out,
+                                size_t *pruned,
+                                int *ret)
+{
+    size_t Dp = idx->Dp;
+    int h = (int)idx->h;
+    size_t first = out->n;
+
+    int c = 0;
+    size_t lo = 0, hi = 0;
+    for (int t = 0; t < idx->n_sorted; t++) {
+        int dq = dq_pivot[idx->sorted_piv[t]];
+        // chiave >= dq - r  e  chiave <= dq + r (chiavi intere)
+        size_t a = index_sorted_lower_bound(idx, t, range_key64(ceil((double)dq - (double)r)));
+        double up = floor((double)dq + (double)r);
+        size_t b = up >= (double)INT_MAX ? idx->n : index_sorted_lower_bound(idx, t, range_key64(up) + 1);
+        if (t == 0 || b - a < hi - lo) {
+            c = t;
+            lo = a;
+            hi = b;
+        }
+    }
+
+    const uint32_t *ids = &idx->sorted_id[(size_t)c * idx->n];
+
+    for (size_t p = lo; p < hi; p++) {
+        size_t i = ids[p];
+
+        const int *dv = &idx->dist[i * h];
+        int best = 0;
+        for (int j = 0; j < h; j++) {
+            int diff = dv[j] - dq_pivot[j];
+            if (diff < 0) diff = -diff;
+            if (diff > best) best = diff;
+        }
+
+        // PRUNING con soglia fissa
+        if ((double)best > r) {
+            (*pruned)++;
+            continue;
+        }
+
+        const uint8_t *vpi = &idx->vp_all[i * Dp];
+        const uint8_t *vni = &idx->vn_all[i * Dp];
+        int d_approx = index_code_distance(idx, vp_q, vn_q, vpi, vni);
+
+        if ((double)d_approx <= r && range_push64(out, (int)i, (double)d_approx) != 0) {
+            *ret = -1;
+            break;
+        }
+    }
+
+    qsort(&out->v[first], out->n - first, sizeof(Neighbor64), cmp_neighbor64_id);
+    return hi - lo;
+}
+
+// Aggiunge a out i punti con distanza approssimata <= r (e reale <= r_real
+// se r_real >= 0), in ordine crescente di id. Ritorna 0, -1 se manca memoria.
+static int range_scan64(const MatrixF64 *ds,
+                      const Index *idx,
+                      const double *q,
+                      int x,
+                      double r,
+                      double r_real,
+                      RangeBuf64 *out)
+{
+    size_t n = ds->n;
+    size_t D = ds->d;
+    int h = (int)idx->h;
+
+    uint8_t *vp_q = (uint8_t *)calloc(idx->Dp, sizeof(uint8_t));
+    uint8_t *vn_q = (uint8_t *)calloc(idx->Dp, sizeof(uint8_t));
+    int *dq_pivot = (int *)malloc(h * sizeof(int));
+    if (!vp_q || !vn_q || !dq_pivot) {
+        free(vp_q);
+        free(vn_q);
+        free(dq_pivot);
+        return -1;
+    }
+
+    PERF_BEGIN(PERF_PHASE_QUANT);
+    quantize_vector_graded_f64(q, vp_q, vn_q, D, x, idx->bits);
+    PERF_END(PERF_PHASE_QUANT);
+
+    PERF_BEGIN(PERF_PHASE_PIVOT);
+    index_pivot_distances(idx, vp_q, vn_q, 1, dq_pivot);
+    PERF_END(PERF_PHASE_PIVOT);
+
+    size_t scanned = n, pruned = 0;
+    size_t first = out->n;
+    int ret = 0;
+
+    if (idx->n_sorted > 0) {
+        PERF_BEGIN(PERF_PHASE_APPROX);
+        scanned = range_sorted_scan64(idx, vp_q, vn_q, dq_pivot, r, out, &pruned, &ret);
+        PERF_END(PERF_PHASE_APPROX);
+    } else {
+        int d_star[SCAN_BLOCK];
+
+        // Cascata: soglia fissa, d* > r se e solo se d* >= limit
+        int dq_hot[INDEX_MAX_HOT], buf[INDEX_ORDER_STACK];
+        int limit = cascade_limit64(floor(r) + 1.0);
+        int *order = index_cascade_begin(idx, dq_pivot, dq_hot, buf);
+
+        for (size_t i0 = 0; i0 < n && ret == 0; i0 += SCAN_BLOCK) {
+            size_t cnt = n - i0 < SCAN_BLOCK ? n - i0 : SCAN_BLOCK;
+
+            PERF_BEGIN(PERF_PHASE_LB);
+            for (size_t b = 0; b < cnt; b++) {
+                if (order) {
+                    d_star[b] = index_cascade_bound(idx, i0 + b, dq_hot, dq_pivot, order, limit);
+                    continue;
+                }
+                const int *dv = &idx->dist[(i0 + b) * h];
+                int best = 0;
+                for (int j = 0; j < h; j++) {
+                    int diff = dv[j] - dq_pivot[j];
+                    if (diff < 0) diff = -diff;
+                    if (diff > best) best = diff;
+                }
+                d_star[b] = best;
+            }
+            PERF_END(PERF_PHASE_LB);
+
+            PERF_BEGIN(PERF_PHASE_APPROX);
+            for (size_t b = 0; b < cnt; b++) {
+                size_t i = i0 + b;
+
+                // PRUNING con soglia fissa
+                if ((double)d_star[b] > r) {
+                    pruned++;
+                    continue;
+                }
+
+                const uint8_t *vpi = &idx->vp_all[i * idx->Dp];
+                const uint8_t *vni = &idx->vn_all[i * idx->Dp];
+                int d_approx = index_code_distance(idx, vp_q, vn_q, vpi, vni);
+
+                if ((double)d_approx <= r && range_push64(out, (int)i, (double)d_approx) != 0) {
+                    ret = -1;
+                    break;
+                }
+            }
+            PERF_END(PERF_PHASE_APPROX);
+        }
+        index_cascade_end(order, buf);
+    }
+    perf_scan_add(scanned, pruned);
+
+    // Distanza reale dei candidati ed eventuale filtro su r_real
+    PERF_BEGIN(PERF_PHASE_RERANK);
+    size_t kept = first;
+    for (size_t c = first; c < out->n; c++) {
+        Neighbor64 nb = out->v[c];
+        nb.dist_real = euclidean_distance_f64(q, &ds->data[(size_t)nb.id * D], D);
+        if (r_real >= 0.0 && nb.dist_real > r_real) continue;
+        out->v[kept++] = nb;
+    }
+    out->n = kept;
+    PERF_END(PERF_PHASE_RERANK);
+
+    free(vp_q);
+    free(vn_q);
+    free(dq_pivot);
+    return ret;
+}
+
+// Concatena i buffer di nq query in un RangeResult64 e li libera
+static RangeResult64 *range_pack64(RangeBuf64 *bufs, size_t nq)
+{
+    RangeResult64 *res = (RangeResult64 *)malloc(sizeof(RangeResult64));
+    size_t total = 0;
+    for (size_t i = 0; i < nq; i++) total += bufs[i].n;
+
+    if (res) {
+        res->nq      = nq;
+        res->offsets = (size_t *)malloc((nq + 1) * sizeof(size_t));
+        res->items   = (Neighbor64 *)malloc((total ? total : 1) * sizeof(Neighbor64));
+        if (!res->offsets || !res->items) {
+            free_range_result_f64(res);
+            res = NULL;
+        }
+    }
+
+    size_t pos = 0;
+    for (size_t i = 0; i < nq; i++) {
+        if (res) {
+            res->offsets[i] = pos;
+            if (bufs[i].n) memcpy(&res->items[pos], bufs[i].v, bufs[i].n * sizeof(Neighbor64));
+            pos += bufs[i].n;
+        }
+        free(bufs[i].v);
+    }
+    if (res) res->offsets[nq] = pos;
+
+    free(bufs);
+    return res;
+}
+
+RangeResult64 *range_query_single_f64(const MatrixF64 *ds,
+                                const Index *idx,
+                                const double *q,
+                                int x,
+                                double r,
+                                double r_real)
+{
+    if (!ds || !idx || !q) return NULL;
+
+    RangeBuf64 *buf = (RangeBuf64 *)calloc(1, sizeof(RangeBuf64));
+    if (!buf) return NULL;
+
+    if (range_scan64(ds, idx, q, x, r, r_real, buf) != 0) {
+        free(buf->v);
+        free(buf);
+        return NULL;
+    }
+    return range_pack64(buf, 1);
+}
+
+RangeResult64 *range_query_all_f64(const MatrixF64 *ds,
+                             const Index *idx,
+                             const MatrixF64 *queries,
+                             int x,
+                             double r,
+                             double r_real)
+{
+    if (!ds || !idx || !queries) return NULL;
+
+    size_t nq = queries->n;
+    RangeBuf64 *bufs = (RangeBuf64 *)calloc(nq ? nq : 1, sizeof(RangeBuf64));
+    if (!bufs) return NULL;
+
+    int failed = 0;
+
+    #pragma omp parallel for schedule(dynamic) reduction(|:failed)
+    for (long qi = 0; qi < (long)nq; qi++) {
+        const double *q = &queries->data[(size_t)qi * queries->d];
+        if (range_scan64(ds, idx, q, x, r, r_real, &bufs[qi]) != 0) failed = 1;
+    }
+
+    if (failed) {
+        for (size_t i = 0; i < nq; i++) free(bufs[i].v);
+        free(bufs);
+        return NULL;
+    }
+    return range_pack64(bufs, nq);
+}
+
+// Shard in ordine di riga: concatenando i risultati gli id restano crescenti
+RangeResult64 *range_query_sharded_all_f64(const MatrixF64 *ds,
+                                     const ShardedIndex *sx,
+                                     const MatrixF64 *queries,
+                                     int x,
+                                     double r,
+                                     double r_real)
+{
+    if (!ds || !sx || !queries) return NULL;
+
+    size_t nq = queries->n;
+    RangeResult64 **part = (RangeResult64 **)calloc(sx->S, sizeof(RangeResult64 *));
+    RangeBuf64 *bufs = (RangeBuf64 *)calloc(nq ? nq : 1, sizeof(RangeBuf64));
+    int failed = !part || !bufs;
+
+    for (size_t s = 0; s < sx->S && !failed; s++) {
+        MatrixF64 view = shard_view_f64(ds, sx, s);
+        part[s] = range_query_all_f64(&view, sx->shards[s], queries, x, r, r_real);
+        if (!part[s]) failed = 1;
+    }
+
+    for (size_t i = 0; i < nq && !failed; i++) {
+        for (size_t s = 0; s < sx->S && !failed; s++) {
+            const RangeResult64 *p = part[s];
+            for (size_t c = p->offsets[i]; c < p->offsets[i + 1]; c++) {
+                Neighbor64 nb = p->items[c];
+                if (range_push64(&bufs[i], nb.id + (int)sx->offset[s], nb.dist_approx) != 0) {
+                    failed = 1;
+                    break;
+                }
+                bufs[i].v[bufs[i].n - 1].dist_real = nb.dist_real;
+            }
+        }
+    }
+
+    if (part)
+        for (size_t s = 0; s < sx->S; s++) free_range_result_f64(part[s]);
+    free(part);
+
+    if (failed) {
+        if (bufs)
+            for (size_t i = 0; i < nq; i++) free(bufs[i].v);
+        free(bufs);
+        return NULL;
+    }
+    return range_pack64(bufs, nq);
+}
+
+void free_range_result_f64(RangeResult64 *res)
+{
+    if (!res) return;
+    free(res->offsets);
+    free(res->items);
+    free(res);
+}
+
+// ------------------ K-NN FILTRATO (RowFilter) ----------------------
+//
+// Il filtro  applicato nella scansione, prima del limite inferiore: le
+// righe escluse non costano n d* n la distanza approssimata e la lista
+// contiene sempre k righe ammesse (se ce ne sono). Con un filtro molto
+// selettivo (<= n / ROW_FILTER_SPARSE righe ammesse) si scandisce
+// direttamente l'elenco degli id ammessi.
+//
+// ----------------------------------------------------------------------------
+
+// Scansione di knn_query_single ristretta alle righe ammesse da f, oppure
+// (rows != NULL) alle n_rows righe elencate in rows
+static void knn_filtered_scan64(const MatrixF64 *ds,
+                              const Index *idx,
+                              const double *q,
+                              int k,
+                              int x,
+                              const RowFilter *f,
+                              const uint32_t *rows,
+                              size_t n_rows,
+                              Neighbor64 *neighbors)
+{
+    size_t n = ds->n;
+    size_t D = ds->d;
+    int h = (int)idx->h;
+
+    if (k > (int)n) k = (int)n;
+
+    for (int i = 0; i < k; i++) {
+        neighbors[i].id          = -1;
+        neighbors[i].dist_approx = DBL_MAX;
+        neighbors[i].dist_real   = DBL_MAX;
+    }
+
+    uint8_t *vp_q = (uint8_t *)calloc(idx->Dp, sizeof(uint8_t));
+    uint8_t *vn_q = (uint8_t *)calloc(idx->Dp, sizeof(uint8_t));
+    int *dq_pivot = (int *)malloc(h * sizeof(int));
+    if (!vp_q || !vn_q || !dq_pivot) {
+        free(vp_q);
+        free(vn_q);
+        free(dq_pivot);
+        return;
+    }
+
+    PERF_BEGIN(PERF_PHASE_QUANT);
+    quantize_vector_graded_f64(q, vp_q, vn_q, D, x, idx->bits);
+    PERF_END(PERF_PHASE_QUANT);
+
+    PERF_BEGIN(PERF_PHASE_PIVOT);
+    index_pivot_distances(idx, vp_q, vn_q, 1, dq_pivot);
+    PERF_END(PERF_PHASE_PIVOT);
+
+    size_t total = rows ? n_rows : n;
+    size_t row[SCAN_BLOCK];
+    int d_star[SCAN_BLOCK];
+    size_t scanned = 0, pruned = 0;
+
+    for (size_t i0 = 0; i0 < total; i0 += SCAN_BLOCK) {
+        size_t cnt = total - i0 < SCAN_BLOCK ? total - i0 : SCAN_BLOCK;
+
+        // Filtro + limite inferiore; le righe escluse hanno d* = -1
+        PERF_BEGIN(PERF_PHASE_LB);
+        for (size_t b = 0; b < cnt; b++) {
+            size_t i = rows ? rows[i0 + b] : i0 + b;
+            row[b] = i;
+            if (!rows && !row_filter_allows(f, i)) {
+                d_star[b] = -1;
+                continue;
+            }
+            const int *dv = &idx->dist[i * h];
+            int best = 0;
+            for (int j = 0; j < h; j++) {
+                int diff = dv[j] - dq_pivot[j];
+                if (diff < 0) diff = -diff;
+                if (diff > best) best = diff;
+            }
+            d_star[b] = best;
+            scanned++;
+        }
+        PERF_END(PERF_PHASE_LB);
+
+        PERF_BEGIN(PERF_PHASE_APPROX);
+        for (size_t b = 0; b < cnt; b++) {
+            if (d_star[b] < 0) continue;
+            size_t i = row[b];
+
+            int worst = find_worst_neighbor64(neighbors, k);
+            double worst_approx = neighbors[worst].dist_approx;
+
+            // PRUNING
+            if ((double)d_star[b] >= worst_approx) {
+                pruned++;
+                continue;
+            }
+
+            const uint8_t *vpi = &idx->vp_all[i * idx->Dp];
+            const uint8_t *vni = &idx->vn_all[i * idx->Dp];
+            int d_approx = index_code_distance(idx, vp_q, vn_q, vpi, vni);
+
+            if ((double)d_approx < worst_approx) {
+                neighbors[worst].id          = (int)i;
+                neighbors[worst].dist_approx = (double)d_approx;
+            }
+        }
+        PERF_END(PERF_PHASE_APPROX);
+    }
+    perf_scan_add(scanned, pruned);
+
+    PERF_BEGIN(PERF_PHASE_RERANK);
+    for (int i = 0; i < k; i++) {
+        if (neighbors[i].id < 0) continue;
+        const double *v = &ds->data[(size_t)neighbors[i].id * D];
+        neighbors[i].dist_real = euclidean_distance_f64(q, v, D);
+    }
+    PERF_END(PERF_PHASE_RERANK);
+
+    free(vp_q);
+    free(vn_q);
+    free(dq_pivot);
+}
+
+// Elenco degli id ammessi se il filtro  selettivo, altrimenti NULL
+// (scansione con test del bit). *n_rows = righe elencate.
+static uint32_t *filter_rows64(const RowFilter *f, size_t n, size_t *n_rows)
+{
+    *n_rows = 0;
+    size_t allowed = row_filter_count(f, n);
+    if (allowed * ROW_FILTER_SPARSE > n) return NULL;
+
+    uint32_t *rows = (uint32_t *)malloc((allowed ? allowed : 1) * sizeof(uint32_t));
+    if (rows) *n_rows = row_filter_rows(f, n, rows);
+    return rows;
+}
+
+void knn_query_single_filtered_f64(const MatrixF64 *ds,
+                               const Index *idx,
+                               const double *q,
+                               int k,
+                               int x,
+                               const RowFilter *f,
+                               Neighbor64 *neighbors)
+{
+    if (!ds || !idx || !q || !neighbors || k <= 0) return;
+    if (!f || !f->bits) {
+        knn_query_single_f64(ds, idx, q, k, x, neighbors);
+        return;
+    }
+
+    size_t n_rows;
+    uint32_t *rows = filter_rows64(f, ds->n, &n_rows);
+    knn_filtered_scan64(ds, idx, q, k, x, f, rows, n_rows, neighbors);
+    free(rows);
+}
+
+void knn_query_all_filtered_f64(const MatrixF64 *ds,
+                            const Index *idx,
+                            const MatrixF64 *queries,
+                            int k,
+                            int x,
+                            const RowFilter *filters,
+                            size_t n_filters,
+                            Neighbor64 *results)
+{
+    if (!ds || !idx || !queries || !results || k <= 0) return;
+    if (!filters || (n_filters != 1 && n_filters != queries->n)) return;
+    if (n_filters == 1 && !filters->bits) {
+        knn_query_all_f64(ds, idx, queries, k, x, results);
+        return;
+    }
+
+    // Filtro condiviso: l'elenco degli id ammessi si costruisce una volta
+    size_t n_rows = 0;
+    uint32_t *rows = n_filters == 1 ? filter_rows64(filters, ds->n, &n_rows) : NULL;
+
+    #pragma omp parallel for schedule(dynamic)
+    for (long qi = 0; qi < (long)queries->n; qi++) {
+        const double *q = &queries->data[(size_t)qi * queries->d];
+        Neighbor64 *nb = &results[(size_t)qi * k];
+        if (n_filters == 1)
+            knn_filtered_scan64(ds, idx, q, k, x, filters, rows, n_rows, nb);
+        else
+            knn_query_single_filtered_f64(ds, idx, q, k, x, &filters[qi], nb);
+    }
+
+    free(rows);
+}
+
+// Indice partizionato: il filtro di ogni shard parte dalla sua prima riga
+void knn_query_sharded_all_filtered_f64(const MatrixF64 *ds,
+                                    const ShardedIndex *sx,
+                                    const MatrixF64 *queries,
+                                    int k,
+                                    int x,
+                                    const RowFilter *filters,
+                                    size_t n_filters,
+                                    Neighbor64 *results)
+{
+    if (!ds || !sx || !queries || !results || k <= 0) return;
+    if (!filters || (n_filters != 1 && n_filters != queries->n)) return;
+
+    size_t S  = sx->S;
+    size_t nq = queries->n;
+    size_t D  = queries->d;
+    int shared = n_filters == 1;
+
+    if (shared && !filters->bits) {
+        knn_query_sharded_all_f64(ds, sx, queries, k, x, results);
+        return;
+    }
+
+    // Filtro condiviso: filtro ed elenco degli id ammessi di ogni shard si
+    // costruiscono una volta, come nel caso non partizionato
+    RowFilter *sf     = shared ? (RowFilter *)malloc(S * sizeof(RowFilter)) : NULL;
+    uint32_t **rows   = shared ? (uint32_t **)calloc(S, sizeof(uint32_t *)) : NULL;
+    size_t    *n_rows = shared ? (size_t *)calloc(S, sizeof(size_t)) : NULL;
+    Neighbor64 *part = (Neighbor64 *)malloc(SHARD_QB * S * (size_t)k * sizeof(Neighbor64));
+    if (!part || (shared && (!sf || !rows || !n_rows))) {
+        free(sf);
+        free(rows);
+        free(n_rows);
+        free(part);
+        return;
+    }
+    for (size_t s = 0; shared && s < S; s++) {
+        sf[s] = filters[0];
+        sf[s].base += sx->offset[s];
+        rows[s] = filter_rows64(&sf[s], sx->offset[s + 1] - sx->offset[s], &n_rows[s]);
+    }
+
+    for (size_t q0 = 0; q0 < nq; q0 += SHARD_QB) {
+        size_t qc = nq - q0 < SHARD_QB ? nq - q0 : SHARD_QB;
+        init_neighbors64(part, qc * S * (size_t)k);
+
+        #pragma omp parallel for schedule(dynamic)
+        for (long t = 0; t < (long)(qc * S); t++) {
+            size_t qi = (size_t)t / S, s = (size_t)t % S;
+            MatrixF64 view = shard_view_f64(ds, sx, s);
+            const double *q = &queries->data[(q0 + qi) * D];
+            if (shared) {
+                knn_filtered_scan64(&view, sx->shards[s], q, k, x, &sf[s], rows[s], n_rows[s], &part[(size_t)t * k]);
+            } else {
+                RowFilter f = filters[q0 + qi];
+                f.base += sx->offset[s];
+                knn_query_single_filtered_f64(&view, sx->shards[s], q, k, x, &f, &part[(size_t)t * k]);
+            }
+        }
+
+        #pragma omp parallel for schedule(static)
+        for (long qi = 0; qi < (long)qc; qi++)
+            merge_shards64(sx, &part[(size_t)qi * S * k], k, &results[(q0 + qi) * (size_t)k]);
+    }
+
+    for (size_t s = 0; shared && s < S; s++) free(rows[s]);
+    free(sf);
+    free(rows);
+    free(n_rows);
+    free(part);
+}
+
+// IVF (vedi knn_query_ivf_single in query.c)
+void knn_query_ivf_single_f64(const MatrixF64 *ds,
+                              const IvfIndex *ivf,
+                              const double *q,
+                              int k,
+                              int x,
+                              int nprobe,
+                              Neighbor64 *neighbors)
+{
+    if (!ds || !ivf || !q || !neighbors) return;
+
+    const Index *idx = ivf->idx;
+    size_t n = ds->n;
+    size_t D = ds->d;
+    int h = (int)idx->h;
+
+    if (k > (int)n) k = (int)n;
+
+    for (int i = 0; i < k; i++) {
+        neighbors[i].id          = -1;
+        neighbors[i].dist_approx = DBL_MAX;
+        neighbors[i].dist_real   = DBL_MAX;
+    }
+
+    size_t np = nprobe > 0 ? (size_t)nprobe : 1;
+    if (np > ivf->C) np = ivf->C;
+
+    uint8_t  *vp_q     = (uint8_t*)calloc(idx->Dp, sizeof(uint8_t));
+    uint8_t  *vn_q     = (uint8_t*)calloc(idx->Dp, sizeof(uint8_t));
+    int      *dq_pivot = (int*)malloc(h * sizeof(int));
+    uint32_t *lists    = (uint32_t*)malloc(np * sizeof(uint32_t));
+    if (!vp_q || !vn_q || !dq_pivot || !lists) {
+        free(vp_q); free(vn_q); free(dq_pivot); free(lists);
+        return;
+    }
+
+    PERF_BEGIN(PERF_PHASE_QUANT);
+    quantize_vector_graded_f64(q, vp_q, vn_q, D, x, idx->bits);
+    PERF_END(PERF_PHASE_QUANT);
+
+    PERF_BEGIN(PERF_PHASE_PIVOT);
+    index_pivot_distances(idx, vp_q, vn_q, 1, dq_pivot);
+    np = ivf_probe_f64(ivf, q, (int)np, lists);
+    PERF_END(PERF_PHASE_PIVOT);
+
+    // Ordine della cascata una volta per query, comune alle liste sondate
+    int dq_hot[INDEX_MAX_HOT], buf[INDEX_ORDER_STACK];
+    int *order = index_cascade_begin(idx, dq_pivot, dq_hot, buf);
+
+    size_t scanned = 0, pruned = 0;
+    for (size_t l = 0; l < np; l++) {
+        size_t begin = ivf->offset[lists[l]];
+        size_t end   = ivf->offset[lists[l] + 1];
+        block_scan64(idx, vp_q, vn_q, dq_pivot, dq_hot, order, begin, end, k, neighbors, &pruned, NULL);
+        scanned += end - begin;
+    }
+    index_cascade_end(order, buf);
+    perf_scan_add(scanned, pruned);
+
+    PERF_BEGIN(PERF_PHASE_RERANK);
+    for (int i = 0; i < k; i++) {
+        if (neighbors[i].id < 0) {
+            neighbors[i].dist_real = DBL_MAX;
+            continue;
+        }
+        neighbors[i].id = (int)ivf->ids[neighbors[i].id];
+        const double *v = &ds->data[(size_t)neighbors[i].id * D];
+        neighbors[i].dist_real = euclidean_distance_f64(q, v, D);
+    }
+    PERF_END(PERF_PHASE_RERANK);
+
+    free(vp_q);
+    free(vn_q);
+    free(dq_pivot);
+    free(lists);
+}
+
+void knn_query_ivf_all_f64(const MatrixF64 *ds, const IvfIndex *ivf, const MatrixF64 *queries, int k, int x, int nprobe, Neighbor64 *results)
+{
+    if (!ds || !ivf || !queries || !results) return;
+
+    #pragma omp parallel for schedule(dynamic)
+    for (size_t qi = 0; qi < queries->n; qi++) {
+        const double *q = &queries->data[qi * queries->d];
+        knn_query_ivf_single_f64(ds, ivf, q, k, x, nprobe, &results[qi * k]);
+    }
+}
+
+// Grafo HNSW (vedi knn_query_hnsw_single in query.c)
+void knn_query_hnsw_single_f64(const MatrixF64 *ds,
+                               const HnswIndex *g,
+                               const double *q,
+                               int k,
+                               int x,
+                               int ef,
+                               Neighbor64 *neighbors)
+{
+    if (!ds || !g || !q || !neighbors || k <= 0) return;
+
+    size_t D = ds->d;
+    if (ef < k) ef = k;
+
+    for (int i = 0; i < k; i++) {
+        neighbors[i].id          = -1;
+        neighbors[i].dist_approx = DBL_MAX;
+        neighbors[i].dist_real   = DBL_MAX;
+    }
+
+    uint8_t    *vp_q = (uint8_t*)calloc(g->idx->Dp, sizeof(uint8_t));
+    uint8_t    *vn_q = (uint8_t*)calloc(g->idx->Dp, sizeof(uint8_t));
+    uint32_t   *ids  = (uint32_t*)malloc((size_t)ef * sizeof(uint32_t));
+    int        *dist = (int*)malloc((size_t)ef * sizeof(int));
+    Neighbor64 *cand = (Neighbor64*)malloc((size_t)ef * sizeof(Neighbor64));
+    if (!vp_q || !vn_q || !ids || !dist || !cand) {
+        free(vp_q); free(vn_q); free(ids); free(dist); free(cand);
+        return;
+    }
+
+    PERF_BEGIN(PERF_PHASE_QUANT);
+    quantize_vector_graded_f64(q, vp_q, vn_q, D, x, g->idx->bits);
+    PERF_END(PERF_PHASE_QUANT);
+
+    size_t evaluated = 0;
+    PERF_BEGIN(PERF_PHASE_APPROX);
+    size_t c = hnsw_search(g, vp_q, vn_q, ef, ids, dist, &evaluated);
+    PERF_END(PERF_PHASE_APPROX);
+    perf_scan_add(evaluated, 0);
+
+    PERF_BEGIN(PERF_PHASE_RERANK);
+    for (size_t i = 0; i < c; i++) {
+        cand[i].id          = (int)ids[i];
+        cand[i].dist_approx = (double)dist[i];
+        cand[i].dist_real   = euclidean_distance_f64(q, &ds->data[(size_t)ids[i] * D], D);
+    }
+    qsort(cand, c, sizeof(Neighbor64), cmp_neighbor64_real);
+    PERF_END(PERF_PHASE_RERANK);
+
+    for (size_t i = 0; i < c && i < (size_t)k; i++)
+        neighbors[i] = cand[i];
+
+    free(vp_q);
+    free(vn_q);
+    free(ids);
+    free(dist);
+    free(cand);
+}
+
+void knn_query_hnsw_all_f64(const MatrixF64 *ds, const HnswIndex *g, const MatrixF64 *queries, int k, int x, int ef, Neighbor64 *results)
+{
+    if (!ds || !g || !queries || !results) return;
+
+    #pragma omp parallel for schedule(dynamic)
+    for (size_t qi = 0; qi < queries->n; qi++) {
+        const double *q = &queries->data[qi * queries->d];
+        knn_query_hnsw_single_f64(ds, g, q, k, x, ef, &results[qi * k]);
+    }
+}
+
+// ------------------ QUANTIZZAZIONE PRODOTTO (PQ) ----------------------
+
+// ADC su tutti i codici per k*r candidati, poi re-rank per distanza reale
+void knn_query_pq_single_f64(const MatrixF64 *ds,
+                             const PqIndex *pq,
+                             const double *q,
+                             int k,
+                             int r,
+                             Neighbor64 *neighbors)
+{
+    if (!ds || !pq || !q || !neighbors || k <= 0) return;
+
+    size_t D = ds->d;
+    if (r < 1) r = 1;
+    size_t kk = (size_t)k * (size_t)r;
+    if (kk > pq->n) kk = pq->n;
+
+    for (int i = 0; i < k; i++) {
+        neighbors[i].id          = -1;
+        neighbors[i].dist_approx = DBL_MAX;
+        neighbors[i].dist_real   = DBL_MAX;
+    }
+    if (kk == 0) return;
+
+    float      *y    = (float*)malloc(pq_rotated_dim(pq) * sizeof(float));
+    float      *T    = (float*)malloc((size_t)pq->M * pq->ks * sizeof(float));
+    uint32_t   *ids  = (uint32_t*)malloc(kk * sizeof(uint32_t));
+    float      *dist = (float*)malloc(kk * sizeof(float));
+    Neighbor64 *cand = (Neighbor64*)malloc(kk * sizeof(Neighbor64));
+    if (!y || !T || !ids || !dist || !cand) {
+        free(y); free(T); free(ids); free(dist); free(cand);
+        return;
+    }
+
+    PERF_BEGIN(PERF_PHASE_QUANT);
+    pq_project_f64(pq, q, y);
+    pq_tables(pq, y, T);
+    PERF_END(PERF_PHASE_QUANT);
+
+    PERF_BEGIN(PERF_PHASE_APPROX);
+    size_t c = pq_scan(pq, T, kk, ids, dist);
+    PERF_END(PERF_PHASE_APPROX);
+    perf_scan_add(pq->n, 0);
+
+    PERF_BEGIN(PERF_PHASE_RERANK);
+    for (size_t i = 0; i < c; i++) {
+        cand[i].id          = (int)ids[i];
+        cand[i].dist_approx = (double)dist[i];
+        cand[i].dist_real   = euclidean_distance_f64(q, &ds->data[(size_t)ids[i] * D], D);
+    }
+    qsort(cand, c, sizeof(Neighbor64), cmp_neighbor64_real);
+    PERF_END(PERF_PHASE_RERANK);
+
+    for (size_t i = 0; i < c && i < (size_t)k; i++)
+        neighbors[i] = cand[i];
+
+    free(y);
+    free(T);
+    free(ids);
+    free(dist);
+    free(cand);
+}
+
+void knn_query_pq_all_f64(const MatrixF64 *ds, const PqIndex *pq, const MatrixF64 *queries, int k, int r, Neighbor64 *results)
+{
+    if (!ds || !pq || !queries || !results) return;
+
+    #pragma omp parallel for schedule(dynamic)
+    for (size_t qi = 0; qi < queries->n; qi++) {
+        const double *q = &queries->data[qi * queries->d];
+        knn_query_pq_single_f64(ds, pq, q, k, r, &results[qi * k]);
+    }
+}
+
+// ------------------ K-NN PER ID E GRAFO K-NN ----------------------
+
+static QueryCodes index_as_queries64(const Index *idx)
+{
+    QueryCodes qc;
+    qc.nq = idx->n;
+    qc.D  = idx->Dp;
+    qc.h  = idx->h;
+    qc.vp = idx->vp_all;
+    qc.vn = idx->vn_all;
+    qc.dq = idx->dist;
+    return qc;
+}
+
+void knn_query_by_id_f64(const MatrixF64 *ds,
+                         const Index *idx,
+                         size_t id,
+                         int k,
+                         int r,
+                         Neighbor64 *neighbors)
+{
+    if (!ds || !idx || !neighbors || k <= 0 || id >= idx->n || ds->n != idx->n) return;
+
+    QueryCodes qc = index_as_queries64(idx);
+    query_prepared64(ds, idx, &ds->data[id * ds->d], &qc, id, k, r, NULL, NULL, neighbors);
+}
+
+void knn_query_by_id_all_f64(const MatrixF64 *ds,
+                             const Index *idx,
+                             const uint32_t *ids,
+                             size_t n_ids,
+                             int k,
+                             int r,
+                             Neighbor64 *results)
+{
+    if (!ds || !idx || !ids || !results || k <= 0 || ds->n != idx->n) return;
+
+    #pragma omp parallel for schedule(dynamic)
+    for (long i = 0; i < (long)n_ids; i++)
+        knn_query_by_id_f64(ds, idx, ids[i], k, r, &results[(size_t)i * k]);
+}
+
+#define GRAPH_TILE 256
+
+typedef struct {
+    Neighbor64 *nb;      // n x k
+    double     *worst;
+    int        *slot;
+    int         k;
+} GraphLists64;
+
+static void graph_offer64(GraphLists64 *g, size_t i, int j, double d)
+{
+    Neighbor64 *nb = &g->nb[i * g->k];
+    nb[g->slot[i]].id          = j;
+    nb[g->slot[i]].dist_approx = d;
+    g->slot[i]  = find_worst_neighbor64(nb, g->k);
+    g->worst[i] = nb[g->slot[i]].dist_approx;
+}
+
+// Coppie delle tessere [a0, a1) x [b0, b1), j > i sulla diagonale
+static size_t graph_tile64(const Index *idx, GraphLists64 *g, size_t a0, size_t a1, size_t b0, size_t b1)
+{
+    size_t Dp = idx->Dp, h = idx->h, pruned = 0;
+
+    for (size_t i = a0; i < a1; i++) {
+        const int *di = &idx->dist[i * h];
+        const uint8_t *vpi = &idx->vp_all[i * Dp];
+        const uint8_t *vni = &idx->vn_all[i * Dp];
+
+        for (size_t j = a0 == b0 ? i + 1 : b0; j < b1; j++) {
+            const int *dj = &idx->dist[j * h];
+            int best = 0;
+            for (size_t p = 0; p < h; p++) {
+                int diff = di[p] - dj[p];
+                if (diff < 0) diff = -diff;
+                if (diff > best) best = diff;
+            }
+
+            double wi = g->worst[i], wj = g->worst[j];
+            int to_i = (double)best < wi, to_j = (double)best < wj;
+            if (!to_i && !to_j) {
+                pruned++;
+                continue;
+            }
+
+            double d = (double)index_code_distance(idx, vpi, vni, &idx->vp_all[j * Dp], &idx->vn_all[j * Dp]);
+            if (to_i && d < wi) graph_offer64(g, i, (int)j, d);
+            if (to_j && d < wj) graph_offer64(g, j, (int)i, d);
+        }
+    }
+    return pruned;
+}
+
+// Diagonali, poi B - 1 turni del metodo del cerchio (tessere disgiunte)
+static void graph_rounds64(const Index *idx, GraphLists64 *g)
+{
+    size_t n = idx->n;
+    size_t nt = (n + GRAPH_TILE - 1) / GRAPH_TILE;
+    size_t B = nt + (nt & 1);
+    size_t pruned = 0;
+
+    PERF_BEGIN(PERF_PHASE_APPROX);
+    #pragma omp parallel for schedule(dynamic) reduction(+:pruned)
+    for (long t = 0; t < (long)nt; t++) {
+        size_t a0 = (size_t)t * GRAPH_TILE, a1 = a0 + GRAPH_TILE < n ? a0 + GRAPH_TILE : n;
+        pruned += graph_tile64(idx, g, a0, a1, a0, a1);
+    }
+
+    for (size_t r = 0; r + 1 < B; r++) {
+        #pragma omp parallel for schedule(dynamic) reduction(+:pruned)
+        for (long p = 0; p < (long)(B / 2); p++) {
+            size_t a = p == 0 ? r : (r + (size_t)p) % (B - 1);
+            size_t b = p == 0 ? B - 1 : (r + B - 1 - (size_t)p) % (B - 1);
+            if (a >= nt || b >= nt) continue;
+            if (a > b) { size_t t = a; a = b; b = t; }
+
+            size_t a0 = a * GRAPH_TILE, a1 = a0 + GRAPH_TILE < n ? a0 + GRAPH_TILE : n;
+            size_t b0 = b * GRAPH_TILE, b1 = b0 + GRAPH_TILE < n ? b0 + GRAPH_TILE : n;
+            pruned += graph_tile64(idx, g, a0, a1, b0, b1);
+        }
+    }
+    PERF_END(PERF_PHASE_APPROX);
+
+    perf_scan_add(n * (n - 1) / 2, pruned);
+}
+
+RangeResult64 *knn_graph_f64(const MatrixF64 *ds, const Index *idx, int k)
+{
+    if (!ds || !idx || k <= 0 || ds->n != idx->n || ds->d != idx->D || idx->n == 0) return NULL;
+
+    size_t n = idx->n, D = ds->d;
+    GraphLists64 g;
+    g.k     = k;
+    g.nb    = (Neighbor64 *)malloc(n * (size_t)k * sizeof(Neighbor64));
+    g.worst = (double *)malloc(n * sizeof(double));
+    g.slot  = (int *)malloc(n * sizeof(int));
+    RangeResult64 *res = (RangeResult64 *)malloc(sizeof(RangeResult64));
+    size_t *offsets = (size_t *)malloc((n + 1) * sizeof(size_t));
+    if (!g.nb || !g.worst || !g.slot || !res || !offsets) {
+        free(g.nb); free(g.worst); free(g.slot); free(res); free(offsets);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < n * (size_t)k; i++) {
+        g.nb[i].id          = -1;
+        g.nb[i].dist_approx = DBL_MAX;
+        g.nb[i].dist_real   = DBL_MAX;
+    }
+    for (size_t i = 0; i < n; i++) {
+        g.worst[i] = DBL_MAX;
+        g.slot[i]  = 0;
+    }
+
+    graph_rounds64(idx, &g);
+
+    #pragma omp parallel for schedule(static)
+    for (long i = 0; i < (long)n; i++) {
+        Neighbor64 *nb = &g.nb[(size_t)i * k];
+        real_distances64(ds, &ds->data[(size_t)i * D], k, nb);
+        qsort(nb, (size_t)k, sizeof(Neighbor64), cmp_neighbor64_real);
+    }
+
+    size_t m = (size_t)k < n - 1 ? (size_t)k : n - 1;
+    for (size_t i = 0; i < n; i++) {
+        if (m < (size_t)k)
+            memmove(&g.nb[i * m], &g.nb[i * (size_t)k], m * sizeof(Neighbor64));
+        offsets[i] = i * m;
+    }
+    offsets[n] = n * m;
+
+    Neighbor64 *items = (Neighbor64 *)realloc(g.nb, (m ? n * m : 1) * sizeof(Neighbor64));
+    res->nq      = n;
+    res->offsets = offsets;
+    res->items   = items ? items : g.nb;
+
+    free(g.worst);
+    free(g.slot);
+    return res;
 }
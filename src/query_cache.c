@@ -0,0 +1,289 @@
+#include "query_cache.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(_WIN32)
+#include <pthread.h>
+typedef pthread_mutex_t CacheLock;
+#define CACHE_LOCK_INIT(l)    pthread_mutex_init(l, NULL)
+#define CACHE_LOCK_DESTROY(l) pthread_mutex_destroy(l)
+#define CACHE_LOCK(l)         pthread_mutex_lock(l)
+#define CACHE_UNLOCK(l)       pthread_mutex_unlock(l)
+#elif defined(_OPENMP)
+#include <omp.h>
+typedef omp_lock_t CacheLock;
+#define CACHE_LOCK_INIT(l)    omp_init_lock(l)
+#define CACHE_LOCK_DESTROY(l) omp_destroy_lock(l)
+#define CACHE_LOCK(l)         omp_set_lock(l)
+#define CACHE_UNLOCK(l)       omp_unset_lock(l)
+#else
+typedef int CacheLock;
+#define CACHE_LOCK_INIT(l)    ((void)(l))
+#define CACHE_LOCK_DESTROY(l) ((void)(l))
+#define CACHE_LOCK(l)         ((void)(l))
+#define CACHE_UNLOCK(l)       ((void)(l))
+#endif
+
+// Codici impacchettati fino a questa dimensione restano sullo stack
+#define CODE_STACK 512
+
+// Voce: k id, k distanze approssimate, poi il codice impacchettato
+typedef struct Entry {
+    uint64_t      hash;
+    struct Entry *prev, *next;   // lista LRU (prev verso la più recente)
+    struct Entry *hnext;         // catena del bucket
+    int           k;
+    size_t        code_len;
+    int           data[];
+} Entry;
+
+typedef struct {
+    CacheLock lock;
+    uint64_t  version;       // Index.version delle voci presenti
+    Entry   **buckets;
+    size_t    mask;          // bucket - 1 (potenza di 2)
+    Entry    *head, *tail;   // più recente / meno recente
+    size_t    count, cap;
+    uint64_t  hits, misses, evictions, invalidations;
+} Shard;
+
+struct QueryCache {
+    Shard shard[QUERY_CACHE_SHARDS];
+};
+
+static const uint8_t *entry_code(const Entry *e)
+{
+    return (const uint8_t *)&e->data[2 * e->k];
+}
+
+// Byte del codice impacchettato: 2 * bits bit per componente
+static size_t code_len(const Index *idx)
+{
+    int bits = idx->bits > 1 ? idx->bits : 1;
+    return (2 * (size_t)bits * idx->D + 7) / 8;
+}
+
+// Per componente il livello di v+ nei bit bassi, poi quello di v- (con
+// codici ternari: v+ nel bit pari, v- nel bit dispari)
+static void pack_code(const Index *idx, const uint8_t *vp, const uint8_t *vn, uint8_t *out)
+{
+    int bits = idx->bits > 1 ? idx->bits : 1;
+    memset(out, 0, code_len(idx));
+    for (size_t j = 0, b = 0; j < idx->D; j++) {
+        unsigned v = (unsigned)vp[j] | (unsigned)vn[j] << bits;
+        for (int t = 0; t < 2 * bits; t++, b++)
+            out[b >> 3] |= (uint8_t)(((v >> t) & 1u) << (b & 7));
+    }
+}
+
+// FNV-1a sul codice, con k nei primi byte
+static uint64_t hash_code(const uint8_t *code, size_t len, int k)
+{
+    uint64_t h = 1469598103934665603ull ^ (uint64_t)(uint32_t)k;
+    h *= 1099511628211ull;
+    for (size_t i = 0; i < len; i++) {
+        h ^= code[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+// ------------------ PARTIZIONI (sotto lock) ----------------------
+
+static void lru_unlink(Shard *s, Entry *e)
+{
+    if (e->prev) e->prev->next = e->next; else s->head = e->next;
+    if (e->next) e->next->prev = e->prev; else s->tail = e->prev;
+}
+
+static void lru_push_front(Shard *s, Entry *e)
+{
+    e->prev = NULL;
+    e->next = s->head;
+    if (s->head) s->head->prev = e; else s->tail = e;
+    s->head = e;
+}
+
+static void bucket_remove(Shard *s, Entry *e)
+{
+    Entry **p = &s->buckets[e->hash & s->mask];
+    while (*p != e) p = &(*p)->hnext;
+    *p = e->hnext;
+}
+
+static void shard_clear(Shard *s)
+{
+    for (Entry *e = s->head, *nx; e; e = nx) {
+        nx = e->next;
+        free(e);
+    }
+    memset(s->buckets, 0, (s->mask + 1) * sizeof(Entry *));
+    s->head = s->tail = NULL;
+    s->count = 0;
+}
+
+// Svuota la partizione se le voci appartengono a un altro indice
+static void shard_check_version(Shard *s, const Index *idx)
+{
+    if (s->version == idx->version) return;
+    if (s->count) {
+        shard_clear(s);
+        s->invalidations++;
+    }
+    s->version = idx->version;
+}
+
+static Entry *shard_find(Shard *s, uint64_t h, const uint8_t *code, size_t len, int k)
+{
+    for (Entry *e = s->buckets[h & s->mask]; e; e = e->hnext)
+        if (e->hash == h && e->k == k && e->code_len == len && memcmp(entry_code(e), code, len) == 0)
+            return e;
+    return NULL;
+}
+
+// ------------------ API ----------------------
+
+QueryCache *query_cache_create(size_t capacity)
+{
+    if (capacity == 0) return NULL;
+
+    QueryCache *c = calloc(1, sizeof(QueryCache));
+    if (!c) return NULL;
+
+    size_t cap = (capacity + QUERY_CACHE_SHARDS - 1) / QUERY_CACHE_SHARDS;
+    size_t nb = 1;
+    while (nb < cap) nb <<= 1;
+
+    for (int i = 0; i < QUERY_CACHE_SHARDS; i++) {
+        Shard *s = &c->shard[i];
+        s->cap     = cap;
+        s->mask    = nb - 1;
+        s->buckets = calloc(nb, sizeof(Entry *));
+        if (!s->buckets) {
+            for (int j = 0; j < i; j++) {
+                CACHE_LOCK_DESTROY(&c->shard[j].lock);
+                free(c->shard[j].buckets);
+            }
+            free(c);
+            return NULL;
+        }
+        CACHE_LOCK_INIT(&s->lock);
+    }
+    return c;
+}
+
+void query_cache_free(QueryCache *c)
+{
+    if (!c) return;
+    for (int i = 0; i < QUERY_CACHE_SHARDS; i++) {
+        shard_clear(&c->shard[i]);
+        CACHE_LOCK_DESTROY(&c->shard[i].lock);
+        free(c->shard[i].buckets);
+    }
+    free(c);
+}
+
+void query_cache_clear(QueryCache *c)
+{
+    if (!c) return;
+    for (int i = 0; i < QUERY_CACHE_SHARDS; i++) {
+        CACHE_LOCK(&c->shard[i].lock);
+        shard_clear(&c->shard[i]);
+        CACHE_UNLOCK(&c->shard[i].lock);
+    }
+}
+
+int query_cache_get(QueryCache *c, const Index *idx, const uint8_t *vp, const uint8_t *vn,
+                    int k, int *ids, int *dist)
+{
+    if (!c || !idx || !vp || !vn || k <= 0) return 0;
+
+    uint8_t stack[CODE_STACK];
+    size_t len = code_len(idx);
+    uint8_t *code = len <= CODE_STACK ? stack : malloc(len);
+    if (!code) return 0;
+    pack_code(idx, vp, vn, code);
+
+    uint64_t h = hash_code(code, len, k);
+    Shard *s = &c->shard[(h >> 32) % QUERY_CACHE_SHARDS];
+
+    CACHE_LOCK(&s->lock);
+    shard_check_version(s, idx);
+    Entry *e = shard_find(s, h, code, len, k);
+    if (e) {
+        memcpy(ids,  &e->data[0], (size_t)k * sizeof(int));
+        memcpy(dist, &e->data[k], (size_t)k * sizeof(int));
+        lru_unlink(s, e);
+        lru_push_front(s, e);
+        s->hits++;
+    } else
+        s->misses++;
+    CACHE_UNLOCK(&s->lock);
+
+    if (code != stack) free(code);
+    return e != NULL;
+}
+
+void query_cache_put(QueryCache *c, const Index *idx, const uint8_t *vp, const uint8_t *vn,
+                     int k, const int *ids, const int *dist)
+{
+    if (!c || !idx || !vp || !vn || k <= 0) return;
+
+    size_t len = code_len(idx);
+    Entry *e = malloc(sizeof(Entry) + 2 * (size_t)k * sizeof(int) + len);
+    if (!e) return;
+    e->k        = k;
+    e->code_len = len;
+    memcpy(&e->data[0], ids,  (size_t)k * sizeof(int));
+    memcpy(&e->data[k], dist, (size_t)k * sizeof(int));
+    pack_code(idx, vp, vn, (uint8_t *)entry_code(e));
+    e->hash = hash_code(entry_code(e), len, k);
+
+    Shard *s = &c->shard[(e->hash >> 32) % QUERY_CACHE_SHARDS];
+
+    CACHE_LOCK(&s->lock);
+    shard_check_version(s, idx);
+
+    // Stessa chiave inserita da un altro thread nel frattempo: si sostituisce
+    Entry *old = shard_find(s, e->hash, entry_code(e), len, k);
+    if (old) {
+        bucket_remove(s, old);
+        lru_unlink(s, old);
+        free(old);
+        s->count--;
+    } else if (s->count >= s->cap) {
+        old = s->tail;
+        bucket_remove(s, old);
+        lru_unlink(s, old);
+        free(old);
+        s->count--;
+        s->evictions++;
+    }
+
+    Entry **b = &s->buckets[e->hash & s->mask];
+    e->hnext = *b;
+    *b = e;
+    lru_push_front(s, e);
+    s->count++;
+    CACHE_UNLOCK(&s->lock);
+}
+
+void query_cache_stats(QueryCache *c, QueryCacheStats *out)
+{
+    if (!out) return;
+    memset(out, 0, sizeof(*out));
+    if (!c) return;
+
+    for (int i = 0; i < QUERY_CACHE_SHARDS; i++) {
+        Shard *s = &c->shard[i];
+        CACHE_LOCK(&s->lock);
+        out->hits          += s->hits;
+        out->misses        += s->misses;
+        out->evictions     += s->evictions;
+        out->invalidations += s->invalidations;
+        out->entries       += s->count;
+        out->capacity      += s->cap;
+        CACHE_UNLOCK(&s->lock);
+    }
+}
@@ -0,0 +1,213 @@
+#include "result_writer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct ResultWriter {
+    FILE     *f_ids, *f_dst;
+    char     *ids_path, *dst_path;
+    uint32_t  nq, k;
+    int       f64;
+    int       err;        // una scrittura è fallita
+    size_t    rows;       // righe ricevute
+    size_t    cap, fill;  // righe per buffer / righe nei buffer
+    int32_t  *ids;        // cap x k
+    void     *dst;        // cap x k float o double
+};
+
+// "base.ext" -> "base<suffix>.ext" (senza estensione: .ds2); *npy = 1 per .npy
+static char *output_path(const char *path, const char *suffix, int *npy)
+{
+    const char *slash = strrchr(path, '/');
+    const char *bslash = strrchr(path, '\\');
+    if (bslash > slash) slash = bslash;
+    const char *dot = strrchr(path, '.');
+    if (dot && slash && dot < slash) dot = NULL;
+
+    const char *ext = dot ? dot : ".ds2";
+    size_t base = dot ? (size_t)(dot - path) : strlen(path);
+    *npy = strcmp(ext, ".npy") == 0;
+
+    char *out = (char *)malloc(base + strlen(suffix) + strlen(ext) + 1);
+    if (!out) return NULL;
+    memcpy(out, path, base);
+    strcpy(out + base, suffix);
+    strcat(out, ext);
+    return out;
+}
+
+// Intestazione NumPy 1.0: magic, lunghezza (uint16 little endian) e
+// dizionario completato da spazi e '\n' fino a un multiplo di 64 byte
+static int write_npy_header(FILE *f, const char *descr, uint32_t n, uint32_t d)
+{
+    char dict[128];
+    int len = snprintf(dict, sizeof(dict), "{'descr': '%s', 'fortran_order': False, 'shape': (%u, %u), }",
+                       descr, n, d);
+    if (len < 0 || (size_t)len >= sizeof(dict)) return -1;
+
+    size_t pad = (64 - (10 + (size_t)len + 1) % 64) % 64;
+    size_t hlen = (size_t)len + pad + 1;
+    unsigned char pre[10] = { 0x93, 'N', 'U', 'M', 'P', 'Y', 1, 0,
+                              (unsigned char)(hlen & 0xff), (unsigned char)(hlen >> 8) };
+
+    if (fwrite(pre, 1, sizeof(pre), f) != sizeof(pre)) return -1;
+    if (fwrite(dict, 1, (size_t)len, f) != (size_t)len) return -1;
+    for (size_t i = 0; i < pad; i++)
+        if (fputc(' ', f) == EOF) return -1;
+    return fputc('\n', f) == EOF ? -1 : 0;
+}
+
+static int write_header(FILE *f, int npy, const char *descr, uint32_t n, uint32_t d)
+{
+    if (npy) return write_npy_header(f, descr, n, d);
+    uint32_t hd[2] = { n, d };
+    return fwrite(hd, sizeof(uint32_t), 2, f) == 2 ? 0 : -1;
+}
+
+static void writer_free(ResultWriter *w)
+{
+    if (w->f_ids) fclose(w->f_ids);
+    if (w->f_dst) fclose(w->f_dst);
+    free(w->ids_path);
+    free(w->dst_path);
+    free(w->ids);
+    free(w->dst);
+    free(w);
+}
+
+ResultWriter *result_writer_open(const char *path, uint32_t nq, uint32_t k, int f64)
+{
+    if (!path || k == 0) return NULL;
+
+    ResultWriter *w = (ResultWriter *)calloc(1, sizeof(ResultWriter));
+    if (!w) return NULL;
+    w->nq  = nq;
+    w->k   = k;
+    w->f64 = f64;
+
+    int npy;
+    size_t dsz = f64 ? sizeof(double) : sizeof(float);
+    w->ids_path = output_path(path, "_ids", &npy);
+    w->dst_path = output_path(path, "_dst", &npy);
+    w->cap = RESULT_WRITER_BUF / ((size_t)k * dsz);
+    if (w->cap == 0) w->cap = 1;
+    w->ids = (int32_t *)malloc(w->cap * k * sizeof(int32_t));
+    w->dst = malloc(w->cap * k * dsz);
+    if (!w->ids_path || !w->dst_path || !w->ids || !w->dst) {
+        writer_free(w);
+        return NULL;
+    }
+
+    w->f_ids = fopen(w->ids_path, "wb");
+    w->f_dst = w->f_ids ? fopen(w->dst_path, "wb") : NULL;
+    if (!w->f_ids || !w->f_dst) {
+        perror("fopen");
+        if (w->f_ids) remove(w->ids_path);
+        writer_free(w);
+        return NULL;
+    }
+
+    if (write_header(w->f_ids, npy, "<i4", nq, k) != 0 ||
+        write_header(w->f_dst, npy, f64 ? "<f8" : "<f4", nq, k) != 0)
+        w->err = 1;
+    return w;
+}
+
+static void writer_flush(ResultWriter *w)
+{
+    size_t cnt = w->fill * w->k;
+    size_t dsz = w->f64 ? sizeof(double) : sizeof(float);
+    if (cnt && !w->err &&
+        (fwrite(w->ids, sizeof(int32_t), cnt, w->f_ids) != cnt ||
+         fwrite(w->dst, dsz, cnt, w->f_dst) != cnt))
+        w->err = 1;
+    w->fill = 0;
+}
+
+int result_writer_put(ResultWriter *w, const Neighbor *nb, size_t rows)
+{
+    if (!w || w->f64 || rows > w->nq - w->rows) return -1;
+
+    float *dst = (float *)w->dst;
+    for (size_t i = 0; i < rows; i++) {
+        size_t o = w->fill * w->k;
+        for (uint32_t j = 0; j < w->k; j++) {
+            w->ids[o + j] = nb[i * w->k + j].id;
+            dst[o + j]    = nb[i * w->k + j].dist_real;
+        }
+        if (++w->fill == w->cap) writer_flush(w);
+    }
+    w->rows += rows;
+    return w->err ? -1 : 0;
+}
+
+int result_writer_put_f64(ResultWriter *w, const Neighbor64 *nb, size_t rows)
+{
+    if (!w || !w->f64 || rows > w->nq - w->rows) return -1;
+
+    double *dst = (double *)w->dst;
+    for (size_t i = 0; i < rows; i++) {
+        size_t o = w->fill * w->k;
+        for (uint32_t j = 0; j < w->k; j++) {
+            w->ids[o + j] = nb[i * w->k + j].id;
+            dst[o + j]    = nb[i * w->k + j].dist_real;
+        }
+        if (++w->fill == w->cap) writer_flush(w);
+    }
+    w->rows += rows;
+    return w->err ? -1 : 0;
+}
+
+int result_writer_write_blocks(ResultWriter *w, size_t block, ResultBlockFn fn, void *ctx)
+{
+    if (!w || !fn || block == 0) return -1;
+
+    size_t left = w->nq - w->rows;
+    size_t nb = left < block ? left : block;
+    size_t esz = w->f64 ? sizeof(Neighbor64) : sizeof(Neighbor);
+    void *results = malloc((nb ? nb : 1) * w->k * esz);
+    if (!results) {
+        w->err = 1;
+        return -1;
+    }
+
+    int rc = 0;
+    for (size_t q0 = w->rows; q0 < w->nq && rc == 0; q0 += nb) {
+        size_t cnt = w->nq - q0 < nb ? w->nq - q0 : nb;
+        fn(ctx, q0, cnt, results);
+        rc = w->f64 ? result_writer_put_f64(w, (const Neighbor64 *)results, cnt)
+                    : result_writer_put(w, (const Neighbor *)results, cnt);
+    }
+    free(results);
+    return rc;
+}
+
+const char *result_writer_ids_path(const ResultWriter *w)
+{
+    return w ? w->ids_path : NULL;
+}
+
+const char *result_writer_dst_path(const ResultWriter *w)
+{
+    return w ? w->dst_path : NULL;
+}
+
+int result_writer_close(ResultWriter *w)
+{
+    if (!w) return -1;
+
+    writer_flush(w);
+    if (fclose(w->f_ids) != 0) w->err = 1;
+    if (fclose(w->f_dst) != 0) w->err = 1;
+    w->f_ids = w->f_dst = NULL;
+
+    // File incompleti: l'intestazione dichiara nq righe
+    int ret = w->err || w->rows != w->nq ? -1 : 0;
+    if (ret != 0) {
+        remove(w->ids_path);
+        remove(w->dst_path);
+    }
+    writer_free(w);
+    return ret;
+}
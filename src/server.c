@@ -0,0 +1,856 @@
+#include "server.h"
+#include "perfcount.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(_WIN32)
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0          // macOS: SIGPIPE è comunque ignorato
+#endif
+
+#define SEND_TIMEOUT_S 5        // risposte ferme da tanti secondi: connessione chiusa
+#define SEND_IOV       16       // messaggi per sendmsg
+
+// ------------------ STRUTTURA ----------------------
+//
+// Un solo thread di I/O accetta le connessioni, legge le richieste (poll
+// su tutti i socket) e le accoda nel motore corrente. Le risposte vanno
+// nella coda in uscita della connessione: chi le produce (la callback di
+// completamento nel thread del motore, o l'I/O per stats e errori) prova
+// un invio non bloccante e lascia il resto al thread di I/O, che lo
+// scrive su POLLOUT. Né l'I/O né il motore aspettano quindi un client
+// lento; quello che non legge per SEND_TIMEOUT_S secondi o accumula più
+// di max_out_mb di risposte viene disconnesso.
+//
+// A fine flusso in lettura la connessione resta aperta finché le sue
+// richieste in volo non hanno risposto; è liberata quando l'I/O l'ha
+// chiusa e nessuna richiesta è in volo.
+//
+// La ricarica gira in un thread a parte: il nuovo motore viene consegnato
+// al thread di I/O, che lo sostituisce fra due letture; il thread di
+// ricarica chiude poi il vecchio (che completa la propria coda).
+//
+// ---------------------------------------------------
+
+// Risposta in attesa di invio (header e payload contigui)
+typedef struct OutMsg {
+    struct OutMsg   *next;
+    size_t           len;
+    unsigned char    data[];
+} OutMsg;
+
+typedef struct {
+    int              fd;
+    int              refs;      // I/O + richieste in volo (atomico)
+    unsigned char   *buf;       // dati ricevuti non ancora elaborati
+    size_t           len, cap;
+    int              rd_closed; // fine flusso in lettura (solo thread di I/O)
+
+    // Coda in uscita (protetta da wlock)
+    pthread_mutex_t  wlock;
+    OutMsg          *out_head, *out_tail;
+    size_t           out_off;   // byte di out_head già inviati
+    size_t           out_bytes; // byte in coda non ancora inviati
+    size_t           out_max;
+    double           out_since; // ultimo progresso della coda
+    int              dead;      // errore di scrittura o client fermo: da chiudere
+} Conn;
+
+typedef struct {
+    const char      *path;
+    ServerLoader     load;
+    void            *user;
+    ServerOptions    opt;
+
+    ServerBackend    cur;
+
+    // Ricarica
+    pthread_t        reload_th;
+    int              reload_join;   // reload_th da raccogliere con pthread_join
+    int              reloading;     // thread di ricarica attivo
+    int              has_next;      // next pronto per lo scambio
+    int              swapped;       // scambio fatto: old da chiudere
+    int              stopping;
+    ServerBackend    next, old;
+    uint64_t         generation;
+
+    // Statistiche (protette da lock, aggiornate anche dai thread del motore)
+    pthread_mutex_t  lock;
+    pthread_cond_t   cond;
+    double           t_start;
+    uint64_t         connections, requests, queries, errors, rejected;
+    uint64_t         tiles_closed;  // tile dei motori già chiusi
+    uint64_t         lat_hist[SERVER_LAT_BUCKETS];
+    uint64_t         qps_sec[SERVER_QPS_WINDOW + 1];
+    uint64_t         qps_cnt[SERVER_QPS_WINDOW + 1];
+} Server;
+
+// Richiesta in volo nel motore
+typedef struct {
+    Server  *srv;
+    Conn    *c;
+    uint32_t id;
+    uint32_t elem;
+    double   t0;
+} Pending;
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// ------------------ SEGNALI ----------------------
+
+static volatile sig_atomic_t g_stop = 0, g_reload = 0;
+static int g_wake[2] = { -1, -1 };    // self-pipe: sveglia poll()
+
+static void on_signal(int sig)
+{
+    int saved = errno;
+    if (sig == SIGHUP) g_reload = 1;
+    else               g_stop = 1;
+    if (g_wake[1] >= 0 && write(g_wake[1], "x", 1) < 0) { /* pipe piena: poll già sveglio */ }
+    errno = saved;
+}
+
+static void wake_io(void)
+{
+    if (write(g_wake[1], "x", 1) < 0) { /* come sopra */ }
+}
+
+// ------------------ CONNESSIONI ----------------------
+
+static Conn *conn_new(int fd, size_t out_max)
+{
+    Conn *c = calloc(1, sizeof(Conn));
+    if (!c) return NULL;
+    c->fd      = fd;
+    c->refs    = 1;
+    c->out_max = out_max;
+    pthread_mutex_init(&c->wlock, NULL);
+    return c;
+}
+
+static void conn_unref(Conn *c)
+{
+    int left = __atomic_sub_fetch(&c->refs, 1, __ATOMIC_ACQ_REL);
+    // Ultima richiesta in volo: l'I/O può chiudere una connessione a fine flusso
+    if (left == 1) wake_io();
+    if (left == 0) {
+        close(c->fd);
+        pthread_mutex_destroy(&c->wlock);
+        while (c->out_head) {
+            OutMsg *m = c->out_head;
+            c->out_head = m->next;
+            free(m);
+        }
+        free(c->buf);
+        free(c);
+    }
+}
+
+// Scrive quanto il socket accetta senza bloccare (wlock preso)
+static void conn_flush_locked(Conn *c)
+{
+    while (c->out_head && !c->dead) {
+        struct iovec iov[SEND_IOV];
+        int cnt = 0;
+        for (OutMsg *m = c->out_head; m && cnt < SEND_IOV; m = m->next, cnt++) {
+            size_t skip = cnt == 0 ? c->out_off : 0;
+            iov[cnt].iov_base = m->data + skip;
+            iov[cnt].iov_len  = m->len - skip;
+        }
+
+        struct msghdr mh;
+        memset(&mh, 0, sizeof(mh));
+        mh.msg_iov    = iov;
+        mh.msg_iovlen = cnt;
+        ssize_t w = sendmsg(c->fd, &mh, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) c->dead = 1;
+            return;
+        }
+
+        // Libera i messaggi inviati per intero
+        c->out_bytes -= (size_t)w;
+        c->out_since  = now_s();
+        size_t left = (size_t)w;
+        while (c->out_head && left >= c->out_head->len - c->out_off) {
+            OutMsg *m = c->out_head;
+            left -= m->len - c->out_off;
+            c->out_head = m->next;
+            c->out_off  = 0;
+            free(m);
+        }
+        if (!c->out_head) c->out_tail = NULL;
+        else              c->out_off += left;
+    }
+}
+
+// Accoda header + payload (copiati: il chiamante può riusarli subito) e
+// prova a inviarli; quello che resta parte dal thread di I/O. Non blocca mai.
+static void conn_send(Conn *c, const ServerResponse *r, const struct iovec *payload, int parts)
+{
+    size_t len = sizeof(*r);
+    for (int i = 0; i < parts; i++) len += payload[i].iov_len;
+    OutMsg *m = malloc(sizeof(OutMsg) + len);
+
+    pthread_mutex_lock(&c->wlock);
+    if (c->dead) {
+        pthread_mutex_unlock(&c->wlock);
+        free(m);
+        return;
+    }
+    if (!m || c->out_bytes + len > c->out_max) {
+        // Memoria esaurita o client che non legge: la connessione si chiude
+        c->dead = 1;
+        pthread_mutex_unlock(&c->wlock);
+        free(m);
+        wake_io();
+        return;
+    }
+
+    m->next = NULL;
+    m->len  = len;
+    memcpy(m->data, r, sizeof(*r));
+    size_t off = sizeof(*r);
+    for (int i = 0; i < parts; i++) {
+        memcpy(m->data + off, payload[i].iov_base, payload[i].iov_len);
+        off += payload[i].iov_len;
+    }
+
+    if (c->out_tail) c->out_tail->next = m;
+    else {
+        c->out_head  = m;
+        c->out_since = now_s();
+    }
+    c->out_tail   = m;
+    c->out_bytes += len;
+    conn_flush_locked(c);
+    int pending = c->out_head != NULL || c->dead;
+    pthread_mutex_unlock(&c->wlock);
+
+    // Il thread di I/O deve aggiungere POLLOUT (o chiudere la connessione)
+    if (pending) wake_io();
+}
+
+// Dal thread di I/O: 1 se la connessione ha risposte in attesa
+static int conn_pending(Conn *c)
+{
+    pthread_mutex_lock(&c->wlock);
+    int p = c->out_head != NULL;
+    pthread_mutex_unlock(&c->wlock);
+    return p;
+}
+
+// Dal thread di I/O: 1 se la connessione va chiusa (errore, client fermo,
+// oppure fine flusso senza più nulla da inviare né richieste in volo)
+static int conn_finished(Conn *c, double now)
+{
+    pthread_mutex_lock(&c->wlock);
+    if (c->out_head && now - c->out_since > SEND_TIMEOUT_S) c->dead = 1;
+    int done = c->dead || (c->rd_closed && !c->out_head &&
+                           __atomic_load_n(&c->refs, __ATOMIC_ACQUIRE) == 1);
+    pthread_mutex_unlock(&c->wlock);
+    return done;
+}
+
+static void send_status(Server *s, Conn *c, const ServerRequest *rq, uint16_t status)
+{
+    ServerResponse r = { SERVER_MAGIC, rq->op, status, rq->id, 0, 0, 0 };
+    if (status != SERVER_OK) {
+        pthread_mutex_lock(&s->lock);
+        s->errors++;
+        if (status == SERVER_EBUSY) s->rejected++;
+        pthread_mutex_unlock(&s->lock);
+    }
+    conn_send(c, &r, NULL, 0);
+}
+
+// ------------------ STATISTICHE ----------------------
+
+static int lat_bucket(double us)
+{
+    int b = 0;
+    while (us >= 2.0 && b < SERVER_LAT_BUCKETS - 1) { us *= 0.5; b++; }
+    return b;
+}
+
+// Percentile dall'istogramma: limite superiore del bucket che lo contiene
+static double lat_percentile(const uint64_t *hist, uint64_t total, double p)
+{
+    if (total == 0) return 0.0;
+    uint64_t want = (uint64_t)(p * (double)total + 0.5), acc = 0;
+    if (want < 1) want = 1;
+    for (int b = 0; b < SERVER_LAT_BUCKETS; b++) {
+        acc += hist[b];
+        if (acc >= want) return (double)(2ULL << b);
+    }
+    return (double)(2ULL << (SERVER_LAT_BUCKETS - 1));
+}
+
+// Registra una richiesta completata (lock preso)
+static void stats_done(Server *s, double t0, size_t nq)
+{
+    double t = now_s();
+    s->requests++;
+    s->queries += nq;
+    s->lat_hist[lat_bucket((t - t0) * 1e6)]++;
+
+    uint64_t sec = (uint64_t)(t - s->t_start);
+    int slot = (int)(sec % (SERVER_QPS_WINDOW + 1));
+    if (s->qps_sec[slot] != sec) {
+        s->qps_sec[slot] = sec;
+        s->qps_cnt[slot] = 0;
+    }
+    s->qps_cnt[slot] += nq;
+}
+
+static void stats_fill(Server *s, ServerStats *st)
+{
+    memset(st, 0, sizeof(*st));
+
+    AsyncStats as = { 0 };
+    if (s->cur.stats) s->cur.stats(s->cur.ctx, &as);
+    perf_scan_read(&st->scanned, &st->pruned);
+
+    pthread_mutex_lock(&s->lock);
+    double up = now_s() - s->t_start;
+    uint64_t sec = (uint64_t)up;
+
+    st->elem_size   = s->cur.elem_size;
+    st->d           = s->cur.d;
+    st->n           = s->cur.n;
+    st->generation  = s->generation;
+    st->uptime_s    = up;
+    st->qps         = up > 0 ? (double)s->queries / up : 0.0;
+    st->connections = s->connections;
+    st->requests    = s->requests;
+    st->queries     = s->queries;
+    st->errors      = s->errors;
+    st->tiles       = s->tiles_closed + as.tiles;
+    st->rejected    = s->rejected;
+    st->cache_hits   = as.cache_hits;
+    st->cache_misses = as.cache_misses;
+    memcpy(st->lat_hist, s->lat_hist, sizeof(st->lat_hist));
+
+    // Secondi interi conclusi nella finestra (il secondo corrente è parziale)
+    uint64_t recent = 0, span = sec < SERVER_QPS_WINDOW ? sec : SERVER_QPS_WINDOW;
+    for (int i = 0; i <= SERVER_QPS_WINDOW; i++)
+        if (s->qps_sec[i] < sec && s->qps_sec[i] + span >= sec) recent += s->qps_cnt[i];
+    st->qps_recent = span > 0 ? (double)recent / (double)span : st->qps;
+    pthread_mutex_unlock(&s->lock);
+
+    st->prune_rate = st->scanned ? (double)st->pruned / (double)st->scanned : 0.0;
+    st->lat_p50_us = lat_percentile(st->lat_hist, st->requests, 0.50);
+    st->lat_p95_us = lat_percentile(st->lat_hist, st->requests, 0.95);
+    st->lat_p99_us = lat_percentile(st->lat_hist, st->requests, 0.99);
+}
+
+// ------------------ QUERY ----------------------
+
+// Dal thread del motore: risposta al client e latenza
+static void query_done(void *tag, const int32_t *ids, const void *dist, size_t nq, int k)
+{
+    Pending *p = (Pending *)tag;
+    Server *s = p->srv;
+
+    ServerResponse r = { SERVER_MAGIC, SERVER_OP_QUERY, SERVER_OK, p->id, (uint32_t)nq, (uint32_t)k, 0 };
+
+    pthread_mutex_lock(&s->lock);
+    if (ids && dist) stats_done(s, p->t0, nq);
+    else             s->errors++;
+    pthread_mutex_unlock(&s->lock);
+
+    if (ids && dist) {
+        struct iovec iov[2];
+        iov[0].iov_base = (void *)ids;
+        iov[0].iov_len  = nq * (size_t)k * sizeof(int32_t);
+        iov[1].iov_base = (void *)dist;
+        iov[1].iov_len  = nq * (size_t)k * p->elem;
+        r.len = (uint32_t)(iov[0].iov_len + iov[1].iov_len);
+        conn_send(p->c, &r, iov, 2);
+    } else {
+        r.status = SERVER_ENOMEM;
+        r.nq = r.k = 0;
+        conn_send(p->c, &r, NULL, 0);
+    }
+
+    conn_unref(p->c);
+    free(p);
+}
+
+static void handle_query(Server *s, Conn *c, const ServerRequest *rq, const void *payload)
+{
+    if (rq->nq == 0 || rq->k == 0 || rq->d != s->cur.d || rq->k > s->cur.n) {
+        send_status(s, c, rq, SERVER_EINVAL);
+        return;
+    }
+
+    // La risposta (nq x k id e distanze) deve stare nel campo len a 32 bit e
+    // nella coda in uscita della connessione
+    uint64_t cells = (uint64_t)rq->nq * rq->k;
+    uint64_t per   = sizeof(int32_t) + s->cur.elem_size;
+    if (cells > UINT32_MAX / per || cells * per > c->out_max) {
+        send_status(s, c, rq, SERVER_EINVAL);
+        return;
+    }
+
+    Pending *p = malloc(sizeof(Pending));
+    if (!p) {
+        send_status(s, c, rq, SERVER_ENOMEM);
+        return;
+    }
+    p->srv  = s;
+    p->c    = c;
+    p->id   = rq->id;
+    p->elem = s->cur.elem_size;
+    p->t0   = now_s();
+
+    __atomic_add_fetch(&c->refs, 1, __ATOMIC_RELAXED);
+    int ret = s->cur.submit(s->cur.ctx, payload, rq->nq, (int)rq->k, query_done, p);
+    if (ret != 0) {
+        conn_unref(c);
+        free(p);
+        send_status(s, c, rq, ret == ASYNC_FULL ? SERVER_EBUSY : SERVER_ENOMEM);
+    }
+}
+
+// ------------------ RICARICA ----------------------
+
+static void *reload_main(void *arg)
+{
+    Server *s = (Server *)arg;
+    ServerBackend nb;
+    memset(&nb, 0, sizeof(nb));
+
+    int ok = s->load(s->user, &nb) == 0;
+
+    pthread_mutex_lock(&s->lock);
+    if (ok && !s->stopping) {
+        s->next     = nb;
+        s->has_next = 1;
+        wake_io();
+        while (!s->swapped && !s->stopping)
+            pthread_cond_wait(&s->cond, &s->lock);
+    }
+    int swapped = s->swapped;
+    ServerBackend old = s->old;
+    s->has_next = 0;
+    s->swapped  = 0;
+    pthread_mutex_unlock(&s->lock);
+
+    if (swapped) {
+        // Il vecchio motore completa la coda; i suoi tile restano nel totale
+        AsyncStats as = { 0 };
+        old.stats(old.ctx, &as);
+        old.close(old.ctx);
+
+        pthread_mutex_lock(&s->lock);
+        s->tiles_closed += as.tiles;
+        s->generation++;
+        pthread_mutex_unlock(&s->lock);
+    } else if (ok)
+        nb.close(nb.ctx);            // arresto durante la ricarica
+
+    if (s->opt.verbose) {
+        printf("[SERVER] ricarica %s\n", swapped ? "completata" : "fallita");
+        fflush(stdout);
+    }
+
+    pthread_mutex_lock(&s->lock);
+    s->reloading = 0;
+    pthread_mutex_unlock(&s->lock);
+    return NULL;
+}
+
+// 0 se avviata, -1 se già in corso o impossibile
+static int start_reload(Server *s)
+{
+    pthread_mutex_lock(&s->lock);
+    if (s->reloading || s->stopping) {
+        pthread_mutex_unlock(&s->lock);
+        return -1;
+    }
+    // Il thread precedente è terminato: va raccolto prima di riusarne l'handle
+    if (s->reload_join) pthread_join(s->reload_th, NULL);
+    s->reloading   = 1;
+    s->reload_join = pthread_create(&s->reload_th, NULL, reload_main, s) == 0;
+    int ok = s->reload_join;
+    if (!ok) s->reloading = 0;
+    pthread_mutex_unlock(&s->lock);
+
+    if (ok && s->opt.verbose) {
+        printf("[SERVER] ricarica avviata\n");
+        fflush(stdout);
+    }
+    return ok ? 0 : -1;
+}
+
+// Dal thread di I/O: installa il motore caricato
+static void swap_backend(Server *s)
+{
+    pthread_mutex_lock(&s->lock);
+    if (s->has_next && !s->swapped) {
+        s->old      = s->cur;
+        s->cur      = s->next;
+        s->has_next = 0;
+        s->swapped  = 1;
+        pthread_cond_broadcast(&s->cond);
+    }
+    pthread_mutex_unlock(&s->lock);
+}
+
+// ------------------ PROTOCOLLO ----------------------
+
+// Elabora i messaggi completi nel buffer; -1 se la connessione va chiusa
+static int process_buffer(Server *s, Conn *c)
+{
+    size_t off = 0;
+    size_t max_payload = (size_t)s->opt.max_query_mb << 20;
+
+    while (c->len - off >= sizeof(ServerRequest)) {
+        ServerRequest rq;
+        memcpy(&rq, c->buf + off, sizeof(rq));
+
+        // Header illeggibile: impossibile ritrovare l'inizio del messaggio successivo
+        if (rq.magic != SERVER_MAGIC) {
+            send_status(s, c, &rq, SERVER_EINVAL);
+            return -1;
+        }
+
+        size_t payload = 0;
+        if (rq.op == SERVER_OP_QUERY) {
+            payload = (size_t)rq.nq * rq.d * s->cur.elem_size;
+            if (payload > max_payload) {
+                send_status(s, c, &rq, SERVER_EINVAL);
+                return -1;
+            }
+        }
+
+        size_t need = sizeof(ServerRequest) + payload;
+        if (c->len - off < need) {
+            // Messaggio incompleto: spazio per riceverlo tutto
+            if (c->cap < need) {
+                unsigned char *nb = malloc(need);
+                if (!nb) return -1;
+                memcpy(nb, c->buf + off, c->len - off);
+                free(c->buf);
+                c->buf = nb;
+                c->cap = need;
+                c->len -= off;
+                off = 0;
+            }
+            break;
+        }
+
+        const void *data = c->buf + off + sizeof(ServerRequest);
+        if (rq.flags != 0) {
+            // Bit riservati: un client più recente chiede qualcosa che qui manca
+            send_status(s, c, &rq, SERVER_EINVAL);
+            off += need;
+            continue;
+        }
+        switch (rq.op) {
+        case SERVER_OP_QUERY:
+            handle_query(s, c, &rq, data);
+            break;
+        case SERVER_OP_STATS: {
+            ServerStats st;
+            stats_fill(s, &st);
+            ServerResponse r = { SERVER_MAGIC, rq.op, SERVER_OK, rq.id, 0, 0, sizeof(st) };
+            struct iovec iov = { &st, sizeof(st) };
+            conn_send(c, &r, &iov, 1);
+            break;
+        }
+        case SERVER_OP_RELOAD:
+            send_status(s, c, &rq, start_reload(s) == 0 ? SERVER_OK : SERVER_ERELOAD);
+            break;
+        default:
+            send_status(s, c, &rq, SERVER_EINVAL);
+            break;
+        }
+        off += need;
+    }
+
+    if (off > 0) {
+        memmove(c->buf, c->buf + off, c->len - off);
+        c->len -= off;
+    }
+    return 0;
+}
+
+// Legge quanto disponibile; -1 a fine flusso o errore
+static int conn_read(Server *s, Conn *c)
+{
+    if (c->cap - c->len < 4096) {
+        size_t cap = c->cap ? c->cap * 2 : 65536;
+        unsigned char *nb = realloc(c->buf, cap);
+        if (!nb) return -1;
+        c->buf = nb;
+        c->cap = cap;
+    }
+
+    ssize_t r = recv(c->fd, c->buf + c->len, c->cap - c->len, MSG_DONTWAIT);
+    if (r == 0) return -1;
+    if (r < 0) return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+
+    c->len += (size_t)r;
+    return process_buffer(s, c);
+}
+
+// ------------------ SOCKET ----------------------
+
+static int open_listener(const char *path)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        printf("ERRORE: percorso del socket troppo lungo: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    // Un socket rimasto da un'esecuzione precedente si rimuove solo se
+    // nessun server vi risponde
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+        printf("ERRORE: un server è già attivo su %s\n", path);
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    unlink(path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 64) != 0) {
+        printf("ERRORE: impossibile aprire il socket %s (%s)\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+int server_run(const char *path, ServerLoader load, void *user, const ServerOptions *opt)
+{
+    if (!path || !load) return -1;
+
+    Server *s = calloc(1, sizeof(Server));
+    if (!s) return -1;
+    s->path = path;
+    s->load = load;
+    s->user = user;
+    if (opt) s->opt = *opt;
+    else     server_default_options(&s->opt);
+    if (s->opt.max_conn < 1) s->opt.max_conn = 1;
+    if (s->opt.max_query_mb < 1) s->opt.max_query_mb = 1;
+    if (s->opt.max_out_mb < 1) s->opt.max_out_mb = 1;
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->cond, NULL);
+
+    Conn **conns = calloc((size_t)s->opt.max_conn, sizeof(Conn *));
+    struct pollfd *pfd = calloc((size_t)s->opt.max_conn + 2, sizeof(struct pollfd));
+    int lfd = -1, ret = -1;
+
+    if (!conns || !pfd || pipe(g_wake) != 0) goto out;
+    fcntl(g_wake[0], F_SETFL, O_NONBLOCK);
+    fcntl(g_wake[1], F_SETFL, O_NONBLOCK);
+
+    if (load(user, &s->cur) != 0) {
+        printf("ERRORE: caricamento del motore fallito.\n");
+        goto out;
+    }
+
+    lfd = open_listener(path);
+    if (lfd < 0) {
+        s->cur.close(s->cur.ctx);
+        goto out;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGHUP, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    s->t_start = now_s();
+    if (s->opt.verbose) {
+        printf("[SERVER] in ascolto su %s (n=%llu, d=%u, %s)\n", path,
+               (unsigned long long)s->cur.n, s->cur.d, s->cur.elem_size == 8 ? "double" : "float");
+        fflush(stdout);
+    }
+
+    size_t out_max = (size_t)s->opt.max_out_mb << 20;
+    int nconn = 0;
+    while (!g_stop) {
+        pfd[0].fd = g_wake[0];
+        pfd[0].events = POLLIN;
+        pfd[1].fd = lfd;
+        pfd[1].events = POLLIN;
+        int writing = 0;
+        for (int i = 0; i < nconn; i++) {
+            int out = conn_pending(conns[i]);
+            short ev = (short)((conns[i]->rd_closed ? 0 : POLLIN) | (out ? POLLOUT : 0));
+            writing |= out;
+            // Senza eventi richiesti (fine flusso, nulla da inviare) il socket
+            // si esclude: POLLHUP sveglierebbe poll() di continuo
+            pfd[2 + i].fd = ev ? conns[i]->fd : -1;
+            pfd[2 + i].events = ev;
+            pfd[2 + i].revents = 0;
+        }
+
+        // Con risposte in attesa poll() si sveglia ogni secondo per SEND_TIMEOUT_S
+        if (poll(pfd, (nfds_t)(2 + nconn), writing ? 1000 : -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        if (pfd[0].revents & POLLIN) {
+            char tmp[64];
+            while (read(g_wake[0], tmp, sizeof(tmp)) > 0) { }
+        }
+        if (g_reload) {
+            g_reload = 0;
+            start_reload(s);
+        }
+        swap_backend(s);
+
+        // Connessioni esistenti: le chiuse sono compattate in fondo al ciclo
+        double now = now_s();
+        int alive = 0;
+        for (int i = 0; i < nconn; i++) {
+            Conn *c = conns[i];
+            short ev = pfd[2 + i].revents;
+            if (ev & (POLLOUT | POLLERR)) {
+                pthread_mutex_lock(&c->wlock);
+                conn_flush_locked(c);
+                pthread_mutex_unlock(&c->wlock);
+            }
+            if (!c->rd_closed && (ev & (POLLIN | POLLHUP | POLLERR)) && conn_read(s, c) != 0) {
+                shutdown(c->fd, SHUT_RD);
+                c->rd_closed = 1;
+            }
+            if (conn_finished(c, now)) {
+                // Le risposte ancora in arrivo dal motore vengono scartate
+                pthread_mutex_lock(&c->wlock);
+                c->dead = 1;
+                pthread_mutex_unlock(&c->wlock);
+                shutdown(c->fd, SHUT_RDWR);
+                conn_unref(c);
+                pthread_mutex_lock(&s->lock);
+                s->connections--;
+                pthread_mutex_unlock(&s->lock);
+                continue;
+            }
+            conns[alive++] = c;
+        }
+        nconn = alive;
+
+        if (pfd[1].revents & POLLIN) {
+            for (;;) {
+                int fd = accept(lfd, NULL, NULL);
+                if (fd < 0) break;
+                fcntl(fd, F_SETFD, FD_CLOEXEC);
+                Conn *c = nconn < s->opt.max_conn ? conn_new(fd, out_max) : NULL;
+                if (!c) {
+                    close(fd);
+                    continue;
+                }
+                conns[nconn++] = c;
+                pthread_mutex_lock(&s->lock);
+                s->connections++;
+                pthread_mutex_unlock(&s->lock);
+            }
+        }
+    }
+
+    if (s->opt.verbose) {
+        printf("[SERVER] arresto: completamento delle richieste in corso\n");
+        fflush(stdout);
+    }
+
+    // Arresto: niente nuove connessioni, ricarica interrotta, coda completata
+    close(lfd);
+    unlink(path);
+
+    pthread_mutex_lock(&s->lock);
+    s->stopping = 1;
+    pthread_cond_broadcast(&s->cond);
+    int joinable = s->reload_join;
+    pthread_mutex_unlock(&s->lock);
+    if (joinable) pthread_join(s->reload_th, NULL);
+
+    s->cur.close(s->cur.ctx);
+
+    // Ultime risposte: al più SEND_TIMEOUT_S secondi per consegnarle
+    double t_end = now_s() + SEND_TIMEOUT_S;
+    for (;;) {
+        int waiting = 0;
+        for (int i = 0; i < nconn; i++) {
+            int out = conn_pending(conns[i]) && !conn_finished(conns[i], now_s());
+            pfd[i].fd      = out ? conns[i]->fd : -1;
+            pfd[i].events  = POLLOUT;
+            pfd[i].revents = 0;
+            waiting |= out;
+        }
+        double left = t_end - now_s();
+        if (!waiting || left <= 0 || poll(pfd, (nfds_t)nconn, (int)(left * 1000) + 1) < 0) break;
+        for (int i = 0; i < nconn; i++)
+            if (pfd[i].revents) {
+                pthread_mutex_lock(&conns[i]->wlock);
+                conn_flush_locked(conns[i]);
+                pthread_mutex_unlock(&conns[i]->wlock);
+            }
+    }
+    for (int i = 0; i < nconn; i++) conn_unref(conns[i]);
+    ret = 0;
+
+out:
+    if (g_wake[0] >= 0) { close(g_wake[0]); close(g_wake[1]); }
+    g_wake[0] = g_wake[1] = -1;
+    g_stop = g_reload = 0;
+    pthread_mutex_destroy(&s->lock);
+    pthread_cond_destroy(&s->cond);
+    free(pfd);
+    free(conns);
+    free(s);
+    return ret;
+}
+
+#else   // ---- Windows: nessun socket Unix ----
+
+int server_run(const char *path, ServerLoader load, void *user, const ServerOptions *opt)
+{
+    (void)path; (void)load; (void)user; (void)opt;
+    printf("ERRORE: la modalità server richiede Linux o macOS.\n");
+    return -1;
+}
+
+#endif
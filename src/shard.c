@@ -0,0 +1,201 @@
+#include "shard.h"
+#include "pool.h"
+
+#include <stdlib.h>
+
+// ------------------ PARTIZIONAMENTO ----------------------
+//
+// Le righe sono divise in S blocchi contigui di dimensione quasi uguale
+// (i primi n % S shard hanno una riga in più). Ogni shard sceglie i propri
+// pivot sulle sue righe, quindi i pivot sono "locali" alla partizione.
+//
+// ---------------------------------------------------------
+
+static ShardedIndex *alloc_sharded(size_t n, size_t D, int S, int h, int x)
+{
+    if (S <= 0 || h <= 0 || x <= 0 || n == 0) return NULL;
+
+    // Ogni shard deve avere almeno h righe
+    if ((size_t)S * (size_t)h > n) S = (int)(n / (size_t)h);
+    if (S < 1) S = 1;
+
+    ShardedIndex *sx = calloc(1, sizeof(ShardedIndex));
+    if (!sx) return NULL;
+
+    sx->S = (size_t)S;
+    sx->n = n;
+    sx->D = D;
+    sx->h = h;
+    sx->x = x;
+    sx->offset = malloc(((size_t)S + 1) * sizeof(size_t));
+    sx->shards = calloc((size_t)S, sizeof(Index *));
+    if (!sx->offset || !sx->shards) {
+        free(sx->offset);
+        free(sx->shards);
+        free(sx);
+        return NULL;
+    }
+
+    size_t base = n / (size_t)S, extra = n % (size_t)S;
+    sx->offset[0] = 0;
+    for (size_t s = 0; s < (size_t)S; s++)
+        sx->offset[s + 1] = sx->offset[s] + base + (s < extra ? 1 : 0);
+
+    return sx;
+}
+
+MatrixF32 shard_view(const MatrixF32 *ds, const ShardedIndex *sx, size_t s)
+{
+    MatrixF32 v;
+    v.n    = (uint32_t)(sx->offset[s + 1] - sx->offset[s]);
+    v.d    = ds->d;
+    v.data = ds->data + sx->offset[s] * ds->d;
+    return v;
+}
+
+MatrixF64 shard_view_f64(const MatrixF64 *ds, const ShardedIndex *sx, size_t s)
+{
+    MatrixF64 v;
+    v.n    = (uint32_t)(sx->offset[s + 1] - sx->offset[s]);
+    v.d    = ds->d;
+    v.data = ds->data + sx->offset[s] * ds->d;
+    return v;
+}
+
+// Shard indipendenti: uno per task sul pool condiviso, così la build è
+// parallela anche nei moduli compilati senza OpenMP. build_index non usa il
+// pool, quindi nessun dispatch annidato.
+typedef struct {
+    const MatrixF32 *ds;
+    const MatrixF64 *ds64;
+    ShardedIndex    *sx;
+} ShardBuild;
+
+static void shard_build_task(void *ctx, size_t begin, size_t end, int tid)
+{
+    ShardBuild *b = (ShardBuild *)ctx;
+    (void)tid;
+    for (size_t s = begin; s < end; s++) {
+        if (b->ds) {
+            MatrixF32 view = shard_view(b->ds, b->sx, s);
+            b->sx->shards[s] = build_index(&view, b->sx->h, b->sx->x);
+        } else {
+            MatrixF64 view = shard_view_f64(b->ds64, b->sx, s);
+            b->sx->shards[s] = build_index_f64(&view, b->sx->h, b->sx->x);
+        }
+    }
+}
+
+static ShardedIndex *build_shards(ShardedIndex *sx, const MatrixF32 *ds, const MatrixF64 *ds64)
+{
+    ShardBuild b = { .ds = ds, .ds64 = ds64, .sx = sx };
+    pool_parallel_for(pool_default(), 0, sx->S, 1, shard_build_task, &b);
+
+    for (size_t s = 0; s < sx->S; s++) {
+        if (!sx->shards[s]) {
+            free_sharded_index(sx);
+            return NULL;
+        }
+    }
+    return sx;
+}
+
+ShardedIndex *build_sharded_index(const MatrixF32 *ds, int S, int h, int x)
+{
+    if (!ds) return NULL;
+
+    ShardedIndex *sx = alloc_sharded(ds->n, ds->d, S, h, x);
+    if (!sx) return NULL;
+
+    return build_shards(sx, ds, NULL);
+}
+
+ShardedIndex *build_sharded_index_f64(const MatrixF64 *ds, int S, int h, int x)
+{
+    if (!ds) return NULL;
+
+    ShardedIndex *sx = alloc_sharded(ds->n, ds->d, S, h, x);
+    if (!sx) return NULL;
+
+    return build_shards(sx, NULL, ds);
+}
+
+// --------------------------------------------------------------
+// RICOSTRUZIONE DI UNO SHARD
+// --------------------------------------------------------------
+int rebuild_shard(ShardedIndex *sx, const MatrixF32 *ds, size_t s)
+{
+    if (!sx || !ds || s >= sx->S || ds->n != sx->n || ds->d != sx->D) return -1;
+
+    MatrixF32 view = shard_view(ds, sx, s);
+    Index *idx = build_index(&view, sx->h, sx->x);
+    if (!idx) return -1;
+
+    // Lo shard nuovo conserva le colonne ordinate e la cascata del precedente
+    if (index_sort_pivots(idx, sx->shards[s]->n_sorted) != 0 ||
+        index_build_cascade(idx, sx->shards[s]->n_hot) != 0) {
+        free_index(idx);
+        return -1;
+    }
+
+    free_index(sx->shards[s]);
+    sx->shards[s] = idx;
+    return 0;
+}
+
+int rebuild_shard_f64(ShardedIndex *sx, const MatrixF64 *ds, size_t s)
+{
+    if (!sx || !ds || s >= sx->S || ds->n != sx->n || ds->d != sx->D) return -1;
+
+    MatrixF64 view = shard_view_f64(ds, sx, s);
+    Index *idx = build_index_f64(&view, sx->h, sx->x);
+    if (!idx) return -1;
+
+    // Lo shard nuovo conserva le colonne ordinate e la cascata del precedente
+    if (index_sort_pivots(idx, sx->shards[s]->n_sorted) != 0 ||
+        index_build_cascade(idx, sx->shards[s]->n_hot) != 0) {
+        free_index(idx);
+        return -1;
+    }
+
+    free_index(sx->shards[s]);
+    sx->shards[s] = idx;
+    return 0;
+}
+
+int sharded_sort_pivots(ShardedIndex *sx, int m)
+{
+    if (!sx) return -1;
+    for (size_t s = 0; s < sx->S; s++)
+        if (index_sort_pivots(sx->shards[s], m) != 0) return -1;
+    return 0;
+}
+
+int sharded_build_cascade(ShardedIndex *sx, int m)
+{
+    if (!sx) return -1;
+    for (size_t s = 0; s < sx->S; s++)
+        if (index_build_cascade(sx->shards[s], m) != 0) return -1;
+    return 0;
+}
+
+// --------------------------------------------------------------
+// PULIZIA MEMORIA
+// --------------------------------------------------------------
+void free_sharded_index(ShardedIndex *sx)
+{
+    if (!sx) return;
+    if (sx->shards)
+        for (size_t s = 0; s < sx->S; s++) free_index(sx->shards[s]);
+    free(sx->shards);
+    free(sx->offset);
+    free(sx);
+}
+
+size_t sharded_memory_bytes(const ShardedIndex *sx)
+{
+    if (!sx) return 0;
+    size_t bytes = sizeof(ShardedIndex) + (sx->S + 1) * sizeof(size_t) + sx->S * sizeof(Index *);
+    for (size_t s = 0; s < sx->S; s++) bytes += index_memory_bytes(sx->shards[s]);
+    return bytes;
+}